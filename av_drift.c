@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gstreamer-1.0/gst/gst.h>
+
+#include "av_drift.h"
+
+#define AV_DRIFT_MAX_CHANNELS 8
+
+// How far ahead of the clock a stream reaches the muxer is the largest lead over this long, so a
+// frame that took the encoder longer than usual does not count as drift
+#define AV_DRIFT_WINDOW (GST_SECOND)
+
+// One sink pad of the muxer
+typedef struct {
+    GstPad *pad;
+    gulong probe;
+    GstSegment segment;
+
+    // Running time the buffers reach minus the running time of the clock when they arrive
+    gint64 lead;
+    bool has_lead;
+    gint64 window_lead;
+    GstClockTime window_start;
+} MuxInput;
+
+struct AvDrift {
+    GstElement *pipeline;
+    // Src pad of `audiocaps`, where the samples are resampled
+    GstPad *pad;
+    gulong probe;
+    GstClockTime threshold;
+
+    GMutex lock;
+
+    MuxInput video;
+    MuxInput audio;
+    // Lead of the audio over the video when the measurement started, the encoders and queues
+    // delay them by different but fixed amounts
+    gint64 baseline;
+    bool has_baseline;
+    gint64 drift_ns;
+
+    // From the caps, only F32LE interleaved comes through `audiocaps`
+    int rate;
+    int channels;
+
+    // Input frames per output frame, and where the next output frame is read from relative to
+    // the start of the next buffer. -1 is the last frame of the previous buffer.
+    double step;
+    double position;
+    float last[AV_DRIFT_MAX_CHANNELS];
+    // Drift integrated over time in s², the part of the correction that cancels a steady skew
+    double integral;
+    // Once a correction started every buffer goes through the resampler, so there is no jump
+    // when it ends
+    bool is_resampling;
+
+    AvDriftStats stats;
+};
+
+static void reset_input(MuxInput *input)
+{
+    gst_segment_init(&input->segment, GST_FORMAT_TIME);
+    input->has_lead = false;
+    input->window_start = GST_CLOCK_TIME_NONE;
+}
+
+static void reset_locked(AvDrift *drift)
+{
+    reset_input(&drift->video);
+    reset_input(&drift->audio);
+    drift->has_baseline = false;
+    drift->drift_ns = 0;
+    drift->step = 1.0;
+    drift->position = 0.0;
+    drift->integral = 0.0;
+    drift->is_resampling = false;
+    memset(drift->last, 0, sizeof(drift->last));
+}
+
+static void read_caps(AvDrift *drift, GstCaps *caps)
+{
+    const GstStructure *s = gst_caps_get_structure(caps, 0);
+    int rate = 0;
+    int channels = 0;
+
+    gst_structure_get_int(s, "rate", &rate);
+    gst_structure_get_int(s, "channels", &channels);
+
+    g_mutex_lock(&drift->lock);
+
+    drift->rate = rate;
+    drift->channels = channels > 0 && channels <= AV_DRIFT_MAX_CHANNELS ? channels : 0;
+    reset_locked(drift);
+
+    g_mutex_unlock(&drift->lock);
+
+    if (channels > AV_DRIFT_MAX_CHANNELS) {
+        fprintf(stderr, "ERROR: A/V drift is only corrected up to %d channels, not %d\n", AV_DRIFT_MAX_CHANNELS, channels);
+    }
+}
+
+// Linear interpolation, plenty for changes of a fraction of a percent
+static size_t resample(AvDrift *drift, const float *in, const size_t n_in, float *out)
+{
+    const int channels = drift->channels;
+    double position = drift->position;
+    size_t n_out = 0;
+
+    while (position < (double)n_in - 1.0) {
+        const long i0 = (long)floor(position);
+        const float frac = (float)(position - (double)i0);
+        const float *a = i0 < 0 ? drift->last : in + i0 * channels;
+        const float *b = in + (i0 + 1) * channels;
+
+        for (int c = 0; c < channels; c++) {
+            out[n_out * channels + c] = a[c] + (b[c] - a[c]) * frac;
+        }
+
+        n_out++;
+        position += drift->step;
+    }
+
+    drift->position = position - (double)n_in;
+    memcpy(drift->last, in + (n_in - 1) * channels, (size_t)channels * sizeof(float));
+
+    return n_out;
+}
+
+// Sets how fast the audio catches up with the video. A clock that runs off keeps doing so, so
+// once the threshold is crossed the correction stays on: the proportional part takes the drift
+// out over AV_DRIFT_CORRECTION_TIME and the integral part learns the rate of the clock.
+static void update_step(AvDrift *drift, const gint64 drift_ns, const double seconds)
+{
+    const gint64 magnitude = drift_ns < 0 ? -drift_ns : drift_ns;
+
+    if (!drift->is_resampling && magnitude <= (gint64)drift->threshold) return;
+
+    // Audio ahead of the video has too many samples for its time
+    const double error = -(double)drift_ns / 1e9;
+    const double time = (double)AV_DRIFT_CORRECTION_TIME / 1e9;
+    double correction = error / time + drift->integral / (time * time);
+
+    // No integrating while the correction is at its limit, or it overshoots once it is not
+    if (correction > AV_DRIFT_MAX_CORRECTION) {
+        correction = AV_DRIFT_MAX_CORRECTION;
+    } else if (correction < -AV_DRIFT_MAX_CORRECTION) {
+        correction = -AV_DRIFT_MAX_CORRECTION;
+    } else {
+        drift->integral += error * seconds;
+    }
+
+    // More output frames than input frames when the samples are behind
+    drift->step = 1.0 / (1.0 + correction);
+    drift->is_resampling = true;
+    drift->stats.correction_ppm = correction * 1e6;
+}
+
+// The encoder timestamps the audio by the samples it got since the start, the video keeps the
+// capture times, so the two timelines reaching the muxer drift apart when the audio clock does
+static void measure_buffer(AvDrift *drift, MuxInput *input, GstBuffer *buffer)
+{
+    const GstClockTime pts = GST_BUFFER_PTS(buffer);
+    if (!GST_CLOCK_TIME_IS_VALID(pts)) return;
+
+    GstClock *clock = gst_element_get_clock(drift->pipeline);
+    if (clock == NULL) return;
+
+    const GstClockTime now = gst_clock_get_time(clock) - gst_element_get_base_time(drift->pipeline);
+    gst_object_unref(clock);
+
+    GstClockTime end = gst_segment_to_running_time(&input->segment, GST_FORMAT_TIME, pts);
+    if (!GST_CLOCK_TIME_IS_VALID(end)) return;
+    if (GST_BUFFER_DURATION_IS_VALID(buffer)) end += GST_BUFFER_DURATION(buffer);
+
+    const gint64 lead = (gint64)end - (gint64)now;
+
+    if (!GST_CLOCK_TIME_IS_VALID(input->window_start) || lead > input->window_lead) {
+        input->window_lead = lead;
+    }
+    if (!GST_CLOCK_TIME_IS_VALID(input->window_start)) input->window_start = now;
+
+    // The first window counts right away, a stream that stopped keeps its last lead
+    if (!input->has_lead || now - input->window_start >= AV_DRIFT_WINDOW) {
+        input->lead = input->window_lead;
+        input->has_lead = true;
+        input->window_start = GST_CLOCK_TIME_NONE;
+    }
+
+    if (!drift->video.has_lead || !drift->audio.has_lead) return;
+
+    const gint64 difference = drift->audio.lead - drift->video.lead;
+
+    if (!drift->has_baseline) {
+        drift->baseline = difference;
+        drift->has_baseline = true;
+    }
+
+    drift->drift_ns = difference - drift->baseline;
+
+    if (drift->drift_ns > (gint64)AV_DRIFT_RESYNC || drift->drift_ns < -(gint64)AV_DRIFT_RESYNC) {
+        drift->stats.resyncs++;
+        drift->baseline = difference;
+        drift->drift_ns = 0;
+    }
+
+    const gint64 magnitude = drift->drift_ns < 0 ? -drift->drift_ns : drift->drift_ns;
+
+    drift->stats.drift_us = drift->drift_ns / 1000;
+    if (magnitude / 1000 > drift->stats.max_drift_us) drift->stats.max_drift_us = magnitude / 1000;
+}
+
+static GstBuffer *process_buffer(AvDrift *drift, GstBuffer *buffer)
+{
+    const size_t frame_size = (size_t)drift->channels * sizeof(float);
+
+    if (drift->rate <= 0 || drift->channels == 0) return buffer;
+
+    const size_t n_in = gst_buffer_get_size(buffer) / frame_size;
+    if (n_in == 0) return buffer;
+
+    drift->stats.buffers++;
+
+    update_step(drift, drift->drift_ns, (double)n_in / drift->rate);
+
+    if (!drift->is_resampling) return buffer;
+
+    // Room for the frames the largest correction can add, and the one held back
+    const size_t max_out = (size_t)((double)n_in / drift->step) + 2;
+    GstBuffer *corrected = gst_buffer_new_allocate(nullptr, max_out * frame_size, nullptr);
+    GstMapInfo in;
+    GstMapInfo out;
+
+    if (corrected == NULL) return buffer;
+
+    if (!gst_buffer_map(buffer, &in, GST_MAP_READ)) {
+        gst_buffer_unref(corrected);
+        return buffer;
+    }
+
+    gst_buffer_map(corrected, &out, GST_MAP_WRITE);
+    const size_t n_out = resample(drift, (const float *)in.data, n_in, (float *)out.data);
+    gst_buffer_unmap(corrected, &out);
+    gst_buffer_unmap(buffer, &in);
+
+    gst_buffer_set_size(corrected, (gssize)(n_out * frame_size));
+    gst_buffer_copy_into(corrected, buffer, GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS | GST_BUFFER_COPY_META, 0, -1);
+    GST_BUFFER_DURATION(corrected) = gst_util_uint64_scale(n_out, GST_SECOND, (guint64)drift->rate);
+    GST_BUFFER_OFFSET(corrected) = GST_BUFFER_OFFSET_NONE;
+    GST_BUFFER_OFFSET_END(corrected) = GST_BUFFER_OFFSET_NONE;
+
+    drift->stats.corrected_buffers++;
+
+    gst_buffer_unref(buffer);
+
+    return corrected;
+}
+
+static GstPadProbeReturn cb_audio(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    AvDrift *drift = user_data;
+
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+
+        if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS) {
+            GstCaps *caps;
+            gst_event_parse_caps(event, &caps);
+            read_caps(drift, caps);
+        }
+
+        return GST_PAD_PROBE_OK;
+    }
+
+    g_mutex_lock(&drift->lock);
+    GST_PAD_PROBE_INFO_DATA(info) = process_buffer(drift, GST_PAD_PROBE_INFO_BUFFER(info));
+    g_mutex_unlock(&drift->lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn cb_mux_input(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    AvDrift *drift = user_data;
+    MuxInput *input = pad == drift->video.pad ? &drift->video : &drift->audio;
+
+    g_mutex_lock(&drift->lock);
+
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+
+        if (GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT) {
+            gst_event_copy_segment(event, &input->segment);
+        } else if (GST_EVENT_TYPE(event) == GST_EVENT_FLUSH_STOP) {
+            reset_input(input);
+            drift->has_baseline = false;
+        }
+    } else {
+        measure_buffer(drift, input, GST_PAD_PROBE_INFO_BUFFER(info));
+    }
+
+    g_mutex_unlock(&drift->lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+// Request pads of the muxer, or of splitmuxsink for segments
+static GstPad *get_mux_pad(GstElement *mux, const char * const *names)
+{
+    for (; *names; names++) {
+        GstPad *pad = gst_element_get_static_pad(mux, *names);
+        if (pad) return pad;
+    }
+
+    return nullptr;
+}
+
+static void add_mux_probe(AvDrift *drift, MuxInput *input)
+{
+    input->probe = gst_pad_add_probe(input->pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, cb_mux_input, drift, nullptr);
+}
+
+AvDrift *av_drift_attach(GstElement *pipeline, const GstClockTime threshold)
+{
+    static const char * const video_names[] = { "video_0", "video", nullptr };
+    static const char * const audio_names[] = { "audio_0", nullptr };
+
+    GstElement *caps = gst_bin_get_by_name(GST_BIN(pipeline), "audiocaps");
+    GstElement *mux = gst_bin_get_by_name(GST_BIN(pipeline), "mux");
+    GstPad *video = mux ? get_mux_pad(mux, video_names) : nullptr;
+    GstPad *audio = mux ? get_mux_pad(mux, audio_names) : nullptr;
+    AvDrift *drift = caps && video && audio ? calloc(1, sizeof(AvDrift)) : nullptr;
+
+    if (mux) gst_object_unref(mux);
+
+    if (drift == NULL) {
+        if (caps) gst_object_unref(caps);
+        if (video) gst_object_unref(video);
+        if (audio) gst_object_unref(audio);
+        return nullptr;
+    }
+
+    g_mutex_init(&drift->lock);
+    drift->pipeline = pipeline;
+    drift->threshold = GST_CLOCK_TIME_IS_VALID(threshold) && threshold > 0 ? threshold : AV_DRIFT_DEFAULT_THRESHOLD;
+    drift->video.pad = video;
+    drift->audio.pad = audio;
+    reset_locked(drift);
+
+    drift->pad = gst_element_get_static_pad(caps, "src");
+    drift->probe = gst_pad_add_probe(drift->pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, cb_audio, drift, nullptr);
+    add_mux_probe(drift, &drift->video);
+    add_mux_probe(drift, &drift->audio);
+    gst_object_unref(caps);
+
+    return drift;
+}
+
+void av_drift_get(AvDrift *drift, AvDriftStats *stats)
+{
+    g_mutex_lock(&drift->lock);
+    *stats = drift->stats;
+    g_mutex_unlock(&drift->lock);
+}
+
+void av_drift_describe(AvDrift *drift, char *line, const size_t size)
+{
+    AvDriftStats stats;
+    av_drift_get(drift, &stats);
+
+    snprintf(line, size, "A/V drift %+.1f ms (max %.1f ms), correction %+.0f ppm, %" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT " buffers resampled, %" G_GUINT64_FORMAT " resyncs",
+        (double)stats.drift_us / 1000.0, (double)stats.max_drift_us / 1000.0, stats.correction_ppm,
+        stats.corrected_buffers, stats.buffers, stats.resyncs);
+}
+
+void av_drift_reset(AvDrift *drift)
+{
+    g_mutex_lock(&drift->lock);
+
+    reset_locked(drift);
+    memset(&drift->stats, 0, sizeof(drift->stats));
+
+    g_mutex_unlock(&drift->lock);
+}
+
+void av_drift_free(AvDrift *drift)
+{
+    if (drift == NULL) return;
+
+    gst_pad_remove_probe(drift->pad, drift->probe);
+    gst_pad_remove_probe(drift->video.pad, drift->video.probe);
+    gst_pad_remove_probe(drift->audio.pad, drift->audio.probe);
+    gst_object_unref(drift->pad);
+    gst_object_unref(drift->video.pad);
+    gst_object_unref(drift->audio.pad);
+    g_mutex_clear(&drift->lock);
+    free(drift);
+}
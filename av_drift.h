@@ -0,0 +1,49 @@
+#ifndef AV_DRIFT_H
+#define AV_DRIFT_H
+
+#include <stdio.h>
+#include <gstreamer-1.0/gst/gst.h>
+
+// Drift past which the audio starts being resampled by default
+#define AV_DRIFT_DEFAULT_THRESHOLD (20 * GST_MSECOND)
+// Largest change of the sample rate a correction makes, 0.5% is not audible in speech
+#define AV_DRIFT_MAX_CORRECTION 0.005
+// A correction aims to remove the drift over this long
+#define AV_DRIFT_CORRECTION_TIME (10 * GST_SECOND)
+// A jump this large is a gap in the capture, it is taken as the new start instead of corrected
+#define AV_DRIFT_RESYNC (GST_SECOND)
+
+typedef struct AvDrift AvDrift;
+
+typedef struct {
+    guint64 buffers;
+    // Audio running time minus video running time at the muxer, both against the clock and
+    // relative to where they started, positive when the audio plays ahead of the video
+    gint64 drift_us;
+    gint64 max_drift_us;
+    // Current change of the sample rate, in parts per million
+    double correction_ppm;
+    guint64 corrected_buffers;
+    guint64 resyncs;
+} AvDriftStats;
+
+// Measures A/V drift where it ends up in the file, on the `video_0` (or `video` for splitmuxsink)
+// and `audio_0` sink pads of the element called `mux`: how far ahead of the clock the running
+// time of each stream arrives, the audio timed by its samples by the encoder and the video by its
+// capture times. Once the two drift apart by more than `threshold` the raw audio is resampled by
+// up to AV_DRIFT_MAX_CORRECTION on the src pad of `audiocaps`, which has to fix F32LE, and stays
+// corrected to the rate of its clock from then on. Returns nullptr when either is missing.
+AvDrift *av_drift_attach(GstElement *pipeline, GstClockTime threshold);
+
+void av_drift_get(AvDrift *drift, AvDriftStats *stats);
+
+// One line summary for the debug overlay and the statistics file
+void av_drift_describe(AvDrift *drift, char *line, size_t size);
+
+// Starts over with the next buffer, for a pipeline that is reused
+void av_drift_reset(AvDrift *drift);
+
+// Removes the probe, call it once no more buffers are flowing
+void av_drift_free(AvDrift *drift);
+
+#endif
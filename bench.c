@@ -0,0 +1,1451 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <gstreamer-1.0/gst/gst.h>
+#include <gstreamer-1.0/gst/video/video.h>
+#include <gstreamer-1.0/gst/app/gstappsrc.h>
+#include <gstreamer-1.0/gst/app/gstappsink.h>
+
+#include "bench.h"
+#include "pipeline.h"
+#include "damage_convert.h"
+#include "rgb_convert.h"
+#include "av_drift.h"
+#include "corpus.h"
+#include "quality.h"
+#include "gif_decoder.h"
+
+#define BENCH_MAX_ITEMS 16
+
+// Changes against the baseline that --compare reports as regressions. Encode speed is noisy
+// from run to run, size and quality are not.
+#define COMPARE_MAX_FPS_DROP 0.10
+#define COMPARE_MAX_SIZE_GROWTH 0.05
+#define COMPARE_MAX_SSIM_DROP 0.005
+
+typedef struct {
+    bool encodings[OUTPUT_ENCODING_COUNT];
+    int sizes[BENCH_MAX_ITEMS][2];
+    int n_sizes;
+    int framerates[BENCH_MAX_ITEMS];
+    int n_framerates;
+    int frames;
+    bool thread_modes[THREAD_MODE_COUNT];
+    // Share of each frame reported as damaged, -1 to run without damageconvert
+    int damage_percent;
+    // Size of a pointer moving over the frames as cursor metadata, 0 for none
+    int cursor_size;
+    // Passed to parse_output_scale()
+    const char *scale;
+    // Converter micro-benchmark instead of the encoders: videoconvert or rgbconvert[:KERNEL]
+    char *converters[BENCH_MAX_ITEMS];
+    int n_converters;
+    int convert_threads;
+    // Fails a run whose RSS grows by more than this after the first tenth of its frames, 0 to not check
+    long max_rss_growth_kb;
+    // Audio of WEBM_WITH_AUDIO, with its timestamps stretched by this many parts per million to
+    // stand in for an audio clock that runs off the system clock
+    enum AudioCodec audio_codec;
+    int audio_skew_ppm;
+    // Screen content clips run through every encoding and scored against their source
+    bool clips[CORPUS_CLIP_COUNT];
+    bool use_corpus;
+    // Baseline and current corpus results to diff instead of running anything
+    char *compare[2];
+
+    const char *source_file;
+    const char *pattern;
+    const char *output;
+    const char *output_dir;
+} BenchOptions;
+
+typedef struct {
+    enum OutputEncoding encoding;
+    enum ThreadMode thread_mode;
+    int width;
+    int height;
+    int framerate;
+
+    bool ok;
+    guint64 frames;
+    double seconds;
+    double cpu_seconds;
+    long peak_rss_kb;
+    long long bytes;
+
+    // RSS once a tenth of the frames went through and at EOS, memory that keeps growing shows up here
+    guint64 rss_sample_frame;
+    long rss_early_kb;
+    long rss_end_kb;
+
+    // The synthetic damage region, moved a bit every frame
+    int damage_percent;
+    guint64 damage_frame;
+
+    // The synthetic pointer, its sprite only comes with the first frame
+    int cursor_size;
+    guint64 cursor_frame;
+
+    // From the source running out, which is where a stop would be, to the file being complete.
+    // The source is not live, so this drains full queues, the worst case of a stop.
+    gint64 source_end;
+    double stop_to_ready_seconds;
+
+    // WEBM_WITH_AUDIO only
+    AvDriftStats drift;
+} BenchResult;
+
+typedef struct {
+    enum CorpusClip clip;
+    enum OutputEncoding encoding;
+    int width;
+    int height;
+    int framerate;
+
+    bool ok;
+    guint64 frames;
+    double seconds;
+    double cpu_seconds;
+    long long bytes;
+
+    // Luma of every source frame against the decoded frame shown at its time
+    QualityScore score;
+} CorpusResult;
+
+typedef struct {
+    const char *converter;
+    int width;
+    int height;
+
+    bool ok;
+    guint64 frames;
+    double seconds;
+    double cpu_seconds;
+
+    // Time buffers spend inside the converter, the source is not part of it
+    gint64 entered;
+    gint64 convert_us;
+} ConvertResult;
+
+static void print_usage(void)
+{
+    fprintf(stderr,
+        "Usage: record_area bench [options]\n"
+        "  --encodings=LIST    comma separated OutputEncoding names (default: all)\n"
+        "  --sizes=LIST        comma separated WIDTHxHEIGHT (default: 1920x1080,3840x2160)\n"
+        "  --framerates=LIST   comma separated frame rates (default: 30,60)\n"
+        "  --frames=N          frames per run (default: 300)\n"
+        "  --threads=LIST      comma separated fixed, auto or pinned (default: auto)\n"
+        "  --damage=PERCENT    attach damage covering PERCENT of each frame and convert only that\n"
+        "  --cursor=SIZE       attach a SIZE pixel pointer moving over the frames as cursor metadata\n"
+        "  --scale=NAME        native, logical, half or fit:WIDTH before conversion (default: native)\n"
+        "  --converters=LIST   time only the RGB to I420 conversion with videoconvert or rgbconvert[:KERNEL]\n"
+        "  --convert-threads=N threads of each converter (default: 1)\n"
+        "  --source=FILE       decode FILE instead of using videotestsrc\n"
+        "  --pattern=NAME      videotestsrc pattern (default: ball)\n"
+        "  --output=FILE       JSON results, - for stdout (default: bench.json)\n"
+        "  --output-dir=DIR    where encoded files go (default: /tmp)\n"
+        "  --max-rss-growth=KB fail runs whose RSS grows by more than KB after the first tenth of the frames\n"
+        "  --audio=NAME        audio codec of WEBM_WITH_AUDIO, vorbis or opus (default: vorbis)\n"
+        "  --audio-skew=PPM    run the audio timestamps PPM parts per million fast to exercise the drift correction\n"
+        "  --corpus=LIST       encode the comma separated screen content clips, terminal, ide, video, desktop or all,\n"
+        "                      and score the output with SSIM and PSNR against the source\n"
+        "  --compare=BASE,CUR  diff two --corpus result files, exits with 1 on any regression\n");
+}
+
+static bool parse_options(const int argc, char *argv[], BenchOptions *options)
+{
+    for (int i = 0; i < argc; i++) {
+        char *arg = argv[i];
+        char *value = strchr(arg, '=');
+
+        if (value == NULL) {
+            fprintf(stderr, "ERROR: Unknown benchmark argument: %s\n", arg);
+            return false;
+        }
+
+        *value++ = '\0';
+
+        if (strcmp(arg, "--encodings") == 0) {
+            memset(options->encodings, 0, sizeof(options->encodings));
+
+            for (char *name = strtok(value, ","); name; name = strtok(nullptr, ",")) {
+                enum OutputEncoding encoding;
+                if (!parse_output_encoding(name, &encoding)) {
+                    fprintf(stderr, "ERROR: Unknown encoding: %s\n", name);
+                    return false;
+                }
+
+                options->encodings[encoding] = true;
+            }
+        } else if (strcmp(arg, "--sizes") == 0) {
+            options->n_sizes = 0;
+
+            for (char *size = strtok(value, ","); size && options->n_sizes < BENCH_MAX_ITEMS; size = strtok(nullptr, ",")) {
+                int *dimensions = options->sizes[options->n_sizes];
+                if (sscanf(size, "%dx%d", &dimensions[0], &dimensions[1]) != 2 || dimensions[0] <= 0 || dimensions[1] <= 0) {
+                    fprintf(stderr, "ERROR: Invalid size: %s\n", size);
+                    return false;
+                }
+
+                options->n_sizes++;
+            }
+        } else if (strcmp(arg, "--framerates") == 0) {
+            options->n_framerates = 0;
+
+            for (char *rate = strtok(value, ","); rate && options->n_framerates < BENCH_MAX_ITEMS; rate = strtok(nullptr, ",")) {
+                const int framerate = atoi(rate);
+                if (framerate <= 0) {
+                    fprintf(stderr, "ERROR: Invalid frame rate: %s\n", rate);
+                    return false;
+                }
+
+                options->framerates[options->n_framerates++] = framerate;
+            }
+        } else if (strcmp(arg, "--scale") == 0) {
+            Recording recording = { 0 };
+            if (!parse_output_scale(value, &recording)) {
+                fprintf(stderr, "ERROR: Unknown scale: %s\n", value);
+                return false;
+            }
+
+            options->scale = value;
+        } else if (strcmp(arg, "--threads") == 0) {
+            memset(options->thread_modes, 0, sizeof(options->thread_modes));
+
+            for (char *name = strtok(value, ","); name; name = strtok(nullptr, ",")) {
+                enum ThreadMode mode;
+                if (!parse_thread_mode(name, &mode)) {
+                    fprintf(stderr, "ERROR: Unknown thread mode: %s\n", name);
+                    return false;
+                }
+
+                options->thread_modes[mode] = true;
+            }
+        } else if (strcmp(arg, "--damage") == 0) {
+            options->damage_percent = atoi(value);
+
+            if (options->damage_percent < 0 || options->damage_percent > 100) {
+                fprintf(stderr, "ERROR: --damage must be between 0 and 100\n");
+                return false;
+            }
+        } else if (strcmp(arg, "--cursor") == 0) {
+            options->cursor_size = atoi(value);
+
+            if (options->cursor_size < 0 || options->cursor_size > 256) {
+                fprintf(stderr, "ERROR: --cursor must be between 0 and 256\n");
+                return false;
+            }
+        } else if (strcmp(arg, "--converters") == 0) {
+            options->n_converters = 0;
+
+            for (char *name = strtok(value, ","); name && options->n_converters < BENCH_MAX_ITEMS; name = strtok(nullptr, ",")) {
+                if (strcmp(name, "videoconvert") != 0 && strncmp(name, "rgbconvert", strlen("rgbconvert")) != 0) {
+                    fprintf(stderr, "ERROR: Unknown converter: %s\n", name);
+                    return false;
+                }
+
+                options->converters[options->n_converters++] = name;
+            }
+        } else if (strcmp(arg, "--convert-threads") == 0) {
+            options->convert_threads = atoi(value);
+
+            if (options->convert_threads <= 0) {
+                fprintf(stderr, "ERROR: --convert-threads must be positive\n");
+                return false;
+            }
+        } else if (strcmp(arg, "--audio") == 0) {
+            if (!parse_audio_codec(value, &options->audio_codec)) {
+                fprintf(stderr, "ERROR: Unknown audio codec: %s\n", value);
+                return false;
+            }
+        } else if (strcmp(arg, "--audio-skew") == 0) {
+            options->audio_skew_ppm = atoi(value);
+        } else if (strcmp(arg, "--corpus") == 0) {
+            memset(options->clips, 0, sizeof(options->clips));
+            options->use_corpus = true;
+
+            for (char *name = strtok(value, ","); name; name = strtok(nullptr, ",")) {
+                enum CorpusClip clip;
+
+                if (strcmp(name, "all") == 0) {
+                    for (int c = 0; c < CORPUS_CLIP_COUNT; c++) options->clips[c] = true;
+                } else if (parse_corpus_clip(name, &clip)) {
+                    options->clips[clip] = true;
+                } else {
+                    fprintf(stderr, "ERROR: Unknown corpus clip: %s\n", name);
+                    return false;
+                }
+            }
+        } else if (strcmp(arg, "--compare") == 0) {
+            char *current = strchr(value, ',');
+
+            if (current == NULL) {
+                fprintf(stderr, "ERROR: --compare needs BASELINE,CURRENT\n");
+                return false;
+            }
+
+            *current++ = '\0';
+            options->compare[0] = value;
+            options->compare[1] = current;
+        } else if (strcmp(arg, "--max-rss-growth") == 0) {
+            options->max_rss_growth_kb = atol(value);
+        } else if (strcmp(arg, "--frames") == 0) {
+            options->frames = atoi(value);
+        } else if (strcmp(arg, "--source") == 0) {
+            options->source_file = value;
+        } else if (strcmp(arg, "--pattern") == 0) {
+            options->pattern = value;
+        } else if (strcmp(arg, "--output") == 0) {
+            options->output = value;
+        } else if (strcmp(arg, "--output-dir") == 0) {
+            options->output_dir = value;
+        } else {
+            fprintf(stderr, "ERROR: Unknown benchmark argument: %s\n", arg);
+            return false;
+        }
+    }
+
+    if (options->frames <= 0) {
+        fprintf(stderr, "ERROR: --frames must be positive\n");
+        return false;
+    }
+
+    return true;
+}
+
+static double monotonic_seconds(void)
+{
+    return (double)g_get_monotonic_time() / 1e6;
+}
+
+static double cpu_seconds(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec / 1e6
+         + (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec / 1e6;
+}
+
+// Peak RSS is tracked per process, so it is reset before every run (Linux 4.0+)
+static void reset_peak_rss(void)
+{
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+
+    if (f != NULL) {
+        fputs("5", f);
+        fclose(f);
+    }
+}
+
+// `field` of /proc/self/status in kB, VmHWM for the peak RSS and VmRSS for the current one
+static long read_status_kb(const char *field)
+{
+    FILE *f = fopen("/proc/self/status", "r");
+    char line[256];
+    long value = -1;
+
+    if (f == NULL) return -1;
+
+    while (fgets(line, sizeof(line), f)) {
+        const size_t length = strlen(field);
+
+        if (strncmp(line, field, length) == 0 && line[length] == ':' && sscanf(line + length + 1, "%ld kB", &value) == 1) break;
+    }
+
+    fclose(f);
+
+    return value;
+}
+
+// Waits for the end of the stream or an error, whichever comes first, up to `timeout`
+static bool wait_for_eos(GstElement *pipeline, const GstClockTime timeout)
+{
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GstMessage *msg = gst_bus_timed_pop_filtered(bus, timeout, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    const bool ok = msg != NULL && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+
+    if (msg == NULL) {
+        fprintf(stderr, "ERROR: The pipeline did not finish in time\n");
+    } else if (!ok) {
+        GError *err;
+        char *debug;
+
+        gst_message_parse_error(msg, &err, &debug);
+        fprintf(stderr, "ERROR: %s\n", err->message);
+        g_error_free(err);
+        g_free(debug);
+    }
+
+    if (msg) gst_message_unref(msg);
+    gst_object_unref(bus);
+
+    return ok;
+}
+
+static GstPadProbeReturn cb_count_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    BenchResult *result = user_data;
+
+    if (++result->frames == result->rss_sample_frame) {
+        result->rss_early_kb = read_status_kb("VmRSS");
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn cb_source_end(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    BenchResult *result = user_data;
+
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_EOS) {
+        result->source_end = g_get_monotonic_time();
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn cb_skew_audio(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    const BenchOptions *options = user_data;
+    GstBuffer *buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+
+    if (GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer))) {
+        GST_BUFFER_PTS(buffer) += (GstClockTime)((double)GST_BUFFER_PTS(buffer) * options->audio_skew_ppm / 1e6);
+    }
+
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+
+    return GST_PAD_PROBE_OK;
+}
+
+// Stands in for the SPA_META_VideoDamage Mutter attaches, 0% marks every frame as unchanged
+static GstPadProbeReturn cb_add_damage(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    BenchResult *result = user_data;
+    GstBuffer *buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+
+    const double scale = sqrt(result->damage_percent / 100.0);
+    const int width = (int)(result->width * scale);
+    const int height = (int)(result->height * scale);
+    const int step = (int)(result->damage_frame++ * 16);
+
+    const int x = result->width > width ? step % (result->width - width + 1) : 0;
+    const int y = result->height > height ? step % (result->height - height + 1) : 0;
+
+    gst_buffer_add_video_region_of_interest_meta(buffer, DAMAGE_META_TYPE, (guint)x, (guint)y, (guint)width, (guint)height);
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+
+    return GST_PAD_PROBE_OK;
+}
+
+// Stands in for the SPA_META_Cursor Mutter attaches with cursor-mode 2: an arrow going around the
+// frame, with its bitmap on the first frame only
+static GstPadProbeReturn cb_add_cursor(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    BenchResult *result = user_data;
+    GstBuffer *buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+    const int size = result->cursor_size;
+    const double t = (double)result->cursor_frame;
+
+    const CursorSprite sprite = {
+        .x = (int)(result->width * (0.5 + 0.45 * sin(t * 0.05))),
+        .y = (int)(result->height * (0.5 + 0.45 * sin(t * 0.07))),
+        .width = size,
+        .height = size,
+        .bitmap = result->cursor_frame == 0 ? gst_buffer_new_allocate(nullptr, (gsize)size * (gsize)size * 4, nullptr) : nullptr,
+    };
+
+    if (sprite.bitmap) {
+        GstMapInfo map;
+        gst_buffer_map(sprite.bitmap, &map, GST_MAP_WRITE);
+
+        // White inside a black outline, see-through right of the diagonal
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                uint8_t *p = map.data + ((size_t)y * (size_t)size + (size_t)x) * 4;
+                const uint8_t shade = x == 0 || x == y || y == size - 1 ? 0 : 255;
+
+                p[0] = shade;
+                p[1] = shade;
+                p[2] = shade;
+                p[3] = x <= y ? 255 : 0;
+            }
+        }
+
+        gst_buffer_unmap(sprite.bitmap, &map);
+        cursor_meta_add(buffer, &sprite, result->width, result->height);
+        gst_buffer_unref(sprite.bitmap);
+    } else {
+        // Position only, the way the metadata comes while the sprite stays the same
+        const int x0 = sprite.x > 0 ? sprite.x : 0;
+        const int y0 = sprite.y > 0 ? sprite.y : 0;
+        const int x1 = sprite.x + size < result->width ? sprite.x + size : result->width;
+        const int y1 = sprite.y + size < result->height ? sprite.y + size : result->height;
+        GstVideoRegionOfInterestMeta *meta = gst_buffer_add_video_region_of_interest_meta(buffer, CURSOR_META_TYPE,
+            (guint)x0, (guint)y0, (guint)(x1 > x0 ? x1 - x0 : 0), (guint)(y1 > y0 ? y1 - y0 : 0));
+
+        gst_video_region_of_interest_meta_add_param(meta, gst_structure_new("cursor", "x", G_TYPE_INT, sprite.x, "y", G_TYPE_INT, sprite.y, nullptr));
+    }
+
+    result->cursor_frame++;
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void get_audio_source(const BenchOptions *options, const int framerate, char *audio_source, const size_t audio_size)
+{
+    // Enough 1024 sample buffers at 44.1kHz to cover the video
+    const long audio_buffers = (long)options->frames * 44100 / ((long)framerate * 1024) + 1;
+    snprintf(audio_source, audio_size, "audiotestsrc name=audiosrc num-buffers=%ld ! audio/x-raw,rate=44100", audio_buffers);
+}
+
+static void get_sources(const BenchOptions *options, const int width, const int height, const int framerate, char *video_source, const size_t video_size, char *audio_source, const size_t audio_size)
+{
+    if (options->source_file) {
+        snprintf(video_source, video_size,
+            "filesrc location=\"%s\" ! decodebin ! videoconvert ! videoscale ! videorate ! "
+            "capsfilter name=benchsource caps=video/x-raw,format=BGRx,width=%d,height=%d,framerate=%d/1",
+            options->source_file, width, height, framerate);
+    } else {
+        snprintf(video_source, video_size,
+            "videotestsrc num-buffers=%d pattern=%s ! "
+            "capsfilter name=benchsource caps=video/x-raw,format=BGRx,width=%d,height=%d,framerate=%d/1",
+            options->frames, options->pattern, width, height, framerate);
+    }
+
+    get_audio_source(options, framerate, audio_source, audio_size);
+}
+
+static bool run_one(const BenchOptions *options, BenchResult *result)
+{
+    char video_source[1024];
+    char audio_source[256];
+    Recording recording = { .output_encoding = result->encoding, .use_damage = result->damage_percent >= 0, .audio_codec = options->audio_codec };
+
+    parse_output_scale(options->scale, &recording);
+    get_sources(options, result->width, result->height, result->framerate, video_source, sizeof(video_source), audio_source, sizeof(audio_source));
+
+    snprintf(recording.location, sizeof(recording.location), "%s/bench_%s_%dx%d_%d_%s%s",
+        options->output_dir, OUTPUT_ENCODING_NAMES[result->encoding],
+        result->width, result->height, result->framerate, THREAD_MODE_NAMES[result->thread_mode],
+        OUTPUT_ENCODING_EXTENSIONS[result->encoding]);
+    snprintf(recording.stats_location, sizeof(recording.stats_location), "%s.stats.txt", recording.location);
+
+    if (!create_pipeline(&recording, video_source, audio_source)) {
+        return false;
+    }
+
+    configure_threads(&recording, result->thread_mode, result->width, result->height);
+
+    GstElement *source = gst_bin_get_by_name(GST_BIN(recording.pipeline), "benchsource");
+    if (source) {
+        GstPad *pad = gst_element_get_static_pad(source, "src");
+        result->rss_sample_frame = options->frames >= 10 ? (guint64)options->frames / 10 : 1;
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, cb_count_frame, result, nullptr);
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, cb_source_end, result, nullptr);
+
+        // The cursor overlay reads the metadata on the src pad, so it goes on in front of that
+        GstPad *sink_pad = gst_element_get_static_pad(source, "sink");
+
+        if (recording.use_damage) {
+            gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, cb_add_damage, result, nullptr);
+        }
+
+        if (result->cursor_size > 0) {
+            gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, cb_add_cursor, result, nullptr);
+        }
+        gst_object_unref(sink_pad);
+        gst_object_unref(pad);
+        gst_object_unref(source);
+    }
+
+    GstElement *audio = gst_bin_get_by_name(GST_BIN(recording.pipeline), "audiosrc");
+    if (audio && options->audio_skew_ppm != 0) {
+        GstPad *pad = gst_element_get_static_pad(audio, "src");
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, cb_skew_audio, (gpointer)options, nullptr);
+        gst_object_unref(pad);
+    }
+    if (audio) gst_object_unref(audio);
+
+    reset_peak_rss();
+    const double start_cpu = cpu_seconds();
+    const double start = monotonic_seconds();
+
+    if (gst_element_set_state(recording.pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        fprintf(stderr, "ERROR: Unable to set the benchmark pipeline to the playing state.\n");
+        destroy_pipeline(&recording);
+        return false;
+    }
+
+    result->ok = wait_for_eos(recording.pipeline, GST_CLOCK_TIME_NONE);
+
+    result->rss_end_kb = read_status_kb("VmRSS");
+
+    if (recording.drift) {
+        av_drift_get(recording.drift, &result->drift);
+    }
+
+    // The file is only complete once the sinks are closed, so that is part of the run
+    if (!destroy_pipeline(&recording)) result->ok = false;
+
+    if (result->source_end > 0) {
+        result->stop_to_ready_seconds = (double)(g_get_monotonic_time() - result->source_end) / 1e6;
+    }
+
+    result->seconds = monotonic_seconds() - start;
+    result->cpu_seconds = cpu_seconds() - start_cpu;
+    result->peak_rss_kb = read_status_kb("VmHWM");
+
+    const long rss_growth_kb = result->rss_early_kb >= 0 ? result->rss_end_kb - result->rss_early_kb : 0;
+
+    if (options->max_rss_growth_kb > 0 && rss_growth_kb > options->max_rss_growth_kb) {
+        fprintf(stderr, "ERROR: RSS grew by %ld kB from frame %" G_GUINT64_FORMAT " to the end, more than the %ld kB allowed\n",
+            rss_growth_kb, result->rss_sample_frame, options->max_rss_growth_kb);
+        result->ok = false;
+    }
+
+    struct stat st;
+    result->bytes = stat(recording.location, &st) == 0 ? (long long)st.st_size : -1;
+
+    return result->ok;
+}
+
+static void write_results(FILE *f, const BenchOptions *options, const BenchResult *results, const int n_results)
+{
+    fprintf(f, "{\n  \"cpu_count\": %ld,\n  \"scale\": \"%s\",\n  \"results\": [", sysconf(_SC_NPROCESSORS_ONLN), options->scale);
+
+    for (int i = 0; i < n_results; i++) {
+        const BenchResult *r = &results[i];
+        const double fps = r->seconds > 0 ? (double)r->frames / r->seconds : 0;
+        const double bytes_per_frame = r->frames > 0 && r->bytes >= 0 ? (double)r->bytes / (double)r->frames : 0;
+
+        fprintf(f,
+            "%s\n    {\"encoding\": \"%s\", \"threads\": \"%s\", \"damage_percent\": %d, \"cursor_size\": %d, \"width\": %d, \"height\": %d, \"framerate\": %d, \"ok\": %s, "
+            "\"frames\": %" G_GUINT64_FORMAT ", \"seconds\": %.4f, \"fps\": %.2f, \"cpu_seconds\": %.4f, "
+            "\"peak_rss_kb\": %ld, \"rss_growth_kb\": %ld, \"bytes\": %lld, \"bytes_per_frame\": %.1f, \"stop_to_ready_seconds\": %.4f, "
+            "\"audio\": \"%s\", \"max_drift_ms\": %.2f, \"final_drift_ms\": %.2f, \"drift_corrected_buffers\": %" G_GUINT64_FORMAT "}",
+            i == 0 ? "" : ",",
+            OUTPUT_ENCODING_NAMES[r->encoding], THREAD_MODE_NAMES[r->thread_mode], r->damage_percent, r->cursor_size, r->width, r->height, r->framerate, r->ok ? "true" : "false",
+            r->frames, r->seconds, fps, r->cpu_seconds,
+            r->peak_rss_kb, r->rss_early_kb >= 0 ? r->rss_end_kb - r->rss_early_kb : 0, r->bytes, bytes_per_frame, r->stop_to_ready_seconds,
+            r->encoding == WEBM_WITH_AUDIO ? AUDIO_CODEC_NAMES[options->audio_codec] : "none",
+            (double)r->drift.max_drift_us / 1000.0, (double)r->drift.drift_us / 1000.0, r->drift.corrected_buffers);
+    }
+
+    fprintf(f, "\n  ]\n}\n");
+}
+
+static GstPadProbeReturn cb_convert_enter(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    ConvertResult *result = user_data;
+    result->entered = g_get_monotonic_time();
+
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn cb_convert_leave(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    ConvertResult *result = user_data;
+    result->convert_us += g_get_monotonic_time() - result->entered;
+    result->frames++;
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void add_convert_probe(GstElement *convert, const char *pad_name, GstPadProbeCallback callback, ConvertResult *result)
+{
+    GstPad *pad = gst_element_get_static_pad(convert, pad_name);
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, callback, result, nullptr);
+    gst_object_unref(pad);
+}
+
+// Converts the source to I420 into a fakesink; the frames are passed on in the streaming thread,
+// so the time between the two pads of the converter is the conversion alone
+static bool run_convert_one(const BenchOptions *options, ConvertResult *result)
+{
+    char video_source[1024];
+    char audio_source[256];
+    char converter[256];
+    char description[2048];
+    const char *kernel = strchr(result->converter, ':');
+
+    get_sources(options, result->width, result->height, options->framerates[0], video_source, sizeof(video_source), audio_source, sizeof(audio_source));
+
+    if (kernel) {
+        snprintf(converter, sizeof(converter), "rgbconvert kernel=%s", kernel + 1);
+    } else if (strcmp(result->converter, "videoconvert") == 0) {
+        snprintf(converter, sizeof(converter), "videoconvert chroma-mode=none dither=none matrix-mode=output-only");
+    } else {
+        snprintf(converter, sizeof(converter), "%s", result->converter);
+    }
+
+    snprintf(description, sizeof(description), "%s ! %s name=convert n-threads=%d ! video/x-raw,format=I420 ! fakesink sync=false",
+        video_source, converter, options->convert_threads);
+
+    GError *error = nullptr;
+    GstElement *pipeline = gst_parse_launch(description, &error);
+
+    if (pipeline == NULL) {
+        fprintf(stderr, "ERROR: Failed to create the conversion pipeline\n");
+        return false;
+    }
+
+    if (error) {
+        fprintf(stderr, "ERROR: %s\n", error->message);
+        g_error_free(error);
+        gst_object_unref(pipeline);
+        return false;
+    }
+
+    GstElement *convert = gst_bin_get_by_name(GST_BIN(pipeline), "convert");
+    add_convert_probe(convert, "sink", cb_convert_enter, result);
+    add_convert_probe(convert, "src", cb_convert_leave, result);
+    gst_object_unref(convert);
+
+    const double start_cpu = cpu_seconds();
+    const double start = monotonic_seconds();
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    result->ok = wait_for_eos(pipeline, GST_CLOCK_TIME_NONE);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+
+    result->seconds = monotonic_seconds() - start;
+    result->cpu_seconds = cpu_seconds() - start_cpu;
+
+    return result->ok;
+}
+
+static void write_convert_results(FILE *f, const BenchOptions *options, const ConvertResult *results, const int n_results)
+{
+    fprintf(f, "{\n  \"cpu_count\": %ld,\n  \"convert_threads\": %d,\n  \"results\": [", sysconf(_SC_NPROCESSORS_ONLN), options->convert_threads);
+
+    for (int i = 0; i < n_results; i++) {
+        const ConvertResult *r = &results[i];
+        const double ms_per_frame = r->frames > 0 ? (double)r->convert_us / 1e3 / (double)r->frames : 0;
+        const double megapixels_per_second = ms_per_frame > 0 ? (double)r->width * r->height / ms_per_frame / 1e3 : 0;
+
+        fprintf(f,
+            "%s\n    {\"converter\": \"%s\", \"width\": %d, \"height\": %d, \"ok\": %s, \"frames\": %" G_GUINT64_FORMAT ", "
+            "\"ms_per_frame\": %.3f, \"fps\": %.1f, \"megapixels_per_second\": %.1f, \"seconds\": %.4f, \"cpu_seconds\": %.4f}",
+            i == 0 ? "" : ",",
+            r->converter, r->width, r->height, r->ok ? "true" : "false", r->frames,
+            ms_per_frame, ms_per_frame > 0 ? 1e3 / ms_per_frame : 0, megapixels_per_second, r->seconds, r->cpu_seconds);
+    }
+
+    fprintf(f, "\n  ]\n}\n");
+}
+
+static int run_convert_benchmark(const BenchOptions *options)
+{
+    ConvertResult results[BENCH_MAX_ITEMS * BENCH_MAX_ITEMS];
+    int n_results = 0;
+    bool all_ok = true;
+
+    rgb_convert_register();
+
+    for (int s = 0; s < options->n_sizes; s++) {
+        for (int c = 0; c < options->n_converters; c++) {
+            ConvertResult *result = &results[n_results++];
+
+            *result = (ConvertResult){
+                .converter = options->converters[c],
+                .width = options->sizes[s][0],
+                .height = options->sizes[s][1],
+            };
+
+            fprintf(stderr, "INFO: Benchmarking %s at %dx%d\n", result->converter, result->width, result->height);
+
+            if (!run_convert_one(options, result)) {
+                all_ok = false;
+            }
+        }
+    }
+
+    FILE *f = strcmp(options->output, "-") == 0 ? stdout : fopen(options->output, "w");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: Unable to open %s for writing\n", options->output);
+        return 1;
+    }
+
+    write_convert_results(f, options, results, n_results);
+
+    if (f != stdout) {
+        fclose(f);
+        fprintf(stderr, "INFO: Benchmark results written to %s\n", options->output);
+    }
+
+    return all_ok ? 0 : 1;
+}
+
+// Draws every frame of `clip` into a file in the output directory and maps it, so the encoders
+// are timed without the drawing and the source can be read back for scoring. The file is
+// unlinked right away, it goes away with the mapping.
+static uint8_t *render_clip(const BenchOptions *options, const enum CorpusClip clip, const int width, const int height, size_t *size)
+{
+    char path[PATH_MAX];
+    const size_t frame_size = (size_t)width * height * 4;
+    uint8_t *map = MAP_FAILED;
+
+    snprintf(path, sizeof(path), "%s/corpus_%s_%dx%d.bgrx", options->output_dir, CORPUS_CLIP_NAMES[clip], width, height);
+
+    const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Unable to create %s: %s\n", path, strerror(errno));
+        return nullptr;
+    }
+
+    *size = frame_size * (size_t)options->frames;
+
+    if (ftruncate(fd, (off_t)*size) == 0) {
+        map = mmap(nullptr, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    unlink(path);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Unable to map %zu bytes for the %s clip: %s\n", *size, CORPUS_CLIP_NAMES[clip], strerror(errno));
+        return nullptr;
+    }
+
+    for (int i = 0; i < options->frames; i++) {
+        corpus_render(clip, i, width, height, map + (size_t)i * frame_size, width * 4);
+    }
+
+    return map;
+}
+
+static bool push_corpus_frames(GstElement *src, const uint8_t *map, CorpusResult *result, const int frames)
+{
+    const size_t frame_size = (size_t)result->width * result->height * 4;
+
+    for (int i = 0; i < frames; i++) {
+        GstBuffer *buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, (gpointer)(map + (size_t)i * frame_size), frame_size, 0, frame_size, nullptr, nullptr);
+
+        GST_BUFFER_PTS(buffer) = gst_util_uint64_scale((guint64)i, GST_SECOND, (guint64)result->framerate);
+        GST_BUFFER_DURATION(buffer) = gst_util_uint64_scale(1, GST_SECOND, (guint64)result->framerate);
+
+        if (gst_app_src_push_buffer(GST_APP_SRC(src), buffer) != GST_FLOW_OK) return false;
+        result->frames++;
+    }
+
+    return gst_app_src_end_of_stream(GST_APP_SRC(src)) == GST_FLOW_OK;
+}
+
+// Walks the source frames alongside the decoded ones
+typedef struct {
+    const uint8_t *source;
+    int width;
+    int height;
+    int framerate;
+    int frames;
+    int next;
+    QualityScore *score;
+} Scorer;
+
+// Scores the source frames due before `until` against `decoded`, which is what a player shows up
+// to then. A source frame is due in the middle of its display time, so timestamps the container
+// rounded to milliseconds still land on the right frame.
+static void score_until(Scorer *scorer, const uint8_t *decoded, const int stride, const GstClockTime until)
+{
+    const size_t frame_size = (size_t)scorer->width * scorer->height * 4;
+
+    while (scorer->next < scorer->frames) {
+        const GstClockTime due = gst_util_uint64_scale((guint64)scorer->next * 2 + 1, GST_SECOND, (guint64)scorer->framerate * 2);
+        if (GST_CLOCK_TIME_IS_VALID(until) && due >= until) break;
+
+        quality_add_frame(scorer->score, scorer->source + (size_t)scorer->next * frame_size, scorer->width * 4, decoded, stride, scorer->width, scorer->height);
+        scorer->next++;
+    }
+}
+
+static bool score_gif(const char *path, Scorer *scorer)
+{
+    int width;
+    int height;
+    GifDecoder *decoder = gif_decoder_open(path, &width, &height);
+
+    if (decoder == NULL) return false;
+
+    if (width != scorer->width || height != scorer->height) {
+        fprintf(stderr, "ERROR: %s is %dx%d, the source was %dx%d\n", path, width, height, scorer->width, scorer->height);
+        gif_decoder_close(decoder);
+        return false;
+    }
+
+    // The canvas is only valid until the next frame, the last one scores whatever comes after it
+    const size_t frame_size = (size_t)width * height * 4;
+    uint8_t *last = malloc(frame_size);
+    const uint8_t *pixels;
+    int delay_cs;
+    GstClockTime shown = 0;
+    bool ok;
+    bool has_frame = false;
+
+    while ((ok = gif_decoder_next_frame(decoder, &pixels, &delay_cs)) && pixels != NULL) {
+        shown += (GstClockTime)delay_cs * 10 * GST_MSECOND;
+        score_until(scorer, pixels, width * 4, shown);
+
+        memcpy(last, pixels, frame_size);
+        has_frame = true;
+    }
+
+    if (ok && has_frame) score_until(scorer, last, width * 4, GST_CLOCK_TIME_NONE);
+
+    free(last);
+    gif_decoder_close(decoder);
+
+    return ok && has_frame;
+}
+
+static bool score_sample(Scorer *scorer, GstSample *sample, const GstClockTime until)
+{
+    GstVideoInfo info;
+    GstVideoFrame frame;
+
+    if (!gst_video_info_from_caps(&info, gst_sample_get_caps(sample))) return false;
+
+    if (GST_VIDEO_INFO_WIDTH(&info) != scorer->width || GST_VIDEO_INFO_HEIGHT(&info) != scorer->height) {
+        fprintf(stderr, "ERROR: Decoded frames are %dx%d, the source was %dx%d\n", GST_VIDEO_INFO_WIDTH(&info), GST_VIDEO_INFO_HEIGHT(&info), scorer->width, scorer->height);
+        return false;
+    }
+
+    if (!gst_video_frame_map(&frame, &info, gst_sample_get_buffer(sample), GST_MAP_READ)) return false;
+
+    score_until(scorer, GST_VIDEO_FRAME_PLANE_DATA(&frame, 0), GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0), until);
+    gst_video_frame_unmap(&frame);
+
+    return true;
+}
+
+// Decodes the file the way a player would, each frame is held up to the timestamp of the next
+static bool score_decoded(const char *path, Scorer *scorer)
+{
+    char description[PATH_MAX + 256];
+
+    snprintf(description, sizeof(description),
+        "filesrc location=\"%s\" ! decodebin ! videoconvert ! video/x-raw,format=BGRx ! appsink name=scoresink sync=false", path);
+
+    GError *error = nullptr;
+    GstElement *pipeline = gst_parse_launch(description, &error);
+
+    if (pipeline == NULL) {
+        fprintf(stderr, "ERROR: Failed to create the decoding pipeline\n");
+        return false;
+    }
+
+    if (error) {
+        fprintf(stderr, "ERROR: %s\n", error->message);
+        g_error_free(error);
+        gst_object_unref(pipeline);
+        return false;
+    }
+
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "scoresink");
+    GstSample *shown = nullptr;
+    GstClockTime first_pts = GST_CLOCK_TIME_NONE;
+    bool ok = gst_element_set_state(pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE;
+
+    while (ok) {
+        GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(sink));
+        if (sample == NULL) break;
+
+        const GstClockTime pts = GST_BUFFER_PTS(gst_sample_get_buffer(sample));
+
+        if (!GST_CLOCK_TIME_IS_VALID(pts)) {
+            gst_sample_unref(sample);
+            continue;
+        }
+
+        if (!GST_CLOCK_TIME_IS_VALID(first_pts)) first_pts = pts;
+
+        if (shown) {
+            ok = score_sample(scorer, shown, pts > first_pts ? pts - first_pts : 0);
+            gst_sample_unref(shown);
+        }
+
+        shown = sample;
+    }
+
+    if (shown) {
+        if (ok) ok = score_sample(scorer, shown, GST_CLOCK_TIME_NONE);
+        gst_sample_unref(shown);
+    }
+
+    // The sink runs dry on errors as well as at the end
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GstMessage *msg = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+
+    if (msg) {
+        GError *err;
+        char *debug;
+
+        gst_message_parse_error(msg, &err, &debug);
+        fprintf(stderr, "ERROR: Decoding %s: %s\n", path, err->message);
+        g_error_free(err);
+        g_free(debug);
+        gst_message_unref(msg);
+        ok = false;
+    }
+
+    gst_object_unref(bus);
+    gst_object_unref(sink);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+
+    return ok && scorer->next == scorer->frames;
+}
+
+// Encodes the rendered clip with the regular pipeline of the encoding, then decodes the file and
+// scores it frame by frame against the source
+static bool run_corpus_one(const BenchOptions *options, const uint8_t *map, CorpusResult *result)
+{
+    char video_source[512];
+    char audio_source[256];
+    const size_t frame_size = (size_t)result->width * result->height * 4;
+    Recording recording = { .output_encoding = result->encoding, .audio_codec = options->audio_codec };
+
+    parse_output_scale("native", &recording);
+
+    // A few frames in flight, pushing blocks beyond that so the source stays ahead of the
+    // encoder without buffering the whole clip
+    snprintf(video_source, sizeof(video_source),
+        "appsrc name=corpussrc format=time block=true max-bytes=%zu caps=video/x-raw,format=BGRx,width=%d,height=%d,framerate=%d/1",
+        frame_size * 4, result->width, result->height, result->framerate);
+    get_audio_source(options, result->framerate, audio_source, sizeof(audio_source));
+
+    snprintf(recording.location, sizeof(recording.location), "%s/corpus_%s_%s_%dx%d_%d%s",
+        options->output_dir, CORPUS_CLIP_NAMES[result->clip], OUTPUT_ENCODING_NAMES[result->encoding],
+        result->width, result->height, result->framerate, OUTPUT_ENCODING_EXTENSIONS[result->encoding]);
+
+    if (!create_pipeline(&recording, video_source, audio_source)) {
+        return false;
+    }
+
+    configure_threads(&recording, THREADS_AUTO, result->width, result->height);
+
+    GstElement *src = gst_bin_get_by_name(GST_BIN(recording.pipeline), "corpussrc");
+    if (src == NULL) {
+        fprintf(stderr, "ERROR: The %s pipeline has no corpus source\n", OUTPUT_ENCODING_NAMES[result->encoding]);
+        destroy_pipeline(&recording);
+        return false;
+    }
+
+    const double start_cpu = cpu_seconds();
+    const double start = monotonic_seconds();
+
+    if (gst_element_set_state(recording.pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        fprintf(stderr, "ERROR: Unable to set the benchmark pipeline to the playing state.\n");
+        gst_object_unref(src);
+        destroy_pipeline(&recording);
+        return false;
+    }
+
+    // A source that stopped taking frames means the pipeline failed, its error is on the bus
+    const bool pushed = push_corpus_frames(src, map, result, options->frames);
+    gst_object_unref(src);
+
+    result->ok = wait_for_eos(recording.pipeline, pushed ? GST_CLOCK_TIME_NONE : 5 * GST_SECOND) && pushed;
+
+    if (!destroy_pipeline(&recording)) result->ok = false;
+
+    result->seconds = monotonic_seconds() - start;
+    result->cpu_seconds = cpu_seconds() - start_cpu;
+
+    struct stat st;
+    result->bytes = stat(recording.location, &st) == 0 ? (long long)st.st_size : -1;
+
+    if (!result->ok) return false;
+
+    Scorer scorer = {
+        .source = map,
+        .width = result->width,
+        .height = result->height,
+        .framerate = result->framerate,
+        .frames = options->frames,
+        .score = &result->score,
+    };
+
+    const bool scored = result->encoding == GIF ? score_gif(recording.location, &scorer) : score_decoded(recording.location, &scorer);
+
+    if (!scored) {
+        fprintf(stderr, "ERROR: Unable to score %s against the %s clip\n", recording.location, CORPUS_CLIP_NAMES[result->clip]);
+        result->ok = false;
+    }
+
+    return result->ok;
+}
+
+static void write_corpus_results(FILE *f, const CorpusResult *results, const int n_results)
+{
+    fprintf(f, "{\n  \"cpu_count\": %ld,\n  \"results\": [", sysconf(_SC_NPROCESSORS_ONLN));
+
+    for (int i = 0; i < n_results; i++) {
+        const CorpusResult *r = &results[i];
+        const double fps = r->seconds > 0 ? (double)r->frames / r->seconds : 0;
+        const double content_seconds = (double)r->frames / r->framerate;
+        const double bytes_per_second = content_seconds > 0 && r->bytes >= 0 ? (double)r->bytes / content_seconds : 0;
+
+        fprintf(f,
+            "%s\n    {\"clip\": \"%s\", \"encoding\": \"%s\", \"width\": %d, \"height\": %d, \"framerate\": %d, \"ok\": %s, "
+            "\"frames\": %" G_GUINT64_FORMAT ", \"seconds\": %.4f, \"fps\": %.2f, \"cpu_seconds\": %.4f, \"bytes\": %lld, \"bytes_per_second\": %.0f, "
+            "\"scored_frames\": %d, \"ssim\": %.5f, \"min_ssim\": %.5f, \"psnr\": %.3f}",
+            i == 0 ? "" : ",",
+            CORPUS_CLIP_NAMES[r->clip], OUTPUT_ENCODING_NAMES[r->encoding], r->width, r->height, r->framerate, r->ok ? "true" : "false",
+            r->frames, r->seconds, fps, r->cpu_seconds, r->bytes, bytes_per_second,
+            r->score.frames, quality_mean_ssim(&r->score), r->score.min_ssim, quality_mean_psnr(&r->score));
+    }
+
+    fprintf(f, "\n  ]\n}\n");
+}
+
+static int run_corpus_benchmark(const BenchOptions *options)
+{
+    const int max_results = CORPUS_CLIP_COUNT * OUTPUT_ENCODING_COUNT * BENCH_MAX_ITEMS * BENCH_MAX_ITEMS;
+    CorpusResult *results = calloc((size_t)max_results, sizeof(CorpusResult));
+    int n_results = 0;
+    bool all_ok = true;
+
+    if (results == NULL) return 1;
+
+    for (int s = 0; s < options->n_sizes; s++) {
+        const int width = options->sizes[s][0];
+        const int height = options->sizes[s][1];
+
+        for (int c = 0; c < CORPUS_CLIP_COUNT; c++) {
+            if (!options->clips[c]) continue;
+
+            size_t size;
+            uint8_t *map = render_clip(options, (enum CorpusClip)c, width, height, &size);
+
+            if (map == NULL) {
+                all_ok = false;
+                continue;
+            }
+
+            for (int f = 0; f < options->n_framerates; f++) {
+                for (int e = 0; e < OUTPUT_ENCODING_COUNT; e++) {
+                    if (!options->encodings[e]) continue;
+
+                    CorpusResult *result = &results[n_results++];
+
+                    *result = (CorpusResult){
+                        .clip = (enum CorpusClip)c,
+                        .encoding = (enum OutputEncoding)e,
+                        .width = width,
+                        .height = height,
+                        .framerate = options->framerates[f],
+                    };
+
+                    fprintf(stderr, "INFO: Benchmarking %s on the %s clip at %dx%d@%d\n", OUTPUT_ENCODING_NAMES[e], CORPUS_CLIP_NAMES[c], width, height, result->framerate);
+
+                    if (!run_corpus_one(options, map, result)) {
+                        all_ok = false;
+                    }
+                }
+            }
+
+            munmap(map, size);
+        }
+    }
+
+    FILE *f = strcmp(options->output, "-") == 0 ? stdout : fopen(options->output, "w");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: Unable to open %s for writing\n", options->output);
+        free(results);
+        return 1;
+    }
+
+    write_corpus_results(f, results, n_results);
+
+    if (f != stdout) {
+        fclose(f);
+        fprintf(stderr, "INFO: Benchmark results written to %s\n", options->output);
+    }
+
+    free(results);
+
+    return all_ok ? 0 : 1;
+}
+
+// One result line of a --corpus run, as far as --compare looks at it
+typedef struct {
+    char clip[32];
+    char encoding[32];
+    int width;
+    int height;
+    int framerate;
+    bool ok;
+    double fps;
+    double bytes_per_second;
+    double ssim;
+    double psnr;
+    bool is_matched;
+} CorpusEntry;
+
+// Where the value of `key` starts in a line written by write_corpus_results()
+static const char *find_json_value(const char *line, const char *key)
+{
+    char quoted[64];
+    snprintf(quoted, sizeof(quoted), "\"%s\": ", key);
+
+    const char *value = strstr(line, quoted);
+
+    return value ? value + strlen(quoted) : nullptr;
+}
+
+static double read_json_number(const char *line, const char *key)
+{
+    const char *value = find_json_value(line, key);
+
+    return value ? strtod(value, nullptr) : 0.0;
+}
+
+static void read_json_string(const char *line, const char *key, char *out, const size_t size)
+{
+    const char *value = find_json_value(line, key);
+
+    out[0] = '\0';
+    if (value == NULL || *value != '"') return;
+
+    size_t length = strcspn(++value, "\"");
+    if (length >= size) length = size - 1;
+
+    memcpy(out, value, length);
+    out[length] = '\0';
+}
+
+// Reads the results of a --corpus run, every result is on a line of its own
+static int read_corpus_results(const char *path, CorpusEntry *entries, const int max_entries)
+{
+    FILE *f = fopen(path, "r");
+    char line[1024];
+    int n_entries = 0;
+
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: Unable to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    while (n_entries < max_entries && fgets(line, sizeof(line), f)) {
+        if (find_json_value(line, "clip") == NULL) continue;
+
+        CorpusEntry *entry = &entries[n_entries++];
+        const char *ok = find_json_value(line, "ok");
+
+        *entry = (CorpusEntry){
+            .width = (int)read_json_number(line, "width"),
+            .height = (int)read_json_number(line, "height"),
+            .framerate = (int)read_json_number(line, "framerate"),
+            .ok = ok != NULL && strncmp(ok, "true", 4) == 0,
+            .fps = read_json_number(line, "fps"),
+            .bytes_per_second = read_json_number(line, "bytes_per_second"),
+            .ssim = read_json_number(line, "ssim"),
+            .psnr = read_json_number(line, "psnr"),
+        };
+
+        read_json_string(line, "clip", entry->clip, sizeof(entry->clip));
+        read_json_string(line, "encoding", entry->encoding, sizeof(entry->encoding));
+    }
+
+    fclose(f);
+
+    return n_entries;
+}
+
+static CorpusEntry *find_corpus_entry(CorpusEntry *entries, const int n_entries, const CorpusEntry *like)
+{
+    for (int i = 0; i < n_entries; i++) {
+        CorpusEntry *entry = &entries[i];
+
+        if (strcmp(entry->clip, like->clip) == 0 && strcmp(entry->encoding, like->encoding) == 0
+            && entry->width == like->width && entry->height == like->height && entry->framerate == like->framerate) {
+            return entry;
+        }
+    }
+
+    return nullptr;
+}
+
+static double relative_change(const double from, const double to)
+{
+    return from > 0 ? to / from - 1.0 : 0.0;
+}
+
+// Prints the scoreboard of `current_path` next to `baseline_path` and flags what got slower,
+// bigger or worse looking by more than the COMPARE_MAX_* limits
+static int compare_corpus_results(const char *baseline_path, const char *current_path)
+{
+    const int max_entries = CORPUS_CLIP_COUNT * OUTPUT_ENCODING_COUNT * BENCH_MAX_ITEMS * BENCH_MAX_ITEMS;
+    CorpusEntry *baseline = calloc((size_t)max_entries, sizeof(CorpusEntry));
+    CorpusEntry *current = calloc((size_t)max_entries, sizeof(CorpusEntry));
+    int regressions = 0;
+
+    if (baseline == NULL || current == NULL) {
+        free(baseline);
+        free(current);
+        return 1;
+    }
+
+    const int n_baseline = read_corpus_results(baseline_path, baseline, max_entries);
+    const int n_current = read_corpus_results(current_path, current, max_entries);
+
+    if (n_baseline < 0 || n_current < 0) {
+        free(baseline);
+        free(current);
+        return 1;
+    }
+
+    printf("%-9s %-16s %-14s %18s %21s %16s %14s\n", "clip", "encoding", "size", "fps", "bytes/s", "ssim", "psnr");
+
+    for (int i = 0; i < n_current; i++) {
+        const CorpusEntry *c = &current[i];
+        CorpusEntry *b = find_corpus_entry(baseline, n_baseline, c);
+        char size[32];
+
+        snprintf(size, sizeof(size), "%dx%d@%d", c->width, c->height, c->framerate);
+
+        if (b == NULL) {
+            printf("%-9s %-16s %-14s not in the baseline\n", c->clip, c->encoding, size);
+            continue;
+        }
+
+        b->is_matched = true;
+
+        const double fps_change = relative_change(b->fps, c->fps);
+        const double size_change = relative_change(b->bytes_per_second, c->bytes_per_second);
+        const double ssim_change = c->ssim - b->ssim;
+        const bool is_regression = (b->ok && !c->ok) || fps_change < -COMPARE_MAX_FPS_DROP
+            || size_change > COMPARE_MAX_SIZE_GROWTH || ssim_change < -COMPARE_MAX_SSIM_DROP;
+
+        printf("%-9s %-16s %-14s %9.1f %+7.1f%% %12.0f %+7.1f%% %7.4f %+8.4f %6.2f %+7.2f%s\n",
+            c->clip, c->encoding, size,
+            c->fps, fps_change * 100.0, c->bytes_per_second, size_change * 100.0,
+            c->ssim, ssim_change, c->psnr, c->psnr - b->psnr,
+            !c->ok ? "  FAILED" : is_regression ? "  REGRESSION" : "");
+
+        if (is_regression) regressions++;
+    }
+
+    for (int i = 0; i < n_baseline; i++) {
+        if (baseline[i].is_matched) continue;
+
+        fprintf(stderr, "ERROR: %s on the %s clip at %dx%d@%d is in the baseline but was not run\n",
+            baseline[i].encoding, baseline[i].clip, baseline[i].width, baseline[i].height, baseline[i].framerate);
+        regressions++;
+    }
+
+    printf("INFO: Compared %d results against %s, %d regressions (fps -%.0f%%, bytes/s +%.0f%%, SSIM -%.3f allowed)\n",
+        n_current, baseline_path, regressions, COMPARE_MAX_FPS_DROP * 100.0, COMPARE_MAX_SIZE_GROWTH * 100.0, COMPARE_MAX_SSIM_DROP);
+
+    free(baseline);
+    free(current);
+
+    return regressions > 0 ? 1 : 0;
+}
+
+int run_benchmark(const int argc, char *argv[])
+{
+    BenchOptions options = {
+        .sizes = { { 1920, 1080 }, { 3840, 2160 } },
+        .n_sizes = 2,
+        .framerates = { 30, 60 },
+        .n_framerates = 2,
+        .frames = 300,
+        .pattern = "ball",
+        .output = "bench.json",
+        .output_dir = "/tmp",
+        .damage_percent = -1,
+        .scale = "native",
+        .convert_threads = 1,
+    };
+
+    for (int i = 0; i < OUTPUT_ENCODING_COUNT; i++) options.encodings[i] = true;
+    options.thread_modes[THREADS_AUTO] = true;
+
+    if (argc == 1 && strcmp(argv[0], "--help") == 0) {
+        print_usage();
+        return 0;
+    }
+
+    if (!parse_options(argc, argv, &options)) {
+        print_usage();
+        return 1;
+    }
+
+    if (options.compare[0]) {
+        return compare_corpus_results(options.compare[0], options.compare[1]);
+    }
+
+    if (options.n_converters > 0) {
+        return run_convert_benchmark(&options);
+    }
+
+    if (options.use_corpus) {
+        return run_corpus_benchmark(&options);
+    }
+
+    BenchResult results[OUTPUT_ENCODING_COUNT * BENCH_MAX_ITEMS * BENCH_MAX_ITEMS * THREAD_MODE_COUNT];
+    int n_results = 0;
+    bool all_ok = true;
+
+    for (int e = 0; e < OUTPUT_ENCODING_COUNT; e++) {
+        if (!options.encodings[e]) continue;
+
+        for (int s = 0; s < options.n_sizes; s++) {
+            for (int f = 0; f < options.n_framerates; f++) {
+                for (int t = 0; t < THREAD_MODE_COUNT; t++) {
+                    if (!options.thread_modes[t]) continue;
+
+                    BenchResult *result = &results[n_results++];
+
+                    *result = (BenchResult){
+                        .encoding = (enum OutputEncoding)e,
+                        .thread_mode = (enum ThreadMode)t,
+                        .width = options.sizes[s][0],
+                        .height = options.sizes[s][1],
+                        .framerate = options.framerates[f],
+                        .damage_percent = options.damage_percent,
+                        .cursor_size = options.cursor_size,
+                        .rss_early_kb = -1,
+                    };
+
+                    fprintf(stderr, "INFO: Benchmarking %s at %dx%d@%d with %s threads\n", OUTPUT_ENCODING_NAMES[e], result->width, result->height, result->framerate, THREAD_MODE_NAMES[t]);
+
+                    if (!run_one(&options, result)) {
+                        all_ok = false;
+                    }
+                }
+            }
+        }
+    }
+
+    FILE *f = strcmp(options.output, "-") == 0 ? stdout : fopen(options.output, "w");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: Unable to open %s for writing\n", options.output);
+        return 1;
+    }
+
+    write_results(f, &options, results, n_results);
+
+    if (f != stdout) {
+        fclose(f);
+        fprintf(stderr, "INFO: Benchmark results written to %s\n", options.output);
+    }
+
+    return all_ok ? 0 : 1;
+}
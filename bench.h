@@ -0,0 +1,8 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Runs every selected OutputEncoding preset against a synthetic or file source and writes the
+// results as JSON. `argv` holds the arguments that follow "bench" on the command line.
+int run_benchmark(int argc, char *argv[]);
+
+#endif
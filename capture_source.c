@@ -0,0 +1,867 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <gstreamer-1.0/gst/gst.h>
+#include <gstreamer-1.0/gst/base/gstpushsrc.h>
+#include <gstreamer-1.0/gst/video/video.h>
+#include <pipewire/pipewire.h>
+#include <spa/param/video/format-utils.h>
+#include <spa/buffer/meta.h>
+
+#include "capture_source.h"
+#include "damage_convert.h"
+#include "cursor_overlay.h"
+
+#define SRC_CAPS GST_VIDEO_CAPS_MAKE("{ BGRx, BGRA, RGBx, RGBA }")
+
+// Rectangles kept per frame, more than that are merged into their bounding box
+#define MAX_DAMAGE_RECTS 16
+
+// Largest pointer sprite PipeWire is asked to make room for
+#define MAX_CURSOR_SIZE 256
+#define CURSOR_META_SIZE(width, height) \
+    (sizeof(struct spa_meta_cursor) + sizeof(struct spa_meta_bitmap) + (width) * (height) * 4)
+
+// Frames downstream still holds count against these, pipewiresrc asks for the same
+#define MIN_BUFFERS 2
+#define DEFAULT_BUFFERS 8
+#define MAX_BUFFERS 16
+
+enum {
+    PROP_0,
+    PROP_PATH,
+    PROP_KEEPALIVE_TIME,
+};
+
+// Our own mapping of a MemFd buffer, so frames still downstream stay readable after PipeWire
+// removes the buffer on a size change or when the stream stops
+typedef struct {
+    gint refs;
+    // Cleared under the loop lock once PipeWire removed the buffer
+    struct pw_buffer *buffer;
+    uint8_t *base;
+    size_t size;
+} SharedBuffer;
+
+// Outlives the element's stream while frames are downstream, which queue their buffer back
+// through it only as long as the stream is there
+typedef struct {
+    gint refs;
+    GMutex lock;
+    struct pw_thread_loop *loop;
+    struct pw_stream *stream;
+} Connection;
+
+typedef struct {
+    Connection *connection;
+    SharedBuffer *shared;
+} Frame;
+
+typedef struct {
+    GstPushSrc parent;
+
+    char *path;
+    int keepalive_time;
+
+    Connection *connection;
+    struct pw_context *context;
+    struct pw_core *core;
+    struct spa_hook stream_listener;
+
+    // Shared with the PipeWire thread
+    GMutex lock;
+    GCond cond;
+    bool flushing;
+    bool failed;
+    GstVideoInfo info;
+    bool caps_changed;
+    // Newest frame not pushed yet, the damage of every frame since the last push is merged into it
+    struct pw_buffer *pending;
+    GstVideoRectangle damage[MAX_DAMAGE_RECTS];
+    int n_damage;
+    bool full_damage;
+    // Pointer as of the newest buffer, `cursor_changed` until a frame took it along
+    bool has_cursor;
+    bool cursor_changed;
+    bool is_cursor_valid;
+    bool is_cursor_blank;
+    int cursor_x;
+    int cursor_y;
+    GstBuffer *cursor_bitmap;
+    int cursor_width;
+    int cursor_height;
+    bool is_new_bitmap;
+
+    // Repeated by the keepalive and for pointer moves
+    GstBuffer *last;
+
+    guint64 frames;
+    guint64 repeated;
+    guint64 skipped;
+    guint64 without_damage;
+    guint64 cursor_only;
+} CaptureSource;
+
+typedef struct {
+    GstPushSrcClass parent_class;
+} CaptureSourceClass;
+
+G_DEFINE_TYPE(CaptureSource, capture_source, GST_TYPE_PUSH_SRC)
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE("src", GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS(SRC_CAPS));
+
+static GQuark damage_quark;
+static GQuark cursor_quark;
+
+static void shared_buffer_unref(SharedBuffer *shared)
+{
+    if (!g_atomic_int_dec_and_test(&shared->refs)) return;
+
+    munmap(shared->base, shared->size);
+    free(shared);
+}
+
+static void connection_unref(Connection *connection)
+{
+    if (!g_atomic_int_dec_and_test(&connection->refs)) return;
+
+    g_mutex_clear(&connection->lock);
+    free(connection);
+}
+
+static void release_frame(gpointer data)
+{
+    Frame *frame = data;
+    Connection *connection = frame->connection;
+
+    // PipeWire only writes into a buffer again once it is queued back
+    g_mutex_lock(&connection->lock);
+    if (connection->stream) {
+        pw_thread_loop_lock(connection->loop);
+        if (frame->shared->buffer) pw_stream_queue_buffer(connection->stream, frame->shared->buffer);
+        pw_thread_loop_unlock(connection->loop);
+    }
+    g_mutex_unlock(&connection->lock);
+
+    shared_buffer_unref(frame->shared);
+    connection_unref(connection);
+    free(frame);
+}
+
+static GstVideoFormat get_video_format(const uint32_t format)
+{
+    switch (format) {
+        case SPA_VIDEO_FORMAT_BGRx:
+            return GST_VIDEO_FORMAT_BGRx;
+        case SPA_VIDEO_FORMAT_BGRA:
+            return GST_VIDEO_FORMAT_BGRA;
+        case SPA_VIDEO_FORMAT_RGBx:
+            return GST_VIDEO_FORMAT_RGBx;
+        case SPA_VIDEO_FORMAT_RGBA:
+            return GST_VIDEO_FORMAT_RGBA;
+        default:
+            return GST_VIDEO_FORMAT_UNKNOWN;
+    }
+}
+
+static void merge_damage(CaptureSource *self, const struct spa_buffer *buffer)
+{
+    const struct spa_meta *meta = spa_buffer_find_meta(buffer, SPA_META_VideoDamage);
+
+    // Without the meta the compositor did not say what changed
+    if (meta == NULL) {
+        self->full_damage = true;
+        return;
+    }
+
+    struct spa_meta_region *region;
+    spa_meta_for_each(region, meta) {
+        if (!spa_meta_region_is_valid(region)) break;
+
+        if (self->n_damage == MAX_DAMAGE_RECTS) {
+            GstVideoRectangle *bounds = &self->damage[0];
+
+            for (int i = 1; i < self->n_damage; i++) {
+                const GstVideoRectangle *rect = &self->damage[i];
+                const int right = MAX(bounds->x + bounds->w, rect->x + rect->w);
+                const int bottom = MAX(bounds->y + bounds->h, rect->y + rect->h);
+
+                bounds->x = MIN(bounds->x, rect->x);
+                bounds->y = MIN(bounds->y, rect->y);
+                bounds->w = right - bounds->x;
+                bounds->h = bottom - bounds->y;
+            }
+            self->n_damage = 1;
+        }
+
+        self->damage[self->n_damage++] = (GstVideoRectangle){
+            region->region.position.x, region->region.position.y,
+            (int)region->region.size.width, (int)region->region.size.height,
+        };
+    }
+}
+
+static bool has_frame(const CaptureSource *self, const struct pw_buffer *buffer)
+{
+    const struct spa_data *data = &buffer->buffer->datas[0];
+    const struct spa_meta_header *header = spa_buffer_find_meta_data(buffer->buffer, SPA_META_Header, sizeof(*header));
+    const int stride = data->chunk->stride > 0 ? data->chunk->stride : (int)GST_VIDEO_INFO_PLANE_STRIDE(&self->info, 0);
+
+    if (header && (header->flags & SPA_META_HEADER_FLAG_CORRUPTED)) return false;
+    if (buffer->user_data == NULL || (data->chunk->flags & SPA_CHUNK_FLAG_CORRUPTED)) return false;
+
+    // Also leaves out the empty chunks sent when only the metadata changed
+    return data->chunk->size >= (uint32_t)stride * GST_VIDEO_INFO_HEIGHT(&self->info) && data->chunk->size > 0;
+}
+
+static inline uint8_t unpremultiply(const uint8_t value, const uint8_t alpha)
+{
+    return alpha == 0 ? 0 : (uint8_t)MIN(255, (value * 255 + alpha / 2) / alpha);
+}
+
+// Mutter fills the bitmap with premultiplied alpha, the overlay blends straight BGRA
+static GstBuffer *copy_bitmap(const struct spa_meta_bitmap *bitmap)
+{
+    int r, g, b, a;
+
+    switch (bitmap->format) {
+        case SPA_VIDEO_FORMAT_RGBA:
+            r = 0; g = 1; b = 2; a = 3;
+            break;
+        case SPA_VIDEO_FORMAT_BGRA:
+            b = 0; g = 1; r = 2; a = 3;
+            break;
+        case SPA_VIDEO_FORMAT_ARGB:
+            a = 0; r = 1; g = 2; b = 3;
+            break;
+        case SPA_VIDEO_FORMAT_ABGR:
+            a = 0; b = 1; g = 2; r = 3;
+            break;
+        default:
+            fprintf(stderr, "ERROR: capturesrc: Unsupported pointer format %u\n", bitmap->format);
+            return nullptr;
+    }
+
+    const int width = (int)bitmap->size.width;
+    const int height = (int)bitmap->size.height;
+    const int stride = bitmap->stride > 0 ? bitmap->stride : width * 4;
+    const uint8_t *pixels = SPA_PTROFF(bitmap, bitmap->offset, const uint8_t);
+    GstBuffer *out = gst_buffer_new_allocate(nullptr, (gsize)width * (gsize)height * 4, nullptr);
+    GstMapInfo map;
+
+    if (out == NULL || !gst_buffer_map(out, &map, GST_MAP_WRITE)) {
+        if (out) gst_buffer_unref(out);
+        return nullptr;
+    }
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t *in = pixels + (size_t)y * (size_t)stride;
+        uint8_t *row = map.data + (size_t)y * (size_t)width * 4;
+
+        for (int x = 0; x < width; x++, in += 4, row += 4) {
+            row[0] = unpremultiply(in[b], in[a]);
+            row[1] = unpremultiply(in[g], in[a]);
+            row[2] = unpremultiply(in[r], in[a]);
+            row[3] = in[a];
+        }
+    }
+
+    gst_buffer_unmap(out, &map);
+
+    return out;
+}
+
+// The bitmap only comes along when the sprite changed, an empty one hides the pointer
+static void read_cursor(CaptureSource *self, const struct spa_buffer *buffer)
+{
+    const struct spa_meta_cursor *cursor = spa_buffer_find_meta_data(buffer, SPA_META_Cursor, sizeof(*cursor));
+
+    if (cursor == NULL) return;
+
+    const bool is_valid = spa_meta_cursor_is_valid(cursor);
+
+    if (is_valid && cursor->bitmap_offset >= sizeof(*cursor)) {
+        const struct spa_meta_bitmap *bitmap = SPA_PTROFF(cursor, cursor->bitmap_offset, const struct spa_meta_bitmap);
+        GstBuffer *pixels = bitmap->size.width > 0 && bitmap->size.height > 0 ? copy_bitmap(bitmap) : nullptr;
+
+        self->is_cursor_blank = pixels == NULL;
+        if (pixels) {
+            gst_clear_buffer(&self->cursor_bitmap);
+            self->cursor_bitmap = pixels;
+            self->cursor_width = (int)bitmap->size.width;
+            self->cursor_height = (int)bitmap->size.height;
+            self->is_new_bitmap = true;
+        }
+        self->cursor_changed = true;
+    }
+
+    const int x = cursor->position.x - cursor->hotspot.x;
+    const int y = cursor->position.y - cursor->hotspot.y;
+
+    if (!self->has_cursor || is_valid != self->is_cursor_valid || (is_valid && (x != self->cursor_x || y != self->cursor_y))) {
+        self->cursor_changed = true;
+    }
+
+    self->has_cursor = true;
+    self->is_cursor_valid = is_valid;
+    if (is_valid) {
+        self->cursor_x = x;
+        self->cursor_y = y;
+    }
+}
+
+// Keeps only the newest frame for create(), the older ones go straight back to PipeWire
+static void on_process(void *data)
+{
+    CaptureSource *self = data;
+    struct pw_stream *stream = self->connection->stream;
+    struct pw_buffer *buffer;
+
+    while ((buffer = pw_stream_dequeue_buffer(stream)) != NULL) {
+        g_mutex_lock(&self->lock);
+        merge_damage(self, buffer->buffer);
+        read_cursor(self, buffer->buffer);
+
+        if (has_frame(self, buffer)) {
+            if (self->pending) {
+                pw_stream_queue_buffer(stream, self->pending);
+                self->skipped++;
+            }
+            self->pending = buffer;
+            g_cond_signal(&self->cond);
+        } else {
+            // Only the pointer changed, create() repeats the last frame with it
+            pw_stream_queue_buffer(stream, buffer);
+            if (self->cursor_changed) g_cond_signal(&self->cond);
+        }
+        g_mutex_unlock(&self->lock);
+    }
+}
+
+// Maps MemFd buffers ourselves, see SharedBuffer. Others are not asked for and never used.
+static void on_add_buffer(void *data, struct pw_buffer *buffer)
+{
+    const struct spa_data *d = &buffer->buffer->datas[0];
+
+    if (d->type != SPA_DATA_MemFd) return;
+
+    const size_t size = d->mapoffset + d->maxsize;
+    uint8_t *base = mmap(nullptr, size, PROT_READ, MAP_SHARED, (int)d->fd, 0);
+
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "ERROR: capturesrc: Failed to map a buffer of %zu bytes\n", size);
+        return;
+    }
+
+    SharedBuffer *shared = calloc(1, sizeof(SharedBuffer));
+    if (shared == NULL) {
+        munmap(base, size);
+        return;
+    }
+
+    shared->refs = 1;
+    shared->buffer = buffer;
+    shared->base = base;
+    shared->size = size;
+    buffer->user_data = shared;
+}
+
+static void on_remove_buffer(void *data, struct pw_buffer *buffer)
+{
+    CaptureSource *self = data;
+    SharedBuffer *shared = buffer->user_data;
+
+    g_mutex_lock(&self->lock);
+    if (self->pending == buffer) self->pending = nullptr;
+    buffer->user_data = nullptr;
+    if (shared) shared->buffer = nullptr;
+    g_mutex_unlock(&self->lock);
+
+    if (shared) shared_buffer_unref(shared);
+}
+
+// Answers the format the compositor picked with the buffers and metadata to send along
+static void on_param_changed(void *data, const uint32_t id, const struct spa_pod *param)
+{
+    CaptureSource *self = data;
+
+    if (param == NULL || id != SPA_PARAM_Format) return;
+
+    struct spa_video_info_raw raw = {};
+    if (spa_format_video_raw_parse(param, &raw) < 0) return;
+
+    const GstVideoFormat format = get_video_format(raw.format);
+    if (format == GST_VIDEO_FORMAT_UNKNOWN) {
+        fprintf(stderr, "ERROR: capturesrc: Unsupported video format %u\n", raw.format);
+        return;
+    }
+
+    GstVideoInfo info;
+    gst_video_info_set_format(&info, format, raw.size.width, raw.size.height);
+    GST_VIDEO_INFO_FPS_N(&info) = 0;
+    GST_VIDEO_INFO_FPS_D(&info) = 1;
+
+    const int stride = (int)GST_VIDEO_INFO_PLANE_STRIDE(&info, 0);
+    const int size = stride * (int)raw.size.height;
+
+    uint8_t pod_buffer[1024];
+    struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(pod_buffer, sizeof(pod_buffer));
+    const struct spa_pod *params[4];
+
+    params[0] = spa_pod_builder_add_object(&builder, SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
+        SPA_PARAM_BUFFERS_buffers, SPA_POD_CHOICE_RANGE_Int(DEFAULT_BUFFERS, MIN_BUFFERS, MAX_BUFFERS),
+        SPA_PARAM_BUFFERS_blocks, SPA_POD_Int(1),
+        SPA_PARAM_BUFFERS_size, SPA_POD_Int(size),
+        SPA_PARAM_BUFFERS_stride, SPA_POD_Int(stride),
+        SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int(1 << SPA_DATA_MemFd));
+    params[1] = spa_pod_builder_add_object(&builder, SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
+        SPA_PARAM_META_type, SPA_POD_Id(SPA_META_Header),
+        SPA_PARAM_META_size, SPA_POD_Int(sizeof(struct spa_meta_header)));
+    params[2] = spa_pod_builder_add_object(&builder, SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
+        SPA_PARAM_META_type, SPA_POD_Id(SPA_META_VideoDamage),
+        SPA_PARAM_META_size, SPA_POD_CHOICE_RANGE_Int(
+            sizeof(struct spa_meta_region) * MAX_DAMAGE_RECTS,
+            sizeof(struct spa_meta_region),
+            sizeof(struct spa_meta_region) * MAX_DAMAGE_RECTS));
+    params[3] = spa_pod_builder_add_object(&builder, SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
+        SPA_PARAM_META_type, SPA_POD_Id(SPA_META_Cursor),
+        SPA_PARAM_META_size, SPA_POD_CHOICE_RANGE_Int(
+            CURSOR_META_SIZE(64, 64),
+            CURSOR_META_SIZE(1, 1),
+            CURSOR_META_SIZE(MAX_CURSOR_SIZE, MAX_CURSOR_SIZE)));
+
+    pw_stream_update_params(self->connection->stream, params, 4);
+
+    g_mutex_lock(&self->lock);
+    self->info = info;
+    self->caps_changed = true;
+    g_mutex_unlock(&self->lock);
+
+    printf("INFO: capturesrc: %ux%u %s\n", raw.size.width, raw.size.height, gst_video_format_to_string(format));
+}
+
+static void on_state_changed(void *data, const enum pw_stream_state old, const enum pw_stream_state state, const char *error)
+{
+    CaptureSource *self = data;
+
+    if (state != PW_STREAM_STATE_ERROR) return;
+
+    fprintf(stderr, "ERROR: capturesrc: %s\n", error ? error : "Stream failed");
+
+    g_mutex_lock(&self->lock);
+    self->failed = true;
+    g_cond_signal(&self->cond);
+    g_mutex_unlock(&self->lock);
+}
+
+static const struct pw_stream_events stream_events = {
+    .version = PW_VERSION_STREAM_EVENTS,
+    .state_changed = on_state_changed,
+    .param_changed = on_param_changed,
+    .add_buffer = on_add_buffer,
+    .remove_buffer = on_remove_buffer,
+    .process = on_process,
+};
+
+static gboolean capture_source_start(GstBaseSrc *base)
+{
+    CaptureSource *self = (CaptureSource *)base;
+    const uint32_t node_id = self->path ? (uint32_t)strtoul(self->path, nullptr, 10) : PW_ID_ANY;
+
+    pw_init(nullptr, nullptr);
+
+    Connection *connection = calloc(1, sizeof(Connection));
+    if (connection == NULL) return FALSE;
+
+    connection->refs = 1;
+    g_mutex_init(&connection->lock);
+    connection->loop = pw_thread_loop_new("capturesrc", nullptr);
+    self->connection = connection;
+    self->context = pw_context_new(pw_thread_loop_get_loop(connection->loop), nullptr, 0);
+
+    if (self->context == NULL || pw_thread_loop_start(connection->loop) < 0) {
+        fprintf(stderr, "ERROR: capturesrc: Failed to start the PipeWire loop\n");
+        return FALSE;
+    }
+
+    pw_thread_loop_lock(connection->loop);
+
+    self->core = pw_context_connect(self->context, nullptr, 0);
+    if (self->core == NULL) {
+        pw_thread_loop_unlock(connection->loop);
+        fprintf(stderr, "ERROR: capturesrc: Failed to connect to PipeWire\n");
+        return FALSE;
+    }
+
+    struct pw_stream *stream = pw_stream_new(self->core, "record_area", pw_properties_new(
+        PW_KEY_MEDIA_TYPE, "Video",
+        PW_KEY_MEDIA_CATEGORY, "Capture",
+        PW_KEY_MEDIA_ROLE, "Screen",
+        nullptr));
+    pw_stream_add_listener(stream, &self->stream_listener, &stream_events, self);
+
+    uint8_t pod_buffer[1024];
+    struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(pod_buffer, sizeof(pod_buffer));
+    const struct spa_pod *params[1];
+
+    // Without a modifier the compositor sticks to shared memory
+    params[0] = spa_pod_builder_add_object(&builder, SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat,
+        SPA_FORMAT_mediaType, SPA_POD_Id(SPA_MEDIA_TYPE_video),
+        SPA_FORMAT_mediaSubtype, SPA_POD_Id(SPA_MEDIA_SUBTYPE_raw),
+        SPA_FORMAT_VIDEO_format, SPA_POD_CHOICE_ENUM_Id(5,
+            SPA_VIDEO_FORMAT_BGRx, SPA_VIDEO_FORMAT_BGRx, SPA_VIDEO_FORMAT_BGRA,
+            SPA_VIDEO_FORMAT_RGBx, SPA_VIDEO_FORMAT_RGBA),
+        SPA_FORMAT_VIDEO_size, SPA_POD_CHOICE_RANGE_Rectangle(
+            &SPA_RECTANGLE(1920, 1080), &SPA_RECTANGLE(1, 1), &SPA_RECTANGLE(16384, 16384)),
+        SPA_FORMAT_VIDEO_framerate, SPA_POD_Fraction(&SPA_FRACTION(0, 1)),
+        SPA_FORMAT_VIDEO_maxFramerate, SPA_POD_CHOICE_RANGE_Fraction(
+            &SPA_FRACTION(60, 1), &SPA_FRACTION(0, 1), &SPA_FRACTION(1000, 1)));
+
+    connection->stream = stream;
+    const int result = pw_stream_connect(stream, PW_DIRECTION_INPUT, node_id, PW_STREAM_FLAG_AUTOCONNECT, params, 1);
+
+    pw_thread_loop_unlock(connection->loop);
+
+    if (result < 0) {
+        fprintf(stderr, "ERROR: capturesrc: Failed to connect to node %s\n", self->path ? self->path : "(none)");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean capture_source_stop(GstBaseSrc *base)
+{
+    CaptureSource *self = (CaptureSource *)base;
+    Connection *connection = self->connection;
+
+    if (self->frames > 0) {
+        printf("INFO: capturesrc: %" G_GUINT64_FORMAT " frames, %" G_GUINT64_FORMAT " skipped, %" G_GUINT64_FORMAT " repeated, %" G_GUINT64_FORMAT " without damage, %" G_GUINT64_FORMAT " for the pointer alone\n",
+            self->frames, self->skipped, self->repeated, self->without_damage, self->cursor_only);
+    }
+
+    if (connection) {
+        g_mutex_lock(&connection->lock);
+        pw_thread_loop_lock(connection->loop);
+
+        // Removes every buffer, the frames downstream keep their mapping
+        if (connection->stream) pw_stream_destroy(connection->stream);
+        connection->stream = nullptr;
+        if (self->core) pw_core_disconnect(self->core);
+
+        pw_thread_loop_unlock(connection->loop);
+        g_mutex_unlock(&connection->lock);
+
+        pw_thread_loop_stop(connection->loop);
+        if (self->context) pw_context_destroy(self->context);
+        pw_thread_loop_destroy(connection->loop);
+        connection->loop = nullptr;
+
+        connection_unref(connection);
+    }
+
+    self->connection = nullptr;
+    self->context = nullptr;
+    self->core = nullptr;
+    self->pending = nullptr;
+    self->n_damage = 0;
+    self->full_damage = false;
+    self->failed = false;
+    self->caps_changed = false;
+    self->has_cursor = false;
+    self->cursor_changed = false;
+    self->is_new_bitmap = false;
+    gst_clear_buffer(&self->cursor_bitmap);
+    gst_buffer_replace(&self->last, nullptr);
+
+    self->frames = 0;
+    self->repeated = 0;
+    self->skipped = 0;
+    self->without_damage = 0;
+    self->cursor_only = 0;
+
+    return TRUE;
+}
+
+// Caps are only known once the compositor picked a format, create() sets them
+static gboolean capture_source_negotiate(GstBaseSrc *base)
+{
+    return TRUE;
+}
+
+static gboolean capture_source_unlock(GstBaseSrc *base)
+{
+    CaptureSource *self = (CaptureSource *)base;
+
+    g_mutex_lock(&self->lock);
+    self->flushing = true;
+    g_cond_broadcast(&self->cond);
+    g_mutex_unlock(&self->lock);
+
+    return TRUE;
+}
+
+static gboolean capture_source_unlock_stop(GstBaseSrc *base)
+{
+    CaptureSource *self = (CaptureSource *)base;
+
+    g_mutex_lock(&self->lock);
+    self->flushing = false;
+    g_mutex_unlock(&self->lock);
+
+    return TRUE;
+}
+
+static gboolean remove_frame_meta(GstBuffer *buffer, GstMeta **meta, gpointer user_data)
+{
+    if ((*meta)->info->api != GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE) return TRUE;
+
+    const GQuark type = ((GstVideoRegionOfInterestMeta *)*meta)->roi_type;
+    if (type == damage_quark || type == cursor_quark) *meta = nullptr;
+
+    return TRUE;
+}
+
+// The buffer stays PipeWire's, it is queued back once the last reference is gone. Called with
+// the lock held, so the buffer cannot be removed meanwhile.
+static GstBuffer *wrap_frame(CaptureSource *self, const struct pw_buffer *buffer)
+{
+    SharedBuffer *shared = buffer->user_data;
+    const struct spa_data *data = &buffer->buffer->datas[0];
+    const uint32_t offset = data->chunk->offset % data->maxsize;
+    const uint32_t size = MIN(data->chunk->size, data->maxsize - offset);
+    const int stride = data->chunk->stride > 0 ? data->chunk->stride : (int)GST_VIDEO_INFO_PLANE_STRIDE(&self->info, 0);
+
+    Frame *frame = calloc(1, sizeof(Frame));
+    if (frame == NULL) return nullptr;
+
+    g_atomic_int_inc(&self->connection->refs);
+    g_atomic_int_inc(&shared->refs);
+    frame->connection = self->connection;
+    frame->shared = shared;
+
+    GstBuffer *out = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, shared->base + data->mapoffset,
+        data->maxsize, offset, size, frame, release_frame);
+
+    gsize offsets[GST_VIDEO_MAX_PLANES] = {0};
+    gint strides[GST_VIDEO_MAX_PLANES] = {stride};
+    gst_buffer_add_video_meta_full(out, GST_VIDEO_FRAME_FLAG_NONE, GST_VIDEO_INFO_FORMAT(&self->info),
+        GST_VIDEO_INFO_WIDTH(&self->info), GST_VIDEO_INFO_HEIGHT(&self->info), 1, offsets, strides);
+
+    return out;
+}
+
+static void add_damage(GstBuffer *buffer, const GstVideoRectangle *damage, const int n_damage, const GstVideoInfo *info)
+{
+    const int width = GST_VIDEO_INFO_WIDTH(info);
+    const int height = GST_VIDEO_INFO_HEIGHT(info);
+    bool has_damage = false;
+
+    for (int i = 0; i < n_damage; i++) {
+        const int x = CLAMP(damage[i].x, 0, width);
+        const int y = CLAMP(damage[i].y, 0, height);
+        const int right = CLAMP(damage[i].x + damage[i].w, x, width);
+        const int bottom = CLAMP(damage[i].y + damage[i].h, y, height);
+
+        if (right == x || bottom == y) continue;
+
+        gst_buffer_add_video_region_of_interest_meta(buffer, DAMAGE_META_TYPE, x, y, right - x, bottom - y);
+        has_damage = true;
+    }
+
+    if (!has_damage) gst_buffer_add_video_region_of_interest_meta(buffer, DAMAGE_META_TYPE, 0, 0, 0, 0);
+}
+
+static GstFlowReturn capture_source_create(GstPushSrc *src, GstBuffer **out)
+{
+    CaptureSource *self = (CaptureSource *)src;
+    const gint64 deadline = g_get_monotonic_time() + (gint64)self->keepalive_time * G_TIME_SPAN_MILLISECOND;
+
+    g_mutex_lock(&self->lock);
+
+    while (self->pending == NULL && !(self->cursor_changed && self->last) && !self->flushing && !self->failed) {
+        if (self->keepalive_time > 0 && self->last) {
+            if (!g_cond_wait_until(&self->cond, &self->lock, deadline)) break;
+        } else {
+            g_cond_wait(&self->cond, &self->lock);
+        }
+    }
+
+    if (self->flushing || self->failed) {
+        const bool failed = self->failed;
+        g_mutex_unlock(&self->lock);
+
+        if (!failed) return GST_FLOW_FLUSHING;
+
+        GST_ELEMENT_ERROR(self, RESOURCE, READ, ("PipeWire stream failed"), (nullptr));
+        return GST_FLOW_ERROR;
+    }
+
+    GstBuffer *frame = self->pending ? wrap_frame(self, self->pending) : nullptr;
+    const bool is_new = self->pending != NULL;
+    GstVideoRectangle damage[MAX_DAMAGE_RECTS];
+    const int n_damage = self->n_damage;
+    const bool full_damage = self->full_damage;
+    const GstVideoInfo info = self->info;
+    GstCaps *caps = self->caps_changed ? gst_video_info_to_caps(&self->info) : nullptr;
+
+    const bool is_cursor_only = !is_new && self->cursor_changed;
+    const bool has_cursor = self->has_cursor;
+    CursorSprite sprite = { self->cursor_x, self->cursor_y, 0, 0, nullptr };
+
+    // Hidden while the compositor says so, or before there is a sprite to show
+    if (self->is_cursor_valid && !self->is_cursor_blank && self->cursor_bitmap) {
+        sprite.width = self->cursor_width;
+        sprite.height = self->cursor_height;
+        if (self->is_new_bitmap) sprite.bitmap = gst_buffer_ref(self->cursor_bitmap);
+        self->is_new_bitmap = false;
+    }
+
+    memcpy(damage, self->damage, sizeof(damage));
+    self->pending = nullptr;
+    self->caps_changed = false;
+    self->cursor_changed = false;
+    if (is_new) {
+        self->n_damage = 0;
+        self->full_damage = false;
+    }
+
+    g_mutex_unlock(&self->lock);
+
+    if (caps) {
+        gst_base_src_set_caps(GST_BASE_SRC(self), caps);
+        gst_caps_unref(caps);
+    }
+
+    if (is_new) {
+        if (frame == NULL) {
+            if (sprite.bitmap) gst_buffer_unref(sprite.bitmap);
+            return GST_FLOW_ERROR;
+        }
+
+        if (full_damage) {
+            self->without_damage++;
+        } else {
+            add_damage(frame, damage, n_damage, &info);
+        }
+
+        gst_buffer_replace(&self->last, frame);
+    } else {
+        // Only the pointer moved or nothing came for the keepalive, the same pixels without damage
+        frame = gst_buffer_copy(self->last);
+        gst_buffer_foreach_meta(frame, remove_frame_meta, nullptr);
+        gst_buffer_add_video_region_of_interest_meta(frame, DAMAGE_META_TYPE, 0, 0, 0, 0);
+        GST_BUFFER_PTS(frame) = GST_CLOCK_TIME_NONE;
+        GST_BUFFER_DTS(frame) = GST_CLOCK_TIME_NONE;
+        GST_BUFFER_DURATION(frame) = GST_CLOCK_TIME_NONE;
+
+        if (is_cursor_only) {
+            self->cursor_only++;
+        } else {
+            self->repeated++;
+        }
+    }
+
+    if (has_cursor) cursor_meta_add(frame, &sprite, GST_VIDEO_INFO_WIDTH(&info), GST_VIDEO_INFO_HEIGHT(&info));
+    if (sprite.bitmap) gst_buffer_unref(sprite.bitmap);
+
+    self->frames++;
+    *out = frame;
+
+    return GST_FLOW_OK;
+}
+
+static void capture_source_set_property(GObject *object, const guint property_id, const GValue *value, GParamSpec *pspec)
+{
+    CaptureSource *self = (CaptureSource *)object;
+
+    switch (property_id) {
+        case PROP_PATH:
+            g_free(self->path);
+            self->path = g_value_dup_string(value);
+            break;
+        case PROP_KEEPALIVE_TIME:
+            self->keepalive_time = g_value_get_int(value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
+static void capture_source_get_property(GObject *object, const guint property_id, GValue *value, GParamSpec *pspec)
+{
+    const CaptureSource *self = (const CaptureSource *)object;
+
+    switch (property_id) {
+        case PROP_PATH:
+            g_value_set_string(value, self->path);
+            break;
+        case PROP_KEEPALIVE_TIME:
+            g_value_set_int(value, self->keepalive_time);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
+static void capture_source_finalize(GObject *object)
+{
+    CaptureSource *self = (CaptureSource *)object;
+
+    g_free(self->path);
+    g_mutex_clear(&self->lock);
+    g_cond_clear(&self->cond);
+
+    G_OBJECT_CLASS(capture_source_parent_class)->finalize(object);
+}
+
+static void capture_source_class_init(CaptureSourceClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+    GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+    GstBaseSrcClass *base_class = GST_BASE_SRC_CLASS(klass);
+    GstPushSrcClass *push_class = GST_PUSH_SRC_CLASS(klass);
+
+    gobject_class->set_property = capture_source_set_property;
+    gobject_class->get_property = capture_source_get_property;
+    gobject_class->finalize = capture_source_finalize;
+
+    g_object_class_install_property(gobject_class, PROP_PATH,
+        g_param_spec_string("path", "Path", "Id of the PipeWire node to capture", nullptr, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property(gobject_class, PROP_KEEPALIVE_TIME,
+        g_param_spec_int("keepalive-time", "Keepalive time", "Repeat the last frame after this many milliseconds without one, 0 to never", 0, G_MAXINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    gst_element_class_add_static_pad_template(element_class, &src_template);
+    gst_element_class_set_static_metadata(element_class, "Screen cast source", "Source/Video",
+        "Captures a PipeWire screen cast node along with its damage and pointer", "record_area");
+
+    base_class->start = capture_source_start;
+    base_class->stop = capture_source_stop;
+    base_class->negotiate = capture_source_negotiate;
+    base_class->unlock = capture_source_unlock;
+    base_class->unlock_stop = capture_source_unlock_stop;
+
+    push_class->create = capture_source_create;
+
+    damage_quark = g_quark_from_static_string(DAMAGE_META_TYPE);
+    cursor_quark = g_quark_from_static_string(CURSOR_META_TYPE);
+}
+
+static void capture_source_init(CaptureSource *self)
+{
+    g_mutex_init(&self->lock);
+    g_cond_init(&self->cond);
+    gst_video_info_init(&self->info);
+
+    gst_base_src_set_live(GST_BASE_SRC(self), TRUE);
+    gst_base_src_set_format(GST_BASE_SRC(self), GST_FORMAT_TIME);
+}
+
+bool capture_source_register(void)
+{
+    return gst_element_register(nullptr, "capturesrc", GST_RANK_NONE, capture_source_get_type());
+}
@@ -0,0 +1,15 @@
+#ifndef CAPTURE_SOURCE_H
+#define CAPTURE_SOURCE_H
+
+// Registers the `capturesrc` element for this process. It takes the frames of a PipeWire screen
+// cast node like pipewiresrc, but keeps the metadata pipewiresrc drops: SPA_META_VideoDamage
+// becomes DAMAGE_META_TYPE metas for damageconvert and frame dedup, and SPA_META_Cursor becomes
+// CURSOR_META_TYPE metas for the cursor overlay, with the last frame repeated when only the pointer
+// moved. Frames of shared memory are passed on without a copy and given back to PipeWire once
+// downstream is done with them.
+//
+// Properties: `path` is the node id as for pipewiresrc, `keepalive-time` (default 0, off) repeats
+// the last frame, without damage, when the compositor sent nothing for that many milliseconds.
+bool capture_source_register(void);
+
+#endif
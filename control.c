@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "control.h"
+
+#define CONTROL_MAX_CLIENTS 8
+#define CONTROL_QUEUE_SIZE 16
+#define CONTROL_LINE_SIZE 256
+
+static const char * const CONTROL_COMMAND_NAMES[] = {
+    [CONTROL_START] = "start",
+    [CONTROL_STOP] = "stop",
+    [CONTROL_PAUSE] = "pause",
+    [CONTROL_RESUME] = "resume",
+    [CONTROL_REPLAY] = "replay",
+    [CONTROL_QUIT] = "quit",
+};
+
+typedef struct {
+    int fd;
+    char line[CONTROL_LINE_SIZE];
+    size_t length;
+} ControlClient;
+
+struct ControlServer {
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    int listen_fd;
+    int wake_fd;
+    // Readable while commands are queued, so the render loop can wait on it
+    int notify_fd;
+    pthread_t thread;
+
+    ControlClient clients[CONTROL_MAX_CLIENTS];
+
+    pthread_mutex_t lock;
+    enum ControlCommand queue[CONTROL_QUEUE_SIZE];
+    int queue_head;
+    atomic_int queued;
+    char status[CONTROL_LINE_SIZE];
+};
+
+static void reply(const int fd, const char *text)
+{
+    // A client that hung up must not take the recording down with SIGPIPE
+    if (send(fd, text, strlen(text), MSG_NOSIGNAL) < 0) {
+        perror("ERROR: Unable to reply on the control socket");
+    }
+}
+
+static void handle_line(ControlServer *server, const int fd, char *line)
+{
+    char response[CONTROL_LINE_SIZE + 16];
+
+    line[strcspn(line, "\r")] = '\0';
+
+    if (strcmp(line, "status") == 0) {
+        pthread_mutex_lock(&server->lock);
+        snprintf(response, sizeof(response), "%s\n", server->status);
+        pthread_mutex_unlock(&server->lock);
+
+        reply(fd, response);
+        return;
+    }
+
+    for (int command = CONTROL_START; command < CONTROL_COMMAND_COUNT; command++) {
+        if (strcmp(line, CONTROL_COMMAND_NAMES[command]) != 0) continue;
+
+        pthread_mutex_lock(&server->lock);
+
+        const int queued = atomic_load(&server->queued);
+        const bool full = queued == CONTROL_QUEUE_SIZE;
+
+        if (!full) {
+            server->queue[(server->queue_head + queued) % CONTROL_QUEUE_SIZE] = (enum ControlCommand)command;
+            atomic_fetch_add(&server->queued, 1);
+            eventfd_write(server->notify_fd, 1);
+        }
+
+        pthread_mutex_unlock(&server->lock);
+
+        reply(fd, full ? "ERROR busy\n" : "OK\n");
+        return;
+    }
+
+    snprintf(response, sizeof(response), "ERROR unknown command: %s\n", line);
+    reply(fd, response);
+}
+
+static bool read_client(ControlServer *server, ControlClient *client)
+{
+    const ssize_t n = read(client->fd, client->line + client->length, sizeof(client->line) - client->length - 1);
+
+    if (n <= 0) return false;
+
+    client->length += (size_t)n;
+    client->line[client->length] = '\0';
+
+    char *newline;
+    while ((newline = strchr(client->line, '\n')) != NULL) {
+        *newline = '\0';
+        handle_line(server, client->fd, client->line);
+
+        const size_t consumed = (size_t)(newline - client->line) + 1;
+        memmove(client->line, newline + 1, client->length - consumed + 1);
+        client->length -= consumed;
+    }
+
+    // A line that does not fit is not a command
+    if (client->length == sizeof(client->line) - 1) {
+        reply(client->fd, "ERROR line too long\n");
+        client->length = 0;
+    }
+
+    return true;
+}
+
+static void accept_client(ControlServer *server)
+{
+    const int fd = accept(server->listen_fd, nullptr, nullptr);
+
+    if (fd < 0) return;
+
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if (server->clients[i].fd < 0) {
+            server->clients[i] = (ControlClient){ .fd = fd };
+            return;
+        }
+    }
+
+    reply(fd, "ERROR too many clients\n");
+    close(fd);
+}
+
+static void *control_main(void *arg)
+{
+    ControlServer *server = arg;
+    struct pollfd fds[CONTROL_MAX_CLIENTS + 2];
+
+    while (true) {
+        int n_fds = 0;
+        fds[n_fds++] = (struct pollfd){ .fd = server->wake_fd, .events = POLLIN };
+        fds[n_fds++] = (struct pollfd){ .fd = server->listen_fd, .events = POLLIN };
+
+        for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+            fds[n_fds++] = (struct pollfd){ .fd = server->clients[i].fd, .events = POLLIN };
+        }
+
+        if (poll(fds, (nfds_t)n_fds, -1) < 0) continue;
+
+        if (fds[0].revents) break;
+
+        if (fds[1].revents & POLLIN) accept_client(server);
+
+        for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+            ControlClient *client = &server->clients[i];
+
+            if (client->fd >= 0 && fds[i + 2].revents && !read_client(server, client)) {
+                close(client->fd);
+                client->fd = -1;
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+ControlServer *control_server_start(const char *path)
+{
+    ControlServer *server = calloc(1, sizeof(ControlServer));
+    if (server == NULL) return nullptr;
+
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "ERROR: Control socket path is too long: %s\n", path);
+        free(server);
+        return nullptr;
+    }
+
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+    snprintf(server->path, sizeof(server->path), "%s", path);
+    snprintf(server->status, sizeof(server->status), "idle");
+
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) server->clients[i].fd = -1;
+
+    // A socket left behind by a previous run would make bind() fail
+    unlink(path);
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    server->wake_fd = eventfd(0, 0);
+    server->notify_fd = eventfd(0, EFD_NONBLOCK);
+
+    if (server->listen_fd < 0 || server->wake_fd < 0 || server->notify_fd < 0
+        || bind(server->listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0
+        || listen(server->listen_fd, CONTROL_MAX_CLIENTS) < 0) {
+        perror("ERROR: Unable to create the control socket");
+
+        if (server->listen_fd >= 0) close(server->listen_fd);
+        if (server->wake_fd >= 0) close(server->wake_fd);
+        if (server->notify_fd >= 0) close(server->notify_fd);
+        free(server);
+        return nullptr;
+    }
+
+    chmod(path, 0600);
+    pthread_mutex_init(&server->lock, nullptr);
+
+    if (pthread_create(&server->thread, nullptr, control_main, server) != 0) {
+        fprintf(stderr, "ERROR: Unable to start the control thread\n");
+
+        pthread_mutex_destroy(&server->lock);
+        close(server->listen_fd);
+        close(server->wake_fd);
+        close(server->notify_fd);
+        unlink(path);
+        free(server);
+        return nullptr;
+    }
+
+    printf("INFO: Listening for commands on %s\n", path);
+
+    return server;
+}
+
+enum ControlCommand control_server_take(ControlServer *server)
+{
+    if (atomic_load(&server->queued) == 0) return CONTROL_NONE;
+
+    pthread_mutex_lock(&server->lock);
+
+    const enum ControlCommand command = server->queue[server->queue_head];
+    server->queue_head = (server->queue_head + 1) % CONTROL_QUEUE_SIZE;
+    // The last command clears the eventfd, both change under the lock so it never ends up empty
+    // with commands still queued
+    if (atomic_fetch_sub(&server->queued, 1) == 1) {
+        eventfd_t value;
+        eventfd_read(server->notify_fd, &value);
+    }
+
+    pthread_mutex_unlock(&server->lock);
+
+    return command;
+}
+
+int control_server_get_fd(ControlServer *server)
+{
+    return server->notify_fd;
+}
+
+void control_server_set_status(ControlServer *server, const char *status)
+{
+    pthread_mutex_lock(&server->lock);
+    snprintf(server->status, sizeof(server->status), "%s", status);
+    pthread_mutex_unlock(&server->lock);
+}
+
+void control_server_stop(ControlServer *server)
+{
+    if (server == NULL) return;
+
+    eventfd_write(server->wake_fd, 1);
+    pthread_join(server->thread, nullptr);
+
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if (server->clients[i].fd >= 0) close(server->clients[i].fd);
+    }
+
+    close(server->listen_fd);
+    close(server->wake_fd);
+    close(server->notify_fd);
+    unlink(server->path);
+    pthread_mutex_destroy(&server->lock);
+    free(server);
+}
+
+int run_control_client(const int argc, char *argv[])
+{
+    if (argc != 1) {
+        fprintf(stderr, "Usage: record_area ctl start|stop|pause|resume|replay|quit|status\n");
+        return 1;
+    }
+
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", CONTROL_SOCKET_PATH);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        fprintf(stderr, "ERROR: Unable to connect to %s, is record_area running?\n", CONTROL_SOCKET_PATH);
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+
+    char line[CONTROL_LINE_SIZE];
+    snprintf(line, sizeof(line), "%s\n", argv[0]);
+    reply(fd, line);
+
+    size_t length = 0;
+    ssize_t n;
+
+    while (length < sizeof(line) - 1 && (n = read(fd, line + length, sizeof(line) - 1 - length)) > 0) {
+        length += (size_t)n;
+        if (memchr(line, '\n', length)) break;
+    }
+
+    line[length] = '\0';
+    close(fd);
+
+    fputs(line, stdout);
+
+    return strncmp(line, "ERROR", 5) == 0 || length == 0 ? 1 : 0;
+}
@@ -0,0 +1,41 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#define CONTROL_SOCKET_PATH "/tmp/recording-indicator/control.sock"
+
+// Commands are sent one per line, e.g. `echo stop | nc -U CONTROL_SOCKET_PATH` or `record_area ctl stop`
+enum ControlCommand {
+    CONTROL_NONE,
+    CONTROL_START,
+    CONTROL_STOP,
+    CONTROL_PAUSE,
+    CONTROL_RESUME,
+    CONTROL_REPLAY,
+    CONTROL_QUIT,
+
+    CONTROL_COMMAND_COUNT
+};
+
+typedef struct ControlServer ControlServer;
+
+// Listens on the Unix socket at `path` from a thread blocked in poll(), an eventfd wakes it up to
+// shut down. Commands are acknowledged right away and queued for the render loop, status queries
+// are answered from the last published status without waiting for a frame.
+ControlServer *control_server_start(const char *path);
+
+// Next queued command or CONTROL_NONE. Only an atomic load when nothing is queued, so it can be
+// called every frame.
+enum ControlCommand control_server_take(ControlServer *server);
+
+// Readable while a command is queued, for the render loop to wake up on instead of polling
+int control_server_get_fd(ControlServer *server);
+
+// Single line answer to `status` queries
+void control_server_set_status(ControlServer *server, const char *status);
+
+void control_server_stop(ControlServer *server);
+
+// Client side of `record_area ctl COMMAND`, prints the reply
+int run_control_client(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "corpus.h"
+
+// Character cells of the made-up font, glyphs are ink patterns derived from the character code
+#define CELL_WIDTH 8
+#define CELL_HEIGHT 16
+
+typedef struct {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+} Rgb;
+
+const char * const CORPUS_CLIP_NAMES[] = {
+    [CLIP_TERMINAL] = "terminal",
+    [CLIP_IDE] = "ide",
+    [CLIP_VIDEO] = "video",
+    [CLIP_DESKTOP] = "desktop",
+};
+
+bool parse_corpus_clip(const char *name, enum CorpusClip *clip)
+{
+    for (int i = 0; i < CORPUS_CLIP_COUNT; i++) {
+        if (strcmp(name, CORPUS_CLIP_NAMES[i]) == 0) {
+            *clip = (enum CorpusClip)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static uint32_t hash(uint32_t a, uint32_t b)
+{
+    uint32_t h = a * 0x9E3779B1u ^ (b + 0x7F4A7C15u) * 0x85EBCA77u;
+
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+
+    return h;
+}
+
+static void put_pixel(uint8_t *pixels, const int stride, const int x, const int y, const Rgb color)
+{
+    uint8_t *p = pixels + (size_t)y * stride + (size_t)x * 4;
+
+    p[0] = color.b;
+    p[1] = color.g;
+    p[2] = color.r;
+    p[3] = 0;
+}
+
+static void fill_rect(uint8_t *pixels, const int stride, const int width, const int height, int x0, int y0, int x1, int y1, const Rgb color)
+{
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > width) x1 = width;
+    if (y1 > height) y1 = height;
+
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) put_pixel(pixels, stride, x, y, color);
+    }
+}
+
+// Inked rows and columns leave a margin like a real font, about half of the rest is set
+static void draw_char(uint8_t *pixels, const int stride, const int width, const int height, const int x, const int y, const uint32_t code, const Rgb color)
+{
+    for (int row = 3; row < CELL_HEIGHT - 3; row++) {
+        const uint32_t bits = hash(code, (uint32_t)row);
+
+        for (int col = 1; col < CELL_WIDTH - 1; col++) {
+            if (!(bits >> col & 1) || x + col >= width || y + row >= height) continue;
+            put_pixel(pixels, stride, x + col, y + row, color);
+        }
+    }
+}
+
+// Length of line `line` of a made-up text, up to `max` characters
+static int line_length(const uint32_t seed, const int line, const int max)
+{
+    const uint32_t h = hash(seed, (uint32_t)line);
+
+    return h % 7 == 0 ? 0 : (int)(h % (uint32_t)max);
+}
+
+// One character in six is a space, which gives words of about five characters
+static bool is_space(const uint32_t seed, const int line, const int col)
+{
+    return hash(seed ^ (uint32_t)line * 7919u, (uint32_t)col) % 6 == 0;
+}
+
+static void render_terminal(const int index, const int width, const int height, uint8_t *pixels, const int stride)
+{
+    const Rgb background = { 30, 30, 30 };
+    const Rgb text = { 204, 204, 204 };
+    const Rgb prompt = { 80, 220, 100 };
+    const int rows = height / CELL_HEIGHT;
+    const int cols = width / CELL_WIDTH;
+    const int first_line = index / 2;
+
+    fill_rect(pixels, stride, width, height, 0, 0, width, height, background);
+
+    for (int row = 0; row < rows; row++) {
+        const int line = first_line + row;
+        const int length = line_length(1, line, cols);
+        const bool is_prompt = line % 17 == 0;
+
+        for (int col = 0; col < length; col++) {
+            if (is_space(1, line, col)) continue;
+            draw_char(pixels, stride, width, height, col * CELL_WIDTH, row * CELL_HEIGHT, hash(line, (uint32_t)col) % 96, is_prompt && col < 12 ? prompt : text);
+        }
+    }
+}
+
+// Keywords, strings and the rest, picked per word
+static Rgb token_color(const int line, const int col)
+{
+    const uint32_t kind = hash((uint32_t)line * 31u, (uint32_t)(col / 6)) % 8;
+
+    if (kind == 0) return (Rgb){ 0, 0, 200 };
+    if (kind == 1) return (Rgb){ 163, 21, 21 };
+    if (kind == 2) return (Rgb){ 0, 128, 0 };
+
+    return (Rgb){ 30, 30, 30 };
+}
+
+static void render_ide(const int index, const int width, const int height, uint8_t *pixels, const int stride)
+{
+    const Rgb background = { 255, 255, 255 };
+    const Rgb gutter = { 240, 240, 240 };
+    const Rgb line_number = { 140, 140, 140 };
+    const Rgb current = { 255, 250, 225 };
+    const int gutter_cols = 6;
+    const int rows = height / CELL_HEIGHT;
+    const int cols = width / CELL_WIDTH - gutter_cols;
+    const int chars_per_line = 40;
+
+    // A new line is started every `chars_per_line` frames, the view follows it
+    const int typing_line = 20 + index / chars_per_line;
+    const int typed = index % chars_per_line;
+    const int first_line = typing_line > rows - 5 ? typing_line - rows + 5 : 0;
+
+    fill_rect(pixels, stride, width, height, 0, 0, width, height, background);
+    fill_rect(pixels, stride, width, height, 0, 0, gutter_cols * CELL_WIDTH, height, gutter);
+
+    for (int row = 0; row < rows; row++) {
+        const int line = first_line + row;
+        const int y = row * CELL_HEIGHT;
+        const int indent = (int)(hash(2, (uint32_t)line) % 4) * 4;
+        int length = indent + line_length(2, line, cols - indent > 60 ? 60 : cols - indent);
+
+        if (line == typing_line) {
+            length = indent + typed;
+            fill_rect(pixels, stride, width, height, gutter_cols * CELL_WIDTH, y, width, y + CELL_HEIGHT, current);
+        }
+
+        for (int digit = 0, n = line + 1; digit < 4 && n > 0; digit++, n /= 10) {
+            draw_char(pixels, stride, width, height, (4 - digit) * CELL_WIDTH, y, (uint32_t)(n % 10), line_number);
+        }
+
+        for (int col = indent; col < length && col < cols; col++) {
+            if (is_space(2, line, col)) continue;
+            draw_char(pixels, stride, width, height, (gutter_cols + col) * CELL_WIDTH, y, hash((uint32_t)line, (uint32_t)col) % 96, token_color(line, col));
+        }
+
+        // Caret, on for half a second and off for half a second at 30 frames per second
+        if (line == typing_line && index / 15 % 2 == 0) {
+            const int x = (gutter_cols + length) * CELL_WIDTH;
+            fill_rect(pixels, stride, width, height, x, y + 2, x + 2, y + CELL_HEIGHT - 2, (Rgb){ 0, 0, 0 });
+        }
+    }
+}
+
+static void render_wallpaper(const int width, const int height, uint8_t *pixels, const int stride)
+{
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            put_pixel(pixels, stride, x, y, (Rgb){
+                (uint8_t)(40 + 60 * y / height),
+                (uint8_t)(70 + 50 * x / width),
+                (uint8_t)(120 + 80 * (x + y) / (width + height)),
+            });
+        }
+    }
+
+    // Icons down the left side and a panel along the bottom
+    for (int i = 0; i < 6; i++) {
+        const int y = 24 + i * 96;
+        if (y + 64 > height - 48) break;
+
+        fill_rect(pixels, stride, width, height, 24, y, 88, y + 64, (Rgb){ (uint8_t)(hash(3, (uint32_t)i) & 0xFF), (uint8_t)(hash(4, (uint32_t)i) & 0xFF), 200 });
+    }
+
+    fill_rect(pixels, stride, width, height, 0, height - 40, width, height, (Rgb){ 20, 20, 24 });
+}
+
+static void render_video(const int index, const int width, const int height, uint8_t *pixels, const int stride)
+{
+    const int x0 = width / 4;
+    const int y0 = height / 4;
+    const int x1 = width * 3 / 4;
+    const int y1 = height * 3 / 4;
+    const float t = (float)index;
+
+    render_wallpaper(width, height, pixels, stride);
+
+    // Window frame and title bar
+    fill_rect(pixels, stride, width, height, x0 - 2, y0 - 30, x1 + 2, y1 + 2, (Rgb){ 60, 60, 60 });
+
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            const float u = (float)(x - x0);
+            const float v = (float)(y - y0);
+
+            // Moving plasma with fine detail on top, every pixel changes every frame
+            const float a = sinf(u * 0.021f + t * 0.09f) + sinf(v * 0.017f - t * 0.07f) + sinf((u + v) * 0.011f + t * 0.05f);
+            const float detail = (float)(hash((uint32_t)(x + index), (uint32_t)y) & 15) - 8.0f;
+
+            put_pixel(pixels, stride, x, y, (Rgb){
+                (uint8_t)fminf(255.0f, fmaxf(0.0f, 128.0f + 40.0f * a + detail)),
+                (uint8_t)fminf(255.0f, fmaxf(0.0f, 100.0f + 45.0f * sinf(a + t * 0.03f) + detail)),
+                (uint8_t)fminf(255.0f, fmaxf(0.0f, 90.0f + 50.0f * cosf(a * 1.3f) + detail)),
+            });
+        }
+    }
+}
+
+static void render_desktop(const int index, const int width, const int height, uint8_t *pixels, const int stride)
+{
+    const float t = (float)index;
+    const int cx = (int)((float)width * (0.5f + 0.4f * sinf(t * 0.05f)));
+    const int cy = (int)((float)height * (0.5f + 0.35f * sinf(t * 0.07f)));
+
+    render_wallpaper(width, height, pixels, stride);
+
+    // Arrow cursor, white with a black outline
+    for (int row = 0; row < 19; row++) {
+        const int span = row < 13 ? row : 13 - (row - 13) * 2;
+
+        for (int col = 0; col <= span && col < 12; col++) {
+            const int x = cx + col;
+            const int y = cy + row;
+            if (x < 0 || x >= width || y < 0 || y >= height) continue;
+
+            const bool is_edge = col == 0 || col == span || row == 18;
+            put_pixel(pixels, stride, x, y, is_edge ? (Rgb){ 0, 0, 0 } : (Rgb){ 255, 255, 255 });
+        }
+    }
+}
+
+void corpus_render(const enum CorpusClip clip, const int index, const int width, const int height, uint8_t *pixels, const int stride)
+{
+    switch (clip) {
+        case CLIP_TERMINAL:
+            render_terminal(index, width, height, pixels, stride);
+            break;
+        case CLIP_IDE:
+            render_ide(index, width, height, pixels, stride);
+            break;
+        case CLIP_VIDEO:
+            render_video(index, width, height, pixels, stride);
+            break;
+        case CLIP_DESKTOP:
+            render_desktop(index, width, height, pixels, stride);
+            break;
+        case CORPUS_CLIP_COUNT:
+            break;
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stdint.h>
+
+// Synthetic screen content for comparing presets. Every clip is drawn from its frame index
+// alone, so the same frame can be drawn again to score what came out of an encoder.
+enum CorpusClip {
+    // Text scrolling up in a terminal, half a line per frame
+    CLIP_TERMINAL,
+    // An editor with a line being typed, a character per frame, and a blinking caret
+    CLIP_IDE,
+    // A window playing smooth, busy video on a still desktop
+    CLIP_VIDEO,
+    // A still desktop with only the cursor moving
+    CLIP_DESKTOP,
+
+    CORPUS_CLIP_COUNT
+};
+
+extern const char * const CORPUS_CLIP_NAMES[];
+
+bool parse_corpus_clip(const char *name, enum CorpusClip *clip);
+
+// Draws frame `index` of `clip` into `pixels` as BGRx
+void corpus_render(enum CorpusClip clip, int index, int width, int height, uint8_t *pixels, int stride);
+
+#endif
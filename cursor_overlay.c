@@ -0,0 +1,557 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gstreamer-1.0/gst/gst.h>
+#include <gstreamer-1.0/gst/video/video.h>
+
+#include "cursor_overlay.h"
+#include "damage_convert.h"
+
+// Columns [x0, x1) and rows [y0, y1), empty when x1 <= x0
+typedef struct {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+} Rect;
+
+struct CursorOverlay {
+    GstPad *source_pad;
+    gulong source_probe;
+    // Src pad of `convert`, nullptr when the pointer is blended at the source
+    GstPad *output_pad;
+    gulong output_probe;
+    // The frames end up in the GIF encoder, which draws the pointer itself
+    bool is_layered;
+
+    GstVideoInfo source_info;
+    bool has_source_info;
+    GstVideoInfo output_info;
+    bool has_output_info;
+
+    // Sprite in capture coordinates, as the last meta with a bitmap had it
+    GstBuffer *bitmap;
+    int width;
+    int height;
+    int x;
+    int y;
+    bool is_visible;
+    bool is_new_sprite;
+    // Where the sprite was on the previous frame, in capture coordinates
+    Rect drawn;
+
+    // The sprite resized for a scaled output
+    GstBuffer *scaled;
+    int scaled_width;
+    int scaled_height;
+
+    guint64 frames;
+    guint64 moves;
+};
+
+static inline int min_int(const int a, const int b)
+{
+    return a < b ? a : b;
+}
+
+static inline int max_int(const int a, const int b)
+{
+    return a > b ? a : b;
+}
+
+static Rect clip_rect(const int x, const int y, const int width, const int height, const int frame_width, const int frame_height)
+{
+    return (Rect){ max_int(x, 0), max_int(y, 0), min_int(x + width, frame_width), min_int(y + height, frame_height) };
+}
+
+static bool is_empty(const Rect rect)
+{
+    return rect.x1 <= rect.x0 || rect.y1 <= rect.y0;
+}
+
+// BT.709 limited range with the same integer math as rgb_kernels.c, so the pointer matches
+// what rgbconvert makes of the frame around it
+static inline int luma(const int r, const int g, const int b)
+{
+    return ((47 * r + 157 * g + 16 * b + 128) >> 8) + 16;
+}
+
+static inline int chroma_u(const int r, const int g, const int b)
+{
+    return (-26 * r - 86 * g + 112 * b + (128 << 8) + 128) >> 8;
+}
+
+static inline int chroma_v(const int r, const int g, const int b)
+{
+    return (112 * r - 102 * g - 10 * b + (128 << 8) + 128) >> 8;
+}
+
+static inline uint8_t blend(const int under, const int over, const int alpha)
+{
+    return (uint8_t)((under * (255 - alpha) + over * alpha + 127) / 255);
+}
+
+static GstVideoRegionOfInterestMeta *find_meta(GstBuffer *buffer, const char *type)
+{
+    const GQuark quark = g_quark_from_static_string(type);
+    gpointer state = nullptr;
+    GstMeta *meta;
+
+    while ((meta = gst_buffer_iterate_meta_filtered(buffer, &state, GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE)) != NULL) {
+        GstVideoRegionOfInterestMeta *roi = (GstVideoRegionOfInterestMeta *)meta;
+        if (roi->roi_type == quark) return roi;
+    }
+
+    return nullptr;
+}
+
+static gboolean cb_remove_cursor(GstBuffer *buffer, GstMeta **meta, gpointer user_data)
+{
+    if ((*meta)->info->api == GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE
+        && ((GstVideoRegionOfInterestMeta *)*meta)->roi_type == g_quark_from_static_string(CURSOR_META_TYPE)) {
+        *meta = nullptr;
+    }
+
+    return TRUE;
+}
+
+static void read_meta(CursorOverlay *overlay, GstVideoRegionOfInterestMeta *roi)
+{
+    GstStructure *s = gst_video_region_of_interest_meta_get_param(roi, "cursor");
+
+    overlay->is_visible = roi->w > 0 && roi->h > 0;
+    if (s == NULL) return;
+
+    gst_structure_get_int(s, "x", &overlay->x);
+    gst_structure_get_int(s, "y", &overlay->y);
+
+    const GValue *value = gst_structure_get_value(s, "bitmap");
+    int width = 0;
+    int height = 0;
+
+    if (value == NULL || !GST_VALUE_HOLDS_BUFFER(value)
+        || !gst_structure_get_int(s, "width", &width) || !gst_structure_get_int(s, "height", &height)) {
+        return;
+    }
+
+    GstBuffer *bitmap = gst_value_get_buffer(value);
+
+    if (width <= 0 || height <= 0 || gst_buffer_get_size(bitmap) < (gsize)width * (gsize)height * 4) {
+        fprintf(stderr, "ERROR: Ignoring a %dx%d pointer sprite of %zu bytes\n", width, height, (size_t)gst_buffer_get_size(bitmap));
+        return;
+    }
+
+    gst_buffer_replace(&overlay->bitmap, bitmap);
+    gst_clear_buffer(&overlay->scaled);
+    overlay->width = width;
+    overlay->height = height;
+    overlay->is_new_sprite = true;
+}
+
+// Blends BGRA `sprite` over a 4 byte RGB frame, with red and blue swapped for RGBx and RGBA
+static void blend_rgb(GstVideoFrame *frame, const uint8_t *sprite, const int width, const int height, const int x, const int y)
+{
+    const GstVideoFormat format = GST_VIDEO_FRAME_FORMAT(frame);
+    const bool rgb_order = format == GST_VIDEO_FORMAT_RGBx || format == GST_VIDEO_FORMAT_RGBA;
+    const Rect rect = clip_rect(x, y, width, height, GST_VIDEO_FRAME_WIDTH(frame), GST_VIDEO_FRAME_HEIGHT(frame));
+    uint8_t *pixels = GST_VIDEO_FRAME_PLANE_DATA(frame, 0);
+    const int stride = GST_VIDEO_FRAME_PLANE_STRIDE(frame, 0);
+
+    for (int row = rect.y0; row < rect.y1; row++) {
+        const uint8_t *in = sprite + ((size_t)(row - y) * (size_t)width + (size_t)(rect.x0 - x)) * 4;
+        uint8_t *out = pixels + (size_t)row * (size_t)stride + (size_t)rect.x0 * 4;
+
+        for (int col = rect.x0; col < rect.x1; col++, in += 4, out += 4) {
+            const int alpha = in[3];
+            if (alpha == 0) continue;
+
+            out[0] = blend(out[0], rgb_order ? in[2] : in[0], alpha);
+            out[1] = blend(out[1], in[1], alpha);
+            out[2] = blend(out[2], rgb_order ? in[0] : in[2], alpha);
+        }
+    }
+}
+
+// Blends BGRA `sprite` over an I420 frame. Chroma takes the alpha weighted sprite colors of each
+// 2x2 block, so the edges of the pointer fade the way the luma does.
+static void blend_i420(GstVideoFrame *frame, const uint8_t *sprite, const int width, const int height, const int x, const int y)
+{
+    const int frame_width = GST_VIDEO_FRAME_WIDTH(frame);
+    const int frame_height = GST_VIDEO_FRAME_HEIGHT(frame);
+    const Rect rect = clip_rect(x, y, width, height, frame_width, frame_height);
+    uint8_t *luma_plane = GST_VIDEO_FRAME_PLANE_DATA(frame, 0);
+    uint8_t *u_plane = GST_VIDEO_FRAME_PLANE_DATA(frame, 1);
+    uint8_t *v_plane = GST_VIDEO_FRAME_PLANE_DATA(frame, 2);
+    const int luma_stride = GST_VIDEO_FRAME_PLANE_STRIDE(frame, 0);
+    const int u_stride = GST_VIDEO_FRAME_PLANE_STRIDE(frame, 1);
+    const int v_stride = GST_VIDEO_FRAME_PLANE_STRIDE(frame, 2);
+
+    for (int row = rect.y0; row < rect.y1; row++) {
+        const uint8_t *in = sprite + ((size_t)(row - y) * (size_t)width + (size_t)(rect.x0 - x)) * 4;
+        uint8_t *out = luma_plane + (size_t)row * (size_t)luma_stride;
+
+        for (int col = rect.x0; col < rect.x1; col++, in += 4) {
+            if (in[3] == 0) continue;
+            out[col] = blend(out[col], luma(in[2], in[1], in[0]), in[3]);
+        }
+    }
+
+    for (int block_y = rect.y0 / 2; block_y < (rect.y1 + 1) / 2; block_y++) {
+        for (int block_x = rect.x0 / 2; block_x < (rect.x1 + 1) / 2; block_x++) {
+            uint8_t *u = u_plane + (size_t)block_y * (size_t)u_stride + (size_t)block_x;
+            uint8_t *v = v_plane + (size_t)block_y * (size_t)v_stride + (size_t)block_x;
+            int pixels = 0;
+            int weight = 0;
+            int u_sum = 0;
+            int v_sum = 0;
+
+            for (int dy = 0; dy < 2; dy++) {
+                for (int dx = 0; dx < 2; dx++) {
+                    const int col = block_x * 2 + dx;
+                    const int row = block_y * 2 + dy;
+                    if (col >= frame_width || row >= frame_height) continue;
+
+                    pixels++;
+                    if (col < rect.x0 || col >= rect.x1 || row < rect.y0 || row >= rect.y1) continue;
+
+                    const uint8_t *in = sprite + ((size_t)(row - y) * (size_t)width + (size_t)(col - x)) * 4;
+                    const int alpha = in[3];
+
+                    weight += alpha;
+                    u_sum += alpha * (chroma_u(in[2], in[1], in[0]) - *u);
+                    v_sum += alpha * (chroma_v(in[2], in[1], in[0]) - *v);
+                }
+            }
+
+            if (weight == 0) continue;
+
+            *u = (uint8_t)(*u + u_sum / (pixels * 255));
+            *v = (uint8_t)(*v + v_sum / (pixels * 255));
+        }
+    }
+}
+
+// The sprite in output coordinates, resized with nearest neighbour when the output is scaled
+static bool get_output_sprite(CursorOverlay *overlay, const int output_width, const int output_height, CursorSprite *sprite)
+{
+    const int source_width = GST_VIDEO_INFO_WIDTH(&overlay->source_info);
+    const int source_height = GST_VIDEO_INFO_HEIGHT(&overlay->source_info);
+
+    if (!overlay->is_visible || overlay->bitmap == NULL || source_width <= 0 || source_height <= 0) return false;
+
+    sprite->x = (int)((gint64)overlay->x * output_width / source_width);
+    sprite->y = (int)((gint64)overlay->y * output_height / source_height);
+
+    if (output_width == source_width && output_height == source_height) {
+        sprite->width = overlay->width;
+        sprite->height = overlay->height;
+        sprite->bitmap = overlay->bitmap;
+        return true;
+    }
+
+    const int width = max_int(1, (int)((gint64)overlay->width * output_width / source_width));
+    const int height = max_int(1, (int)((gint64)overlay->height * output_height / source_height));
+
+    if (overlay->scaled == NULL || overlay->scaled_width != width || overlay->scaled_height != height) {
+        GstMapInfo in;
+        GstMapInfo out;
+
+        gst_clear_buffer(&overlay->scaled);
+        overlay->scaled = gst_buffer_new_allocate(nullptr, (gsize)width * (gsize)height * 4, nullptr);
+
+        if (overlay->scaled == NULL || !gst_buffer_map(overlay->bitmap, &in, GST_MAP_READ)) {
+            gst_clear_buffer(&overlay->scaled);
+            return false;
+        }
+
+        gst_buffer_map(overlay->scaled, &out, GST_MAP_WRITE);
+
+        for (int row = 0; row < height; row++) {
+            const int source_row = row * overlay->height / height;
+
+            for (int col = 0; col < width; col++) {
+                const int source_col = col * overlay->width / width;
+                memcpy(out.data + ((size_t)row * (size_t)width + (size_t)col) * 4, in.data + ((size_t)source_row * (size_t)overlay->width + (size_t)source_col) * 4, 4);
+            }
+        }
+
+        gst_buffer_unmap(overlay->scaled, &out);
+        gst_buffer_unmap(overlay->bitmap, &in);
+
+        overlay->scaled_width = width;
+        overlay->scaled_height = height;
+    }
+
+    sprite->width = width;
+    sprite->height = height;
+    sprite->bitmap = overlay->scaled;
+
+    return true;
+}
+
+// Blends the sprite into `buffer`, which has to be writable, as a frame described by `info`
+static void draw_sprite(const GstVideoInfo *info, GstBuffer *buffer, const CursorSprite *sprite)
+{
+    const GstVideoFormat format = GST_VIDEO_INFO_FORMAT(info);
+    const bool is_rgb = format == GST_VIDEO_FORMAT_BGRx || format == GST_VIDEO_FORMAT_BGRA
+        || format == GST_VIDEO_FORMAT_RGBx || format == GST_VIDEO_FORMAT_RGBA;
+    GstVideoFrame frame;
+    GstMapInfo map;
+
+    if (!is_rgb && format != GST_VIDEO_FORMAT_I420) return;
+    if (!gst_buffer_map(sprite->bitmap, &map, GST_MAP_READ)) return;
+
+    if (gst_video_frame_map(&frame, info, buffer, GST_MAP_WRITE)) {
+        if (is_rgb) {
+            blend_rgb(&frame, map.data, sprite->width, sprite->height, sprite->x, sprite->y);
+        } else {
+            blend_i420(&frame, map.data, sprite->width, sprite->height, sprite->x, sprite->y);
+        }
+
+        gst_video_frame_unmap(&frame);
+    }
+
+    gst_buffer_unmap(sprite->bitmap, &map);
+}
+
+static void add_damage(GstBuffer *buffer, const Rect rect)
+{
+    if (is_empty(rect)) return;
+
+    gst_buffer_add_video_region_of_interest_meta(buffer, DAMAGE_META_TYPE,
+        (guint)rect.x0, (guint)rect.y0, (guint)(rect.x1 - rect.x0), (guint)(rect.y1 - rect.y0));
+}
+
+static void forget_pointer(CursorOverlay *overlay)
+{
+    gst_clear_buffer(&overlay->bitmap);
+    gst_clear_buffer(&overlay->scaled);
+    overlay->is_visible = false;
+    overlay->is_new_sprite = false;
+    overlay->drawn = (Rect){ 0 };
+}
+
+static GstPadProbeReturn cb_source(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    CursorOverlay *overlay = user_data;
+
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+
+        if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS) {
+            GstCaps *caps;
+            gst_event_parse_caps(event, &caps);
+            overlay->has_source_info = gst_video_info_from_caps(&overlay->source_info, caps);
+            overlay->drawn = (Rect){ 0 };
+        } else if (GST_EVENT_TYPE(event) == GST_EVENT_FLUSH_STOP) {
+            overlay->drawn = (Rect){ 0 };
+        }
+
+        return GST_PAD_PROBE_OK;
+    }
+
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstVideoRegionOfInterestMeta *roi = find_meta(buffer, CURSOR_META_TYPE);
+
+    if (roi) read_meta(overlay, roi);
+    if (overlay->bitmap == NULL || !overlay->has_source_info) return GST_PAD_PROBE_OK;
+
+    overlay->frames++;
+
+    const Rect now = overlay->is_visible
+        ? clip_rect(overlay->x, overlay->y, overlay->width, overlay->height, GST_VIDEO_INFO_WIDTH(&overlay->source_info), GST_VIDEO_INFO_HEIGHT(&overlay->source_info))
+        : (Rect){ 0 };
+    const bool moved = overlay->is_new_sprite || memcmp(&now, &overlay->drawn, sizeof(now)) != 0;
+    const bool is_blended_here = overlay->output_pad == NULL && !is_empty(now);
+
+    if (moved || is_blended_here) {
+        const bool has_damage = find_meta(buffer, DAMAGE_META_TYPE) != NULL;
+
+        buffer = gst_buffer_make_writable(buffer);
+
+        // Without damage the frame would be hashed, and dropped as a duplicate when only the
+        // pointer changed. Damage over the whole frame means the same as none to everything else.
+        if (moved && has_damage) {
+            add_damage(buffer, overlay->drawn);
+            add_damage(buffer, now);
+        } else if (moved) {
+            add_damage(buffer, (Rect){ 0, 0, GST_VIDEO_INFO_WIDTH(&overlay->source_info), GST_VIDEO_INFO_HEIGHT(&overlay->source_info) });
+        }
+
+        CursorSprite sprite;
+        if (is_blended_here && get_output_sprite(overlay, GST_VIDEO_INFO_WIDTH(&overlay->source_info), GST_VIDEO_INFO_HEIGHT(&overlay->source_info), &sprite)) {
+            draw_sprite(&overlay->source_info, buffer, &sprite);
+        }
+
+        GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    }
+
+    if (moved) overlay->moves++;
+    overlay->drawn = now;
+    overlay->is_new_sprite = false;
+
+    return GST_PAD_PROBE_OK;
+}
+
+// Runs in the same streaming thread as cb_source() with no queue in between, so the pointer is
+// still the one of this frame
+static GstPadProbeReturn cb_output(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    CursorOverlay *overlay = user_data;
+
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+
+        if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS) {
+            GstCaps *caps;
+            gst_event_parse_caps(event, &caps);
+            overlay->has_output_info = gst_video_info_from_caps(&overlay->output_info, caps);
+        }
+
+        return GST_PAD_PROBE_OK;
+    }
+
+    const int width = GST_VIDEO_INFO_WIDTH(&overlay->output_info);
+    const int height = GST_VIDEO_INFO_HEIGHT(&overlay->output_info);
+    CursorSprite sprite;
+
+    if (!overlay->has_output_info || !get_output_sprite(overlay, width, height, &sprite)) return GST_PAD_PROBE_OK;
+
+    GstBuffer *buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+
+    if (overlay->is_layered) {
+        gst_buffer_foreach_meta(buffer, cb_remove_cursor, nullptr);
+        cursor_meta_add(buffer, &sprite, width, height);
+    } else {
+        draw_sprite(&overlay->output_info, buffer, &sprite);
+    }
+
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+
+    return GST_PAD_PROBE_OK;
+}
+
+CursorOverlay *cursor_overlay_attach(GstElement *pipeline)
+{
+    static const char * const targets[] = { "scale", "damage", "convert", "spoolsink" };
+    GstElement *element = nullptr;
+
+    for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]) && element == NULL; i++) {
+        element = gst_bin_get_by_name(GST_BIN(pipeline), targets[i]);
+    }
+
+    if (element == NULL) {
+        fprintf(stderr, "ERROR: Pipeline has nothing to draw the pointer in front of\n");
+        return nullptr;
+    }
+
+    // The src pad feeding it rather than its sink pad, where frame dedup pushes the frame it held
+    // back through a second time
+    GstPad *sink = gst_element_get_static_pad(element, "sink");
+    GstPad *source = gst_pad_get_peer(sink);
+
+    gst_object_unref(sink);
+    gst_object_unref(element);
+
+    if (source == NULL) {
+        fprintf(stderr, "ERROR: Pipeline has no source linked to draw the pointer on\n");
+        return nullptr;
+    }
+
+    CursorOverlay *overlay = calloc(1, sizeof(CursorOverlay));
+
+    if (overlay == NULL) {
+        gst_object_unref(source);
+        return nullptr;
+    }
+
+    overlay->source_pad = source;
+    overlay->source_probe = gst_pad_add_probe(source, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, cb_source, overlay, nullptr);
+
+    GstElement *convert = gst_bin_get_by_name(GST_BIN(pipeline), "convert");
+    GstElement *gif_sink = gst_bin_get_by_name(GST_BIN(pipeline), "gifsink");
+
+    if (convert) {
+        overlay->output_pad = gst_element_get_static_pad(convert, "src");
+        overlay->output_probe = gst_pad_add_probe(overlay->output_pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, cb_output, overlay, nullptr);
+        overlay->is_layered = gif_sink != NULL;
+        gst_object_unref(convert);
+    }
+
+    if (gif_sink) gst_object_unref(gif_sink);
+
+    return overlay;
+}
+
+void cursor_overlay_reset(CursorOverlay *overlay)
+{
+    if (overlay->frames > 0) {
+        printf("INFO: Pointer changed on %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " frames\n", overlay->moves, overlay->frames);
+    }
+
+    forget_pointer(overlay);
+    overlay->frames = 0;
+    overlay->moves = 0;
+}
+
+void cursor_overlay_free(CursorOverlay *overlay)
+{
+    if (overlay == NULL) return;
+
+    gst_pad_remove_probe(overlay->source_pad, overlay->source_probe);
+    gst_object_unref(overlay->source_pad);
+
+    if (overlay->output_pad) {
+        gst_pad_remove_probe(overlay->output_pad, overlay->output_probe);
+        gst_object_unref(overlay->output_pad);
+    }
+
+    forget_pointer(overlay);
+    free(overlay);
+}
+
+bool cursor_meta_get(GstBuffer *buffer, CursorSprite *sprite)
+{
+    GstVideoRegionOfInterestMeta *roi = find_meta(buffer, CURSOR_META_TYPE);
+    if (roi == NULL || roi->w == 0 || roi->h == 0) return false;
+
+    GstStructure *s = gst_video_region_of_interest_meta_get_param(roi, "cursor");
+    if (s == NULL) return false;
+
+    const GValue *value = gst_structure_get_value(s, "bitmap");
+
+    if (value == NULL || !GST_VALUE_HOLDS_BUFFER(value)
+        || !gst_structure_get_int(s, "x", &sprite->x) || !gst_structure_get_int(s, "y", &sprite->y)
+        || !gst_structure_get_int(s, "width", &sprite->width) || !gst_structure_get_int(s, "height", &sprite->height)) {
+        return false;
+    }
+
+    sprite->bitmap = gst_value_get_buffer(value);
+
+    return sprite->width > 0 && sprite->height > 0 && gst_buffer_get_size(sprite->bitmap) >= (gsize)sprite->width * (gsize)sprite->height * 4;
+}
+
+void cursor_meta_add(GstBuffer *buffer, const CursorSprite *sprite, const int frame_width, const int frame_height)
+{
+    Rect rect = clip_rect(sprite->x, sprite->y, sprite->width, sprite->height, frame_width, frame_height);
+    if (is_empty(rect)) rect = (Rect){ 0 };
+
+    GstVideoRegionOfInterestMeta *meta = gst_buffer_add_video_region_of_interest_meta(buffer, CURSOR_META_TYPE,
+        (guint)rect.x0, (guint)rect.y0, (guint)(rect.x1 - rect.x0), (guint)(rect.y1 - rect.y0));
+
+    if (sprite->bitmap == NULL) {
+        gst_video_region_of_interest_meta_add_param(meta, gst_structure_new("cursor",
+            "x", G_TYPE_INT, sprite->x,
+            "y", G_TYPE_INT, sprite->y,
+            nullptr));
+        return;
+    }
+
+    gst_video_region_of_interest_meta_add_param(meta, gst_structure_new("cursor",
+        "x", G_TYPE_INT, sprite->x,
+        "y", G_TYPE_INT, sprite->y,
+        "width", G_TYPE_INT, sprite->width,
+        "height", G_TYPE_INT, sprite->height,
+        "bitmap", GST_TYPE_BUFFER, sprite->bitmap,
+        nullptr));
+}
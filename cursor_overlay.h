@@ -0,0 +1,55 @@
+#ifndef CURSOR_OVERLAY_H
+#define CURSOR_OVERLAY_H
+
+#include <gstreamer-1.0/gst/gst.h>
+
+// The pointer travels as a GstVideoRegionOfInterestMeta of this type, which capturesrc makes of
+// the SPA_META_Cursor coming with the frames when the stream is started with cursor-mode 2. Its
+// rectangle is the part of the sprite inside the frame, 0x0 while the pointer is hidden. A
+// "cursor" parameter gives the top left corner of the sprite as "x" and "y", which may be outside
+// the frame, and when the sprite is new or changed a "bitmap" GstBuffer of BGRA with straight
+// alpha and its "width" and "height". Frames without it are left alone.
+#define CURSOR_META_TYPE "cursor"
+
+typedef struct CursorOverlay CursorOverlay;
+
+typedef struct {
+    // Top left corner of the sprite in frame coordinates
+    int x;
+    int y;
+    int width;
+    int height;
+    // `width` * `height` BGRA pixels, borrowed from the meta
+    GstBuffer *bitmap;
+} CursorSprite;
+
+// Follows the pointer on the frames entering the first of `scale`, `damage`, `convert` or
+// `spoolsink`, and draws it as a layer of its own instead of having it baked into every frame:
+//
+// - A move adds damage for where the sprite was and where it is, so damageconvert and frame
+//   dedup see the few tiles under it change instead of a whole new frame, and a still pointer on
+//   a still screen keeps the frame a duplicate.
+// - It is blended into the I420 frames coming out of `convert`, which are freshly allocated, so
+//   nothing is copied for it.
+// - In front of `gifsink` every frame gets a complete meta instead, for the GIF encoder to draw it
+//   as its own sub-image, see gif_encoder_push_layered_frame().
+// - Pipelines without `convert` (the spool) get it blended into the RGB frames right away.
+//
+// Returns nullptr when there is no element to follow the pointer in front of.
+CursorOverlay *cursor_overlay_attach(GstElement *pipeline);
+
+// Forgets the pointer, for a pipeline going back to READY
+void cursor_overlay_reset(CursorOverlay *overlay);
+
+// Removes the probes, call it once no more buffers are flowing
+void cursor_overlay_free(CursorOverlay *overlay);
+
+// Reads a complete CURSOR_META_TYPE meta of `buffer`, one that carries its bitmap. Returns false
+// when there is none or the pointer is hidden.
+bool cursor_meta_get(GstBuffer *buffer, CursorSprite *sprite);
+
+// Attaches a CURSOR_META_TYPE meta for `sprite` to `buffer`, which has to be writable. Without a
+// `bitmap` it only moves the sprite sent before, and a 0x0 `sprite` hides it.
+void cursor_meta_add(GstBuffer *buffer, const CursorSprite *sprite, int frame_width, int frame_height);
+
+#endif
@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <gstreamer-1.0/gst/gst.h>
+#include <gstreamer-1.0/gst/video/video.h>
+#include <gstreamer-1.0/gst/video/gstvideofilter.h>
+
+#include "damage_convert.h"
+#include "thread_pool.h"
+#include "rgb_kernels.h"
+
+#define SINK_CAPS GST_VIDEO_CAPS_MAKE("{ BGRx, BGRA, RGBx, RGBA }")
+#define SRC_CAPS GST_VIDEO_CAPS_MAKE("I420") ", colorimetry=(string)bt709"
+
+#define PLANE_ALIGNMENT 32
+
+enum {
+    PROP_0,
+    PROP_N_THREADS,
+    PROP_DROP_UNDAMAGED,
+};
+
+typedef struct {
+    GstVideoFilter parent;
+
+    int n_threads;
+    gboolean drop_undamaged;
+
+    ThreadPool *pool;
+    const RgbKernel *kernel;
+    bool rgb_order;
+
+    // Last converted frame in I420, tiles without damage are taken from here
+    uint8_t *frame;
+    uint8_t *planes[3];
+    int strides[3];
+    bool has_previous;
+
+    int tiles_x;
+    int tiles_y;
+    uint8_t *dirty;
+
+    // Only set while a frame is being converted
+    const GstVideoFrame *input;
+
+    guint64 frames;
+    guint64 dropped;
+    guint64 tiles_converted;
+} DamageConvert;
+
+typedef struct {
+    GstVideoFilterClass parent_class;
+} DamageConvertClass;
+
+G_DEFINE_TYPE(DamageConvert, damage_convert, GST_TYPE_VIDEO_FILTER)
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE("sink", GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS(SINK_CAPS));
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE("src", GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS(SRC_CAPS));
+
+static GQuark damage_quark;
+
+static int min_int(const int a, const int b)
+{
+    return a < b ? a : b;
+}
+
+static int align(const int value)
+{
+    return (value + PLANE_ALIGNMENT - 1) & ~(PLANE_ALIGNMENT - 1);
+}
+
+// Tiles start on even rows and columns, so every 2x2 chroma block lies inside one tile
+static void convert_tile(DamageConvert *self, const int tile_x, const int tile_y)
+{
+    const GstVideoFrame *input = self->input;
+    const int width = GST_VIDEO_FRAME_WIDTH(input);
+    const int height = GST_VIDEO_FRAME_HEIGHT(input);
+    const int stride = GST_VIDEO_FRAME_PLANE_STRIDE(input, 0);
+    const uint8_t *pixels = GST_VIDEO_FRAME_PLANE_DATA(input, 0);
+
+    const int x0 = tile_x * DAMAGE_TILE_SIZE;
+    const int y0 = tile_y * DAMAGE_TILE_SIZE;
+    const int x1 = min_int(x0 + DAMAGE_TILE_SIZE, width);
+    const int y1 = min_int(y0 + DAMAGE_TILE_SIZE, height);
+
+    for (int y = y0; y < y1; y += 2) {
+        // The last row of an odd height goes into the spare luma row
+        const uint8_t *row0 = pixels + (size_t)y * stride + x0 * 4;
+        const uint8_t *row1 = y + 1 < height ? row0 + stride : row0;
+
+        uint8_t *luma0 = self->planes[0] + (size_t)y * self->strides[0] + x0;
+        uint8_t *u = self->planes[1] + (size_t)(y / 2) * self->strides[1] + x0 / 2;
+        uint8_t *v = self->planes[2] + (size_t)(y / 2) * self->strides[2] + x0 / 2;
+
+        self->kernel->to_i420(row0, row1, x1 - x0, self->rgb_order, luma0, luma0 + self->strides[0], u, v);
+    }
+}
+
+static void convert_task(void *context, const int tile_y, const int worker_index)
+{
+    DamageConvert *self = context;
+
+    for (int tile_x = 0; tile_x < self->tiles_x; tile_x++) {
+        if (self->dirty[tile_y * self->tiles_x + tile_x]) convert_tile(self, tile_x, tile_y);
+    }
+}
+
+// Marks the tiles touched by the damage of `buffer` and returns how many there are
+static int mark_damage(DamageConvert *self, GstBuffer *buffer, const int width, const int height)
+{
+    const int n_tiles = self->tiles_x * self->tiles_y;
+    bool has_damage_info = false;
+    int n_dirty = 0;
+    gpointer state = nullptr;
+    GstMeta *meta;
+
+    memset(self->dirty, 0, (size_t)n_tiles);
+
+    while ((meta = gst_buffer_iterate_meta_filtered(buffer, &state, GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE)) != NULL) {
+        const GstVideoRegionOfInterestMeta *roi = (const GstVideoRegionOfInterestMeta *)meta;
+
+        if (roi->roi_type != damage_quark) continue;
+
+        has_damage_info = true;
+
+        const int x0 = min_int((int)roi->x, width);
+        const int y0 = min_int((int)roi->y, height);
+        const int x1 = min_int((int)(roi->x + roi->w), width);
+        const int y1 = min_int((int)(roi->y + roi->h), height);
+
+        if (x1 <= x0 || y1 <= y0) continue;
+
+        for (int tile_y = y0 / DAMAGE_TILE_SIZE; tile_y <= (y1 - 1) / DAMAGE_TILE_SIZE; tile_y++) {
+            for (int tile_x = x0 / DAMAGE_TILE_SIZE; tile_x <= (x1 - 1) / DAMAGE_TILE_SIZE; tile_x++) {
+                uint8_t *dirty = &self->dirty[tile_y * self->tiles_x + tile_x];
+                n_dirty += !*dirty;
+                *dirty = 1;
+            }
+        }
+    }
+
+    // Without damage, or without a previous frame to fill in from, everything is converted
+    if (!has_damage_info || !self->has_previous) {
+        memset(self->dirty, 1, (size_t)n_tiles);
+        return n_tiles;
+    }
+
+    return n_dirty;
+}
+
+static void copy_planes(const DamageConvert *self, GstVideoFrame *output)
+{
+    const int width = GST_VIDEO_FRAME_WIDTH(output);
+    const int height = GST_VIDEO_FRAME_HEIGHT(output);
+
+    for (int plane = 0; plane < 3; plane++) {
+        const int plane_width = plane == 0 ? width : (width + 1) / 2;
+        const int plane_height = plane == 0 ? height : (height + 1) / 2;
+        uint8_t *dest = GST_VIDEO_FRAME_PLANE_DATA(output, plane);
+        const int dest_stride = GST_VIDEO_FRAME_PLANE_STRIDE(output, plane);
+
+        for (int y = 0; y < plane_height; y++) {
+            memcpy(dest + (size_t)y * dest_stride, self->planes[plane] + (size_t)y * self->strides[plane], (size_t)plane_width);
+        }
+    }
+}
+
+static GstFlowReturn damage_convert_transform_frame(GstVideoFilter *filter, GstVideoFrame *input, GstVideoFrame *output)
+{
+    DamageConvert *self = (DamageConvert *)filter;
+    const int n_dirty = mark_damage(self, input->buffer, GST_VIDEO_FRAME_WIDTH(input), GST_VIDEO_FRAME_HEIGHT(input));
+
+    self->frames++;
+
+    if (n_dirty == 0 && self->drop_undamaged) {
+        self->dropped++;
+        return GST_BASE_TRANSFORM_FLOW_DROPPED;
+    }
+
+    if (n_dirty > 0) {
+        self->input = input;
+        thread_pool_run(self->pool, self->tiles_y, convert_task, self);
+        self->input = nullptr;
+
+        self->tiles_converted += (guint64)n_dirty;
+        self->has_previous = true;
+    }
+
+    copy_planes(self, output);
+
+    return GST_FLOW_OK;
+}
+
+static void free_frame(DamageConvert *self)
+{
+    free(self->frame);
+    free(self->dirty);
+
+    self->frame = nullptr;
+    self->dirty = nullptr;
+    self->has_previous = false;
+}
+
+static gboolean damage_convert_set_info(GstVideoFilter *filter, GstCaps *incaps, GstVideoInfo *in_info, GstCaps *outcaps, GstVideoInfo *out_info)
+{
+    DamageConvert *self = (DamageConvert *)filter;
+    const int width = GST_VIDEO_INFO_WIDTH(in_info);
+    const int height = GST_VIDEO_INFO_HEIGHT(in_info);
+    const GstVideoFormat format = GST_VIDEO_INFO_FORMAT(in_info);
+
+    self->rgb_order = format == GST_VIDEO_FORMAT_RGBx || format == GST_VIDEO_FORMAT_RGBA;
+
+    free_frame(self);
+
+    self->strides[0] = align(width);
+    self->strides[1] = align((width + 1) / 2);
+    self->strides[2] = self->strides[1];
+
+    // One spare luma row, so an odd height never needs a special case
+    const size_t luma_size = (size_t)self->strides[0] * (size_t)(height + 1);
+    const size_t chroma_size = (size_t)self->strides[1] * (size_t)((height + 1) / 2);
+
+    self->tiles_x = (width + DAMAGE_TILE_SIZE - 1) / DAMAGE_TILE_SIZE;
+    self->tiles_y = (height + DAMAGE_TILE_SIZE - 1) / DAMAGE_TILE_SIZE;
+
+    self->frame = malloc(luma_size + 2 * chroma_size);
+    self->dirty = malloc((size_t)(self->tiles_x * self->tiles_y));
+
+    if (self->frame == NULL || self->dirty == NULL) {
+        free_frame(self);
+        return FALSE;
+    }
+
+    self->planes[0] = self->frame;
+    self->planes[1] = self->frame + luma_size;
+    self->planes[2] = self->planes[1] + chroma_size;
+
+    if (self->pool == NULL || thread_pool_size(self->pool) != self->n_threads) {
+        if (self->pool) thread_pool_free(self->pool);
+        self->pool = thread_pool_new(self->n_threads);
+    }
+
+    return self->pool != NULL;
+}
+
+static GstCaps *damage_convert_transform_caps(GstBaseTransform *trans, const GstPadDirection direction, GstCaps *caps, GstCaps *filter)
+{
+    GstCaps *stripped = gst_caps_copy(caps);
+
+    for (guint i = 0; i < gst_caps_get_size(stripped); i++) {
+        gst_structure_remove_fields(gst_caps_get_structure(stripped, i), "format", "colorimetry", "chroma-site", nullptr);
+    }
+
+    // Same size and frame rate, only the format of the other pad changes
+    GstCaps *other = gst_caps_from_string(direction == GST_PAD_SINK ? SRC_CAPS : SINK_CAPS);
+    GstCaps *result = gst_caps_intersect(stripped, other);
+
+    gst_caps_unref(stripped);
+    gst_caps_unref(other);
+
+    if (filter) {
+        GstCaps *filtered = gst_caps_intersect_full(filter, result, GST_CAPS_INTERSECT_FIRST);
+        gst_caps_unref(result);
+        result = filtered;
+    }
+
+    return result;
+}
+
+static gboolean damage_convert_stop(GstBaseTransform *trans)
+{
+    DamageConvert *self = (DamageConvert *)trans;
+    const guint64 converted_frames = self->frames - self->dropped;
+
+    if (self->frames > 0 && self->tiles_x > 0) {
+        printf("INFO: damageconvert: %" G_GUINT64_FORMAT " frames, %" G_GUINT64_FORMAT " dropped without damage, %.1f%% of tiles converted\n",
+            self->frames, self->dropped,
+            converted_frames > 0 ? 100.0 * (double)self->tiles_converted / ((double)converted_frames * self->tiles_x * self->tiles_y) : 0.0);
+    }
+
+    self->frames = 0;
+    self->dropped = 0;
+    self->tiles_converted = 0;
+    free_frame(self);
+
+    return TRUE;
+}
+
+static void damage_convert_set_property(GObject *object, const guint property_id, const GValue *value, GParamSpec *pspec)
+{
+    DamageConvert *self = (DamageConvert *)object;
+
+    switch (property_id) {
+        case PROP_N_THREADS:
+            self->n_threads = g_value_get_int(value);
+            break;
+        case PROP_DROP_UNDAMAGED:
+            self->drop_undamaged = g_value_get_boolean(value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
+static void damage_convert_get_property(GObject *object, const guint property_id, GValue *value, GParamSpec *pspec)
+{
+    const DamageConvert *self = (const DamageConvert *)object;
+
+    switch (property_id) {
+        case PROP_N_THREADS:
+            g_value_set_int(value, self->n_threads);
+            break;
+        case PROP_DROP_UNDAMAGED:
+            g_value_set_boolean(value, self->drop_undamaged);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
+static void damage_convert_finalize(GObject *object)
+{
+    DamageConvert *self = (DamageConvert *)object;
+
+    if (self->pool) thread_pool_free(self->pool);
+    free_frame(self);
+
+    G_OBJECT_CLASS(damage_convert_parent_class)->finalize(object);
+}
+
+static void damage_convert_class_init(DamageConvertClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+    GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+    GstBaseTransformClass *trans_class = GST_BASE_TRANSFORM_CLASS(klass);
+    GstVideoFilterClass *filter_class = GST_VIDEO_FILTER_CLASS(klass);
+
+    gobject_class->set_property = damage_convert_set_property;
+    gobject_class->get_property = damage_convert_get_property;
+    gobject_class->finalize = damage_convert_finalize;
+
+    g_object_class_install_property(gobject_class, PROP_N_THREADS,
+        g_param_spec_int("n-threads", "Threads", "Threads the damaged tiles are converted on", 1, 256, 1, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property(gobject_class, PROP_DROP_UNDAMAGED,
+        g_param_spec_boolean("drop-undamaged", "Drop undamaged", "Drop frames without damage instead of repeating the previous one", TRUE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    gst_element_class_add_static_pad_template(element_class, &sink_template);
+    gst_element_class_add_static_pad_template(element_class, &src_template);
+    gst_element_class_set_static_metadata(element_class, "Damage aware converter", "Filter/Converter/Video",
+        "Converts only the damaged tiles of RGB screen captures to I420", "record_area");
+
+    trans_class->transform_caps = damage_convert_transform_caps;
+    trans_class->stop = damage_convert_stop;
+
+    filter_class->set_info = damage_convert_set_info;
+    filter_class->transform_frame = damage_convert_transform_frame;
+
+    damage_quark = g_quark_from_static_string(DAMAGE_META_TYPE);
+}
+
+static void damage_convert_init(DamageConvert *self)
+{
+    self->n_threads = 1;
+    self->drop_undamaged = TRUE;
+    self->kernel = rgb_kernel_get(nullptr);
+}
+
+bool damage_convert_register(void)
+{
+    return gst_element_register(nullptr, "damageconvert", GST_RANK_NONE, damage_convert_get_type());
+}
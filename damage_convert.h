@@ -0,0 +1,19 @@
+#ifndef DAMAGE_CONVERT_H
+#define DAMAGE_CONVERT_H
+
+// Damaged rectangles travel as GstVideoRegionOfInterestMeta of this type. A buffer with only an
+// empty one (0x0) did not change at all, a buffer without any was fully redrawn.
+#define DAMAGE_META_TYPE "damage"
+
+// Width and height of the blocks that are converted or kept as a whole
+#define DAMAGE_TILE_SIZE 64
+
+// Registers the `damageconvert` element for this process. It converts RGB screen captures to I420
+// like videoconvert, but only the tiles touched by the damage of each frame. The rest is copied
+// from the previous frame, and frames with no damage are dropped so the encoder never sees them.
+//
+// Properties: `n-threads` (default 1) spreads the tiles over a thread pool, `drop-undamaged`
+// (default true) can be turned off to repeat the previous frame instead.
+bool damage_convert_register(void);
+
+#endif
@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gstreamer-1.0/gst/gst.h>
+
+#include "encoder_tuner.h"
+
+#define TUNER_INTERVAL_US (1000 * 1000)
+
+// Share of the wall time the encoder may spend encoding before it counts as falling behind, and
+// the share a slower step has to fit in before one is tried
+#define TUNER_BUSY_HIGH 0.85
+#define TUNER_BUSY_LOW 0.5
+// Frames waiting in front of the encoder, more than this is a backlog building up
+#define TUNER_QUEUE_HIGH 4
+// A faster step is taken at once, a slower one only after this many intervals with room to spare
+#define TUNER_CALM_INTERVALS 5
+// Intervals to wait after a step so the measurements reflect it
+#define TUNER_SETTLE_INTERVALS 2
+
+typedef struct {
+    int cpu_used;
+    int max_quantizer;
+    // Fraction of the target frame rate let through to the converter
+    int fps_num;
+    int fps_den;
+} TunerStep;
+
+// From best quality to fastest, every recording starts at TUNER_PRESET_STEP which matches PIPELINES[]
+static const TunerStep TUNER_STEPS[] = {
+    { 4, 17, 1, 1 },
+    { 8, 17, 1, 1 },
+    { 16, 17, 1, 1 },
+    { 16, 24, 1, 1 },
+    { 16, 32, 1, 1 },
+    { 16, 32, 3, 4 },
+    { 16, 40, 1, 2 },
+};
+
+#define TUNER_STEP_COUNT ((int)(sizeof(TUNER_STEPS) / sizeof(TUNER_STEPS[0])))
+#define TUNER_PRESET_STEP 2
+
+struct EncoderTuner {
+    Recording *recording;
+    GstElement *encoder;
+    FILE *log;
+
+    int target_fps;
+    int step;
+    int adjustments;
+    gint64 start_time;
+
+    // Frames closer together than this are dropped in front of the converter
+    GstPad *rate_pad;
+    gulong rate_probe;
+    gint min_interval_us;
+    gint skipped;
+    GstClockTime last_pts;
+
+    GThread *thread;
+    GMutex lock;
+    GCond cond;
+    bool stopping;
+};
+
+static GstPadProbeReturn cb_limit_rate(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    EncoderTuner *tuner = user_data;
+    const GstClockTime pts = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+    const GstClockTime min_interval = (GstClockTime)g_atomic_int_get(&tuner->min_interval_us) * GST_USECOND;
+
+    if (!GST_CLOCK_TIME_IS_VALID(pts)) return GST_PAD_PROBE_OK;
+
+    // Some slack, so frames arriving at about the target rate are not thinned out by jitter
+    if (GST_CLOCK_TIME_IS_VALID(tuner->last_pts) && pts < tuner->last_pts + min_interval - min_interval / 8) {
+        g_atomic_int_inc(&tuner->skipped);
+        return GST_PAD_PROBE_DROP;
+    }
+
+    tuner->last_pts = pts;
+
+    return GST_PAD_PROBE_OK;
+}
+
+static int step_fps(const EncoderTuner *tuner, const int step)
+{
+    const int fps = tuner->target_fps * TUNER_STEPS[step].fps_num / TUNER_STEPS[step].fps_den;
+
+    return fps > 0 ? fps : 1;
+}
+
+static void apply_step(EncoderTuner *tuner, const int step)
+{
+    const TunerStep *settings = &TUNER_STEPS[step];
+
+    // vp8enc takes both while encoding, the next frame uses them
+    g_object_set(tuner->encoder, "cpu-used", settings->cpu_used, "max-quantizer", settings->max_quantizer, nullptr);
+    g_atomic_int_set(&tuner->min_interval_us, 1000000 / step_fps(tuner, step));
+
+    tuner->step = step;
+}
+
+static void log_line(const EncoderTuner *tuner, const char *line)
+{
+    printf("INFO: %s\n", line);
+
+    if (tuner->log) {
+        fprintf(tuner->log, "%8.1fs %s\n", (double)(g_get_monotonic_time() - tuner->start_time) / 1e6, line);
+        fflush(tuner->log);
+    }
+}
+
+static void change_step(EncoderTuner *tuner, const int step, const char *reason, const double busy, const double fps, const guint queued)
+{
+    const TunerStep *settings = &TUNER_STEPS[step];
+    char line[512];
+
+    snprintf(line, sizeof(line),
+        "Encoder step %d -> %d (%s): cpu-used %d, max-quantizer %d, %d fps; measured %.0f%% busy, %.1f fps, %u queued",
+        tuner->step, step, reason, settings->cpu_used, settings->max_quantizer, step_fps(tuner, step), busy * 100.0, fps, queued);
+
+    log_line(tuner, line);
+    apply_step(tuner, step);
+    tuner->adjustments++;
+}
+
+static gpointer tuner_thread(gpointer user_data)
+{
+    EncoderTuner *tuner = user_data;
+    PipelineStats *stats = tuner->recording->stats;
+
+    ElementCounters last = { 0 };
+    gint64 last_time = g_get_monotonic_time();
+    int settle = TUNER_SETTLE_INTERVALS;
+    int calm = 0;
+
+    g_mutex_lock(&tuner->lock);
+
+    while (!tuner->stopping) {
+        const gint64 deadline = g_get_monotonic_time() + TUNER_INTERVAL_US;
+
+        while (!tuner->stopping && g_cond_wait_until(&tuner->cond, &tuner->lock, deadline)) {}
+        if (tuner->stopping) break;
+
+        g_mutex_unlock(&tuner->lock);
+
+        ElementCounters encoder = { 0 };
+        ElementCounters queue = { 0 };
+
+        pipeline_stats_poll(stats);
+        pipeline_stats_get(stats, "encoder", &encoder);
+        pipeline_stats_get(stats, "encoderqueue", &queue);
+
+        const gint64 now = g_get_monotonic_time();
+        const double elapsed = (double)(now - last_time);
+        const guint64 frames = encoder.buffers_in - last.buffers_in;
+        const bool dropped = encoder.dropped > last.dropped;
+
+        // Time spent inside the encoder per wall clock time, 1 means it never waits for a frame
+        const double busy = (double)(encoder.latency_sum - last.latency_sum) / elapsed;
+        const double fps = (double)frames * 1e6 / elapsed;
+
+        last = encoder;
+        last_time = now;
+
+        if (settle > 0) {
+            settle--;
+        } else if (busy > TUNER_BUSY_HIGH || queue.queue_level > TUNER_QUEUE_HIGH || dropped) {
+            calm = 0;
+
+            if (tuner->step < TUNER_STEP_COUNT - 1) {
+                change_step(tuner, tuner->step + 1, dropped ? "frames dropped" : "falling behind", busy, fps, queue.queue_level);
+                settle = TUNER_SETTLE_INTERVALS;
+            }
+        } else if (frames > 0 && queue.queue_level <= 1 && tuner->step > 0) {
+            // More frames mean proportionally more work, the other settings have to be tried
+            const double projected = busy * step_fps(tuner, tuner->step - 1) / step_fps(tuner, tuner->step);
+
+            calm = projected < TUNER_BUSY_LOW ? calm + 1 : 0;
+
+            if (calm >= TUNER_CALM_INTERVALS) {
+                change_step(tuner, tuner->step - 1, "room to spare", busy, fps, queue.queue_level);
+                settle = TUNER_SETTLE_INTERVALS;
+                calm = 0;
+            }
+        } else {
+            calm = 0;
+        }
+
+        g_mutex_lock(&tuner->lock);
+    }
+
+    g_mutex_unlock(&tuner->lock);
+
+    return nullptr;
+}
+
+EncoderTuner *encoder_tuner_start(Recording *recording)
+{
+    if (recording->target_fps <= 0 || recording->stats == NULL) return nullptr;
+
+    GstElement *encoder = gst_bin_get_by_name(GST_BIN(recording->pipeline), "encoder");
+    GstElement *convert = gst_bin_get_by_name(GST_BIN(recording->pipeline), "convert");
+
+    // The ladder is in vp8enc settings, the other encoders keep their preset
+    GstElementFactory *factory = encoder ? gst_element_get_factory(encoder) : nullptr;
+    const bool is_vp8 = factory != NULL && strcmp(GST_OBJECT_NAME(factory), "vp8enc") == 0;
+
+    if (!is_vp8 || convert == NULL) {
+        if (encoder) gst_object_unref(encoder);
+        if (convert) gst_object_unref(convert);
+        return nullptr;
+    }
+
+    EncoderTuner *tuner = calloc(1, sizeof(EncoderTuner));
+
+    if (tuner == NULL) {
+        gst_object_unref(encoder);
+        gst_object_unref(convert);
+        return nullptr;
+    }
+
+    tuner->recording = recording;
+    tuner->encoder = encoder;
+    tuner->target_fps = recording->target_fps;
+    tuner->last_pts = GST_CLOCK_TIME_NONE;
+    tuner->start_time = g_get_monotonic_time();
+
+    // The pipeline is reused, so undo whatever the previous recording ended with
+    apply_step(tuner, TUNER_PRESET_STEP);
+
+    // Frames are thinned out after damageconvert, which has to see every damaged frame
+    tuner->rate_pad = gst_element_get_static_pad(convert, "sink");
+    tuner->rate_probe = gst_pad_add_probe(tuner->rate_pad, GST_PAD_PROBE_TYPE_BUFFER, cb_limit_rate, tuner, nullptr);
+    gst_object_unref(convert);
+
+    if (recording->tuning_location[0] != '\0') {
+        tuner->log = fopen(recording->tuning_location, "a");
+
+        if (tuner->log == NULL) {
+            fprintf(stderr, "ERROR: Unable to open %s for writing\n", recording->tuning_location);
+        }
+    }
+
+    char line[PATH_MAX + 128];
+    snprintf(line, sizeof(line), "Encoder tuning for %s, target %d fps, starting at step %d",
+        recording->location, tuner->target_fps, tuner->step);
+    log_line(tuner, line);
+
+    g_mutex_init(&tuner->lock);
+    g_cond_init(&tuner->cond);
+    tuner->thread = g_thread_new("encoder-tuner", tuner_thread, tuner);
+
+    return tuner;
+}
+
+void encoder_tuner_stop(EncoderTuner *tuner)
+{
+    if (tuner == NULL) return;
+
+    g_mutex_lock(&tuner->lock);
+    tuner->stopping = true;
+    g_cond_signal(&tuner->cond);
+    g_mutex_unlock(&tuner->lock);
+
+    g_thread_join(tuner->thread);
+
+    gst_pad_remove_probe(tuner->rate_pad, tuner->rate_probe);
+    gst_object_unref(tuner->rate_pad);
+
+    char line[256];
+    snprintf(line, sizeof(line), "Encoder tuning finished at step %d after %d adjustments, %d frames skipped",
+        tuner->step, tuner->adjustments, g_atomic_int_get(&tuner->skipped));
+    log_line(tuner, line);
+
+    if (tuner->log) fclose(tuner->log);
+
+    gst_object_unref(tuner->encoder);
+    g_mutex_clear(&tuner->lock);
+    g_cond_clear(&tuner->cond);
+    free(tuner);
+}
@@ -0,0 +1,19 @@
+#ifndef ENCODER_TUNER_H
+#define ENCODER_TUNER_H
+
+#include "pipeline.h"
+
+// Watches the VP8 encoder of a playing pipeline once a second and moves along a ladder of
+// settings to hold `recording->target_fps`: faster cpu-used, a higher max-quantizer and finally a
+// lower frame rate while the encoder falls behind, back towards quality once it has room to
+// spare. Every step is printed and appended to `recording->tuning_location`.
+//
+// Returns nullptr when the pipeline has no live VP8 encoder to tune, e.g. GIF, spool and the
+// other codecs.
+EncoderTuner *encoder_tuner_start(Recording *recording);
+
+// Stops the controller once no more buffers are flowing, and before the pipeline statistics are
+// reset or freed. The next encoder_tuner_start() goes back to the preset settings.
+void encoder_tuner_stop(EncoderTuner *tuner);
+
+#endif
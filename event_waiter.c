@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <gstreamer-1.0/gst/gst.h>
+
+#include "raylib.h"
+#include "event_waiter.h"
+
+// raylib is built with GLFW, and this is how another thread ends its glfwWaitEvents()
+void glfwPostEmptyEvent(void);
+
+struct EventWaiter {
+    bool headless;
+    pthread_t thread;
+    // Tells the thread about a new wait or the stop
+    int kick_fd;
+    // Ends a headless wait
+    int wake_fd;
+
+    int fds[EVENT_WAITER_MAX_FDS];
+    int n_fds;
+
+    pthread_mutex_t lock;
+    // Set for each wait and cleared by the wakeup, so a descriptor the loop has not read yet
+    // wakes it once instead of in a busy loop
+    bool is_armed;
+    bool is_stopping;
+    // Monotonic microseconds, -1 for none
+    gint64 deadline;
+};
+
+static void wake(EventWaiter *waiter)
+{
+    if (waiter->headless) {
+        eventfd_write(waiter->wake_fd, 1);
+    } else {
+        glfwPostEmptyEvent();
+    }
+}
+
+static void *waiter_main(void *arg)
+{
+    EventWaiter *waiter = arg;
+    struct pollfd fds[EVENT_WAITER_MAX_FDS + 1];
+
+    while (true) {
+        pthread_mutex_lock(&waiter->lock);
+        const bool is_armed = waiter->is_armed;
+        const bool is_stopping = waiter->is_stopping;
+        const gint64 deadline = waiter->deadline;
+        pthread_mutex_unlock(&waiter->lock);
+
+        if (is_stopping) break;
+
+        int n_fds = 0;
+        fds[n_fds++] = (struct pollfd){ .fd = waiter->kick_fd, .events = POLLIN };
+
+        if (is_armed) {
+            for (int i = 0; i < waiter->n_fds; i++) {
+                fds[n_fds++] = (struct pollfd){ .fd = waiter->fds[i], .events = POLLIN };
+            }
+        }
+
+        int timeout_ms = -1;
+        if (is_armed && deadline >= 0) {
+            const gint64 remaining = deadline - g_get_monotonic_time();
+            timeout_ms = remaining > 0 ? (int)((remaining + 999) / 1000) : 0;
+        }
+
+        const int ready = poll(fds, (nfds_t)n_fds, timeout_ms);
+        if (ready < 0) continue;
+
+        if (fds[0].revents) {
+            eventfd_t value;
+            eventfd_read(waiter->kick_fd, &value);
+            continue;
+        }
+
+        if (!is_armed) continue;
+
+        pthread_mutex_lock(&waiter->lock);
+        waiter->is_armed = false;
+        pthread_mutex_unlock(&waiter->lock);
+
+        wake(waiter);
+    }
+
+    return nullptr;
+}
+
+EventWaiter *event_waiter_start(const bool headless)
+{
+    EventWaiter *waiter = calloc(1, sizeof(EventWaiter));
+    if (waiter == NULL) return nullptr;
+
+    waiter->headless = headless;
+    waiter->deadline = -1;
+    waiter->kick_fd = eventfd(0, 0);
+    waiter->wake_fd = eventfd(0, EFD_NONBLOCK);
+
+    if (waiter->kick_fd < 0 || waiter->wake_fd < 0) {
+        perror("ERROR: Unable to create the event waiter");
+
+        if (waiter->kick_fd >= 0) close(waiter->kick_fd);
+        if (waiter->wake_fd >= 0) close(waiter->wake_fd);
+        free(waiter);
+        return nullptr;
+    }
+
+    pthread_mutex_init(&waiter->lock, nullptr);
+
+    if (pthread_create(&waiter->thread, nullptr, waiter_main, waiter) != 0) {
+        fprintf(stderr, "ERROR: Unable to start the event waiter thread\n");
+
+        pthread_mutex_destroy(&waiter->lock);
+        close(waiter->kick_fd);
+        close(waiter->wake_fd);
+        free(waiter);
+        return nullptr;
+    }
+
+    return waiter;
+}
+
+bool event_waiter_watch(EventWaiter *waiter, const int fd)
+{
+    if (fd < 0) return false;
+
+    pthread_mutex_lock(&waiter->lock);
+
+    const bool has_room = waiter->n_fds < EVENT_WAITER_MAX_FDS;
+    if (has_room) waiter->fds[waiter->n_fds++] = fd;
+
+    pthread_mutex_unlock(&waiter->lock);
+
+    eventfd_write(waiter->kick_fd, 1);
+
+    if (!has_room) fprintf(stderr, "ERROR: The event waiter watches at most %d descriptors\n", EVENT_WAITER_MAX_FDS);
+
+    return has_room;
+}
+
+void event_waiter_wait(EventWaiter *waiter, const double timeout)
+{
+    eventfd_t value;
+
+    // A wakeup left from a wait that input ended first
+    if (waiter->headless) eventfd_read(waiter->wake_fd, &value);
+
+    pthread_mutex_lock(&waiter->lock);
+    waiter->is_armed = true;
+    waiter->deadline = timeout >= 0 ? g_get_monotonic_time() + (gint64)(timeout * 1e6) : -1;
+    pthread_mutex_unlock(&waiter->lock);
+
+    eventfd_write(waiter->kick_fd, 1);
+
+    if (waiter->headless) {
+        struct pollfd fd = { .fd = waiter->wake_fd, .events = POLLIN };
+        while (poll(&fd, 1, -1) < 0) {}
+        eventfd_read(waiter->wake_fd, &value);
+        return;
+    }
+
+    EnableEventWaiting();
+    PollInputEvents();
+    DisableEventWaiting();
+}
+
+void event_waiter_stop(EventWaiter *waiter)
+{
+    if (waiter == NULL) return;
+
+    pthread_mutex_lock(&waiter->lock);
+    waiter->is_stopping = true;
+    pthread_mutex_unlock(&waiter->lock);
+
+    eventfd_write(waiter->kick_fd, 1);
+    pthread_join(waiter->thread, nullptr);
+
+    close(waiter->kick_fd);
+    close(waiter->wake_fd);
+    pthread_mutex_destroy(&waiter->lock);
+    free(waiter);
+}
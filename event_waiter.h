@@ -0,0 +1,24 @@
+#ifndef EVENT_WAITER_H
+#define EVENT_WAITER_H
+
+// Descriptors one waiter can watch
+#define EVENT_WAITER_MAX_FDS 8
+
+typedef struct EventWaiter EventWaiter;
+
+// Starts the thread that watches descriptors for the render loop. With a window it wakes
+// raylib's event waiting through GLFW, `headless` waits on an eventfd instead, for benchmarks
+// without a display.
+EventWaiter *event_waiter_start(bool headless);
+
+// Also wakes the loop whenever `fd` is readable, call it before the first wait
+bool event_waiter_watch(EventWaiter *waiter, int fd);
+
+// Blocks the render loop until input arrives, a watched descriptor is readable or `timeout`
+// seconds have passed, a negative `timeout` waits without one. Input is polled as
+// PollInputEvents() does, so it takes the place of EndDrawing() for frames that are not drawn.
+void event_waiter_wait(EventWaiter *waiter, double timeout);
+
+void event_waiter_stop(EventWaiter *waiter);
+
+#endif
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <gstreamer-1.0/gst/gst.h>
+#include <gstreamer-1.0/gst/video/video.h>
+
+#include "frame_dedup.h"
+#include "damage_convert.h"
+
+// The xxHash64 primes and round, four lanes so the multiplies do not wait on each other
+#define HASH_PRIME_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME_3 0x165667B19E3779F9ULL
+
+struct FrameDedup {
+    GstPad *pad;
+    gulong probe;
+
+    // A frame went through since the last reset or caps change
+    bool has_previous;
+    bool has_hash;
+    uint64_t hash;
+
+    // Last dropped duplicate, let through before EOS
+    GstBuffer *held;
+    bool releasing;
+
+    guint64 frames;
+    guint64 dropped;
+};
+
+static inline uint64_t hash_round(const uint64_t lane, const uint64_t word)
+{
+    const uint64_t mixed = lane + word * HASH_PRIME_2;
+
+    return ((mixed << 31) | (mixed >> 33)) * HASH_PRIME_1;
+}
+
+// Reads every byte once, so it runs at memory bandwidth
+static uint64_t hash_frame(const uint8_t *data, const size_t size)
+{
+    uint64_t lanes[4] = { HASH_PRIME_1, HASH_PRIME_2, HASH_PRIME_3, 0 };
+    size_t i = 0;
+
+    for (; i + 32 <= size; i += 32) {
+        uint64_t words[4];
+        memcpy(words, data + i, sizeof(words));
+
+        for (int lane = 0; lane < 4; lane++) lanes[lane] = hash_round(lanes[lane], words[lane]);
+    }
+
+    uint64_t hash = size;
+    for (int lane = 0; lane < 4; lane++) hash = (hash ^ lanes[lane]) * HASH_PRIME_1;
+    for (; i < size; i++) hash = (hash ^ data[i]) * HASH_PRIME_3;
+
+    return hash;
+}
+
+// -1 without damage information, otherwise whether any damaged rectangle has an area
+static int has_damage(GstBuffer *buffer)
+{
+    const GQuark damage_quark = g_quark_from_static_string(DAMAGE_META_TYPE);
+    int damaged = -1;
+    gpointer state = nullptr;
+    GstMeta *meta;
+
+    while ((meta = gst_buffer_iterate_meta_filtered(buffer, &state, GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE)) != NULL) {
+        const GstVideoRegionOfInterestMeta *roi = (const GstVideoRegionOfInterestMeta *)meta;
+
+        if (roi->roi_type != damage_quark) continue;
+        if (roi->w > 0 && roi->h > 0) return 1;
+
+        damaged = 0;
+    }
+
+    return damaged;
+}
+
+static gboolean cb_remove_damage(GstBuffer *buffer, GstMeta **meta, gpointer user_data)
+{
+    if ((*meta)->info->api == GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE
+        && ((GstVideoRegionOfInterestMeta *)*meta)->roi_type == g_quark_from_static_string(DAMAGE_META_TYPE)) {
+        *meta = nullptr;
+    }
+
+    return TRUE;
+}
+
+static void forget_frame(FrameDedup *dedup)
+{
+    dedup->has_previous = false;
+    dedup->has_hash = false;
+    gst_clear_buffer(&dedup->held);
+}
+
+static bool is_duplicate(FrameDedup *dedup, GstBuffer *buffer)
+{
+    // Damage comes with the frame, no need to read it
+    const int damaged = has_damage(buffer);
+
+    if (damaged >= 0) {
+        const bool duplicate = damaged == 0 && dedup->has_previous;
+        if (!duplicate) dedup->has_hash = false;
+        return duplicate;
+    }
+
+    GstMapInfo map;
+
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        dedup->has_hash = false;
+        return false;
+    }
+
+    const uint64_t hash = hash_frame(map.data, map.size);
+    gst_buffer_unmap(buffer, &map);
+
+    const bool duplicate = dedup->has_hash && hash == dedup->hash;
+
+    dedup->has_hash = true;
+    dedup->hash = hash;
+
+    return duplicate;
+}
+
+static GstPadProbeReturn cb_dedup(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    FrameDedup *dedup = user_data;
+
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+
+        switch (GST_EVENT_TYPE(event)) {
+            case GST_EVENT_EOS:
+                // Gives the still frame at the end its length
+                if (dedup->held) {
+                    // Its empty damage would get it dropped again by damageconvert
+                    GstBuffer *held = gst_buffer_make_writable(dedup->held);
+                    gst_buffer_foreach_meta(held, cb_remove_damage, nullptr);
+                    dedup->held = nullptr;
+                    dedup->releasing = true;
+                    gst_pad_chain(pad, held);
+                    dedup->releasing = false;
+                }
+                break;
+            case GST_EVENT_CAPS:
+            case GST_EVENT_FLUSH_STOP:
+            case GST_EVENT_STREAM_START:
+                forget_frame(dedup);
+                break;
+            default:
+                break;
+        }
+
+        return GST_PAD_PROBE_OK;
+    }
+
+    if (dedup->releasing) return GST_PAD_PROBE_OK;
+
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    if (is_duplicate(dedup, buffer)) {
+        gst_buffer_replace(&dedup->held, buffer);
+        dedup->frames++;
+        dedup->dropped++;
+        return GST_PAD_PROBE_DROP;
+    }
+
+    gst_clear_buffer(&dedup->held);
+    dedup->has_previous = true;
+    dedup->frames++;
+
+    return GST_PAD_PROBE_OK;
+}
+
+FrameDedup *frame_dedup_attach(GstElement *pipeline)
+{
+    static const char * const targets[] = { "scale", "damage", "convert", "spoolsink" };
+    GstElement *element = nullptr;
+
+    for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]) && element == NULL; i++) {
+        element = gst_bin_get_by_name(GST_BIN(pipeline), targets[i]);
+    }
+
+    if (element == NULL) {
+        fprintf(stderr, "ERROR: Pipeline has nothing to drop duplicate frames in front of\n");
+        return nullptr;
+    }
+
+    FrameDedup *dedup = calloc(1, sizeof(FrameDedup));
+
+    if (dedup == NULL) {
+        gst_object_unref(element);
+        return nullptr;
+    }
+
+    dedup->pad = gst_element_get_static_pad(element, "sink");
+    dedup->probe = gst_pad_add_probe(dedup->pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, cb_dedup, dedup, nullptr);
+    gst_object_unref(element);
+
+    return dedup;
+}
+
+void frame_dedup_reset(FrameDedup *dedup)
+{
+    if (dedup->frames > 0) {
+        printf("INFO: Dropped %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " frames as duplicates\n", dedup->dropped, dedup->frames);
+    }
+
+    forget_frame(dedup);
+    dedup->frames = 0;
+    dedup->dropped = 0;
+}
+
+void frame_dedup_free(FrameDedup *dedup)
+{
+    if (dedup == NULL) return;
+
+    gst_pad_remove_probe(dedup->pad, dedup->probe);
+    gst_object_unref(dedup->pad);
+    gst_clear_buffer(&dedup->held);
+    free(dedup);
+}
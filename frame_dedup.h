@@ -0,0 +1,23 @@
+#ifndef FRAME_DEDUP_H
+#define FRAME_DEDUP_H
+
+#include <gstreamer-1.0/gst/gst.h>
+
+typedef struct FrameDedup FrameDedup;
+
+// Drops frames identical to the last one let through, in front of the first of `scale`, `damage`,
+// `convert` or `spoolsink` in `pipeline`. A frame whose damage is empty is a duplicate without
+// looking at its pixels, otherwise a hash of the whole frame is compared. Downstream sees a
+// variable frame rate, the muxer and the GIF encoder stretch a frame until the next timestamp.
+//
+// The last duplicate is held back and let through right before EOS, so a recording that ends on
+// a still screen keeps its full length.
+FrameDedup *frame_dedup_attach(GstElement *pipeline);
+
+// Forgets the last frame and prints how many were dropped, for a pipeline going back to READY
+void frame_dedup_reset(FrameDedup *dedup);
+
+// Removes the probe, call it once no more buffers are flowing
+void frame_dedup_free(FrameDedup *dedup);
+
+#endif
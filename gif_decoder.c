@@ -0,0 +1,425 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "gif_decoder.h"
+
+#define LZW_MAX_CODES 4096
+
+enum Disposal {
+    DISPOSE_NONE = 0,
+    DISPOSE_KEEP = 1,
+    DISPOSE_BACKGROUND = 2,
+    DISPOSE_PREVIOUS = 3,
+};
+
+struct GifDecoder {
+    const uint8_t *data;
+    size_t size;
+    size_t offset;
+
+    int width;
+    int height;
+    uint8_t global_palette[256 * 3];
+    int global_palette_size;
+
+    uint8_t *canvas;
+    // Canvas before the last image, for DISPOSE_PREVIOUS
+    uint8_t *saved;
+
+    // Of the last image, applied before the next one is drawn
+    enum Disposal disposal;
+    int x;
+    int y;
+    int image_width;
+    int image_height;
+
+    // LZW data of the current image with the sub-block lengths taken out, and its indices
+    uint8_t *lzw;
+    size_t lzw_capacity;
+    uint8_t *indices;
+
+    uint16_t prefix[LZW_MAX_CODES];
+    uint8_t suffix[LZW_MAX_CODES];
+    uint8_t first[LZW_MAX_CODES];
+    uint16_t length[LZW_MAX_CODES];
+};
+
+static bool has_bytes(const GifDecoder *decoder, const size_t n)
+{
+    return decoder->size - decoder->offset >= n;
+}
+
+static int read_u16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+// Skips a chain of sub-blocks up to and including its terminator
+static bool skip_sub_blocks(GifDecoder *decoder)
+{
+    while (has_bytes(decoder, 1)) {
+        const size_t length = decoder->data[decoder->offset++];
+        if (length == 0) return true;
+        if (!has_bytes(decoder, length)) return false;
+
+        decoder->offset += length;
+    }
+
+    return false;
+}
+
+// Copies the payload of a chain of sub-blocks into `decoder->lzw`, returns its size or -1
+static long gather_sub_blocks(GifDecoder *decoder)
+{
+    size_t size = 0;
+
+    while (has_bytes(decoder, 1)) {
+        const size_t length = decoder->data[decoder->offset++];
+        if (length == 0) return (long)size;
+        if (!has_bytes(decoder, length)) return -1;
+
+        if (size + length > decoder->lzw_capacity) {
+            const size_t capacity = decoder->lzw_capacity ? decoder->lzw_capacity * 2 : 1 << 16;
+            uint8_t *lzw = realloc(decoder->lzw, capacity);
+            if (lzw == NULL) return -1;
+
+            decoder->lzw = lzw;
+            decoder->lzw_capacity = capacity;
+        }
+
+        memcpy(decoder->lzw + size, decoder->data + decoder->offset, length);
+        size += length;
+        decoder->offset += length;
+    }
+
+    return -1;
+}
+
+// Decodes `n_pixels` indices into `decoder->indices`. Images that end early keep index 0 for the
+// rest, the way browsers show truncated files.
+static bool lzw_decode(GifDecoder *decoder, const int min_code_size, const size_t size, const size_t n_pixels)
+{
+    if (min_code_size < 2 || min_code_size > 8) return false;
+
+    const int clear_code = 1 << min_code_size;
+    const int end_code = clear_code + 1;
+    int code_size = min_code_size + 1;
+    int next_code = end_code + 1;
+    int previous = -1;
+
+    for (int code = 0; code < clear_code; code++) {
+        decoder->suffix[code] = (uint8_t)code;
+        decoder->first[code] = (uint8_t)code;
+        decoder->length[code] = 1;
+    }
+
+    uint8_t *out = decoder->indices;
+    size_t n_out = 0;
+    uint32_t bits = 0;
+    int n_bits = 0;
+    size_t position = 0;
+
+    memset(out, 0, n_pixels);
+
+    while (n_out < n_pixels) {
+        while (n_bits < code_size && position < size) {
+            bits |= (uint32_t)decoder->lzw[position++] << n_bits;
+            n_bits += 8;
+        }
+
+        if (n_bits < code_size) break;
+
+        const int code = (int)(bits & ((1u << code_size) - 1));
+        bits >>= code_size;
+        n_bits -= code_size;
+
+        if (code == clear_code) {
+            code_size = min_code_size + 1;
+            next_code = end_code + 1;
+            previous = -1;
+            continue;
+        }
+
+        if (code == end_code) break;
+
+        if (previous < 0) {
+            if (code >= clear_code) return false;
+
+            out[n_out++] = (uint8_t)code;
+            previous = code;
+            continue;
+        }
+
+        // A code not in the table yet can only be the string being added right now, the previous
+        // one followed by its own first index
+        if (code > next_code) return false;
+
+        const uint8_t first = code < next_code ? decoder->first[code] : decoder->first[previous];
+
+        if (next_code < LZW_MAX_CODES) {
+            decoder->prefix[next_code] = (uint16_t)previous;
+            decoder->suffix[next_code] = first;
+            decoder->first[next_code] = decoder->first[previous];
+            decoder->length[next_code] = (uint16_t)(decoder->length[previous] + 1);
+            next_code++;
+
+            if (next_code == (1 << code_size) && code_size < 12) code_size++;
+        } else if (code == next_code) {
+            return false;
+        }
+
+        // Strings are stored back to front, so they are written out from their last index
+        const int length = decoder->length[code];
+        const int written = n_out + (size_t)length > n_pixels ? (int)(n_pixels - n_out) : length;
+        int walk = code;
+
+        for (int i = length - 1; i >= 0; i--) {
+            if (i < written) out[n_out + (size_t)i] = decoder->suffix[walk];
+            walk = decoder->prefix[walk];
+        }
+
+        n_out += (size_t)written;
+        previous = code;
+    }
+
+    return true;
+}
+
+// Row of the image that the `row`th decoded row goes to, interlaced images come in four passes
+static int interlaced_row(const int row, const int height)
+{
+    static const int starts[4] = { 0, 4, 2, 1 };
+    static const int steps[4] = { 8, 8, 4, 2 };
+    int first = 0;
+
+    for (int pass = 0; pass < 4; pass++) {
+        const int rows = starts[pass] < height ? (height - starts[pass] + steps[pass] - 1) / steps[pass] : 0;
+
+        if (row < first + rows) return starts[pass] + (row - first) * steps[pass];
+
+        first += rows;
+    }
+
+    return row;
+}
+
+static void dispose(GifDecoder *decoder)
+{
+    if (decoder->disposal == DISPOSE_PREVIOUS) {
+        memcpy(decoder->canvas, decoder->saved, (size_t)decoder->width * (size_t)decoder->height * 4);
+        return;
+    }
+
+    if (decoder->disposal != DISPOSE_BACKGROUND) return;
+
+    for (int y = decoder->y; y < decoder->y + decoder->image_height && y < decoder->height; y++) {
+        const int x0 = decoder->x < decoder->width ? decoder->x : decoder->width;
+        const int x1 = decoder->x + decoder->image_width < decoder->width ? decoder->x + decoder->image_width : decoder->width;
+
+        memset(decoder->canvas + ((size_t)y * (size_t)decoder->width + (size_t)x0) * 4, 0, (size_t)(x1 - x0) * 4);
+    }
+}
+
+GifDecoder *gif_decoder_open(const char *path, int *width, int *height)
+{
+    const int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Unable to open %s\n", path);
+        return nullptr;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || st.st_size < 13) {
+        fprintf(stderr, "ERROR: %s is not a GIF\n", path);
+        close(fd);
+        return nullptr;
+    }
+
+    const uint8_t *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Unable to map %s\n", path);
+        return nullptr;
+    }
+
+    madvise((void *)data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    GifDecoder *decoder = calloc(1, sizeof(GifDecoder));
+
+    if (decoder == NULL) {
+        munmap((void *)data, (size_t)st.st_size);
+        return nullptr;
+    }
+
+    decoder->data = data;
+    decoder->size = (size_t)st.st_size;
+    decoder->width = read_u16(data + 6);
+    decoder->height = read_u16(data + 8);
+    decoder->offset = 13;
+
+    if (memcmp(data, "GIF87a", 6) != 0 && memcmp(data, "GIF89a", 6) != 0) {
+        fprintf(stderr, "ERROR: %s is not a GIF\n", path);
+        gif_decoder_close(decoder);
+        return nullptr;
+    }
+
+    if (data[10] & 0x80) {
+        decoder->global_palette_size = 2 << (data[10] & 0x07);
+
+        if (!has_bytes(decoder, (size_t)decoder->global_palette_size * 3)) {
+            fprintf(stderr, "ERROR: %s is truncated\n", path);
+            gif_decoder_close(decoder);
+            return nullptr;
+        }
+
+        memcpy(decoder->global_palette, data + decoder->offset, (size_t)decoder->global_palette_size * 3);
+        decoder->offset += (size_t)decoder->global_palette_size * 3;
+    }
+
+    const size_t n_pixels = (size_t)decoder->width * (size_t)decoder->height;
+
+    decoder->canvas = calloc(n_pixels, 4);
+    decoder->saved = malloc(n_pixels * 4);
+    decoder->indices = malloc(n_pixels);
+
+    if (n_pixels == 0 || decoder->canvas == NULL || decoder->saved == NULL || decoder->indices == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate a %dx%d canvas for %s\n", decoder->width, decoder->height, path);
+        gif_decoder_close(decoder);
+        return nullptr;
+    }
+
+    *width = decoder->width;
+    *height = decoder->height;
+
+    return decoder;
+}
+
+bool gif_decoder_next_frame(GifDecoder *decoder, const uint8_t **pixels, int *delay_cs)
+{
+    enum Disposal disposal = DISPOSE_NONE;
+    int transparent_index = -1;
+
+    *pixels = nullptr;
+    *delay_cs = 0;
+
+    while (has_bytes(decoder, 1)) {
+        const uint8_t block = decoder->data[decoder->offset++];
+
+        // Trailer
+        if (block == 0x3B) return true;
+
+        if (block == 0x21) {
+            if (!has_bytes(decoder, 1)) return false;
+
+            const uint8_t label = decoder->data[decoder->offset++];
+
+            // Graphic control extension, for the image that follows
+            if (label == 0xF9 && has_bytes(decoder, 6) && decoder->data[decoder->offset] == 4) {
+                const uint8_t *extension = decoder->data + decoder->offset + 1;
+
+                disposal = (enum Disposal)((extension[0] >> 2) & 0x07);
+                *delay_cs = read_u16(extension + 1);
+                transparent_index = (extension[0] & 0x01) ? extension[3] : -1;
+            }
+
+            if (!skip_sub_blocks(decoder)) return false;
+            continue;
+        }
+
+        if (block != 0x2C || !has_bytes(decoder, 9)) return false;
+
+        const uint8_t *descriptor = decoder->data + decoder->offset;
+        decoder->offset += 9;
+
+        const uint8_t *palette = decoder->global_palette;
+        int palette_size = decoder->global_palette_size;
+
+        if (descriptor[8] & 0x80) {
+            palette_size = 2 << (descriptor[8] & 0x07);
+            palette = decoder->data + decoder->offset;
+
+            if (!has_bytes(decoder, (size_t)palette_size * 3)) return false;
+            decoder->offset += (size_t)palette_size * 3;
+        }
+
+        if (!has_bytes(decoder, 1)) return false;
+
+        const int min_code_size = decoder->data[decoder->offset++];
+        const long size = gather_sub_blocks(decoder);
+        const int x = read_u16(descriptor);
+        const int y = read_u16(descriptor + 2);
+        const int image_width = read_u16(descriptor + 4);
+        const int image_height = read_u16(descriptor + 6);
+        const size_t n_pixels = (size_t)image_width * (size_t)image_height;
+
+        if (size < 0) return false;
+
+        // Sub-images larger than the screen are clipped, so they can not need more than it holds
+        if (n_pixels > (size_t)decoder->width * (size_t)decoder->height) return false;
+
+        if (!lzw_decode(decoder, min_code_size, (size_t)size, n_pixels)) return false;
+
+        dispose(decoder);
+
+        if (disposal == DISPOSE_PREVIOUS) {
+            memcpy(decoder->saved, decoder->canvas, (size_t)decoder->width * (size_t)decoder->height * 4);
+        }
+
+        const bool interlaced = descriptor[8] & 0x40;
+
+        for (int row = 0; row < image_height; row++) {
+            const int image_y = interlaced ? interlaced_row(row, image_height) : row;
+            const int canvas_y = y + image_y;
+            const uint8_t *indices = decoder->indices + (size_t)row * (size_t)image_width;
+
+            if (canvas_y >= decoder->height) continue;
+
+            uint8_t *out = decoder->canvas + (size_t)canvas_y * (size_t)decoder->width * 4;
+
+            for (int i = 0; i < image_width && x + i < decoder->width; i++) {
+                const int index = indices[i];
+                if (index == transparent_index || index >= palette_size) continue;
+
+                uint8_t *pixel = out + (size_t)(x + i) * 4;
+                pixel[0] = palette[index * 3 + 2];
+                pixel[1] = palette[index * 3 + 1];
+                pixel[2] = palette[index * 3];
+                pixel[3] = 0;
+            }
+        }
+
+        decoder->disposal = disposal;
+        decoder->x = x;
+        decoder->y = y;
+        decoder->image_width = image_width;
+        decoder->image_height = image_height;
+
+        *pixels = decoder->canvas;
+
+        return true;
+    }
+
+    // A file cut short still ends the animation
+    return true;
+}
+
+void gif_decoder_close(GifDecoder *decoder)
+{
+    munmap((void *)decoder->data, decoder->size);
+    free(decoder->canvas);
+    free(decoder->saved);
+    free(decoder->indices);
+    free(decoder->lzw);
+    free(decoder);
+}
@@ -0,0 +1,19 @@
+#ifndef GIF_DECODER_H
+#define GIF_DECODER_H
+
+#include <stdint.h>
+
+typedef struct GifDecoder GifDecoder;
+
+// Maps the GIF at `path` and reads its screen descriptor. Images come out composited onto the
+// full canvas the way a viewer shows them, so they can be fed straight to gif_encoder_push_frame().
+GifDecoder *gif_decoder_open(const char *path, int *width, int *height);
+
+// Draws the next image onto the canvas, after disposing of the previous one, and points `pixels`
+// at it as BGRx with a stride of width * 4. `delay_cs` is how long it shows in hundredths of a
+// second. Returns false on a broken file, and true with `pixels` set to nullptr after the last one.
+bool gif_decoder_next_frame(GifDecoder *decoder, const uint8_t **pixels, int *delay_cs);
+
+void gif_decoder_close(GifDecoder *decoder);
+
+#endif
@@ -0,0 +1,1381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "gif_encoder.h"
+#include "thread_pool.h"
+
+// Colors are binned at 5 bits per channel for the histogram and the palette lookup table
+#define GIF_HISTOGRAM_SIZE (1 << 15)
+#define GIF_MAX_COLORS 256
+#define GIF_MIN_STRIPE_HEIGHT 32
+#define GIF_MERGE_CHUNK 1024
+
+// Browsers clamp delays below 2cs to 10cs, so frames closer together than 20ms are skipped
+#define GIF_MIN_FRAME_INTERVAL 20000000ull
+#define GIF_DEFAULT_DELAY 10
+
+#define LZW_MAX_CODE 4095
+#define LZW_HASH_BITS 13
+#define LZW_HASH_SIZE (1 << LZW_HASH_BITS)
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+} ByteBuffer;
+
+typedef struct {
+    uint32_t count[GIF_HISTOGRAM_SIZE];
+    uint64_t sum[GIF_HISTOGRAM_SIZE][3];
+} Histogram;
+
+typedef struct {
+    uint8_t color[3];
+    uint32_t count;
+} ColorBin;
+
+typedef struct {
+    int start;
+    int end;
+    int channel;
+    int range;
+    uint64_t weight;
+} ColorBox;
+
+typedef struct {
+    Histogram histogram;
+
+    // Palette index in the low byte, the generation it was looked up for in the rest
+    uint32_t lut[GIF_HISTOGRAM_SIZE];
+
+    uint32_t lzw_keys[LZW_HASH_SIZE];
+    uint16_t lzw_codes[LZW_HASH_SIZE];
+
+    // A row with the cursor drawn over it
+    uint8_t *row;
+} GifWorker;
+
+// Columns [x0, x1) and rows [y0, y1), empty when x1 <= x0
+typedef struct {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+} GifRegion;
+
+typedef struct {
+    int y0;
+    int y1;
+
+    // Bounding box of the pixels that changed since the previous frame, empty when max_x < min_x
+    int min_x;
+    int max_x;
+    int min_y;
+    int max_y;
+
+    // LZW codes packed LSB first, the bits that did not fill a byte are kept in `tail`
+    ByteBuffer lzw;
+    uint32_t tail;
+    int tail_bits;
+} GifStripe;
+
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+
+    // Pixels that did not change since the previous frame use this index, -1 when there are none
+    int transparent_index;
+
+    uint8_t palette[GIF_MAX_COLORS * 3];
+    int palette_bits;
+    // `palette` is the global color table, so no local one is written
+    bool uses_global_palette;
+    int min_code_size;
+    ByteBuffer lzw;
+} GifImage;
+
+struct GifEncoder {
+    FILE *file;
+    int width;
+    int height;
+    GifEncoderOptions options;
+    GifEncoderStats stats;
+
+    // Written with the first image, once the global color table is known
+    bool has_header;
+
+    ThreadPool *pool;
+    GifWorker *workers;
+    GifStripe *stripes;
+    int n_stripes;
+    int max_stripes;
+
+    const uint8_t *pixels;
+    int stride;
+    const GifCursor *cursor;
+    uint8_t *indices;
+
+    // What the viewer currently shows, frames are diffed against it
+    uint8_t *previous;
+    bool has_previous;
+
+    // Part of the frame that is diffed, where `previous` has the cursor, and what changed on
+    // frames skipped since the last one that was diffed
+    GifRegion region;
+    GifRegion shown_cursor;
+    GifRegion skipped;
+
+    // The last skipped frame over what its diff reads, and its pointer, for gif_encoder_finish()
+    // to encode when no frame comes after it
+    uint8_t *held;
+    uint8_t *held_cursor_pixels;
+    size_t held_cursor_capacity;
+    GifCursor held_cursor;
+    bool has_held;
+    bool has_held_cursor;
+
+    Histogram histogram;
+    ColorBin bins[GIF_HISTOGRAM_SIZE];
+    int n_bins;
+    uint8_t palette[GIF_MAX_COLORS][3];
+    int palette_size;
+    bool dither;
+    uint32_t lut_generation;
+
+    // The first palette, with room for the transparent index, when `options.reuse_palette` is set
+    uint8_t global_palette[GIF_MAX_COLORS][3];
+    int global_palette_size;
+    int global_palette_bits;
+
+    // For `options.search_lzw`: what the viewer shows as RGB, the indices with unchanged pixels
+    // continuing the run before them, and both images compressed as a single run each
+    uint8_t *shown;
+    uint8_t *run_indices;
+    GifStripe candidates[2];
+
+    // images[current] is being encoded while the other one waits for its delay
+    GifImage images[2];
+    int current;
+    bool has_pending;
+
+    bool has_frames;
+    uint64_t first_pts;
+    uint64_t last_pts;
+    uint64_t latest_pts;
+    uint64_t written_cs;
+    int last_delay;
+};
+
+// 4x4 Bayer matrix scaled to the 0-7 step of a 5 bit channel
+static const uint8_t BAYER[4][4] = {
+    { 0, 4, 1, 5 },
+    { 6, 2, 7, 3 },
+    { 1, 5, 0, 4 },
+    { 7, 3, 6, 2 },
+};
+
+static bool byte_buffer_reserve(ByteBuffer *buffer, const size_t additional)
+{
+    if (buffer->size + additional <= buffer->capacity) return true;
+
+    size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+    while (capacity < buffer->size + additional) capacity *= 2;
+
+    uint8_t *data = realloc(buffer->data, capacity);
+    if (data == NULL) {
+        return false;
+    }
+
+    buffer->data = data;
+    buffer->capacity = capacity;
+
+    return true;
+}
+
+static inline uint32_t color_bin(const uint32_t pixel)
+{
+    // BGRx in memory is 0xxxRRGGBB as a little endian word
+    return ((pixel >> 9) & 0x7C00) | ((pixel >> 6) & 0x03E0) | ((pixel >> 3) & 0x001F);
+}
+
+static inline uint8_t expand_5_bits(const uint32_t value)
+{
+    return (uint8_t)((value << 3) | (value >> 2));
+}
+
+// Computes the color bins of `n` pixels starting at column `x0` of row `y`, after adding the dither offsets
+static void compute_bins(const uint8_t *row, const int n, const int x0, const int y, const bool dither, uint32_t *bins)
+{
+    int x = 0;
+
+#ifdef __SSE2__
+    const uint8_t *offsets = BAYER[y & 3];
+    const int phase = x0 & 3;
+    const __m128i dither_vector = dither
+        ? _mm_setr_epi8(
+            (char)offsets[phase], (char)offsets[phase], (char)offsets[phase], 0,
+            (char)offsets[(phase + 1) & 3], (char)offsets[(phase + 1) & 3], (char)offsets[(phase + 1) & 3], 0,
+            (char)offsets[(phase + 2) & 3], (char)offsets[(phase + 2) & 3], (char)offsets[(phase + 2) & 3], 0,
+            (char)offsets[(phase + 3) & 3], (char)offsets[(phase + 3) & 3], (char)offsets[(phase + 3) & 3], 0)
+        : _mm_setzero_si128();
+    const __m128i mask = _mm_set1_epi32(0x1F);
+
+    for (; x + 4 <= n; x += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i *)(row + x * 4));
+        pixels = _mm_adds_epu8(pixels, dither_vector);
+
+        const __m128i blue = _mm_and_si128(_mm_srli_epi32(pixels, 3), mask);
+        const __m128i green = _mm_and_si128(_mm_srli_epi32(pixels, 11), mask);
+        const __m128i red = _mm_and_si128(_mm_srli_epi32(pixels, 19), mask);
+
+        const __m128i bin = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(red, 10), _mm_slli_epi32(green, 5)), blue);
+        _mm_storeu_si128((__m128i *)(bins + x), bin);
+    }
+#elif defined(__aarch64__)
+    const uint8_t *offsets = BAYER[y & 3];
+    uint8_t dither_bytes[16] = { 0 };
+
+    for (int i = 0; dither && i < 4; i++) {
+        dither_bytes[i * 4] = dither_bytes[i * 4 + 1] = dither_bytes[i * 4 + 2] = offsets[(x0 + i) & 3];
+    }
+
+    const uint8x16_t dither_vector = vld1q_u8(dither_bytes);
+    const uint32x4_t mask = vdupq_n_u32(0x1F);
+
+    for (; x + 4 <= n; x += 4) {
+        const uint32x4_t pixels = vreinterpretq_u32_u8(vqaddq_u8(vld1q_u8(row + x * 4), dither_vector));
+
+        const uint32x4_t blue = vandq_u32(vshrq_n_u32(pixels, 3), mask);
+        const uint32x4_t green = vandq_u32(vshrq_n_u32(pixels, 11), mask);
+        const uint32x4_t red = vandq_u32(vshrq_n_u32(pixels, 19), mask);
+
+        vst1q_u32(bins + x, vorrq_u32(vorrq_u32(vshlq_n_u32(red, 10), vshlq_n_u32(green, 5)), blue));
+    }
+#endif
+
+    for (; x < n; x++) {
+        uint32_t pixel;
+        memcpy(&pixel, row + x * 4, sizeof(pixel));
+
+        if (dither) {
+            const uint32_t offset = BAYER[y & 3][(x0 + x) & 3];
+            uint32_t b = (pixel & 0xFF) + offset;
+            uint32_t g = ((pixel >> 8) & 0xFF) + offset;
+            uint32_t r = ((pixel >> 16) & 0xFF) + offset;
+            if (b > 255) b = 255;
+            if (g > 255) g = 255;
+            if (r > 255) r = 255;
+            pixel = (r << 16) | (g << 8) | b;
+        }
+
+        bins[x] = color_bin(pixel);
+    }
+}
+
+// Flags the pixels that differ from `previous`, ignoring the padding byte. Returns how many did.
+static int find_changes(const uint8_t *row, const uint8_t *previous, const int n, uint8_t *changed)
+{
+    int x = 0;
+    int n_changed = 0;
+
+#ifdef __SSE2__
+    const __m128i color_mask = _mm_set1_epi32(0x00FFFFFF);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; x + 4 <= n; x += 4) {
+        const __m128i a = _mm_loadu_si128((const __m128i *)(row + x * 4));
+        const __m128i b = _mm_loadu_si128((const __m128i *)(previous + x * 4));
+        const __m128i same = _mm_cmpeq_epi32(_mm_and_si128(_mm_xor_si128(a, b), color_mask), zero);
+        const int mask = ~_mm_movemask_ps(_mm_castsi128_ps(same)) & 0xF;
+
+        changed[x] = mask & 1;
+        changed[x + 1] = (mask >> 1) & 1;
+        changed[x + 2] = (mask >> 2) & 1;
+        changed[x + 3] = (mask >> 3) & 1;
+        n_changed += __builtin_popcount((unsigned int)mask);
+    }
+#elif defined(__aarch64__)
+    const uint32x4_t color_mask = vdupq_n_u32(0x00FFFFFF);
+
+    for (; x + 4 <= n; x += 4) {
+        const uint32x4_t a = vreinterpretq_u32_u8(vld1q_u8(row + x * 4));
+        const uint32x4_t b = vreinterpretq_u32_u8(vld1q_u8(previous + x * 4));
+        // 1 in the lanes whose colors differ
+        const uint32x4_t differs = vshrq_n_u32(vtstq_u32(veorq_u32(a, b), color_mask), 31);
+
+        changed[x] = (uint8_t)vgetq_lane_u32(differs, 0);
+        changed[x + 1] = (uint8_t)vgetq_lane_u32(differs, 1);
+        changed[x + 2] = (uint8_t)vgetq_lane_u32(differs, 2);
+        changed[x + 3] = (uint8_t)vgetq_lane_u32(differs, 3);
+        n_changed += (int)vaddvq_u32(differs);
+    }
+#endif
+
+    for (; x < n; x++) {
+        uint32_t a;
+        uint32_t b;
+        memcpy(&a, row + x * 4, sizeof(a));
+        memcpy(&b, previous + x * 4, sizeof(b));
+
+        changed[x] = ((a ^ b) & 0x00FFFFFF) != 0;
+        n_changed += changed[x];
+    }
+
+    return n_changed;
+}
+
+static GifRegion clip_region(const int x, const int y, const int width, const int height, const GifEncoder *encoder)
+{
+    return (GifRegion){
+        x > 0 ? x : 0,
+        y > 0 ? y : 0,
+        x + width < encoder->width ? x + width : encoder->width,
+        y + height < encoder->height ? y + height : encoder->height,
+    };
+}
+
+static GifRegion union_region(const GifRegion a, const GifRegion b)
+{
+    if (a.x1 <= a.x0 || a.y1 <= a.y0) return b;
+    if (b.x1 <= b.x0 || b.y1 <= b.y0) return a;
+
+    return (GifRegion){
+        a.x0 < b.x0 ? a.x0 : b.x0,
+        a.y0 < b.y0 ? a.y0 : b.y0,
+        a.x1 > b.x1 ? a.x1 : b.x1,
+        a.y1 > b.y1 ? a.y1 : b.y1,
+    };
+}
+
+// Row `y` of the frame, copied with the cursor blended over it when it crosses the cursor
+static const uint8_t *compose_row(const GifEncoder *encoder, GifWorker *worker, const int y)
+{
+    const uint8_t *row = encoder->pixels + (size_t)y * (size_t)encoder->stride;
+    const GifCursor *cursor = encoder->cursor;
+
+    if (cursor == NULL || y < cursor->y || y >= cursor->y + cursor->height) return row;
+
+    const GifRegion rect = clip_region(cursor->x, cursor->y, cursor->width, cursor->height, encoder);
+    if (rect.x1 <= rect.x0) return row;
+
+    const uint8_t *sprite = cursor->pixels + ((size_t)(y - cursor->y) * (size_t)cursor->width + (size_t)(rect.x0 - cursor->x)) * 4;
+    uint8_t *out = worker->row + (size_t)rect.x0 * 4;
+
+    memcpy(worker->row, row, (size_t)encoder->width * 4);
+
+    for (int x = rect.x0; x < rect.x1; x++, sprite += 4, out += 4) {
+        const int alpha = sprite[3];
+        if (alpha == 0) continue;
+
+        for (int c = 0; c < 3; c++) out[c] = (uint8_t)((out[c] * (255 - alpha) + sprite[c] * alpha + 127) / 255);
+    }
+
+    return worker->row;
+}
+
+// Finds what changed since the previous frame and builds the histogram of the changed pixels only
+static void diff_task(void *context, const int task_index, const int worker_index)
+{
+    GifEncoder *encoder = context;
+    GifStripe *stripe = &encoder->stripes[task_index];
+    GifWorker *worker = &encoder->workers[worker_index];
+    Histogram *histogram = &worker->histogram;
+    const GifRegion region = encoder->region;
+    uint32_t bins[256];
+    uint8_t changed[256];
+
+    stripe->min_x = encoder->width;
+    stripe->max_x = -1;
+    stripe->min_y = encoder->height;
+    stripe->max_y = -1;
+
+    for (int y = stripe->y0; y < stripe->y1; y++) {
+        const uint8_t *row = compose_row(encoder, worker, y);
+        const uint8_t *previous_row = encoder->previous + (size_t)y * (size_t)encoder->width * 4;
+
+        for (int x = region.x0; x < region.x1; x += 256) {
+            const int n = region.x1 - x < 256 ? region.x1 - x : 256;
+
+            if (encoder->has_previous) {
+                if (find_changes(row + x * 4, previous_row + x * 4, n, changed) == 0) continue;
+            } else {
+                memset(changed, 1, (size_t)n);
+            }
+
+            compute_bins(row + x * 4, n, x, y, false, bins);
+
+            for (int i = 0; i < n; i++) {
+                if (!changed[i]) continue;
+
+                const uint8_t *pixel = row + (x + i) * 4;
+                const uint32_t bin = bins[i];
+
+                if (x + i < stripe->min_x) stripe->min_x = x + i;
+                if (x + i > stripe->max_x) stripe->max_x = x + i;
+                if (y < stripe->min_y) stripe->min_y = y;
+                stripe->max_y = y;
+
+                histogram->count[bin]++;
+                histogram->sum[bin][0] += pixel[2];
+                histogram->sum[bin][1] += pixel[1];
+                histogram->sum[bin][2] += pixel[0];
+            }
+        }
+    }
+}
+
+// Adds the per worker histograms into the encoder one and clears them for the next frame
+static void merge_task(void *context, const int task_index, const int worker_index)
+{
+    GifEncoder *encoder = context;
+    const int start = task_index * GIF_MERGE_CHUNK;
+    const int end = start + GIF_MERGE_CHUNK;
+    const int n_workers = thread_pool_size(encoder->pool);
+
+    for (int bin = start; bin < end; bin++) {
+        uint32_t count = 0;
+        uint64_t sum[3] = { 0 };
+
+        for (int w = 0; w < n_workers; w++) {
+            Histogram *histogram = &encoder->workers[w].histogram;
+            if (histogram->count[bin] == 0) continue;
+
+            count += histogram->count[bin];
+            sum[0] += histogram->sum[bin][0];
+            sum[1] += histogram->sum[bin][1];
+            sum[2] += histogram->sum[bin][2];
+
+            histogram->count[bin] = 0;
+            memset(histogram->sum[bin], 0, sizeof(histogram->sum[bin]));
+        }
+
+        encoder->histogram.count[bin] = count;
+        memcpy(encoder->histogram.sum[bin], sum, sizeof(sum));
+    }
+}
+
+static int compare_bins_red(const void *a, const void *b)
+{
+    return ((const ColorBin *)a)->color[0] - ((const ColorBin *)b)->color[0];
+}
+
+static int compare_bins_green(const void *a, const void *b)
+{
+    return ((const ColorBin *)a)->color[1] - ((const ColorBin *)b)->color[1];
+}
+
+static int compare_bins_blue(const void *a, const void *b)
+{
+    return ((const ColorBin *)a)->color[2] - ((const ColorBin *)b)->color[2];
+}
+
+static void color_box_update(ColorBox *box, const ColorBin *bins)
+{
+    uint8_t min[3] = { 255, 255, 255 };
+    uint8_t max[3] = { 0, 0, 0 };
+
+    box->weight = 0;
+
+    for (int i = box->start; i < box->end; i++) {
+        for (int c = 0; c < 3; c++) {
+            if (bins[i].color[c] < min[c]) min[c] = bins[i].color[c];
+            if (bins[i].color[c] > max[c]) max[c] = bins[i].color[c];
+        }
+
+        box->weight += bins[i].count;
+    }
+
+    box->channel = 0;
+    box->range = max[0] - min[0];
+
+    for (int c = 1; c < 3; c++) {
+        if (max[c] - min[c] > box->range) {
+            box->channel = c;
+            box->range = max[c] - min[c];
+        }
+    }
+}
+
+// Median cut over the non-empty histogram bins
+static int median_cut(ColorBin *bins, const int n_bins, uint8_t palette[][3], const int max_colors)
+{
+    static int (*const comparators[3])(const void *, const void *) = {
+        compare_bins_red, compare_bins_green, compare_bins_blue
+    };
+
+    ColorBox boxes[GIF_MAX_COLORS];
+    int n_boxes = 1;
+
+    boxes[0] = (ColorBox){ .start = 0, .end = n_bins };
+    color_box_update(&boxes[0], bins);
+
+    while (n_boxes < max_colors) {
+        int best = -1;
+        uint64_t best_score = 0;
+
+        for (int i = 0; i < n_boxes; i++) {
+            if (boxes[i].end - boxes[i].start < 2) continue;
+
+            const uint64_t score = (uint64_t)boxes[i].range * boxes[i].weight;
+            if (score > best_score) {
+                best = i;
+                best_score = score;
+            }
+        }
+
+        if (best < 0) break;
+
+        ColorBox *box = &boxes[best];
+        qsort(bins + box->start, (size_t)(box->end - box->start), sizeof(ColorBin), comparators[box->channel]);
+
+        // Split at the weighted median, keeping at least one bin on each side
+        uint64_t accumulated = 0;
+        int split = box->start + 1;
+        for (int i = box->start; i < box->end - 1; i++) {
+            accumulated += bins[i].count;
+            split = i + 1;
+            if (accumulated * 2 >= box->weight) break;
+        }
+
+        boxes[n_boxes] = (ColorBox){ .start = split, .end = box->end };
+        box->end = split;
+
+        color_box_update(box, bins);
+        color_box_update(&boxes[n_boxes], bins);
+        n_boxes++;
+    }
+
+    for (int i = 0; i < n_boxes; i++) {
+        uint64_t sum[3] = { 0 };
+
+        for (int b = boxes[i].start; b < boxes[i].end; b++) {
+            for (int c = 0; c < 3; c++) sum[c] += (uint64_t)bins[b].color[c] * bins[b].count;
+        }
+
+        for (int c = 0; c < 3; c++) {
+            palette[i][c] = boxes[i].weight ? (uint8_t)((sum[c] + boxes[i].weight / 2) / boxes[i].weight) : 0;
+        }
+    }
+
+    return n_boxes;
+}
+
+// Makes every worker look colors up again, after the palette changed
+static void invalidate_luts(GifEncoder *encoder)
+{
+    if (++encoder->lut_generation >= (1u << 24)) {
+        for (int w = 0; w < thread_pool_size(encoder->pool); w++) {
+            memset(encoder->workers[w].lut, 0, sizeof(encoder->workers[w].lut));
+        }
+
+        encoder->lut_generation = 1;
+    }
+}
+
+static void build_palette(GifEncoder *encoder, const int max_colors)
+{
+    int n_bins = 0;
+
+    for (int bin = 0; bin < GIF_HISTOGRAM_SIZE; bin++) {
+        const uint32_t count = encoder->histogram.count[bin];
+        if (count == 0) continue;
+
+        ColorBin *entry = &encoder->bins[n_bins++];
+        entry->count = count;
+        for (int c = 0; c < 3; c++) {
+            entry->color[c] = (uint8_t)((encoder->histogram.sum[bin][c] + count / 2) / count);
+        }
+    }
+
+    encoder->n_bins = n_bins;
+
+    if (n_bins <= max_colors) {
+        // Few enough colors for every bin to get its own entry, dithering would only add noise
+        for (int i = 0; i < n_bins; i++) memcpy(encoder->palette[i], encoder->bins[i].color, 3);
+
+        encoder->palette_size = n_bins > 0 ? n_bins : 1;
+        encoder->dither = false;
+    } else {
+        encoder->palette_size = median_cut(encoder->bins, n_bins, encoder->palette, max_colors);
+        encoder->dither = true;
+    }
+
+    invalidate_luts(encoder);
+}
+
+static int palette_bits_for(const int n_entries)
+{
+    int bits = 1;
+    while ((1 << bits) < n_entries) bits++;
+
+    return bits;
+}
+
+// Switches to the global palette when it has every color of the frame exactly. The palette of the
+// first frame becomes the global one.
+static bool use_global_palette(GifEncoder *encoder)
+{
+    if (encoder->global_palette_size == 0) {
+        memcpy(encoder->global_palette, encoder->palette, (size_t)encoder->palette_size * 3);
+        encoder->global_palette_size = encoder->palette_size;
+        encoder->global_palette_bits = palette_bits_for(encoder->palette_size + 1);
+
+        return true;
+    }
+
+    // A dithered frame has more colors than any palette
+    if (encoder->dither) return false;
+
+    for (int i = 0; i < encoder->n_bins; i++) {
+        int match = 0;
+
+        while (match < encoder->global_palette_size && memcmp(encoder->global_palette[match], encoder->bins[i].color, 3) != 0) match++;
+
+        if (match == encoder->global_palette_size) return false;
+    }
+
+    memcpy(encoder->palette, encoder->global_palette, (size_t)encoder->global_palette_size * 3);
+    encoder->palette_size = encoder->global_palette_size;
+    invalidate_luts(encoder);
+
+    return true;
+}
+
+static uint8_t lookup_bin(const GifEncoder *encoder, GifWorker *worker, const uint32_t bin)
+{
+    const uint32_t entry = worker->lut[bin];
+    if ((entry >> 8) == encoder->lut_generation) {
+        return (uint8_t)entry;
+    }
+
+    int color[3];
+    const uint32_t count = encoder->histogram.count[bin];
+
+    if (count > 0) {
+        for (int c = 0; c < 3; c++) color[c] = (int)((encoder->histogram.sum[bin][c] + count / 2) / count);
+    } else {
+        color[0] = expand_5_bits(bin >> 10);
+        color[1] = expand_5_bits((bin >> 5) & 0x1F);
+        color[2] = expand_5_bits(bin & 0x1F);
+    }
+
+    int best = 0;
+    int best_distance = INT32_MAX;
+
+    for (int i = 0; i < encoder->palette_size; i++) {
+        const int dr = color[0] - encoder->palette[i][0];
+        const int dg = color[1] - encoder->palette[i][1];
+        const int db = color[2] - encoder->palette[i][2];
+        const int distance = dr * dr * 2 + dg * dg * 4 + db * db * 3;
+
+        if (distance < best_distance) {
+            best = i;
+            best_distance = distance;
+            if (distance == 0) break;
+        }
+    }
+
+    worker->lut[bin] = (encoder->lut_generation << 8) | (uint32_t)best;
+
+    return (uint8_t)best;
+}
+
+static inline void lzw_put_code(GifStripe *stripe, uint64_t *bits, int *n_bits, const uint32_t code, const int code_size)
+{
+    *bits |= (uint64_t)code << *n_bits;
+    *n_bits += code_size;
+
+    while (*n_bits >= 8) {
+        stripe->lzw.data[stripe->lzw.size++] = (uint8_t)*bits;
+        *bits >>= 8;
+        *n_bits -= 8;
+    }
+}
+
+// Encodes a stripe as a self contained run of codes that ends with a clear code, so the
+// stripes can be compressed in parallel and then concatenated bit by bit.
+static bool lzw_encode_stripe(GifWorker *worker, GifStripe *stripe, const uint8_t *indices, const size_t n, const int min_code_size, const bool first)
+{
+    const uint32_t clear_code = 1u << min_code_size;
+    int code_size = min_code_size + 1;
+    uint32_t max_code = clear_code + 1;
+    uint64_t bits = 0;
+    int n_bits = 0;
+
+    // Worst case is one 12 bit code per pixel plus the clear codes
+    stripe->lzw.size = 0;
+    if (!byte_buffer_reserve(&stripe->lzw, n * 2 + 16)) {
+        return false;
+    }
+
+    memset(worker->lzw_keys, 0, sizeof(worker->lzw_keys));
+
+    if (first) {
+        lzw_put_code(stripe, &bits, &n_bits, clear_code, code_size);
+    }
+
+    uint32_t prefix = indices[0];
+
+    for (size_t i = 1; i < n; i++) {
+        const uint32_t key = (prefix << 8) | indices[i];
+        uint32_t slot = (key * 2654435761u) >> (32 - LZW_HASH_BITS);
+        bool found = false;
+
+        while (worker->lzw_keys[slot] != 0) {
+            if (worker->lzw_keys[slot] == key + 1) {
+                prefix = worker->lzw_codes[slot];
+                found = true;
+                break;
+            }
+
+            slot = (slot + 1) & (LZW_HASH_SIZE - 1);
+        }
+
+        if (found) continue;
+
+        lzw_put_code(stripe, &bits, &n_bits, prefix, code_size);
+
+        worker->lzw_keys[slot] = key + 1;
+        worker->lzw_codes[slot] = (uint16_t)++max_code;
+
+        if (max_code >= (1u << code_size)) code_size++;
+
+        if (max_code == LZW_MAX_CODE) {
+            lzw_put_code(stripe, &bits, &n_bits, clear_code, code_size);
+            memset(worker->lzw_keys, 0, sizeof(worker->lzw_keys));
+            code_size = min_code_size + 1;
+            max_code = clear_code + 1;
+        }
+
+        prefix = indices[i];
+    }
+
+    lzw_put_code(stripe, &bits, &n_bits, prefix, code_size);
+
+    // Reading that last code makes the decoder add one more entry, which can widen its codes
+    // before it gets to the clear code
+    if (max_code + 1 == (1u << code_size) && code_size < 12) code_size++;
+
+    lzw_put_code(stripe, &bits, &n_bits, clear_code, code_size);
+
+    stripe->tail = (uint32_t)bits;
+    stripe->tail_bits = n_bits;
+
+    return true;
+}
+
+// Gives unchanged pixels the index of the pixel before them instead of the transparent one where
+// that shows the same color, which makes for longer runs. `shown` takes the changed pixels.
+static void extend_runs(const GifImage *image, const uint8_t *indices, uint8_t *runs, uint8_t *shown)
+{
+    int last = -1;
+
+    for (int x = 0; x < image->width; x++) {
+        uint8_t index = indices[x];
+
+        if (index == image->transparent_index) {
+            if (last >= 0 && memcmp(image->palette + last * 3, shown + x * 3, 3) == 0) index = (uint8_t)last;
+        } else {
+            memcpy(shown + x * 3, image->palette + index * 3, 3);
+        }
+
+        runs[x] = index;
+        last = index == image->transparent_index ? -1 : index;
+    }
+}
+
+// Maps the rows of a stripe to palette indices and remembers them as what the viewer shows next
+static void quantize_stripe(GifEncoder *encoder, const GifStripe *stripe, GifWorker *worker)
+{
+    const GifImage *image = &encoder->images[encoder->current];
+    uint32_t bins[256];
+    uint8_t changed[256];
+
+    for (int y = stripe->y0; y < stripe->y1; y++) {
+        const uint8_t *row = compose_row(encoder, worker, y) + (size_t)image->x * 4;
+        uint8_t *previous_row = encoder->previous + ((size_t)y * (size_t)encoder->width + (size_t)image->x) * 4;
+        uint8_t *indices = encoder->indices + (size_t)(y - image->y) * (size_t)image->width;
+
+        for (int x = 0; x < image->width; x += 256) {
+            const int n = image->width - x < 256 ? image->width - x : 256;
+            compute_bins(row + x * 4, n, image->x + x, y, encoder->dither, bins);
+
+            if (image->transparent_index < 0) {
+                for (int i = 0; i < n; i++) indices[x + i] = lookup_bin(encoder, worker, bins[i]);
+                continue;
+            }
+
+            find_changes(row + x * 4, previous_row + x * 4, n, changed);
+
+            for (int i = 0; i < n; i++) {
+                indices[x + i] = changed[i] ? lookup_bin(encoder, worker, bins[i]) : (uint8_t)image->transparent_index;
+            }
+        }
+
+        memcpy(previous_row, row, (size_t)image->width * 4);
+
+        if (encoder->run_indices) {
+            const size_t offset = (size_t)(y - image->y) * (size_t)image->width;
+            uint8_t *shown = encoder->shown + ((size_t)y * (size_t)encoder->width + (size_t)image->x) * 3;
+
+            extend_runs(image, indices, encoder->run_indices + offset, shown);
+        }
+    }
+}
+
+static void encode_stripe_task(void *context, const int task_index, const int worker_index)
+{
+    GifEncoder *encoder = context;
+    GifStripe *stripe = &encoder->stripes[task_index];
+    GifWorker *worker = &encoder->workers[worker_index];
+    const GifImage *image = &encoder->images[encoder->current];
+
+    quantize_stripe(encoder, stripe, worker);
+
+    const size_t offset = (size_t)(stripe->y0 - image->y) * (size_t)image->width;
+    const size_t n = (size_t)(stripe->y1 - stripe->y0) * (size_t)image->width;
+
+    if (!lzw_encode_stripe(worker, stripe, encoder->indices + offset, n, image->min_code_size, task_index == 0)) {
+        // Leave an empty stripe behind, join_stripes() reports the failure
+        stripe->lzw.size = 0;
+        stripe->tail_bits = -1;
+    }
+}
+
+static void quantize_stripe_task(void *context, const int task_index, const int worker_index)
+{
+    GifEncoder *encoder = context;
+
+    quantize_stripe(encoder, &encoder->stripes[task_index], &encoder->workers[worker_index]);
+}
+
+// Compresses the whole image as one run, from the plain indices for candidate 0 and from the
+// extended runs for candidate 1
+static void encode_candidate_task(void *context, const int task_index, const int worker_index)
+{
+    GifEncoder *encoder = context;
+    GifStripe *candidate = &encoder->candidates[task_index];
+    const GifImage *image = &encoder->images[encoder->current];
+    const uint8_t *indices = task_index == 0 ? encoder->indices : encoder->run_indices;
+
+    if (!lzw_encode_stripe(&encoder->workers[worker_index], candidate, indices, (size_t)image->width * (size_t)image->height, image->min_code_size, true)) {
+        candidate->lzw.size = 0;
+        candidate->tail_bits = -1;
+    }
+}
+
+// Quantizes in stripes but compresses the image in one run, the way that comes out smaller, into
+// encoder->candidates[0]
+static void encode_searching(GifEncoder *encoder, const GifImage *image)
+{
+    const int n_candidates = image->transparent_index >= 0 ? 2 : 1;
+
+    thread_pool_run(encoder->pool, encoder->n_stripes, quantize_stripe_task, encoder);
+    thread_pool_run(encoder->pool, n_candidates, encode_candidate_task, encoder);
+
+    GifStripe *plain = &encoder->candidates[0];
+    GifStripe *runs = &encoder->candidates[1];
+
+    if (n_candidates == 2 && runs->tail_bits >= 0
+        && (plain->tail_bits < 0 || runs->lzw.size * 8 + (size_t)runs->tail_bits < plain->lzw.size * 8 + (size_t)plain->tail_bits)) {
+        const GifStripe swap = *plain;
+        *plain = *runs;
+        *runs = swap;
+
+        encoder->stats.extended_run_frames++;
+    }
+}
+
+// Splits rows [y0, y1) into stripes, every stripe restarts the LZW dictionary so they are kept tall enough
+static void split_stripes(GifEncoder *encoder, const int y0, const int y1)
+{
+    int n_stripes = (y1 - y0) / GIF_MIN_STRIPE_HEIGHT;
+    if (n_stripes > encoder->max_stripes) n_stripes = encoder->max_stripes;
+    if (n_stripes < 1) n_stripes = 1;
+
+    for (int s = 0; s < n_stripes; s++) {
+        encoder->stripes[s].y0 = y0 + (int)((int64_t)(y1 - y0) * s / n_stripes);
+        encoder->stripes[s].y1 = y0 + (int)((int64_t)(y1 - y0) * (s + 1) / n_stripes);
+    }
+
+    encoder->n_stripes = n_stripes;
+}
+
+static bool join_stripes(const GifStripe *stripes, const int n_stripes, GifImage *image)
+{
+    ByteBuffer *out = &image->lzw;
+    uint64_t bits = 0;
+    int n_bits = 0;
+
+    out->size = 0;
+
+    for (int s = 0; s < n_stripes; s++) {
+        const GifStripe *stripe = &stripes[s];
+
+        if (stripe->tail_bits < 0 || !byte_buffer_reserve(out, stripe->lzw.size + 8)) {
+            return false;
+        }
+
+        if (n_bits == 0) {
+            memcpy(out->data + out->size, stripe->lzw.data, stripe->lzw.size);
+            out->size += stripe->lzw.size;
+        } else {
+            for (size_t i = 0; i < stripe->lzw.size; i++) {
+                bits |= (uint64_t)stripe->lzw.data[i] << n_bits;
+                out->data[out->size++] = (uint8_t)bits;
+                bits >>= 8;
+            }
+        }
+
+        bits |= (uint64_t)stripe->tail << n_bits;
+        n_bits += stripe->tail_bits;
+
+        while (n_bits >= 8) {
+            out->data[out->size++] = (uint8_t)bits;
+            bits >>= 8;
+            n_bits -= 8;
+        }
+    }
+
+    // End of information, right after a clear code so it uses the initial code size
+    const uint32_t end_code = (1u << image->min_code_size) + 1;
+    bits |= (uint64_t)end_code << n_bits;
+    n_bits += image->min_code_size + 1;
+
+    while (n_bits > 0) {
+        out->data[out->size++] = (uint8_t)bits;
+        bits >>= 8;
+        n_bits -= 8;
+    }
+
+    return true;
+}
+
+static int next_delay(GifEncoder *encoder, const uint64_t next_pts)
+{
+    // Round against the first frame so the small errors do not add up over a long recording
+    const uint64_t target_cs = (next_pts - encoder->first_pts + 5000000) / 10000000;
+    uint64_t delay = target_cs > encoder->written_cs ? target_cs - encoder->written_cs : 0;
+
+    if (delay < 2) delay = 2;
+    if (delay > UINT16_MAX) delay = UINT16_MAX;
+
+    encoder->written_cs += delay;
+
+    return (int)delay;
+}
+
+static bool write_header(GifEncoder *encoder)
+{
+    const bool has_global_palette = encoder->global_palette_size > 0;
+
+    const uint8_t header[13] = {
+        'G', 'I', 'F', '8', '9', 'a',
+        (uint8_t)encoder->width, (uint8_t)(encoder->width >> 8),
+        (uint8_t)encoder->height, (uint8_t)(encoder->height >> 8),
+        // 8 bits of color resolution, the global color table only when palettes are reused
+        (uint8_t)(has_global_palette ? 0xF0 | (encoder->global_palette_bits - 1) : 0x70),
+        0x00,
+        0x00,
+    };
+
+    // Loop forever
+    const uint8_t netscape[19] = {
+        0x21, 0xFF, 0x0B,
+        'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0',
+        0x03, 0x01, 0x00, 0x00,
+        0x00,
+    };
+
+    fwrite(header, 1, sizeof(header), encoder->file);
+
+    if (has_global_palette) {
+        uint8_t table[GIF_MAX_COLORS * 3] = { 0 };
+        memcpy(table, encoder->global_palette, (size_t)encoder->global_palette_size * 3);
+        fwrite(table, 1, (size_t)3 << encoder->global_palette_bits, encoder->file);
+    }
+
+    fwrite(netscape, 1, sizeof(netscape), encoder->file);
+
+    encoder->has_header = true;
+
+    return ferror(encoder->file) == 0;
+}
+
+static bool write_image(GifEncoder *encoder, const GifImage *image, const int delay)
+{
+    FILE *f = encoder->file;
+
+    if (!encoder->has_header && !write_header(encoder)) {
+        return false;
+    }
+
+    const bool transparent = image->transparent_index >= 0;
+
+    const uint8_t graphic_control[8] = {
+        0x21, 0xF9, 0x04,
+        (uint8_t)(0x04 | transparent), // Disposal method 1: do not dispose
+        (uint8_t)delay, (uint8_t)(delay >> 8),
+        (uint8_t)(transparent ? image->transparent_index : 0),
+        0x00,
+    };
+
+    const uint8_t descriptor[10] = {
+        0x2C,
+        (uint8_t)image->x, (uint8_t)(image->x >> 8),
+        (uint8_t)image->y, (uint8_t)(image->y >> 8),
+        (uint8_t)image->width, (uint8_t)(image->width >> 8),
+        (uint8_t)image->height, (uint8_t)(image->height >> 8),
+        (uint8_t)(image->uses_global_palette ? 0x00 : 0x80 | (image->palette_bits - 1)),
+    };
+
+    fwrite(graphic_control, 1, sizeof(graphic_control), f);
+    fwrite(descriptor, 1, sizeof(descriptor), f);
+    if (!image->uses_global_palette) fwrite(image->palette, 1, (size_t)3 << image->palette_bits, f);
+    fputc(image->min_code_size, f);
+
+    for (size_t offset = 0; offset < image->lzw.size; offset += 255) {
+        const size_t length = image->lzw.size - offset < 255 ? image->lzw.size - offset : 255;
+
+        fputc((int)length, f);
+        fwrite(image->lzw.data + offset, 1, length, f);
+    }
+
+    fputc(0x00, f);
+
+    encoder->last_delay = delay;
+
+    return ferror(f) == 0;
+}
+
+static void gif_encoder_free(GifEncoder *encoder)
+{
+    if (encoder->workers) {
+        for (int w = 0; w < thread_pool_size(encoder->pool); w++) free(encoder->workers[w].row);
+    }
+
+    if (encoder->stripes) {
+        for (int s = 0; s < encoder->max_stripes; s++) free(encoder->stripes[s].lzw.data);
+    }
+
+    free(encoder->images[0].lzw.data);
+    free(encoder->images[1].lzw.data);
+    free(encoder->candidates[0].lzw.data);
+    free(encoder->candidates[1].lzw.data);
+    free(encoder->shown);
+    free(encoder->run_indices);
+    free(encoder->stripes);
+    free(encoder->workers);
+    free(encoder->indices);
+    free(encoder->previous);
+    free(encoder->held);
+    free(encoder->held_cursor_pixels);
+    thread_pool_free(encoder->pool);
+    free(encoder);
+}
+
+GifEncoder *gif_encoder_new(const char *path, const int width, const int height, const int n_threads)
+{
+    const GifEncoderOptions options = { 0 };
+
+    return gif_encoder_new_with_options(path, width, height, n_threads, &options);
+}
+
+GifEncoder *gif_encoder_new_with_options(const char *path, const int width, const int height, const int n_threads, const GifEncoderOptions *options)
+{
+    if (width <= 0 || height <= 0 || width > UINT16_MAX || height > UINT16_MAX) {
+        fprintf(stderr, "ERROR: Invalid GIF size %dx%d\n", width, height);
+        return nullptr;
+    }
+
+    GifEncoder *encoder = calloc(1, sizeof(GifEncoder));
+    if (encoder == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate GIF encoder\n");
+        return nullptr;
+    }
+
+    encoder->width = width;
+    encoder->height = height;
+    encoder->options = *options;
+    encoder->lut_generation = 0;
+
+    int max_stripes = height / GIF_MIN_STRIPE_HEIGHT;
+    if (max_stripes > n_threads) max_stripes = n_threads;
+    if (max_stripes < 1) max_stripes = 1;
+
+    encoder->max_stripes = max_stripes;
+    encoder->pool = thread_pool_new(max_stripes);
+    encoder->workers = encoder->pool ? calloc((size_t)thread_pool_size(encoder->pool), sizeof(GifWorker)) : nullptr;
+    encoder->stripes = calloc((size_t)max_stripes, sizeof(GifStripe));
+    encoder->indices = malloc((size_t)width * (size_t)height);
+    encoder->previous = malloc((size_t)width * (size_t)height * 4);
+
+    bool has_rows = encoder->workers != NULL;
+
+    for (int w = 0; has_rows && w < thread_pool_size(encoder->pool); w++) {
+        encoder->workers[w].row = malloc((size_t)width * 4);
+        has_rows = encoder->workers[w].row != NULL;
+    }
+
+    if (options->search_lzw) {
+        encoder->shown = calloc((size_t)width * (size_t)height, 3);
+        encoder->run_indices = malloc((size_t)width * (size_t)height);
+    }
+
+    if (encoder->pool == NULL || !has_rows || encoder->stripes == NULL || encoder->indices == NULL || encoder->previous == NULL
+        || (options->search_lzw && (encoder->shown == NULL || encoder->run_indices == NULL))) {
+        fprintf(stderr, "ERROR: Unable to allocate GIF encoder\n");
+        gif_encoder_free(encoder);
+        return nullptr;
+    }
+
+    encoder->file = fopen(path, "wb");
+    if (encoder->file == NULL) {
+        fprintf(stderr, "ERROR: Unable to open %s for writing\n", path);
+        gif_encoder_free(encoder);
+        return nullptr;
+    }
+
+    setvbuf(encoder->file, nullptr, _IOFBF, 1 << 20);
+
+    printf("INFO: Encoding %dx%d GIF to %s with %d threads\n", width, height, path, thread_pool_size(encoder->pool));
+
+    return encoder;
+}
+
+bool gif_encoder_push_frame(GifEncoder *encoder, const uint8_t *pixels, const int stride, const uint64_t pts)
+{
+    return gif_encoder_push_layered_frame(encoder, pixels, stride, pts, nullptr, nullptr);
+}
+
+// Copies what the diff of a skipped frame reads, the skipped regions and both pointer positions,
+// since its pixels are gone once the push returns
+static bool hold_frame(GifEncoder *encoder, const uint8_t *pixels, const int stride, const GifCursor *cursor, const GifRegion cursor_region)
+{
+    const size_t cursor_size = cursor ? (size_t)cursor->width * (size_t)cursor->height * 4 : 0;
+
+    if (encoder->held == NULL) encoder->held = calloc((size_t)encoder->width * (size_t)encoder->height, 4);
+
+    if (cursor_size > encoder->held_cursor_capacity) {
+        uint8_t *cursor_pixels = realloc(encoder->held_cursor_pixels, cursor_size);
+
+        if (cursor_pixels != NULL) {
+            encoder->held_cursor_pixels = cursor_pixels;
+            encoder->held_cursor_capacity = cursor_size;
+        }
+    }
+
+    if (encoder->held == NULL || cursor_size > encoder->held_cursor_capacity) {
+        fprintf(stderr, "ERROR: Unable to allocate memory for GIF frame\n");
+        return false;
+    }
+
+    const GifRegion region = union_region(union_region(encoder->skipped, encoder->shown_cursor), cursor_region);
+
+    for (int y = region.y0; y < region.y1; y++) {
+        memcpy(encoder->held + ((size_t)y * (size_t)encoder->width + (size_t)region.x0) * 4,
+            pixels + (size_t)y * (size_t)stride + (size_t)region.x0 * 4,
+            (size_t)(region.x1 - region.x0) * 4);
+    }
+
+    encoder->has_held_cursor = cursor != NULL;
+
+    if (cursor) {
+        memcpy(encoder->held_cursor_pixels, cursor->pixels, cursor_size);
+        encoder->held_cursor = *cursor;
+        encoder->held_cursor.pixels = encoder->held_cursor_pixels;
+    }
+
+    encoder->has_held = true;
+
+    return true;
+}
+
+static bool encode_frame(GifEncoder *encoder, const uint8_t *pixels, const int stride, const uint64_t pts,
+                         const GifRegion changed_region, const GifCursor *cursor, const GifRegion cursor_region);
+
+bool gif_encoder_push_layered_frame(GifEncoder *encoder, const uint8_t *pixels, const int stride, const uint64_t pts, const GifRect *changed, const GifCursor *cursor)
+{
+    const GifRegion frame = { 0, 0, encoder->width, encoder->height };
+    const GifRegion changed_region = changed ? clip_region(changed->x, changed->y, changed->width, changed->height, encoder) : frame;
+    const GifRegion cursor_region = cursor ? clip_region(cursor->x, cursor->y, cursor->width, cursor->height, encoder) : (GifRegion){ 0 };
+
+    encoder->stats.frames_pushed++;
+
+    if (encoder->has_frames && pts < encoder->last_pts + GIF_MIN_FRAME_INTERVAL) {
+        // Diffed with the next frame instead, or encoded by gif_encoder_finish() when it is the last one
+        encoder->skipped = union_region(encoder->skipped, changed_region);
+        encoder->latest_pts = pts;
+        return hold_frame(encoder, pixels, stride, cursor, cursor_region);
+    }
+
+    encoder->has_held = false;
+
+    return encode_frame(encoder, pixels, stride, pts, changed_region, cursor, cursor_region);
+}
+
+// Diffs the frame against what is shown, encodes what changed and writes out the image before it
+static bool encode_frame(GifEncoder *encoder, const uint8_t *pixels, const int stride, const uint64_t pts,
+                         const GifRegion changed_region, const GifCursor *cursor, const GifRegion cursor_region)
+{
+    const GifRegion frame = { 0, 0, encoder->width, encoder->height };
+
+    encoder->pixels = pixels;
+    encoder->stride = stride;
+    encoder->cursor = cursor;
+    encoder->latest_pts = pts;
+    encoder->region = encoder->has_previous
+        ? union_region(union_region(changed_region, encoder->skipped), union_region(encoder->shown_cursor, cursor_region))
+        : frame;
+    encoder->skipped = (GifRegion){ 0 };
+    encoder->shown_cursor = cursor_region;
+
+    // Nothing changed, the pending frame simply stays on screen for longer
+    if (encoder->region.x1 <= encoder->region.x0 || encoder->region.y1 <= encoder->region.y0) {
+        return true;
+    }
+
+    split_stripes(encoder, encoder->region.y0, encoder->region.y1);
+    thread_pool_run(encoder->pool, encoder->n_stripes, diff_task, encoder);
+
+    GifImage *image = &encoder->images[encoder->current];
+    int min_x = encoder->width;
+    int max_x = -1;
+    int min_y = encoder->height;
+    int max_y = -1;
+
+    for (int s = 0; s < encoder->n_stripes; s++) {
+        const GifStripe *stripe = &encoder->stripes[s];
+        if (stripe->max_x < stripe->min_x) continue;
+
+        if (stripe->min_x < min_x) min_x = stripe->min_x;
+        if (stripe->max_x > max_x) max_x = stripe->max_x;
+        if (stripe->min_y < min_y) min_y = stripe->min_y;
+        if (stripe->max_y > max_y) max_y = stripe->max_y;
+    }
+
+    // Nothing changed, the pending frame simply stays on screen for longer
+    if (max_x < min_x) {
+        return true;
+    }
+
+    thread_pool_run(encoder->pool, GIF_HISTOGRAM_SIZE / GIF_MERGE_CHUNK, merge_task, encoder);
+
+    // One palette entry is kept free for the transparent index once there is something to diff
+    // against, the global palette needs it from the start
+    build_palette(encoder, encoder->has_previous || encoder->options.reuse_palette ? GIF_MAX_COLORS - 1 : GIF_MAX_COLORS);
+
+    image->uses_global_palette = encoder->options.reuse_palette && use_global_palette(encoder);
+    if (image->uses_global_palette) encoder->stats.global_palette_frames++;
+
+    // GIF players clamp zero delays, so the changed regions are merged into one sub-image instead of
+    // being emitted as separate images
+    image->x = min_x;
+    image->y = min_y;
+    image->width = max_x - min_x + 1;
+    image->height = max_y - min_y + 1;
+    image->transparent_index = encoder->has_previous ? encoder->palette_size : -1;
+
+    image->palette_bits = image->uses_global_palette
+        ? encoder->global_palette_bits
+        : palette_bits_for(encoder->palette_size + (image->transparent_index >= 0));
+    image->min_code_size = image->palette_bits < 2 ? 2 : image->palette_bits;
+
+    memset(image->palette, 0, sizeof(image->palette));
+    memcpy(image->palette, encoder->palette, (size_t)encoder->palette_size * 3);
+
+    split_stripes(encoder, min_y, max_y + 1);
+
+    bool joined;
+
+    if (encoder->options.search_lzw) {
+        encode_searching(encoder, image);
+        joined = join_stripes(encoder->candidates, 1, image);
+    } else {
+        thread_pool_run(encoder->pool, encoder->n_stripes, encode_stripe_task, encoder);
+        joined = join_stripes(encoder->stripes, encoder->n_stripes, image);
+    }
+
+    if (!joined) {
+        fprintf(stderr, "ERROR: Unable to allocate memory for GIF frame\n");
+        return false;
+    }
+
+    // The previous frame lasts until this one
+    if (encoder->has_pending) {
+        if (!write_image(encoder, &encoder->images[encoder->current ^ 1], next_delay(encoder, pts))) {
+            fprintf(stderr, "ERROR: Unable to write GIF frame\n");
+            return false;
+        }
+    }
+
+    if (!encoder->has_frames) {
+        encoder->first_pts = pts;
+        encoder->has_frames = true;
+    }
+
+    encoder->stats.frames_encoded++;
+    encoder->last_pts = pts;
+    encoder->has_pending = true;
+    encoder->has_previous = true;
+    encoder->current ^= 1;
+
+    return true;
+}
+
+void gif_encoder_get_stats(const GifEncoder *encoder, GifEncoderStats *stats)
+{
+    *stats = encoder->stats;
+}
+
+bool gif_encoder_finish(GifEncoder *encoder)
+{
+    bool ok = true;
+
+    // A frame skipped for coming too soon after the previous one is still the last thing shown
+    if (encoder->has_held) {
+        const GifRegion cursor_region = encoder->has_held_cursor
+            ? clip_region(encoder->held_cursor.x, encoder->held_cursor.y, encoder->held_cursor.width, encoder->held_cursor.height, encoder)
+            : (GifRegion){ 0 };
+
+        encoder->has_held = false;
+        ok = encode_frame(encoder, encoder->held, encoder->width * 4, encoder->latest_pts, (GifRegion){ 0 },
+            encoder->has_held_cursor ? &encoder->held_cursor : nullptr, cursor_region);
+    }
+
+    if (ok && encoder->has_pending) {
+        int delay = encoder->last_delay > 0 ? encoder->last_delay : GIF_DEFAULT_DELAY;
+
+        // Identical frames at the end extend the last one
+        if (encoder->latest_pts > encoder->last_pts) {
+            delay = next_delay(encoder, encoder->latest_pts);
+        }
+
+        ok = write_image(encoder, &encoder->images[encoder->current ^ 1], delay);
+    }
+
+    if (!encoder->has_header && !write_header(encoder)) ok = false;
+
+    fputc(0x3B, encoder->file);
+
+    if (ferror(encoder->file)) ok = false;
+    if (fclose(encoder->file) != 0) ok = false;
+
+    if (!ok) {
+        fprintf(stderr, "ERROR: Unable to finish writing GIF file\n");
+    }
+
+    gif_encoder_free(encoder);
+
+    return ok;
+}
@@ -0,0 +1,65 @@
+#ifndef GIF_ENCODER_H
+#define GIF_ENCODER_H
+
+#include <stdint.h>
+
+typedef struct GifEncoder GifEncoder;
+
+// Slower settings for files that are written once and kept, see gif_optimize.c
+typedef struct {
+    // The first palette becomes the global color table, later frames whose colors are all in it
+    // skip their own table
+    bool reuse_palette;
+    // Every frame is compressed as a single LZW run, once with unchanged pixels transparent and
+    // once with them continuing the run before them where the color allows, and the smaller is kept
+    bool search_lzw;
+} GifEncoderOptions;
+
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} GifRect;
+
+// A pointer drawn over the frame by the encoder, `width` * `height` BGRA pixels with straight
+// alpha whose top left corner is at `x`, `y`, which may be outside the frame
+typedef struct {
+    const uint8_t *pixels;
+    int width;
+    int height;
+    int x;
+    int y;
+} GifCursor;
+
+typedef struct {
+    int frames_pushed;
+    // Frames left after dropping identical ones and ones too close to the previous one
+    int frames_encoded;
+    int global_palette_frames;
+    int extended_run_frames;
+} GifEncoderStats;
+
+// Opens `path` for writing an animated GIF of the given size. Every frame is quantized to
+// its own palette, the work is split into horizontal stripes spread over `n_threads` threads.
+// Only the bounding box of what changed since the previous frame is encoded, with the unchanged
+// pixels inside it left transparent, and identical frames just extend the previous one.
+GifEncoder *gif_encoder_new(const char *path, int width, int height, int n_threads);
+
+GifEncoder *gif_encoder_new_with_options(const char *path, int width, int height, int n_threads, const GifEncoderOptions *options);
+
+// Encodes a BGRx frame. `pts` is in nanoseconds and is used to work out frame delays.
+// The frame is written out once the timestamp of the next one is known.
+bool gif_encoder_push_frame(GifEncoder *encoder, const uint8_t *pixels, int stride, uint64_t pts);
+
+// Same as gif_encoder_push_frame(), with the pointer kept apart from the frame. Only `changed`,
+// nullptr for the whole frame, and where the pointer was and is are diffed, so a pointer moving
+// over a still screen is encoded as a sub-image of its own size. `cursor` is nullptr while hidden.
+bool gif_encoder_push_layered_frame(GifEncoder *encoder, const uint8_t *pixels, int stride, uint64_t pts, const GifRect *changed, const GifCursor *cursor);
+
+void gif_encoder_get_stats(const GifEncoder *encoder, GifEncoderStats *stats);
+
+// Writes the last frame and the trailer, closes the file and frees the encoder.
+bool gif_encoder_finish(GifEncoder *encoder);
+
+#endif
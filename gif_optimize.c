@@ -0,0 +1,342 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "gif_decoder.h"
+#include "gif_encoder.h"
+#include "thread_pool.h"
+
+// Re-encodes GIFs written by the GIF mode, or any other GIF, with the slow encoder settings: the
+// encoder drops repeated frames and crops every frame to what changed, on top of that palettes
+// are shared through the global color table and each frame gets the smaller of two LZW encodings.
+// Several files are optimized at once and every file uses the remaining cores for its stripes.
+
+#define OPTIMIZE_MAX_FILES 4096
+#define DEFAULT_SUFFIX ".optimized"
+
+// Images shown for less than this are not pushed on their own, see GIF_MIN_FRAME_INTERVAL
+#define MIN_DELAY_CS 2
+
+typedef struct {
+    int jobs;
+    int threads;
+    bool in_place;
+    const char *suffix;
+    GifEncoderOptions encoder;
+} OptimizeOptions;
+
+typedef struct {
+    char path[PATH_MAX];
+    char output[PATH_MAX];
+
+    long long input_bytes;
+    long long output_bytes;
+    int images;
+    GifEncoderStats stats;
+    double seconds;
+
+    bool ok;
+    bool replaced;
+} OptimizeJob;
+
+typedef struct {
+    const OptimizeOptions *options;
+    OptimizeJob *jobs;
+} OptimizeContext;
+
+static void print_usage(void)
+{
+    fprintf(stderr,
+        "Usage: gif_optimize [options] FILE|DIR...\n"
+        "  --jobs=N            files optimized at once (default: one per core, at most the number of files)\n"
+        "  --threads=N         threads per file (default: the cores left over by --jobs)\n"
+        "  --in-place          replace each file when the result is smaller\n"
+        "  --suffix=TEXT       added in front of .gif otherwise (default: " DEFAULT_SUFFIX ")\n"
+        "  --no-global-palette give every frame its own color table\n"
+        "  --no-lzw-search     keep the first LZW encoding of every frame\n"
+        "Directories are searched for *.gif, skipping earlier output.\n");
+}
+
+static double monotonic_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static long long file_size(const char *path)
+{
+    struct stat st;
+
+    return stat(path, &st) == 0 ? (long long)st.st_size : -1;
+}
+
+static bool has_suffix(const char *name, const char *suffix)
+{
+    const size_t length = strlen(name);
+    const size_t suffix_length = strlen(suffix);
+
+    return length >= suffix_length && strcmp(name + length - suffix_length, suffix) == 0;
+}
+
+static int compare_jobs(const void *a, const void *b)
+{
+    return strcmp(((const OptimizeJob *)a)->path, ((const OptimizeJob *)b)->path);
+}
+
+static bool add_file(OptimizeJob *jobs, int *n_jobs, const char *path)
+{
+    if (*n_jobs == OPTIMIZE_MAX_FILES) {
+        fprintf(stderr, "ERROR: More than %d files, ignoring %s\n", OPTIMIZE_MAX_FILES, path);
+        return false;
+    }
+
+    snprintf(jobs[(*n_jobs)++].path, PATH_MAX, "%s", path);
+
+    return true;
+}
+
+// Adds the GIFs directly in `path`, leaving out the ones an earlier run wrote
+static bool add_directory(OptimizeJob *jobs, int *n_jobs, const char *path, const char *suffix)
+{
+    DIR *dir = opendir(path);
+
+    if (dir == NULL) {
+        fprintf(stderr, "ERROR: Unable to open %s\n", path);
+        return false;
+    }
+
+    char output_suffix[NAME_MAX];
+    snprintf(output_suffix, sizeof(output_suffix), "%s.gif", suffix);
+
+    for (struct dirent *entry = readdir(dir); entry; entry = readdir(dir)) {
+        if (!has_suffix(entry->d_name, ".gif") || has_suffix(entry->d_name, output_suffix)) continue;
+
+        char file[PATH_MAX];
+        snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+
+        if (!add_file(jobs, n_jobs, file)) break;
+    }
+
+    closedir(dir);
+
+    return true;
+}
+
+static bool optimize_file(const OptimizeOptions *options, OptimizeJob *job)
+{
+    int width;
+    int height;
+    GifDecoder *decoder = gif_decoder_open(job->path, &width, &height);
+
+    if (decoder == NULL) return false;
+
+    GifEncoder *encoder = gif_encoder_new_with_options(job->output, width, height, options->threads, &options->encoder);
+
+    if (encoder == NULL) {
+        gif_decoder_close(decoder);
+        return false;
+    }
+
+    const uint8_t *pixels;
+    const uint8_t *canvas = nullptr;
+    int delay_cs;
+    uint64_t time_cs = 0;
+    // Start of the images at the end that were too brief to push, -1 when there are none
+    int64_t unpushed_cs = -1;
+    bool ok = true;
+
+    while ((ok = gif_decoder_next_frame(decoder, &pixels, &delay_cs)) && pixels) {
+        job->images++;
+        canvas = pixels;
+
+        // Images shown too briefly to matter only add to the next one, which is drawn over them
+        if (delay_cs >= MIN_DELAY_CS) {
+            ok = gif_encoder_push_frame(encoder, canvas, width * 4, time_cs * 10000000);
+            unpushed_cs = -1;
+        } else if (unpushed_cs < 0) {
+            unpushed_cs = (int64_t)time_cs;
+        }
+
+        time_cs += (uint64_t)delay_cs;
+
+        if (!ok) break;
+    }
+
+    if (!ok) {
+        fprintf(stderr, "ERROR: Unable to decode %s\n", job->path);
+    }
+
+    if (ok && unpushed_cs >= 0) {
+        ok = gif_encoder_push_frame(encoder, canvas, width * 4, (uint64_t)unpushed_cs * 10000000);
+    }
+
+    // The same canvas again at the end only sets how long the last frame stays
+    if (ok && canvas) {
+        ok = gif_encoder_push_frame(encoder, canvas, width * 4, time_cs * 10000000);
+    }
+
+    gif_encoder_get_stats(encoder, &job->stats);
+
+    if (!gif_encoder_finish(encoder)) ok = false;
+
+    gif_decoder_close(decoder);
+
+    return ok && job->stats.frames_encoded > 0;
+}
+
+static void optimize_task(void *context, const int task_index, const int worker_index)
+{
+    const OptimizeContext *optimize = context;
+    const OptimizeOptions *options = optimize->options;
+    OptimizeJob *job = &optimize->jobs[task_index];
+    const double start = monotonic_seconds();
+
+    if (options->in_place) {
+        snprintf(job->output, sizeof(job->output), "%s.optimizing", job->path);
+    } else {
+        const int base_length = has_suffix(job->path, ".gif") ? (int)strlen(job->path) - 4 : (int)strlen(job->path);
+        snprintf(job->output, sizeof(job->output), "%.*s%s.gif", base_length, job->path, options->suffix);
+    }
+
+    job->input_bytes = file_size(job->path);
+    job->ok = optimize_file(options, job);
+    job->output_bytes = file_size(job->output);
+    job->seconds = monotonic_seconds() - start;
+
+    if (!job->ok) {
+        unlink(job->output);
+        fprintf(stderr, "ERROR: Unable to optimize %s\n", job->path);
+        return;
+    }
+
+    if (options->in_place) {
+        if (job->output_bytes < job->input_bytes && rename(job->output, job->path) == 0) {
+            job->replaced = true;
+        } else {
+            unlink(job->output);
+        }
+    }
+
+    printf("INFO: %s: %lld -> %lld bytes (%+.1f%%), %d images -> %d frames, %d on the global palette, %d with extended runs, %.1f frames/s%s\n",
+        job->path, job->input_bytes, job->output_bytes,
+        job->input_bytes > 0 ? 100.0 * (double)(job->output_bytes - job->input_bytes) / (double)job->input_bytes : 0.0,
+        job->images, job->stats.frames_encoded, job->stats.global_palette_frames, job->stats.extended_run_frames,
+        job->seconds > 0 ? job->images / job->seconds : 0.0,
+        options->in_place && !job->replaced ? ", kept the original" : "");
+}
+
+int main(const int argc, char *argv[])
+{
+    OptimizeOptions options = {
+        .suffix = DEFAULT_SUFFIX,
+        .encoder = { .reuse_palette = true, .search_lzw = true },
+    };
+    OptimizeJob *jobs = calloc(OPTIMIZE_MAX_FILES, sizeof(OptimizeJob));
+    int n_jobs = 0;
+    bool ok = jobs != NULL;
+
+    // Options first, so --suffix applies to every directory
+    for (int i = 1; ok && i < argc; i++) {
+        if (strncmp(argv[i], "--jobs=", 7) == 0) {
+            options.jobs = atoi(argv[i] + 7);
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            options.threads = atoi(argv[i] + 10);
+        } else if (strcmp(argv[i], "--in-place") == 0) {
+            options.in_place = true;
+        } else if (strncmp(argv[i], "--suffix=", 9) == 0) {
+            options.suffix = argv[i] + 9;
+        } else if (strcmp(argv[i], "--no-global-palette") == 0) {
+            options.encoder.reuse_palette = false;
+        } else if (strcmp(argv[i], "--no-lzw-search") == 0) {
+            options.encoder.search_lzw = false;
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            fprintf(stderr, "ERROR: Unknown argument: %s\n", argv[i]);
+            ok = false;
+        }
+    }
+
+    for (int i = 1; ok && i < argc; i++) {
+        struct stat st;
+
+        if (strncmp(argv[i], "--", 2) == 0) continue;
+
+        if (stat(argv[i], &st) != 0) {
+            fprintf(stderr, "ERROR: %s does not exist\n", argv[i]);
+            ok = false;
+        } else if (S_ISDIR(st.st_mode)) {
+            ok = add_directory(jobs, &n_jobs, argv[i], options.suffix);
+        } else {
+            add_file(jobs, &n_jobs, argv[i]);
+        }
+    }
+
+    if (!ok || n_jobs == 0) {
+        if (ok) fprintf(stderr, "ERROR: No GIFs to optimize\n");
+        print_usage();
+        free(jobs);
+
+        return 1;
+    }
+
+    qsort(jobs, (size_t)n_jobs, sizeof(OptimizeJob), compare_jobs);
+
+    const int n_cores = (int)sysconf(_SC_NPROCESSORS_ONLN) > 0 ? (int)sysconf(_SC_NPROCESSORS_ONLN) : 1;
+
+    if (options.jobs <= 0) options.jobs = n_cores;
+    if (options.jobs > n_jobs) options.jobs = n_jobs;
+    if (options.threads <= 0) options.threads = n_cores / options.jobs > 1 ? n_cores / options.jobs : 1;
+
+    printf("INFO: Optimizing %d files, %d at once with %d threads each\n", n_jobs, options.jobs, options.threads);
+
+    ThreadPool *pool = thread_pool_new(options.jobs);
+
+    if (pool == NULL) {
+        fprintf(stderr, "ERROR: Unable to start %d jobs\n", options.jobs);
+        free(jobs);
+
+        return 1;
+    }
+
+    OptimizeContext context = { .options = &options, .jobs = jobs };
+    const double start = monotonic_seconds();
+
+    thread_pool_run(pool, n_jobs, optimize_task, &context);
+
+    const double seconds = monotonic_seconds() - start;
+    long long input_bytes = 0;
+    long long output_bytes = 0;
+    long long images = 0;
+    int failed = 0;
+
+    for (int i = 0; i < n_jobs; i++) {
+        if (!jobs[i].ok) {
+            failed++;
+            continue;
+        }
+
+        input_bytes += jobs[i].input_bytes;
+        // Files that did not get smaller stay as they were when optimizing in place
+        output_bytes += options.in_place && !jobs[i].replaced ? jobs[i].input_bytes : jobs[i].output_bytes;
+        images += jobs[i].images;
+    }
+
+    printf("INFO: %d of %d files, %.1f MB -> %.1f MB (%+.1f%%) in %.2f s, %.1f frames/s, %.1f MB/s\n",
+        n_jobs - failed, n_jobs, (double)input_bytes / 1e6, (double)output_bytes / 1e6,
+        input_bytes > 0 ? 100.0 * (double)(output_bytes - input_bytes) / (double)input_bytes : 0.0,
+        seconds, seconds > 0 ? (double)images / seconds : 0.0, seconds > 0 ? (double)input_bytes / 1e6 / seconds : 0.0);
+
+    thread_pool_free(pool);
+    free(jobs);
+
+    return failed > 0 ? 1 : 0;
+}
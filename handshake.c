@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <gstreamer-1.0/gst/gst.h>
+
+#include "handshake.h"
+#include "pipeline.h"
+#include "screencast.h"
+
+// A stream without a frame this long after it was added counts as broken
+#define HANDSHAKE_FIRST_FRAME_TIMEOUT_MS 5000
+
+// How late after its deadline a step may fail before the timeout itself counts as broken
+#define HANDSHAKE_DEADLINE_SLACK_MS 500
+
+typedef struct {
+    int area[4];
+    bool expect_timeout;
+    const char *output_dir;
+} HandshakeOptions;
+
+static void print_usage(void)
+{
+    fprintf(stderr,
+        "Usage: record_area handshake [options]\n"
+        "  --area=X,Y,W,H      area to ask the ScreenCast service for (default: 0,0,640,480)\n"
+        "  --expect=RESULT     ok for a first frame, timeout for a step of the handshake timing out (default: ok)\n"
+        "  --output-dir=DIR    where the recording and its statistics go (default: /tmp)\n");
+}
+
+static bool parse_options(const int argc, char *argv[], HandshakeOptions *options)
+{
+    for (int i = 0; i < argc; i++) {
+        char *arg = argv[i];
+        char *value = strchr(arg, '=');
+
+        if (value == NULL) {
+            fprintf(stderr, "ERROR: Unknown handshake argument: %s\n", arg);
+            return false;
+        }
+
+        *value++ = '\0';
+
+        if (strcmp(arg, "--area") == 0) {
+            if (sscanf(value, "%d,%d,%d,%d", &options->area[0], &options->area[1], &options->area[2], &options->area[3]) != 4
+                || options->area[2] <= 0 || options->area[3] <= 0) {
+                fprintf(stderr, "ERROR: Invalid area: %s\n", value);
+                return false;
+            }
+        } else if (strcmp(arg, "--expect") == 0) {
+            if (strcmp(value, "ok") != 0 && strcmp(value, "timeout") != 0) {
+                fprintf(stderr, "ERROR: --expect must be ok or timeout\n");
+                return false;
+            }
+
+            options->expect_timeout = strcmp(value, "timeout") == 0;
+        } else if (strcmp(arg, "--output-dir") == 0) {
+            options->output_dir = value;
+        } else {
+            fprintf(stderr, "ERROR: Unknown handshake argument: %s\n", arg);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Sleeps until the bus has something to read or the next step of the handshake times out, as the
+// render loop does
+static void wait_for_bus(const ScreenCastState *state)
+{
+    const long long deadline = screen_cast_next_deadline(state);
+    int timeout_ms = 100;
+
+    if (deadline >= 0) {
+        const long long remaining = deadline - g_get_monotonic_time();
+        timeout_ms = remaining > 0 ? (int)(remaining / 1000) + 1 : 0;
+    }
+
+    struct pollfd fd = { .fd = screen_cast_get_fd(state), .events = POLLIN };
+    poll(&fd, 1, timeout_ms);
+}
+
+static bool has_first_frame_report(const char *stats_location)
+{
+    char line[256];
+    bool found = false;
+    FILE *f = fopen(stats_location, "r");
+
+    if (f == NULL) return false;
+
+    while (!found && fgets(line, sizeof(line), f)) {
+        found = strncmp(line, "Time to first frame:", 20) == 0;
+    }
+
+    fclose(f);
+
+    return found;
+}
+
+// Starts the pipeline on the added stream and waits for its first frame to be reported
+static bool record_first_frame(Recording *recording, const ScreenCastStream *stream)
+{
+    if (!wait_for_pipeline(recording)) {
+        fprintf(stderr, "ERROR: Unable to build the pipeline\n");
+        return false;
+    }
+
+    if (!connect_pipewire_node(recording, stream->pipewire_node_id) || !start_pipeline(recording)) {
+        return false;
+    }
+
+    const gint64 frame_deadline = g_get_monotonic_time() + (gint64)HANDSHAKE_FIRST_FRAME_TIMEOUT_MS * 1000;
+
+    while (g_atomic_int_get(&recording->time_to_first_frame_us) == 0 && g_get_monotonic_time() < frame_deadline) {
+        g_usleep(1000);
+    }
+
+    const gint time_to_first_frame = g_atomic_int_get(&recording->time_to_first_frame_us);
+    bool ok = finish_recording(recording, 5 * GST_SECOND);
+
+    if (time_to_first_frame == 0) {
+        fprintf(stderr, "ERROR: No frame %d ms after PipeWire stream %u was added\n", HANDSHAKE_FIRST_FRAME_TIMEOUT_MS, stream->pipewire_node_id);
+        return false;
+    }
+
+    // Written when the pipeline went back to READY
+    if (!has_first_frame_report(recording->stats_location)) {
+        fprintf(stderr, "ERROR: %s has no time to first frame\n", recording->stats_location);
+        ok = false;
+    }
+
+    printf("INFO: First frame %.1f ms after the record request\n", (double)time_to_first_frame / 1000.0);
+
+    return ok;
+}
+
+int run_handshake_test(const int argc, char *argv[])
+{
+    HandshakeOptions options = {
+        .area = { 0, 0, 640, 480 },
+        .output_dir = "/tmp",
+    };
+
+    if (argc == 1 && strcmp(argv[0], "--help") == 0) {
+        print_usage();
+        return 0;
+    }
+
+    if (!parse_options(argc, argv, &options)) {
+        print_usage();
+        return 1;
+    }
+
+    Recording recording = { .output_encoding = WEBM_ONLY_VIDEO };
+    snprintf(recording.location, sizeof(recording.location), "%s/handshake%s", options.output_dir, OUTPUT_ENCODING_EXTENSIONS[WEBM_ONLY_VIDEO]);
+    snprintf(recording.stats_location, sizeof(recording.stats_location), "%s.stats.txt", recording.location);
+    remove(recording.stats_location);
+
+    ScreenCastState state = { .cursor_mode = SCREEN_CAST_CURSOR_METADATA };
+
+    if (!screen_cast_connect(&state)) {
+        return 1;
+    }
+
+    // Built while the service answers, as after a record click
+    char video_source[256];
+    snprintf(video_source, sizeof(video_source),
+        "videotestsrc name=pipewiresrc is-live=true pattern=ball ! video/x-raw,format=BGRx,width=%d,height=%d,framerate=30/1",
+        options.area[2], options.area[3]);
+
+    prewarm_pipeline(&recording, video_source, "audiotestsrc name=audiosrc is-live=true", 0, 0);
+
+    const int index = screen_cast_record_area(&state, options.area[0], options.area[1], options.area[2], options.area[3]);
+
+    if (index < 0) {
+        wait_for_pipeline(&recording);
+        destroy_pipeline(&recording);
+        screen_cast_stop(&state);
+        return 1;
+    }
+
+    recording.request_time = g_get_monotonic_time();
+
+    // Every step has a deadline, so this only ends a handshake that ignores them
+    const gint64 give_up = recording.request_time + (gint64)SCREEN_CAST_TIMEOUT_MS * 1000 * 3;
+    long long deadline = -1;
+    bool is_failed = false;
+    bool ok = false;
+
+    while (g_get_monotonic_time() < give_up) {
+        deadline = screen_cast_next_deadline(&state);
+
+        const enum ScreenCastPhase phase = screen_cast_poll(&state);
+        const ScreenCastStream *stream = &state.streams[index];
+
+        if (phase == SCREEN_CAST_FAILED || stream->phase == SCREEN_CAST_FAILED) {
+            is_failed = true;
+            break;
+        }
+
+        if (stream->phase == SCREEN_CAST_STREAMING) {
+            ok = record_first_frame(&recording, stream);
+            break;
+        }
+
+        wait_for_bus(&state);
+    }
+
+    if (is_failed) {
+        const double late_ms = deadline >= 0 ? (double)(g_get_monotonic_time() - deadline) / 1000.0 : -1.0;
+
+        if (!options.expect_timeout) {
+            fprintf(stderr, "ERROR: The handshake failed\n");
+        } else if (late_ms < 0) {
+            fprintf(stderr, "ERROR: The handshake failed before any of its deadlines\n");
+        } else if (late_ms > HANDSHAKE_DEADLINE_SLACK_MS) {
+            fprintf(stderr, "ERROR: The handshake failed %.1f ms after its deadline, more than the %d ms allowed\n", late_ms, HANDSHAKE_DEADLINE_SLACK_MS);
+        } else {
+            printf("INFO: The handshake timed out %.1f ms after its deadline\n", late_ms);
+            ok = true;
+        }
+    } else if (options.expect_timeout) {
+        fprintf(stderr, "ERROR: The handshake was expected to time out\n");
+        ok = false;
+    } else if (!ok && g_get_monotonic_time() >= give_up) {
+        fprintf(stderr, "ERROR: The handshake did not end in %d ms\n", SCREEN_CAST_TIMEOUT_MS * 3);
+    }
+
+    wait_for_pipeline(&recording);
+    destroy_pipeline(&recording);
+
+    // Stop goes out without waiting, the mock checks that it arrives
+    screen_cast_stop(&state);
+
+    if (ok) {
+        printf("INFO: Handshake test passed\n");
+    } else {
+        fprintf(stderr, "ERROR: Handshake test failed\n");
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,11 @@
+#ifndef HANDSHAKE_H
+#define HANDSHAKE_H
+
+// Runs the screen cast handshake without a display against whatever owns the ScreenCast name on
+// the session bus, normally mock_screencast.py on a private one, and records from a synthetic
+// source named like pipewiresrc once the stream is added. Checks the time-to-first-frame report,
+// or with --expect=timeout that the handshake fails within its deadline. `argv` holds the
+// arguments that follow "handshake" on the command line.
+int run_handshake_test(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "rgb_kernels.h"
+
+// Checks that rgb_kernel_get() always finds a kernel this CPU runs for "auto", and that every
+// kernel it has matches the scalar one. Built a second time with __builtin_cpu_supports() masked,
+// see check-kernels in the Makefile, to stand in for a CPU without AVX2 or SSE4.1.
+
+// Odd, so the tail of the SIMD kernels and the repeated last column are covered
+#define CHECK_WIDTH 301
+
+static const char * const KERNEL_NAMES[] = { "scalar", "sse4.1", "avx2", "neon" };
+
+// Converts the same two rows with `kernel` and the scalar kernel, true when all planes match
+static bool matches_scalar(const RgbKernel *kernel, const RgbKernel *scalar, const uint8_t *rows, const bool rgb_order)
+{
+    uint8_t planes[2][4][CHECK_WIDTH];
+    const RgbKernel *kernels[2] = { kernel, scalar };
+
+    for (int i = 0; i < 2; i++) {
+        kernels[i]->to_i420(rows, rows + CHECK_WIDTH * 4, CHECK_WIDTH, rgb_order, planes[i][0], planes[i][1], planes[i][2], planes[i][3]);
+    }
+
+    return memcmp(planes[0][0], planes[1][0], CHECK_WIDTH) == 0
+        && memcmp(planes[0][1], planes[1][1], CHECK_WIDTH) == 0
+        && memcmp(planes[0][2], planes[1][2], (CHECK_WIDTH + 1) / 2) == 0
+        && memcmp(planes[0][3], planes[1][3], (CHECK_WIDTH + 1) / 2) == 0;
+}
+
+int main(void)
+{
+    const RgbKernel *scalar = rgb_kernel_get("scalar");
+    const RgbKernel *fastest = rgb_kernel_get("auto");
+    bool ok = true;
+
+    if (scalar == NULL) {
+        fprintf(stderr, "ERROR: There is no scalar kernel\n");
+        return 1;
+    }
+
+    if (fastest == NULL || rgb_kernel_get(nullptr) != fastest) {
+        fprintf(stderr, "ERROR: No kernel for auto, rgbconvert and damageconvert would have nothing to convert with\n");
+        return 1;
+    }
+
+    printf("INFO: auto picks the %s kernel\n", fastest->name);
+
+    uint8_t rows[CHECK_WIDTH * 4 * 2];
+    srand(1);
+
+    for (size_t i = 0; i < sizeof(rows); i++) {
+        rows[i] = (uint8_t)rand();
+    }
+
+    for (size_t i = 0; i < sizeof(KERNEL_NAMES) / sizeof(KERNEL_NAMES[0]); i++) {
+        const RgbKernel *kernel = rgb_kernel_get(KERNEL_NAMES[i]);
+
+        if (kernel == NULL) {
+            printf("INFO: %s is not available here\n", KERNEL_NAMES[i]);
+            continue;
+        }
+
+        if (!matches_scalar(kernel, scalar, rows, false) || !matches_scalar(kernel, scalar, rows, true)) {
+            fprintf(stderr, "ERROR: The %s kernel differs from the scalar one\n", kernel->name);
+            ok = false;
+            continue;
+        }
+
+        printf("INFO: %s matches the scalar kernel\n", kernel->name);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <gstreamer-1.0/gst/gst.h>
+
+#include "loop_bench.h"
+#include "control.h"
+#include "event_waiter.h"
+#include "overlay_meter.h"
+
+#define LOOP_BENCH_MAX_COMMANDS 10000
+
+// What the render loop slept between checks at most before it waited for events
+#define LOOP_BENCH_POLL_SECONDS 0.05
+
+typedef struct {
+    int commands;
+    int interval_ms;
+    double max_latency_ms;
+    bool use_poll;
+    const char *path;
+} LoopBenchOptions;
+
+typedef struct {
+    const LoopBenchOptions *options;
+    // Monotonic microseconds each command was sent at
+    gint64 sent[LOOP_BENCH_MAX_COMMANDS];
+    bool is_failed;
+    atomic_bool is_done;
+    // Ends a wait without a timeout when the client gave up before sending quit
+    int done_fd;
+} LoopBenchClient;
+
+static void print_usage(void)
+{
+    fprintf(stderr,
+        "Usage: record_area loop-bench [options]\n"
+        "  --commands=N        pause and resume commands to send (default: 20)\n"
+        "  --interval=MS       time between commands (default: 250)\n"
+        "  --poll              sleep up to 50 ms between checks as the loop used to instead of waiting\n"
+        "  --max-latency=MS    exit with 1 when a command took longer than MS to be applied\n"
+        "  --socket=PATH       control socket to use (default: /tmp/recording-indicator/loop-bench.sock)\n");
+}
+
+static bool parse_options(const int argc, char *argv[], LoopBenchOptions *options)
+{
+    for (int i = 0; i < argc; i++) {
+        char *arg = argv[i];
+
+        if (strcmp(arg, "--poll") == 0) {
+            options->use_poll = true;
+            continue;
+        }
+
+        char *value = strchr(arg, '=');
+
+        if (value == NULL) {
+            fprintf(stderr, "ERROR: Unknown loop benchmark argument: %s\n", arg);
+            return false;
+        }
+
+        *value++ = '\0';
+
+        if (strcmp(arg, "--commands") == 0) {
+            options->commands = atoi(value);
+        } else if (strcmp(arg, "--interval") == 0) {
+            options->interval_ms = atoi(value);
+        } else if (strcmp(arg, "--max-latency") == 0) {
+            options->max_latency_ms = atof(value);
+        } else if (strcmp(arg, "--socket") == 0) {
+            options->path = value;
+        } else {
+            fprintf(stderr, "ERROR: Unknown loop benchmark argument: %s\n", arg);
+            return false;
+        }
+    }
+
+    if (options->commands <= 0 || options->commands > LOOP_BENCH_MAX_COMMANDS) {
+        fprintf(stderr, "ERROR: --commands must be between 1 and %d\n", LOOP_BENCH_MAX_COMMANDS);
+        return false;
+    }
+
+    if (options->interval_ms < 0) {
+        fprintf(stderr, "ERROR: --interval must not be negative\n");
+        return false;
+    }
+
+    return true;
+}
+
+static double seconds_now(void)
+{
+    return (double)g_get_monotonic_time() / 1e6;
+}
+
+static bool send_command(const char *path, const char *command)
+{
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        fprintf(stderr, "ERROR: Unable to connect to %s\n", path);
+        if (fd >= 0) close(fd);
+        return false;
+    }
+
+    char line[64];
+    snprintf(line, sizeof(line), "%s\n", command);
+
+    const bool is_sent = send(fd, line, strlen(line), MSG_NOSIGNAL) == (ssize_t)strlen(line);
+    const ssize_t n = is_sent ? read(fd, line, sizeof(line) - 1) : -1;
+
+    close(fd);
+
+    if (n < 2 || strncmp(line, "OK", 2) != 0) {
+        fprintf(stderr, "ERROR: The control socket did not take %s\n", command);
+        return false;
+    }
+
+    return true;
+}
+
+static void *client_main(void *arg)
+{
+    LoopBenchClient *client = arg;
+    const LoopBenchOptions *options = client->options;
+
+    for (int i = 0; i < options->commands && !client->is_failed; i++) {
+        g_usleep((gulong)options->interval_ms * 1000);
+
+        client->sent[i] = g_get_monotonic_time();
+        client->is_failed = !send_command(options->path, i % 2 == 0 ? "pause" : "resume");
+    }
+
+    if (!send_command(options->path, "quit")) client->is_failed = true;
+
+    atomic_store(&client->is_done, true);
+    eventfd_write(client->done_fd, 1);
+
+    return nullptr;
+}
+
+int run_loop_benchmark(const int argc, char *argv[])
+{
+    LoopBenchOptions options = {
+        .commands = 20,
+        .interval_ms = 250,
+        .path = "/tmp/recording-indicator/loop-bench.sock",
+    };
+
+    if (argc == 1 && strcmp(argv[0], "--help") == 0) {
+        print_usage();
+        return 0;
+    }
+
+    if (!parse_options(argc, argv, &options)) {
+        print_usage();
+        return 1;
+    }
+
+    ControlServer *control = control_server_start(options.path);
+    if (control == NULL) return 1;
+
+    EventWaiter *waiter = nullptr;
+
+    if (!options.use_poll) {
+        waiter = event_waiter_start(true);
+
+        if (waiter == NULL || !event_waiter_watch(waiter, control_server_get_fd(control))) {
+            event_waiter_stop(waiter);
+            control_server_stop(control);
+            return 1;
+        }
+    }
+
+    LoopBenchClient *client = calloc(1, sizeof(LoopBenchClient));
+    gint64 *applied = calloc((size_t)options.commands, sizeof(gint64));
+    int n_applied = 0;
+    pthread_t thread;
+
+    if (client == NULL || applied == NULL || (client->done_fd = eventfd(0, EFD_NONBLOCK)) < 0) {
+        fprintf(stderr, "ERROR: Unable to set up the loop benchmark\n");
+        free(client);
+        free(applied);
+        event_waiter_stop(waiter);
+        control_server_stop(control);
+        return 1;
+    }
+
+    if (waiter) event_waiter_watch(waiter, client->done_fd);
+
+    client->options = &options;
+    pthread_create(&thread, nullptr, client_main, client);
+
+    OverlayMeter meter;
+    overlay_meter_start(&meter);
+
+    const double run_start = seconds_now();
+    double start_time = run_start;
+    double pause_time = 0.0;
+    bool is_paused = false;
+    int elapsed_seconds = 0;
+    int drawn_seconds = -1;
+    bool drawn_paused = false;
+    long wakeups = 0;
+
+    // Same steps as the render loop while recording, a frame is counted where it would draw one
+    while (true) {
+        const enum ControlCommand command = control_server_take(control);
+
+        if (command == CONTROL_QUIT) break;
+        if (atomic_load(&client->is_done) && client->is_failed) break;
+
+        if (command == CONTROL_PAUSE && !is_paused) {
+            is_paused = true;
+            pause_time = seconds_now();
+        } else if (command == CONTROL_RESUME && is_paused) {
+            is_paused = false;
+            start_time += seconds_now() - pause_time;
+        }
+
+        if ((command == CONTROL_PAUSE || command == CONTROL_RESUME) && n_applied < options.commands) {
+            applied[n_applied++] = g_get_monotonic_time();
+        }
+
+        if (!is_paused) elapsed_seconds = (int)(seconds_now() - start_time);
+
+        if (command != CONTROL_NONE || elapsed_seconds != drawn_seconds || is_paused != drawn_paused) {
+            drawn_seconds = elapsed_seconds;
+            drawn_paused = is_paused;
+            overlay_meter_frame(&meter);
+            continue;
+        }
+
+        wakeups++;
+
+        const double until_next_second = 1.0 - fmod(seconds_now() - start_time, 1.0);
+
+        if (options.use_poll) {
+            g_usleep((gulong)((is_paused ? LOOP_BENCH_POLL_SECONDS : fmin(until_next_second, LOOP_BENCH_POLL_SECONDS)) * 1e6));
+        } else {
+            event_waiter_wait(waiter, is_paused ? -1.0 : until_next_second);
+        }
+    }
+
+    char overlay[64];
+    overlay_meter_describe(&meter, overlay, sizeof(overlay));
+    const double run_seconds = seconds_now() - run_start;
+
+    pthread_join(thread, nullptr);
+
+    event_waiter_stop(waiter);
+    control_server_stop(control);
+
+    double total_ms = 0.0;
+    double max_ms = 0.0;
+
+    for (int i = 0; i < n_applied; i++) {
+        const double latency_ms = (double)(applied[i] - client->sent[i]) / 1e3;
+
+        total_ms += latency_ms;
+        max_ms = fmax(max_ms, latency_ms);
+    }
+
+    int status = client->is_failed || n_applied != options.commands ? 1 : 0;
+
+    printf("INFO: %s loop drew %ld frames in %.1f s and woke up %ld times without drawing, %s\n",
+        options.use_poll ? "Polling" : "Waiting", meter.frames, run_seconds, wakeups, overlay);
+
+    if (n_applied > 0) {
+        printf("INFO: %s loop applied %d commands, latency %.3f ms on average, %.3f ms at most\n",
+            options.use_poll ? "Polling" : "Waiting", n_applied, total_ms / n_applied, max_ms);
+    }
+
+    if (n_applied != options.commands) {
+        fprintf(stderr, "ERROR: Only %d of %d commands were applied\n", n_applied, options.commands);
+    }
+
+    if (options.max_latency_ms > 0 && max_ms > options.max_latency_ms) {
+        fprintf(stderr, "ERROR: A command took %.3f ms to be applied, more than the %.3f ms allowed\n", max_ms, options.max_latency_ms);
+        status = 1;
+    }
+
+    close(client->done_fd);
+    free(client);
+    free(applied);
+
+    return status;
+}
@@ -0,0 +1,10 @@
+#ifndef LOOP_BENCH_H
+#define LOOP_BENCH_H
+
+// Runs the render loop of a recording without a display: a client sends pause and resume commands
+// over a control socket, and the time until the loop applies each one is reported along with the
+// frames drawn, the wakeups and the CPU time of the loop's thread. `argv` holds the arguments that
+// follow "loop-bench" on the command line.
+int run_loop_benchmark(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,198 @@
+#!/usr/bin/env python3
+"""Stands in for Mutter's org.gnome.Mutter.ScreenCast on the session bus, so the screen cast
+handshake can be tested without a GNOME session, e.g.
+
+    dbus-run-session -- ./mock_screencast.py -- ./record_area handshake
+
+The command after -- runs once the name is owned and its exit status is returned. With --hang a
+step never answers, to exercise the deadlines of the handshake. Needs dbus-python and PyGObject.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+
+import dbus
+import dbus.service
+from dbus.mainloop.glib import DBusGMainLoop
+from gi.repository import GLib
+
+SERVICE = 'org.gnome.Mutter.ScreenCast'
+OBJECT_PATH = '/org/gnome/Mutter/ScreenCast'
+SCREENCAST_INTERFACE = 'org.gnome.Mutter.ScreenCast'
+SESSION_INTERFACE = 'org.gnome.Mutter.ScreenCast.Session'
+STREAM_INTERFACE = 'org.gnome.Mutter.ScreenCast.Stream'
+
+# Steps --hang can leave without an answer
+STEPS = ('CreateSession', 'Session.Start', 'RecordArea', 'Stream.Start', 'PipeWireStreamAdded')
+
+# How long the Stop of a finished command may take to arrive, it is sent without waiting
+STOP_GRACE_MS = 1000
+
+
+def log(text):
+    print(f'mock: {text}', flush=True)
+
+
+class Stream(dbus.service.Object):
+    def __init__(self, service, path, node_id):
+        super().__init__(service.bus, path)
+        self.path = path
+        self.service = service
+        self.node_id = node_id
+
+    @dbus.service.method(STREAM_INTERFACE, in_signature='', out_signature='', async_callbacks=('reply', 'error'))
+    def Start(self, reply, error):
+        log(f'{self.path} Start')
+        if self.service.hangs('Stream.Start'):
+            return
+
+        self.service.answer(reply)
+
+        if not self.service.hangs('PipeWireStreamAdded'):
+            GLib.timeout_add(self.service.options.delay, self.add_stream)
+
+    def add_stream(self):
+        log(f'{self.path} PipeWireStreamAdded {self.node_id}')
+        self.PipeWireStreamAdded(dbus.UInt32(self.node_id))
+        return False
+
+    @dbus.service.signal(STREAM_INTERFACE, signature='u')
+    def PipeWireStreamAdded(self, node_id):
+        pass
+
+    @dbus.service.method(STREAM_INTERFACE, in_signature='', out_signature='')
+    def Stop(self):
+        log(f'{self.path} Stop')
+        self.service.stopped.add(self.path)
+
+
+class Session(dbus.service.Object):
+    def __init__(self, service, path):
+        super().__init__(service.bus, path)
+        self.path = path
+        self.service = service
+        self.n_streams = 0
+
+    @dbus.service.method(SESSION_INTERFACE, in_signature='', out_signature='', async_callbacks=('reply', 'error'))
+    def Start(self, reply, error):
+        log(f'{self.path} Start')
+        if not self.service.hangs('Session.Start'):
+            self.service.answer(reply)
+
+    @dbus.service.method(SESSION_INTERFACE, in_signature='iiiia{sv}', out_signature='o', async_callbacks=('reply', 'error'))
+    def RecordArea(self, x, y, width, height, properties, reply, error):
+        cursor_mode = int(properties.get('cursor-mode', -1))
+        log(f'{self.path} RecordArea {width}x{height} at {x},{y} cursor-mode {cursor_mode}')
+
+        if width <= 0 or height <= 0:
+            error(dbus.exceptions.DBusException('Invalid area', name='org.freedesktop.DBus.Error.InvalidArgs'))
+            return
+
+        if self.service.hangs('RecordArea'):
+            return
+
+        self.n_streams += 1
+        path = f'/org/gnome/Mutter/ScreenCast/Stream/u{self.service.next_id()}'
+        self.service.streams.append(Stream(self.service, path, self.service.options.node_id + self.n_streams - 1))
+        self.service.answer(reply, dbus.ObjectPath(path))
+
+    @dbus.service.method(SESSION_INTERFACE, in_signature='', out_signature='')
+    def Stop(self):
+        log(f'{self.path} Stop')
+        self.service.stopped.add(self.path)
+
+
+class ScreenCast(dbus.service.Object):
+    def __init__(self, bus, options):
+        super().__init__(bus, OBJECT_PATH)
+        self.bus = bus
+        self.options = options
+        self.sessions = []
+        self.streams = []
+        self.stopped = set()
+        self.ids = 0
+
+    def next_id(self):
+        self.ids += 1
+        return self.ids
+
+    def hangs(self, step):
+        if self.options.hang != step:
+            return False
+
+        log(f'not answering {step}')
+        return True
+
+    # Replies come a little later, as from a compositor that has other work to do
+    def answer(self, reply, *args):
+        def send():
+            reply(*args)
+            return False
+
+        GLib.timeout_add(self.options.delay, send)
+
+    @dbus.service.method(SCREENCAST_INTERFACE, in_signature='a{sv}', out_signature='o', async_callbacks=('reply', 'error'))
+    def CreateSession(self, properties, reply, error):
+        log('CreateSession')
+        if self.hangs('CreateSession'):
+            return
+
+        path = f'/org/gnome/Mutter/ScreenCast/Session/u{self.next_id()}'
+        self.sessions.append(Session(self, path))
+        self.answer(reply, dbus.ObjectPath(path))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Mock of the Mutter ScreenCast service')
+    parser.add_argument('--hang', choices=STEPS, help='never answer this step')
+    parser.add_argument('--delay', type=int, default=20, help='milliseconds before each reply and signal (default: 20)')
+    parser.add_argument('--node-id', type=int, default=42, help='PipeWire node id of the first stream (default: 42)')
+    parser.add_argument('command', nargs=argparse.REMAINDER, help='-- COMMAND to run once the name is owned')
+    options = parser.parse_args()
+
+    command = options.command[1:] if options.command[:1] == ['--'] else options.command
+
+    if not command:
+        parser.error('a command to run is needed after --')
+
+    DBusGMainLoop(set_as_default=True)
+    bus = dbus.SessionBus()
+    service = ScreenCast(bus, options)
+    name = dbus.service.BusName(SERVICE, bus, do_not_queue=True)
+
+    loop = GLib.MainLoop()
+    status = 1
+
+    def check_stopped():
+        nonlocal status
+
+        # Every session and stream handed out has to be stopped again
+        started = [stream.path for stream in service.streams] + [session.path for session in service.sessions]
+        missing = [path for path in started if path not in service.stopped]
+
+        if status == 0 and missing:
+            log(f'ERROR: Stop never arrived for {", ".join(missing)}')
+            status = 1
+
+        loop.quit()
+        return False
+
+    def on_exit(pid, code):
+        nonlocal status
+        status = os.waitstatus_to_exitcode(code)
+        GLib.timeout_add(STOP_GRACE_MS, check_stopped)
+
+    log(f'owning {SERVICE}, running {" ".join(command)}')
+    child = subprocess.Popen(command)
+    GLib.child_watch_add(GLib.PRIORITY_DEFAULT, child.pid, on_exit)
+
+    loop.run()
+    del name
+
+    return status
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,45 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <gstreamer-1.0/gst/gst.h>
+
+#include "overlay_meter.h"
+
+static double seconds_now(void)
+{
+    return (double)g_get_monotonic_time() / 1e6;
+}
+
+// Only the calling thread, the encoder threads would drown it out
+static double thread_cpu_seconds(void)
+{
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_THREAD, &usage) != 0) return 0.0;
+
+    return (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec / 1e6
+         + (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec / 1e6;
+}
+
+void overlay_meter_start(OverlayMeter *meter)
+{
+    meter->frames = 0;
+    meter->start_time = seconds_now();
+    meter->start_cpu = thread_cpu_seconds();
+}
+
+void overlay_meter_frame(OverlayMeter *meter)
+{
+    meter->frames++;
+}
+
+void overlay_meter_describe(const OverlayMeter *meter, char *line, const size_t size)
+{
+    const double seconds = seconds_now() - meter->start_time;
+    const double cpu = thread_cpu_seconds() - meter->start_cpu;
+
+    snprintf(line, size, "overlay %.1f fps %.1f%% cpu",
+        seconds > 0 ? (double)meter->frames / seconds : 0.0,
+        seconds > 0 ? cpu * 100.0 / seconds : 0.0);
+}
@@ -0,0 +1,22 @@
+#ifndef OVERLAY_METER_H
+#define OVERLAY_METER_H
+
+#include <stddef.h>
+
+// Frames drawn by the overlay and CPU time of the thread drawing them, so the cost of the window
+// next to the encoder can be read from `record_area ctl status` without looking at the screen
+typedef struct {
+    long frames;
+    double start_time;
+    double start_cpu;
+} OverlayMeter;
+
+// Starts counting from now, call it from the thread that draws
+void overlay_meter_start(OverlayMeter *meter);
+
+void overlay_meter_frame(OverlayMeter *meter);
+
+// e.g. "overlay 1.0 fps 0.3% cpu", averaged since overlay_meter_start()
+void overlay_meter_describe(const OverlayMeter *meter, char *line, size_t size);
+
+#endif
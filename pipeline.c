@@ -0,0 +1,1463 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <gstreamer-1.0/gst/gst.h>
+#include <gstreamer-1.0/gst/app/gstappsink.h>
+#include <gstreamer-1.0/gst/video/video.h>
+
+#include "pipeline.h"
+#include "replay.h"
+#include "spool.h"
+#include "segments.h"
+#include "av_drift.h"
+#include "damage_convert.h"
+#include "capture_source.h"
+#include "rgb_convert.h"
+#include "encoder_tuner.h"
+
+const char * const OUTPUT_ENCODING_NAMES[] = {
+    [WEBM_WITH_AUDIO] = "WEBM_WITH_AUDIO",
+    [WEBM_ONLY_VIDEO] = "WEBM_ONLY_VIDEO",
+    [GIF] = "GIF",
+    [WEBM_VP9] = "WEBM_VP9",
+    [MKV_AV1] = "MKV_AV1",
+    [MP4_H264] = "MP4_H264",
+};
+
+const char * const AUDIO_CODEC_NAMES[] = {
+    [AUDIO_VORBIS] = "vorbis",
+    [AUDIO_OPUS] = "opus",
+};
+
+const char * const OUTPUT_ENCODING_EXTENSIONS[] = {
+    [WEBM_WITH_AUDIO] = ".webm",
+    [WEBM_ONLY_VIDEO] = ".webm",
+    [GIF] = ".gif",
+    [WEBM_VP9] = ".webm",
+    [MKV_AV1] = ".mkv",
+    [MP4_H264] = ".mp4",
+};
+
+// Muxer of each encoding, in front of the filesink or inside splitmuxsink. GIF segments are
+// captured as WEBM_ONLY_VIDEO, see get_pipeline_string().
+static const char * const MUXERS[] = {
+    [WEBM_WITH_AUDIO] = "webmmux",
+    [WEBM_ONLY_VIDEO] = "webmmux",
+    [WEBM_VP9] = "webmmux",
+    [MKV_AV1] = "matroskamux",
+    [MP4_H264] = "mp4mux",
+};
+
+// Fragments so a recording that is cut off stays playable, segments already give that
+static const char * const MUXER_PROPERTIES[] = {
+    [MP4_H264] = " fragment-duration=1000",
+};
+
+// The audio source, the caps and encoder of the codec. `audiocaps` fixes a sample format the
+// drift correction can work on, see av_drift_attach().
+static const char * const AUDIO_PIPELINE =
+    "%s ! audioconvert ! audioresample ! capsfilter name=audiocaps caps=\"%s\" ! %s ! queue name=audioqueue ! mux.audio_0";
+
+static const char * const AUDIO_CAPS[] = {
+    [AUDIO_VORBIS] = "audio/x-raw,format=F32LE",
+    [AUDIO_OPUS] = "audio/x-raw,format=F32LE,rate=48000",
+};
+
+// Opus in its low delay mode, which leaves out the speech coder and its lookahead, with 10 ms frames
+static const char * const AUDIO_ENCODERS[] = {
+    [AUDIO_VORBIS] = "vorbisenc name=audioencoder",
+    [AUDIO_OPUS] = "opusenc name=audioencoder audio-type=restricted-lowdelay frame-size=10 bitrate=128000",
+};
+
+// The video source and then the sink, see get_sink_string(). The muxer is always named `mux`.
+static const char * const PIPELINES[] = {
+    [WEBM_WITH_AUDIO] =
+    "%s ! "
+    "capsfilter caps=video/x-raw,max-framerate=30/1 ! "
+    "rgbconvert name=convert ! "
+    "queue name=encoderqueue ! "
+    "vp8enc name=encoder cpu-used=16 max-quantizer=17 deadline=1 keyframe-mode=disabled static-threshold=100 buffer-size=20000 ! "
+    "queue ! "
+    "%s "
+    "%s",
+
+    [WEBM_ONLY_VIDEO] =
+    "%s ! "
+    "capsfilter caps=video/x-raw,max-framerate=30/1 ! "
+    "rgbconvert name=convert ! "
+    "queue name=encoderqueue ! "
+    "vp8enc name=encoder cpu-used=16 max-quantizer=17 deadline=1 keyframe-mode=disabled static-threshold=1000 buffer-size=20000 ! "
+    "queue ! "
+    "%s",
+
+    [GIF] =
+    "%s ! "
+    "capsfilter caps=video/x-raw,max-framerate=60/1 ! "
+    "videoconvert name=convert chroma-mode=none dither=none matrix-mode=output-only ! "
+    "capsfilter caps=\"video/x-raw,format={ BGRx, BGRA }\" ! "
+    "queue name=gifqueue ! "
+    "appsink name=gifsink sync=false",
+
+
+    // Row based multithreading and 2^4 tile columns keep the cores busy at 5K, where VP8 only
+    // splits into token partitions. The screen tuning favours sharp text over smooth motion.
+    [WEBM_VP9] =
+    "%s ! "
+    "capsfilter caps=video/x-raw,max-framerate=30/1 ! "
+    "rgbconvert name=convert ! "
+    "queue name=encoderqueue ! "
+    "vp9enc name=encoder deadline=1 cpu-used=8 row-mt=true tile-columns=4 frame-parallel-decoding=true tune-content=screen "
+    "max-quantizer=17 keyframe-mode=disabled static-threshold=1000 buffer-size=20000 ! "
+    "queue ! "
+    "%s",
+
+    // scm=1 turns on the screen content tools (palette and intra block copy), pred-struct=1 is low delay
+    [MKV_AV1] =
+    "%s ! "
+    "capsfilter caps=video/x-raw,max-framerate=30/1 ! "
+    "rgbconvert name=convert ! "
+    "queue name=encoderqueue ! "
+    "svtav1enc name=encoder preset=10 crf=30 intra-period-length=-1 parameters-string=\"scm=1:pred-struct=1:lookahead=0\" ! "
+    "av1parse ! "
+    "queue ! "
+    "%s",
+
+    // No lookahead or B-frames
+    [MP4_H264] =
+    "%s ! "
+    "capsfilter caps=video/x-raw,max-framerate=30/1 ! "
+    "rgbconvert name=convert ! "
+    "queue name=encoderqueue ! "
+    "x264enc name=encoder tune=zerolatency speed-preset=superfast pass=qual quantizer=20 key-int-max=300 ! "
+    "h264parse ! "
+    "queue ! "
+    "%s",
+};
+
+// Same encoder settings as WEBM_ONLY_VIDEO, with keyframes so the ring can be cut anywhere
+static const char * const REPLAY_PIPELINE =
+    "%s ! "
+    "capsfilter caps=video/x-raw,max-framerate=30/1 ! "
+    "rgbconvert name=convert ! "
+    "queue name=encoderqueue ! "
+    "vp8enc name=encoder cpu-used=16 max-quantizer=17 deadline=1 keyframe-max-dist=60 static-threshold=1000 buffer-size=20000 ! "
+    "appsink name=replaysink sync=false";
+
+// Raw frames only, the queue lets the source carry on while a frame is copied to the spool
+static const char * const SPOOL_PIPELINE =
+    "%s ! "
+    "capsfilter caps=video/x-raw,max-framerate=%d/1 ! "
+    "queue max-size-buffers=4 max-size-bytes=0 max-size-time=0 ! "
+    "appsink name=spoolsink sync=false";
+
+// Encodes spooled frames with no real-time deadline: good quality mode, constrained quality rate
+// control and alt-ref frames instead of deadline=1 with keyframes disabled
+static const char * const OFFLINE_PIPELINES[] = {
+    [WEBM_ONLY_VIDEO] =
+    "%s ! "
+    "rgbconvert name=convert ! "
+    "queue ! "
+    "vp8enc name=encoder deadline=1000000 cpu-used=1 end-usage=cq cq-level=8 min-quantizer=4 max-quantizer=17 target-bitrate=200000000 "
+    "token-partitions=3 auto-alt-ref=true lag-in-frames=25 keyframe-max-dist=300 ! "
+    "queue ! "
+    "webmmux ! filesink location=%s",
+
+    [GIF] =
+    "%s ! "
+    "videoconvert name=convert chroma-mode=none dither=none matrix-mode=output-only ! "
+    "capsfilter caps=\"video/x-raw,format={ BGRx, BGRA }\" ! "
+    "queue name=gifqueue ! "
+    "appsink name=gifsink sync=false",
+
+    [WEBM_VP9] =
+    "%s ! "
+    "rgbconvert name=convert ! "
+    "queue ! "
+    "vp9enc name=encoder deadline=1000000 cpu-used=2 row-mt=true tile-columns=4 tune-content=screen end-usage=cq cq-level=8 "
+    "min-quantizer=4 max-quantizer=17 target-bitrate=200000000 auto-alt-ref=true lag-in-frames=25 keyframe-max-dist=300 ! "
+    "queue ! "
+    "webmmux ! filesink location=%s",
+
+    [MKV_AV1] =
+    "%s ! "
+    "rgbconvert name=convert ! "
+    "queue ! "
+    "svtav1enc name=encoder preset=6 crf=24 intra-period-length=300 parameters-string=\"scm=1\" ! "
+    "av1parse ! "
+    "queue ! "
+    "matroskamux ! filesink location=%s",
+
+    [MP4_H264] =
+    "%s ! "
+    "rgbconvert name=convert ! "
+    "queue ! "
+    "x264enc name=encoder speed-preset=slow pass=qual quantizer=18 key-int-max=300 ! "
+    "h264parse ! "
+    "queue ! "
+    "mp4mux ! filesink location=%s",
+};
+
+// Joins finished segments without re-encoding, splitmuxsrc plays them back to back. The files
+// come from the format-location signal of `src`.
+static const char * const CONCAT_PIPELINE =
+    "splitmuxsrc name=src "
+    "src.video ! queue ! %s name=mux%s ! filesink name=filesink%s";
+
+static const char * const CONCAT_AUDIO = " src.audio_0 ! queue ! mux.audio_0";
+
+static const char * const REMUX_PIPELINES[] = {
+    [WEBM_WITH_AUDIO] = "%s ! webmmux ! filesink location=%s",
+    [WEBM_ONLY_VIDEO] = "%s ! webmmux ! filesink location=%s",
+
+    [GIF] =
+    "%s ! "
+    "vp8dec ! "
+    "videoconvert chroma-mode=none dither=none matrix-mode=output-only ! "
+    "video/x-raw,format=BGRx ! "
+    "queue name=gifqueue ! "
+    "appsink name=gifsink sync=false",
+
+    // The replay ring always holds VP8, Matroska takes it as it is and MP4 gets it re-encoded
+    [WEBM_VP9] = "%s ! webmmux ! filesink location=%s",
+    [MKV_AV1] = "%s ! matroskamux ! filesink location=%s",
+
+    [MP4_H264] =
+    "%s ! "
+    "vp8dec ! "
+    "videoconvert chroma-mode=none dither=none matrix-mode=output-only ! "
+    "x264enc speed-preset=veryfast pass=qual quantizer=20 ! "
+    "h264parse ! "
+    "mp4mux ! filesink location=%s",
+};
+
+bool parse_output_encoding(const char *name, enum OutputEncoding *output_encoding)
+{
+    for (int i = 0; i < OUTPUT_ENCODING_COUNT; i++) {
+        if (strcmp(name, OUTPUT_ENCODING_NAMES[i]) == 0) {
+            *output_encoding = (enum OutputEncoding)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool parse_audio_codec(const char *name, enum AudioCodec *audio_codec)
+{
+    for (int i = 0; i < AUDIO_CODEC_COUNT; i++) {
+        if (strcmp(name, AUDIO_CODEC_NAMES[i]) == 0) {
+            *audio_codec = (enum AudioCodec)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool parse_output_scale(const char *name, Recording *recording)
+{
+    if (strcmp(name, "native") == 0) {
+        recording->output_scale = SCALE_NATIVE;
+    } else if (strcmp(name, "logical") == 0) {
+        recording->output_scale = SCALE_LOGICAL;
+    } else if (strcmp(name, "half") == 0) {
+        recording->output_scale = SCALE_HALF;
+    } else if (strncmp(name, "fit:", 4) == 0 && atoi(name + 4) > 0) {
+        recording->output_scale = SCALE_FIT_WIDTH;
+        recording->fit_width = atoi(name + 4);
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+void get_output_size(const Recording *recording, const int width, const int height, int *output_width, int *output_height)
+{
+    double factor = 1.0;
+
+    switch (recording->output_scale) {
+        case SCALE_NATIVE:
+            break;
+        case SCALE_LOGICAL:
+            if (recording->dpi_scale > 1.0f) factor = 1.0 / recording->dpi_scale;
+            break;
+        case SCALE_HALF:
+            factor = 0.5;
+            break;
+        case SCALE_FIT_WIDTH:
+            if (width > recording->fit_width) factor = (double)recording->fit_width / width;
+            break;
+    }
+
+    *output_width = factor < 1.0 ? ((int)(width * factor) & ~1) : width;
+    *output_height = factor < 1.0 ? ((int)(height * factor) & ~1) : height;
+
+    if (*output_width < 2) *output_width = 2;
+    if (*output_height < 2) *output_height = 2;
+}
+
+// Scaling comes first so everything after it, including the spool and the duplicate check, works
+// on the smaller frames. Bilinear at 2:1 averages 2x2 blocks, videoscale runs it with ORC.
+static void get_scaled_source(char *str, const size_t size, const Recording *recording, const char *video_source)
+{
+    if (recording->output_scale != SCALE_NATIVE) {
+        snprintf(str, size, "%s ! videoscale name=scale method=bilinear add-borders=false ! capsfilter name=scalecaps", video_source);
+    } else {
+        snprintf(str, size, "%s", video_source);
+    }
+}
+
+// Damage only pays off in front of a video encoder, GIF keeps its RGB frames
+static void get_video_source(char *str, const size_t size, const Recording *recording, const char *video_source)
+{
+    char scaled_source[2048];
+    get_scaled_source(scaled_source, sizeof(scaled_source), recording, video_source);
+
+    if (recording->use_damage && recording->output_encoding != GIF) {
+        snprintf(str, size, "%s ! damageconvert name=damage", scaled_source);
+    } else {
+        snprintf(str, size, "%s", scaled_source);
+    }
+}
+
+// Segments go through splitmuxsink, which asks for every location itself, see cb_segment_location().
+// It is linked to by pad name, its pads accept anything.
+static void get_sink_string(char *str, const size_t size, const Recording *recording, const enum OutputEncoding encoding)
+{
+    const char *properties = MUXER_PROPERTIES[encoding] ? MUXER_PROPERTIES[encoding] : "";
+
+    if (recording->segment_seconds > 0) {
+        snprintf(str, size, "mux.video splitmuxsink name=mux muxer-factory=%s max-size-time=%" G_GUINT64_FORMAT " send-keyframe-requests=true",
+            MUXERS[encoding], (guint64)recording->segment_seconds * GST_SECOND);
+        return;
+    }
+
+    // A pre-warmed pipeline gets its location in start_pipeline()
+    const char *location = recording->location[0] != '\0' ? recording->location : "/dev/null";
+
+    snprintf(str, size, "%s name=mux%s ! filesink name=filesink location=%s", MUXERS[encoding], properties, location);
+}
+
+static void get_pipeline_string(char *str, const size_t size, const Recording *recording, const char *source, const char *audio_source)
+{
+    char video_source[2048];
+    get_video_source(video_source, sizeof(video_source), recording, source);
+
+    // A segmented GIF is captured as VP8, each segment is turned into a GIF once it is complete
+    const enum OutputEncoding encoding = recording->segment_seconds > 0 && recording->output_encoding == GIF
+        ? WEBM_ONLY_VIDEO
+        : recording->output_encoding;
+
+    char sink[512];
+    get_sink_string(sink, sizeof(sink), recording, encoding);
+
+    switch (encoding) {
+        case WEBM_WITH_AUDIO: {
+            char audio[1024];
+            snprintf(audio, sizeof(audio), AUDIO_PIPELINE, audio_source, AUDIO_CAPS[recording->audio_codec], AUDIO_ENCODERS[recording->audio_codec]);
+            snprintf(str, size, PIPELINES[WEBM_WITH_AUDIO], video_source, sink, audio);
+            break;
+        }
+        case WEBM_ONLY_VIDEO:
+        case WEBM_VP9:
+        case MKV_AV1:
+        case MP4_H264:
+            snprintf(str, size, PIPELINES[encoding], video_source, sink);
+            break;
+        case GIF:
+            snprintf(str, size, PIPELINES[GIF], video_source);
+            break;
+        case OUTPUT_ENCODING_COUNT:
+            break;
+    }
+}
+
+// Bounding box of the damage on `buffer`, false when it has none and may have changed anywhere
+static bool get_damage_bounds(GstBuffer *buffer, GifRect *rect)
+{
+    const GQuark damage_quark = g_quark_from_static_string(DAMAGE_META_TYPE);
+    bool has_damage = false;
+    int x0 = INT_MAX;
+    int y0 = INT_MAX;
+    int x1 = 0;
+    int y1 = 0;
+    gpointer state = nullptr;
+    GstMeta *meta;
+
+    while ((meta = gst_buffer_iterate_meta_filtered(buffer, &state, GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE)) != NULL) {
+        const GstVideoRegionOfInterestMeta *roi = (const GstVideoRegionOfInterestMeta *)meta;
+
+        if (roi->roi_type != damage_quark) continue;
+
+        has_damage = true;
+        if (roi->w == 0 || roi->h == 0) continue;
+
+        if ((int)roi->x < x0) x0 = (int)roi->x;
+        if ((int)roi->y < y0) y0 = (int)roi->y;
+        if ((int)(roi->x + roi->w) > x1) x1 = (int)(roi->x + roi->w);
+        if ((int)(roi->y + roi->h) > y1) y1 = (int)(roi->y + roi->h);
+    }
+
+    *rect = x1 > x0 ? (GifRect){ x0, y0, x1 - x0, y1 - y0 } : (GifRect){ 0 };
+
+    return has_damage;
+}
+
+static GstFlowReturn cb_new_gif_sample(GstAppSink *sink, gpointer user_data)
+{
+    Recording *recording = user_data;
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+
+    if (sample == NULL) {
+        return GST_FLOW_EOS;
+    }
+
+    GstVideoInfo info;
+    GstVideoFrame frame;
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+
+    if (!gst_video_info_from_caps(&info, gst_sample_get_caps(sample)) || !gst_video_frame_map(&frame, &info, buffer, GST_MAP_READ)) {
+        fprintf(stderr, "ERROR: Unable to map GIF frame\n");
+        gst_sample_unref(sample);
+        return GST_FLOW_ERROR;
+    }
+
+    // The frame size is only known once caps are negotiated
+    if (recording->gif_encoder == NULL) {
+        recording->gif_encoder = gif_encoder_new(
+            recording->location,
+            GST_VIDEO_INFO_WIDTH(&info), GST_VIDEO_INFO_HEIGHT(&info),
+            recording->threads.encoder_threads > 0 ? recording->threads.encoder_threads : (int)sysconf(_SC_NPROCESSORS_ONLN)
+        );
+    }
+
+    // The pointer comes apart from the frame, see cursor_overlay_attach()
+    GifRect damage;
+    const bool has_damage = get_damage_bounds(buffer, &damage);
+    CursorSprite sprite;
+    GstMapInfo sprite_map;
+    const bool has_cursor = cursor_meta_get(buffer, &sprite) && gst_buffer_map(sprite.bitmap, &sprite_map, GST_MAP_READ);
+    const GifCursor cursor = has_cursor ? (GifCursor){ sprite_map.data, sprite.width, sprite.height, sprite.x, sprite.y } : (GifCursor){ 0 };
+
+    bool ok = recording->gif_encoder != NULL && gif_encoder_push_layered_frame(
+        recording->gif_encoder,
+        GST_VIDEO_FRAME_PLANE_DATA(&frame, 0),
+        GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0),
+        GST_BUFFER_PTS(buffer),
+        has_damage ? &damage : nullptr,
+        has_cursor ? &cursor : nullptr
+    );
+
+    if (has_cursor) gst_buffer_unmap(sprite.bitmap, &sprite_map);
+    gst_video_frame_unmap(&frame);
+    gst_sample_unref(sample);
+
+    return ok ? GST_FLOW_OK : GST_FLOW_ERROR;
+}
+
+static void connect_gif_sink(Recording *recording)
+{
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(recording->pipeline), "gifsink");
+
+    if (sink == NULL) return;
+
+    GstAppSinkCallbacks callbacks = { 0 };
+    callbacks.new_sample = cb_new_gif_sample;
+
+    gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks, recording, nullptr);
+
+    // Frames are encoded and written out one by one in the appsink callback, so memory only
+    // depends on how many wait in front of it. Once those are taken the queue blocks upstream
+    // instead of growing, and pipewiresrc skips the frames the encoder has no time for.
+    const int in_flight = recording->gif_max_frames > 0 ? recording->gif_max_frames : GIF_DEFAULT_IN_FLIGHT;
+    GstElement *queue = gst_bin_get_by_name(GST_BIN(recording->pipeline), "gifqueue");
+
+    gst_app_sink_set_max_buffers(GST_APP_SINK(sink), 1);
+    gst_app_sink_set_drop(GST_APP_SINK(sink), FALSE);
+
+    if (queue) {
+        g_object_set(queue, "max-size-buffers", (guint)in_flight, "max-size-bytes", 0, "max-size-time", (guint64)0, nullptr);
+        gst_object_unref(queue);
+    }
+
+    gst_object_unref(sink);
+}
+
+static GstFlowReturn cb_new_replay_sample(GstAppSink *sink, gpointer user_data)
+{
+    Recording *recording = user_data;
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+
+    if (sample == NULL) {
+        return GST_FLOW_EOS;
+    }
+
+    replay_buffer_push(recording->replay, sample);
+    gst_sample_unref(sample);
+
+    return GST_FLOW_OK;
+}
+
+static void connect_replay_sink(Recording *recording)
+{
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(recording->pipeline), "replaysink");
+
+    if (sink == NULL) return;
+
+    GstAppSinkCallbacks callbacks = { 0 };
+    callbacks.new_sample = cb_new_replay_sample;
+
+    gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks, recording, nullptr);
+    gst_object_unref(sink);
+}
+
+static GstFlowReturn cb_new_spool_sample(GstAppSink *sink, gpointer user_data)
+{
+    Recording *recording = user_data;
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+
+    if (sample == NULL) {
+        return GST_FLOW_EOS;
+    }
+
+    // Only set between start_pipeline() and reset_pipeline()
+    if (recording->spool) {
+        spool_writer_push(recording->spool, sample);
+    }
+
+    gst_sample_unref(sample);
+
+    return GST_FLOW_OK;
+}
+
+static void connect_spool_sink(Recording *recording)
+{
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(recording->pipeline), "spoolsink");
+
+    if (sink == NULL) return;
+
+    GstAppSinkCallbacks callbacks = { 0 };
+    callbacks.new_sample = cb_new_spool_sample;
+
+    gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks, recording, nullptr);
+    gst_object_unref(sink);
+}
+
+// Called by splitmuxsink from the streaming thread each time it opens a file, which also means
+// the one before it is complete
+static gchar *cb_segment_location(GstElement *splitmux, const guint fragment_id, gpointer user_data)
+{
+    Recording *recording = user_data;
+
+    if (recording->segments == NULL) return g_strdup("/dev/null");
+
+    return segment_set_next_location(recording->segments, fragment_id);
+}
+
+static void connect_segments(Recording *recording)
+{
+    if (recording->segment_seconds <= 0) return;
+
+    GstElement *mux = gst_bin_get_by_name(GST_BIN(recording->pipeline), "mux");
+
+    if (mux == NULL) return;
+
+    g_signal_connect(mux, "format-location", G_CALLBACK(cb_segment_location), recording);
+    gst_object_unref(mux);
+}
+
+// Sizes the ring buffer of an audio source built from PULSE_AUDIO_SOURCE. Smaller means lower
+// latency and less to drift, too small and the source drops samples when it is not scheduled in time.
+static void configure_audio_source(Recording *recording)
+{
+    if (recording->audio_buffer_ms <= 0) return;
+
+    GstElement *source = gst_bin_get_by_name(GST_BIN(recording->pipeline), "audiosrc");
+    if (source == NULL) return;
+
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(source), "buffer-time")) {
+        const gint64 buffer_us = (gint64)recording->audio_buffer_ms * 1000;
+        // Segments of at most 10 ms, the default, and at least two of them in the buffer
+        const gint64 latency_us = buffer_us / 2 < 10000 ? buffer_us / 2 : 10000;
+
+        g_object_set(source, "buffer-time", buffer_us, "latency-time", latency_us, nullptr);
+    }
+
+    gst_object_unref(source);
+}
+
+static GstPadProbeReturn cb_first_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    Recording *recording = user_data;
+    const gint64 elapsed = g_get_monotonic_time() - recording->request_time;
+
+    g_atomic_int_set(&recording->time_to_first_frame_us, (gint)elapsed);
+    printf("INFO: First frame captured %.1f ms after the record request\n", (double)elapsed / 1000.0);
+
+    return GST_PAD_PROBE_REMOVE;
+}
+
+bool connect_pipewire_node(Recording *recording, const unsigned int node_id)
+{
+    GstElement *src = gst_bin_get_by_name(GST_BIN(recording->pipeline), "pipewiresrc");
+
+    if (src == NULL) {
+        fprintf(stderr, "ERROR: Pipeline has no pipewiresrc\n");
+        return false;
+    }
+
+    char path[16];
+    snprintf(path, sizeof(path), "%u", node_id);
+    g_atomic_int_set(&recording->time_to_first_frame_us, 0);
+
+    // A synthetic source standing in for PipeWire, see run_handshake_test(), has no node to follow
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(src), "path")) {
+        g_object_set(src, "path", path, nullptr);
+    }
+
+    GstPad *pad = gst_element_get_static_pad(src, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, cb_first_frame, recording, nullptr);
+
+    gst_object_unref(pad);
+    gst_object_unref(src);
+
+    return true;
+}
+
+// The capture size is only known from the caps, the target size is set on the capsfilter before
+// videoscale negotiates with it
+static GstPadProbeReturn cb_scale_caps(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    Recording *recording = user_data;
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+
+    if (GST_EVENT_TYPE(event) != GST_EVENT_CAPS) return GST_PAD_PROBE_OK;
+
+    GstCaps *caps;
+    GstVideoInfo video_info;
+    gst_event_parse_caps(event, &caps);
+
+    if (!gst_video_info_from_caps(&video_info, caps)) return GST_PAD_PROBE_OK;
+
+    int width;
+    int height;
+    get_output_size(recording, GST_VIDEO_INFO_WIDTH(&video_info), GST_VIDEO_INFO_HEIGHT(&video_info), &width, &height);
+
+    GstElement *filter = gst_bin_get_by_name(GST_BIN(recording->pipeline), "scalecaps");
+    if (filter == NULL) return GST_PAD_PROBE_OK;
+
+    GstCaps *scaled = gst_caps_new_simple("video/x-raw",
+        "width", G_TYPE_INT, width,
+        "height", G_TYPE_INT, height,
+        "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1,
+        nullptr);
+
+    g_object_set(filter, "caps", scaled, nullptr);
+    printf("INFO: Scaling %dx%d captures to %dx%d\n", GST_VIDEO_INFO_WIDTH(&video_info), GST_VIDEO_INFO_HEIGHT(&video_info), width, height);
+
+    gst_caps_unref(scaled);
+    gst_object_unref(filter);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void connect_scale(Recording *recording)
+{
+    GstElement *scale = gst_bin_get_by_name(GST_BIN(recording->pipeline), "scale");
+
+    if (scale == NULL) return;
+
+    GstPad *pad = gst_element_get_static_pad(scale, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, cb_scale_caps, recording, nullptr);
+
+    gst_object_unref(pad);
+    gst_object_unref(scale);
+}
+
+static GstPadProbeReturn cb_pin_thread(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    // Runs on the streaming thread, before the element starts its own threads on caps
+    thread_plan_pin(user_data);
+
+    return GST_PAD_PROBE_REMOVE;
+}
+
+static void pin_streaming_thread(Recording *recording, const char *name, const CpuSet *cpus)
+{
+    GstElement *element = gst_bin_get_by_name(GST_BIN(recording->pipeline), name);
+
+    if (element == NULL) return;
+
+    GstPad *pad = gst_element_get_static_pad(element, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_DATA_DOWNSTREAM, cb_pin_thread, (gpointer)cpus, nullptr);
+
+    gst_object_unref(pad);
+    gst_object_unref(element);
+}
+
+// Encoders do not agree on the property name, the first one `name` has is set
+static void set_threads(Recording *recording, const char *name, const char * const *properties, const int n_threads)
+{
+    GstElement *element = gst_bin_get_by_name(GST_BIN(recording->pipeline), name);
+
+    if (element == NULL) return;
+
+    for (int i = 0; properties[i] != NULL; i++) {
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(element), properties[i]) != NULL) {
+            g_object_set(element, properties[i], n_threads, nullptr);
+            break;
+        }
+    }
+
+    gst_object_unref(element);
+}
+
+void configure_threads(Recording *recording, const enum ThreadMode mode, const int width, const int height)
+{
+    configure_threads_share(recording, mode, width, height, 0, 0);
+}
+
+void configure_threads_share(Recording *recording, const enum ThreadMode mode, const int width, const int height, const long long pixels_before, const long long total_pixels)
+{
+    int output_width;
+    int output_height;
+    get_output_size(recording, width, height, &output_width, &output_height);
+
+    thread_plan_compute_share(&recording->threads, mode, output_width, output_height, pixels_before, total_pixels);
+
+    static const char * const convert_properties[] = { "n-threads", nullptr };
+    static const char * const encoder_properties[] = { "threads", "logical-processors", nullptr };
+
+    set_threads(recording, "scale", convert_properties, recording->threads.convert_threads);
+    set_threads(recording, "convert", convert_properties, recording->threads.convert_threads);
+    set_threads(recording, "damage", convert_properties, recording->threads.convert_threads);
+    set_threads(recording, "encoder", encoder_properties, recording->threads.encoder_threads);
+
+    // Streaming threads come from a pool and may still carry the affinity of an earlier run
+    const bool pinned = recording->threads.mode == THREADS_PINNED;
+    const CpuSet *convert_cpus = pinned ? &recording->threads.convert_cpus : &recording->threads.all_cpus;
+    const CpuSet *encoder_cpus = pinned ? &recording->threads.encoder_cpus : &recording->threads.all_cpus;
+
+    pin_streaming_thread(recording, "scale", convert_cpus);
+    pin_streaming_thread(recording, "damage", convert_cpus);
+    pin_streaming_thread(recording, "convert", convert_cpus);
+    pin_streaming_thread(recording, "encoder", encoder_cpus);
+
+    // The GIF encoder starts its thread pool from the appsink thread
+    pin_streaming_thread(recording, "gifsink", encoder_cpus);
+}
+
+static bool launch_pipeline(Recording *recording, const char *fullPipeline)
+{
+    static gsize registered = 0;
+    GError *error = nullptr;
+
+    // Elements that live in this binary, registered the first time a pipeline is built
+    if (g_once_init_enter(&registered)) {
+        damage_convert_register();
+        rgb_convert_register();
+        capture_source_register();
+        g_once_init_leave(&registered, 1);
+    }
+
+    GstElement *pipeline = gst_parse_launch(fullPipeline, &error);
+
+    if (pipeline == NULL) {
+        fprintf(stderr, "ERROR: Failed to create pipeline\n");
+        return false;
+    }
+
+    if (error != NULL) {
+        fprintf(stderr, "ERROR: Error parsing full pipeline: %d, %s\n", error->code, error->message);
+        g_error_free(error);
+        gst_object_unref(pipeline);
+        return false;
+    }
+
+    recording->pipeline = pipeline;
+    recording->gif_encoder = nullptr;
+    recording->replay = nullptr;
+    recording->stats = pipeline_stats_attach(pipeline);
+    recording->dedup = nullptr;
+    recording->cursor = nullptr;
+    recording->drift = nullptr;
+
+    connect_scale(recording);
+
+    return true;
+}
+
+bool create_pipeline(Recording *recording, const char *video_source, const char *audio_source)
+{
+    char fullPipeline[9999];
+
+    if (recording->use_spool) {
+        char scaled_source[2048];
+        get_scaled_source(scaled_source, sizeof(scaled_source), recording, video_source);
+        snprintf(fullPipeline, sizeof(fullPipeline), SPOOL_PIPELINE, scaled_source, recording->output_encoding == GIF ? 60 : 30);
+
+        if (!launch_pipeline(recording, fullPipeline)) return false;
+
+        connect_spool_sink(recording);
+        recording->cursor = cursor_overlay_attach(recording->pipeline);
+
+        if (recording->use_vfr) {
+            recording->dedup = frame_dedup_attach(recording->pipeline);
+        }
+
+        return true;
+    }
+
+    get_pipeline_string(fullPipeline, sizeof(fullPipeline), recording, video_source, audio_source);
+
+    if (!launch_pipeline(recording, fullPipeline)) return false;
+
+    if (recording->output_encoding == GIF) {
+        connect_gif_sink(recording);
+    }
+
+    connect_segments(recording);
+    recording->cursor = cursor_overlay_attach(recording->pipeline);
+
+    if (recording->output_encoding == WEBM_WITH_AUDIO) {
+        configure_audio_source(recording);
+        recording->drift = av_drift_attach(recording->pipeline,
+            recording->drift_threshold_ms > 0 ? (GstClockTime)recording->drift_threshold_ms * GST_MSECOND : AV_DRIFT_DEFAULT_THRESHOLD);
+    }
+
+    if (recording->use_vfr) {
+        recording->dedup = frame_dedup_attach(recording->pipeline);
+    }
+
+    return true;
+}
+
+bool create_replay_pipeline(Recording *recording, const char *video_source, const GstClockTime duration, const size_t max_bytes)
+{
+    char fullPipeline[9999];
+    char source[2048];
+    get_video_source(source, sizeof(source), recording, video_source);
+    snprintf(fullPipeline, sizeof(fullPipeline), REPLAY_PIPELINE, source);
+
+    if (!launch_pipeline(recording, fullPipeline)) return false;
+
+    recording->replay = replay_buffer_new(duration, max_bytes);
+
+    if (recording->replay == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate the replay buffer\n");
+        destroy_pipeline(recording);
+        return false;
+    }
+
+    connect_replay_sink(recording);
+    recording->cursor = cursor_overlay_attach(recording->pipeline);
+
+    if (recording->use_vfr) {
+        recording->dedup = frame_dedup_attach(recording->pipeline);
+    }
+
+    return true;
+}
+
+bool create_offline_pipeline(Recording *recording, const char *source)
+{
+    char fullPipeline[9999];
+
+    // Audio is not spooled, so WEBM_WITH_AUDIO comes out video only
+    if (recording->output_encoding == GIF) {
+        snprintf(fullPipeline, sizeof(fullPipeline), OFFLINE_PIPELINES[GIF], source);
+    } else if (recording->output_encoding == WEBM_WITH_AUDIO) {
+        snprintf(fullPipeline, sizeof(fullPipeline), OFFLINE_PIPELINES[WEBM_ONLY_VIDEO], source, recording->location);
+    } else {
+        snprintf(fullPipeline, sizeof(fullPipeline), OFFLINE_PIPELINES[recording->output_encoding], source, recording->location);
+    }
+
+    if (!launch_pipeline(recording, fullPipeline)) return false;
+
+    if (recording->output_encoding == GIF) {
+        connect_gif_sink(recording);
+    }
+
+    return true;
+}
+
+bool create_remux_pipeline(Recording *recording, const char *source)
+{
+    char fullPipeline[9999];
+
+    if (recording->output_encoding == GIF) {
+        snprintf(fullPipeline, sizeof(fullPipeline), REMUX_PIPELINES[GIF], source);
+    } else {
+        snprintf(fullPipeline, sizeof(fullPipeline), REMUX_PIPELINES[recording->output_encoding], source, recording->location);
+    }
+
+    if (!launch_pipeline(recording, fullPipeline)) return false;
+
+    if (recording->output_encoding == GIF) {
+        connect_gif_sink(recording);
+    }
+
+    return true;
+}
+
+bool create_concat_pipeline(Recording *recording)
+{
+    char fullPipeline[9999];
+    const enum OutputEncoding encoding = recording->output_encoding;
+
+    snprintf(fullPipeline, sizeof(fullPipeline), CONCAT_PIPELINE,
+        MUXERS[encoding], MUXER_PROPERTIES[encoding] ? MUXER_PROPERTIES[encoding] : "",
+        encoding == WEBM_WITH_AUDIO ? CONCAT_AUDIO : "");
+
+    if (!launch_pipeline(recording, fullPipeline)) return false;
+
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(recording->pipeline), "filesink");
+    g_object_set(sink, "location", recording->location, nullptr);
+    gst_object_unref(sink);
+
+    return true;
+}
+
+bool run_pipeline(Recording *recording)
+{
+    bool ok = gst_element_set_state(recording->pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE;
+
+    if (ok) {
+        GstBus *bus = gst_element_get_bus(recording->pipeline);
+        GstMessage *msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+        if (msg == NULL || GST_MESSAGE_TYPE(msg) != GST_MESSAGE_EOS) {
+            fprintf(stderr, "ERROR: Pipeline did not finish cleanly\n");
+            ok = false;
+        }
+
+        if (msg) gst_message_unref(msg);
+        gst_object_unref(bus);
+    }
+
+    return destroy_pipeline(recording) && ok;
+}
+
+static void write_stats(Recording *recording)
+{
+    if (recording->stats_location[0] == '\0' || !pipeline_stats_has_data(recording->stats)) return;
+
+    FILE *f = fopen(recording->stats_location, "w");
+
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: Unable to open %s for writing\n", recording->stats_location);
+        return;
+    }
+
+    fprintf(f, "Pipeline statistics for %s\n", recording->location);
+
+    const gint time_to_first_frame = g_atomic_int_get(&recording->time_to_first_frame_us);
+    if (time_to_first_frame > 0) {
+        fprintf(f, "Time to first frame: %.1f ms\n", (double)time_to_first_frame / 1000.0);
+    }
+
+    if (recording->drift) {
+        char line[256];
+        av_drift_describe(recording->drift, line, sizeof(line));
+        fprintf(f, "%s\n", line);
+    }
+
+    fprintf(f, "\n");
+
+    if (pipeline_stats_write(recording->stats, f)) {
+        printf("INFO: Pipeline statistics written to %s\n", recording->stats_location);
+    } else {
+        fprintf(stderr, "ERROR: Unable to write %s\n", recording->stats_location);
+    }
+
+    fclose(f);
+}
+
+typedef struct {
+    Recording *recording;
+    char video_source[1024];
+    char audio_source[1024];
+    GstClockTime replay_duration;
+    size_t replay_max_bytes;
+} PrewarmJob;
+
+static gpointer prewarm_thread(gpointer user_data)
+{
+    PrewarmJob *job = user_data;
+    Recording *recording = job->recording;
+
+    const bool ok = job->replay_duration > 0
+        ? create_replay_pipeline(recording, job->video_source, job->replay_duration, job->replay_max_bytes)
+        : create_pipeline(recording, job->video_source, job->audio_source);
+
+    // READY loads the plugins and opens the devices, a live source cannot go further without data
+    if (ok && gst_element_set_state(recording->pipeline, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
+        fprintf(stderr, "ERROR: Unable to set the pipeline to the ready state.\n");
+        destroy_pipeline(recording);
+    }
+
+    free(job);
+
+    return nullptr;
+}
+
+bool prewarm_pipeline(Recording *recording, const char *video_source, const char *audio_source, const GstClockTime replay_duration, const size_t replay_max_bytes)
+{
+    PrewarmJob *job = calloc(1, sizeof(PrewarmJob));
+    if (job == NULL) return false;
+
+    job->recording = recording;
+    job->replay_duration = replay_duration;
+    job->replay_max_bytes = replay_max_bytes;
+    snprintf(job->video_source, sizeof(job->video_source), "%s", video_source);
+    snprintf(job->audio_source, sizeof(job->audio_source), "%s", audio_source);
+
+    // The job may be this very recording's sources, see claim_pipeline()
+    if (recording->video_source != video_source) snprintf(recording->video_source, sizeof(recording->video_source), "%s", video_source);
+    if (recording->audio_source != audio_source) snprintf(recording->audio_source, sizeof(recording->audio_source), "%s", audio_source);
+    recording->replay_duration = replay_duration;
+    recording->replay_max_bytes = replay_max_bytes;
+
+    recording->pipeline = nullptr;
+    recording->prewarm_thread = g_thread_new("prewarm", prewarm_thread, job);
+
+    return true;
+}
+
+bool wait_for_pipeline(Recording *recording)
+{
+    if (recording->prewarm_thread) {
+        g_thread_join(recording->prewarm_thread);
+        recording->prewarm_thread = nullptr;
+    }
+
+    wait_for_finish(recording);
+
+    return recording->pipeline != NULL;
+}
+
+bool start_pipeline(Recording *recording)
+{
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(recording->pipeline), "filesink");
+
+    // Only possible below PAUSED, which is where a new or reset pipeline is
+    if (sink) {
+        g_object_set(sink, "location", recording->location, nullptr);
+        gst_object_unref(sink);
+    }
+
+    if (recording->use_spool) {
+        char path[PATH_MAX + 8];
+        snprintf(path, sizeof(path), "%s.spool", recording->location);
+
+        recording->spool = spool_writer_new(path);
+        if (recording->spool == NULL) return false;
+    }
+
+    if (recording->segment_seconds > 0 && !recording->use_spool && recording->replay == NULL) {
+        recording->segments = segment_set_new(recording->location, recording->output_encoding, recording->concat_segments);
+        if (recording->segments == NULL) return false;
+    }
+
+    recording->tuner = encoder_tuner_start(recording);
+
+    if (gst_element_set_state(recording->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        fprintf(stderr, "ERROR: Unable to set the pipeline to the playing state.\n");
+        return false;
+    }
+
+    return true;
+}
+
+// Closes the spool and hands it to a background encoder, one spool of a pipeline is encoded at a time
+static void finish_spool(Recording *recording)
+{
+    char path[PATH_MAX + 8];
+    snprintf(path, sizeof(path), "%s.spool", recording->location);
+
+    const long n_frames = spool_writer_close(recording->spool);
+    recording->spool = nullptr;
+
+    if (n_frames == 0) return;
+
+    if (recording->spool_encoder) {
+        printf("INFO: Waiting for the previous spool to be encoded...\n");
+        spool_encoder_wait(recording->spool_encoder);
+    }
+
+    recording->spool_encoder = spool_encoder_start(path, recording->output_encoding, recording->location);
+}
+
+// The last segment is complete once the pipeline is in READY. Its post-processing runs in the
+// background, one recording at a time like the spool.
+static void finish_segments(Recording *recording)
+{
+    if (recording->finishing_segments) {
+        printf("INFO: Waiting for the segments of the previous recording...\n");
+        segment_set_wait(recording->finishing_segments);
+    }
+
+    segment_set_close(recording->segments);
+    recording->finishing_segments = recording->segments;
+    recording->segments = nullptr;
+}
+
+bool reset_pipeline(Recording *recording)
+{
+    bool ok = true;
+
+    if (recording->pipeline == NULL) return false;
+
+    // Going back to READY closes the file and clears EOS, the elements themselves stay loaded
+    if (gst_element_set_state(recording->pipeline, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
+        fprintf(stderr, "ERROR: Unable to set the pipeline to the ready state.\n");
+        ok = false;
+    }
+
+    // Nothing flows in READY, so its probe can go
+    encoder_tuner_stop(recording->tuner);
+    recording->tuner = nullptr;
+
+    if (recording->dedup) {
+        frame_dedup_reset(recording->dedup);
+    }
+
+    if (recording->cursor) {
+        cursor_overlay_reset(recording->cursor);
+    }
+
+    if (recording->drift) {
+        char line[256];
+        av_drift_describe(recording->drift, line, sizeof(line));
+        printf("INFO: %s\n", line);
+    }
+
+    if (recording->stats) {
+        write_stats(recording);
+        pipeline_stats_reset(recording->stats);
+    }
+
+    if (recording->drift) {
+        av_drift_reset(recording->drift);
+    }
+
+    if (recording->replay) {
+        replay_buffer_reset(recording->replay);
+    }
+
+    if (recording->spool) {
+        finish_spool(recording);
+    }
+
+    if (recording->segments) {
+        finish_segments(recording);
+    }
+
+    if (recording->gif_encoder) {
+        if (!gif_encoder_finish(recording->gif_encoder)) ok = false;
+        recording->gif_encoder = nullptr;
+    }
+
+    return ok;
+}
+
+bool destroy_pipeline(Recording *recording)
+{
+    bool ok = wait_for_finish(recording);
+
+    if (recording->pipeline) {
+        gst_element_set_state(recording->pipeline, GST_STATE_NULL);
+
+        encoder_tuner_stop(recording->tuner);
+        recording->tuner = nullptr;
+
+        frame_dedup_free(recording->dedup);
+        recording->dedup = nullptr;
+
+        cursor_overlay_free(recording->cursor);
+        recording->cursor = nullptr;
+
+        if (recording->stats) {
+            write_stats(recording);
+            pipeline_stats_free(recording->stats);
+            recording->stats = nullptr;
+        }
+
+        av_drift_free(recording->drift);
+        recording->drift = nullptr;
+
+        gst_object_unref(recording->pipeline);
+        recording->pipeline = nullptr;
+    }
+
+    // Joins a save that is still reading from the ring
+    if (recording->replay) {
+        replay_buffer_free(recording->replay);
+        recording->replay = nullptr;
+    }
+
+    // Everything has been pushed through the appsink by now
+    if (recording->gif_encoder) {
+        if (!gif_encoder_finish(recording->gif_encoder)) ok = false;
+        recording->gif_encoder = nullptr;
+    }
+
+    if (recording->spool) {
+        finish_spool(recording);
+    }
+
+    if (recording->spool_encoder) {
+        printf("INFO: Waiting for the spool to be encoded...\n");
+        if (!spool_encoder_wait(recording->spool_encoder)) ok = false;
+        recording->spool_encoder = nullptr;
+    }
+
+    if (recording->segments) {
+        finish_segments(recording);
+    }
+
+    if (recording->finishing_segments) {
+        printf("INFO: Waiting for the segments to be finished...\n");
+        if (!segment_set_wait(recording->finishing_segments)) ok = false;
+        recording->finishing_segments = nullptr;
+    }
+
+    return ok;
+}
+
+bool finish_recording(Recording *recording, const GstClockTime timeout)
+{
+    bool ok = true;
+
+    if (recording->pipeline) {
+        GstBus *bus = gst_element_get_bus(recording->pipeline);
+        gst_element_send_event(recording->pipeline, gst_event_new_eos());
+
+        GstMessage *msg = gst_bus_timed_pop_filtered(bus, timeout, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+        if (msg == NULL || GST_MESSAGE_TYPE(msg) != GST_MESSAGE_EOS) {
+            fprintf(stderr, "ERROR: Pipeline did not finish cleanly\n");
+            ok = false;
+        }
+
+        if (msg) gst_message_unref(msg);
+        gst_object_unref(bus);
+    }
+
+    return reset_pipeline(recording) && ok;
+}
+
+// Queue in front of the encoder, where a backlog builds up when encoding falls behind
+static const char *get_encoder_queue_name(const Recording *recording)
+{
+    return recording->output_encoding == GIF && recording->segment_seconds <= 0 ? "gifqueue" : "encoderqueue";
+}
+
+static GstPadProbeReturn cb_drop_queued(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    Recording *recording = user_data;
+
+    return g_atomic_int_get(&recording->drop_queued) ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+}
+
+// Frames waiting in front of the encoder and how many left it since the last reset
+static void get_queue_progress(Recording *recording, guint *queued, guint64 *drained)
+{
+    ElementCounters queue = { 0 };
+
+    if (recording->stats) {
+        pipeline_stats_poll(recording->stats);
+        pipeline_stats_get(recording->stats, get_encoder_queue_name(recording), &queue);
+    }
+
+    *queued = queue.queue_level;
+    *drained = queue.buffers_out;
+}
+
+static gpointer finish_thread(gpointer user_data)
+{
+    Recording *recording = user_data;
+    const gint64 deadline = GST_CLOCK_TIME_IS_VALID(recording->finish_deadline)
+        ? recording->stop_time + (gint64)(recording->finish_deadline / GST_USECOND)
+        : G_MAXINT64;
+
+    GstBus *bus = gst_element_get_bus(recording->pipeline);
+    GstElement *queue = gst_bin_get_by_name(GST_BIN(recording->pipeline), get_encoder_queue_name(recording));
+    GstPad *pad = queue ? gst_element_get_static_pad(queue, "src") : nullptr;
+    const gulong probe = pad ? gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, cb_drop_queued, recording, nullptr) : 0;
+
+    guint queued;
+    guint64 drained;
+    gint64 last_time = g_get_monotonic_time();
+    get_queue_progress(recording, &queued, &drained);
+
+    bool ok = false;
+
+    while (true) {
+        GstMessage *msg = gst_bus_timed_pop_filtered(bus, FINISH_PROGRESS_INTERVAL, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+        if (msg) {
+            ok = GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+            gst_message_unref(msg);
+            break;
+        }
+
+        const gint64 now = g_get_monotonic_time();
+        const guint64 last_drained = drained;
+        get_queue_progress(recording, &queued, &drained);
+
+        if (now >= deadline + (gint64)(FINISH_GRACE / GST_USECOND)) break;
+
+        if (now >= deadline && !g_atomic_int_get(&recording->drop_queued)) {
+            printf("INFO: Stop deadline passed, dropping %u queued frames of %s\n", queued, recording->location);
+            g_atomic_int_set(&recording->drop_queued, 1);
+            continue;
+        }
+
+        // Drain rate since the last report, nothing to estimate until the queue moves
+        const double rate = (double)(drained - last_drained) * 1e6 / (double)(now - last_time);
+        last_time = now;
+
+        if (rate > 0) {
+            printf("INFO: Finishing %s, %u frames queued, about %.1f s left\n", recording->location, queued, (double)queued / rate);
+        } else {
+            printf("INFO: Finishing %s, %u frames queued\n", recording->location, queued);
+        }
+    }
+
+    if (!ok) fprintf(stderr, "ERROR: Pipeline did not finish cleanly\n");
+
+    if (probe) gst_pad_remove_probe(pad, probe);
+    if (pad) gst_object_unref(pad);
+    if (queue) gst_object_unref(queue);
+    gst_object_unref(bus);
+
+    recording->finish_ok = reset_pipeline(recording) && ok;
+    recording->stop_to_ready_us = (gint)(g_get_monotonic_time() - recording->stop_time);
+    g_atomic_int_set(&recording->drop_queued, 0);
+
+    printf("INFO: %s ready %.2f s after the stop\n", recording->location, (double)recording->stop_to_ready_us / 1e6);
+
+    g_atomic_int_set(&recording->finish_done, 1);
+
+    return nullptr;
+}
+
+void finish_recording_async(Recording *recording, const GstClockTime deadline)
+{
+    if (recording->pipeline == NULL) return;
+
+    recording->stop_time = g_get_monotonic_time();
+    recording->finish_deadline = deadline;
+    g_atomic_int_set(&recording->finish_done, 0);
+
+    // Sent from here so the sources have it before their streams go away
+    gst_element_send_event(recording->pipeline, gst_event_new_eos());
+
+    recording->finish_thread = g_thread_new("finish", finish_thread, recording);
+}
+
+// Recordings handed off by claim_pipeline() that are not done yet
+static GMutex detached_lock;
+static GCond detached_done;
+static int n_detached;
+static bool detached_ok = true;
+
+static gpointer detached_thread(gpointer user_data)
+{
+    Recording *recording = user_data;
+
+    // Joins the finish thread, which still has the pipeline and its callbacks bound to `recording`
+    const bool ok = destroy_pipeline(recording);
+
+    free(recording);
+
+    g_mutex_lock(&detached_lock);
+    if (!ok) detached_ok = false;
+    n_detached--;
+    g_cond_broadcast(&detached_done);
+    g_mutex_unlock(&detached_lock);
+
+    return nullptr;
+}
+
+bool claim_pipeline(Recording **recording)
+{
+    Recording *finishing = *recording;
+
+    // Nothing draining, or done with it and back in READY, so the pipeline is used again
+    if (finishing->finish_thread == NULL || g_atomic_int_get(&finishing->finish_done)) {
+        return wait_for_pipeline(finishing);
+    }
+
+    Recording *next = malloc(sizeof(Recording));
+
+    // Without a new one the drain is waited for, as before
+    if (next == NULL) return wait_for_pipeline(finishing);
+
+    *next = *finishing;
+
+    // Everything built with or for the pipeline stays with the recording being finished
+    next->pipeline = nullptr;
+    next->gif_encoder = nullptr;
+    next->stats = nullptr;
+    next->replay = nullptr;
+    next->tuner = nullptr;
+    next->dedup = nullptr;
+    next->cursor = nullptr;
+    next->spool = nullptr;
+    next->spool_encoder = nullptr;
+    next->segments = nullptr;
+    next->finishing_segments = nullptr;
+    next->drift = nullptr;
+    next->prewarm_thread = nullptr;
+    next->finish_thread = nullptr;
+    next->finish_done = 0;
+    next->drop_queued = 0;
+
+    printf("INFO: %s is still being finished, building a new pipeline for the next recording\n", finishing->location);
+
+    g_mutex_lock(&detached_lock);
+    n_detached++;
+    g_mutex_unlock(&detached_lock);
+
+    // Nobody joins it, wait_for_detached() waits for the count instead
+    g_thread_unref(g_thread_new("detached", detached_thread, finishing));
+
+    *recording = next;
+    prewarm_pipeline(next, next->video_source, next->audio_source, next->replay_duration, next->replay_max_bytes);
+
+    return wait_for_pipeline(next);
+}
+
+bool wait_for_detached(void)
+{
+    g_mutex_lock(&detached_lock);
+
+    if (n_detached > 0) printf("INFO: Waiting for %d recordings to be finished...\n", n_detached);
+    while (n_detached > 0) g_cond_wait(&detached_done, &detached_lock);
+
+    const bool ok = detached_ok;
+    g_mutex_unlock(&detached_lock);
+
+    return ok;
+}
+
+bool wait_for_finish(Recording *recording)
+{
+    if (recording->finish_thread == NULL) return true;
+
+    g_thread_join(recording->finish_thread);
+    recording->finish_thread = nullptr;
+
+    return recording->finish_ok;
+}
+
+bool finish_pipeline(Recording *recording, const GstClockTime timeout)
+{
+    const bool ok = finish_recording(recording, timeout);
+
+    return destroy_pipeline(recording) && ok;
+}
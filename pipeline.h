@@ -0,0 +1,258 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <linux/limits.h>
+#include <gstreamer-1.0/gst/gst.h>
+
+#include "gif_encoder.h"
+#include "pipeline_stats.h"
+#include "frame_dedup.h"
+#include "cursor_overlay.h"
+#include "thread_plan.h"
+
+// The node is only known once Mutter has started the stream, see connect_pipewire_node()
+#define PIPEWIRE_SOURCE "pipewiresrc name=pipewiresrc \
+        do-timestamp=true \
+        keepalive-time=1000 \
+        resend-last=true"
+
+// Takes the place of PIPEWIRE_SOURCE for streams with the pointer as metadata, and passes it on
+// along with the damage, which pipewiresrc both drops. See capture_source_register(). Named the
+// same for connect_pipewire_node().
+#define CAPTURE_SOURCE "capturesrc name=pipewiresrc \
+        do-timestamp=true \
+        keepalive-time=1000"
+
+// Named so its buffer can be sized, see `Recording.audio_buffer_ms`
+#define PULSE_AUDIO_SOURCE "pulsesrc name=audiosrc"
+
+// Frames queued in front of the GIF encoder by default
+#define GIF_DEFAULT_IN_FLIGHT 3
+
+// How often finish_recording_async() reports what is left to drain
+#define FINISH_PROGRESS_INTERVAL (500 * GST_MSECOND)
+// Time the pipeline gets to reach EOS after the queued frames are dropped, before it is reset as it is
+#define FINISH_GRACE (2 * GST_SECOND)
+
+enum OutputEncoding {
+    WEBM_WITH_AUDIO,
+    WEBM_ONLY_VIDEO,
+    GIF,
+    // Video only, for comparing the cost per frame and per byte against VP8
+    WEBM_VP9,
+    MKV_AV1,
+    MP4_H264,
+
+    OUTPUT_ENCODING_COUNT
+};
+
+// Audio codec of WEBM_WITH_AUDIO
+enum AudioCodec {
+    AUDIO_VORBIS,
+    // Low delay mode with 10 ms frames, cheaper and steadier than Vorbis
+    AUDIO_OPUS,
+
+    AUDIO_CODEC_COUNT
+};
+
+// Size the captured frames are brought to before anything else touches them
+enum OutputScale {
+    // As delivered, physical pixels on a HiDPI screen
+    SCALE_NATIVE,
+    // Divided by `Recording.dpi_scale`, the size the area has on screen
+    SCALE_LOGICAL,
+    SCALE_HALF,
+    // Down to `Recording.fit_width` wide, never up
+    SCALE_FIT_WIDTH,
+};
+
+typedef struct ReplayBuffer ReplayBuffer;
+typedef struct SpoolWriter SpoolWriter;
+typedef struct SpoolEncoder SpoolEncoder;
+typedef struct EncoderTuner EncoderTuner;
+typedef struct SegmentSet SegmentSet;
+typedef struct AvDrift AvDrift;
+
+extern const char * const OUTPUT_ENCODING_NAMES[];
+extern const char * const OUTPUT_ENCODING_EXTENSIONS[];
+extern const char * const AUDIO_CODEC_NAMES[];
+
+typedef struct {
+    enum OutputEncoding output_encoding;
+    char location[PATH_MAX];
+    // Per-element statistics are written here when the pipeline is torn down, empty to skip
+    char stats_location[PATH_MAX];
+
+    GstElement *pipeline;
+    GifEncoder *gif_encoder;
+    PipelineStats *stats;
+    ReplayBuffer *replay;
+
+    // Frame rate the encoder settings are adjusted to hold, 0 keeps the preset. Every adjustment
+    // is appended to `tuning_location`, see encoder_tuner_start().
+    int target_fps;
+    char tuning_location[PATH_MAX];
+    EncoderTuner *tuner;
+
+    // g_get_monotonic_time() of the record request, the first captured buffer is measured against it
+    gint64 request_time;
+    gint time_to_first_frame_us;
+
+    GThread *prewarm_thread;
+    // What prewarm_pipeline() was given, claim_pipeline() builds the next pipeline from it
+    char video_source[1024];
+    char audio_source[1024];
+    GstClockTime replay_duration;
+    size_t replay_max_bytes;
+    ThreadPlan threads;
+
+    // A videoscale follows the source unless this is SCALE_NATIVE, see get_output_size()
+    enum OutputScale output_scale;
+    float dpi_scale;
+    int fit_width;
+
+    // Frames allowed to wait for the GIF encoder before capture is held back, 0 for
+    // GIF_DEFAULT_IN_FLIGHT. The encoder writes each frame out as the next one arrives, so memory
+    // stays the same however long the recording gets.
+    int gif_max_frames;
+
+    // Converts only what PipeWire reports as damaged, see damage_convert_register()
+    bool use_damage;
+
+    // Frames identical to the previous one are dropped, so a still screen costs next to nothing
+    bool use_vfr;
+    FrameDedup *dedup;
+
+    // Draws the pointer from the cursor metadata, see cursor_overlay_attach()
+    CursorOverlay *cursor;
+
+    // Raw frames go to `<location>.spool` and are encoded once the recording stops
+    bool use_spool;
+    SpoolWriter *spool;
+    // Encode of the previous spool, still running while the next recording starts
+    SpoolEncoder *spool_encoder;
+
+    // Output is cut into files this many seconds long, so a crash only loses the one being
+    // written, see segment_set_new(). 0 writes a single file.
+    int segment_seconds;
+    // The segments are joined into `location` once the recording stops
+    bool concat_segments;
+    SegmentSet *segments;
+    // Segments of the previous recording, still being converted or joined
+    SegmentSet *finishing_segments;
+
+    enum AudioCodec audio_codec;
+    // Ring buffer of the audio source in milliseconds, 0 keeps the default of 200
+    int audio_buffer_ms;
+    // A/V drift past which the audio is resampled, 0 for AV_DRIFT_DEFAULT_THRESHOLD. The drift is
+    // measured all the time and ends up in the statistics, see av_drift_attach().
+    int drift_threshold_ms;
+    AvDrift *drift;
+
+    // Drains the pipeline after a stop while the caller goes on, see finish_recording_async()
+    GThread *finish_thread;
+    // Set once the output is complete, so claim_pipeline() can tell without joining the thread
+    gint finish_done;
+    GstClockTime finish_deadline;
+    // Set once the deadline has passed, frames leaving the encoder queue are dropped from then on
+    gint drop_queued;
+    gint64 stop_time;
+    bool finish_ok;
+    // From the last stop to its output being complete
+    gint stop_to_ready_us;
+} Recording;
+
+// Looks up an encoding by its name in OUTPUT_ENCODING_NAMES
+bool parse_output_encoding(const char *name, enum OutputEncoding *output_encoding);
+
+// Looks up an audio codec by its name in AUDIO_CODEC_NAMES
+bool parse_audio_codec(const char *name, enum AudioCodec *audio_codec);
+
+// Parses `native`, `logical`, `half` or `fit:WIDTH` for --scale=
+bool parse_output_scale(const char *name, Recording *recording);
+
+// Size `width`x`height` frames come out of the scaling stage at, rounded to even for 4:2:0
+void get_output_size(const Recording *recording, int width, int height, int *output_width, int *output_height);
+
+// Builds the pipeline for `recording->output_encoding` writing to `recording->location`, or only
+// capturing raw frames when `recording->use_spool` is set. `video_source` and `audio_source` are
+// pipeline fragments, so synthetic sources can stand in for PipeWire and PulseAudio.
+bool create_pipeline(Recording *recording, const char *video_source, const char *audio_source);
+
+// Points the source of a pipeline built from PIPEWIRE_SOURCE or CAPTURE_SOURCE at `node_id` and reports the
+// time from `recording->request_time` to its first buffer
+bool connect_pipewire_node(Recording *recording, unsigned int node_id);
+
+// Keeps the video encoder running into an in-memory ring holding the last `duration` of packets,
+// capped at `max_bytes`, instead of writing a file. See replay_buffer_save().
+bool create_replay_pipeline(Recording *recording, const char *video_source, GstClockTime duration, size_t max_bytes);
+
+// Writes already encoded VP8 from `source` to `recording->location` without re-encoding it,
+// only GIF has to decode it first
+bool create_remux_pipeline(Recording *recording, const char *source);
+
+// Joins segments to `recording->location` without re-encoding. The segment files are returned
+// from the format-location signal of the `src` element, then run_pipeline() starts it.
+bool create_concat_pipeline(Recording *recording);
+
+// Plays a pipeline whose sources end by themselves up to EOS and destroys it
+bool run_pipeline(Recording *recording);
+
+// Encodes raw frames from `source` to `recording->location` at a higher quality than the live
+// presets, for spools written with `recording->use_spool`. See spool_encoder_start().
+bool create_offline_pipeline(Recording *recording, const char *source);
+
+// Builds the pipeline from a background thread and takes it to READY, so plugin loading and
+// element setup are done before the user starts recording. The replay pipeline is built when
+// `replay_duration` is not 0. `recording->location` can still be empty.
+bool prewarm_pipeline(Recording *recording, const char *video_source, const char *audio_source, GstClockTime replay_duration, size_t replay_max_bytes);
+
+// Waits for prewarm_pipeline() and finish_recording_async(), false if the pipeline could not be built
+bool wait_for_pipeline(Recording *recording);
+
+// Sizes the converter and encoder threads for a `width`x`height` capture after scaling and, for THREADS_PINNED,
+// moves their streaming threads onto their own cores once data flows. Call it below PAUSED.
+void configure_threads(Recording *recording, enum ThreadMode mode, int width, int height);
+
+// configure_threads() for one of several recordings at once, which split the cores between them,
+// see thread_plan_compute_share(). The pixel counts are of the captured areas.
+void configure_threads_share(Recording *recording, enum ThreadMode mode, int width, int height, long long pixels_before, long long total_pixels);
+
+// Points the filesink at `recording->location` and starts playing, with the encoder tuned
+// towards `recording->target_fps` when it is set
+bool start_pipeline(Recording *recording);
+
+// Sends EOS, waits up to `timeout` for it to reach the sinks and closes the output, leaving the
+// pipeline in READY for the next recording
+bool finish_recording(Recording *recording, GstClockTime timeout);
+
+// finish_recording() on a background thread, so the caller does not wait for the encoder to
+// drain its backlog. What is left is reported every FINISH_PROGRESS_INTERVAL. Once `deadline`
+// has passed since the stop, frames still waiting in front of the encoder are dropped;
+// GST_CLOCK_TIME_NONE drains all of them. wait_for_pipeline() and destroy_pipeline() wait for it.
+void finish_recording_async(Recording *recording, GstClockTime deadline);
+
+// Waits for finish_recording_async(), false if the output could not be completed
+bool wait_for_finish(Recording *recording);
+
+// wait_for_pipeline() for the next recording, without waiting for the drain of the last one. When
+// finish_recording_async() is still at it, `*recording` is handed to a background thread that
+// destroys it once its output is complete, and a new one with the same settings and a pipeline
+// from prewarm_pipeline() takes its place. The appsink callbacks and probes stay bound to the one
+// they were set up with. Otherwise the drained pipeline, back in READY, is used again. Recordings
+// passed here have to come from malloc().
+bool claim_pipeline(Recording **recording);
+
+// Waits for every recording handed off by claim_pipeline(), false if one of the outputs could not be completed
+bool wait_for_detached(void);
+
+// Closes the output without draining the pipeline and takes it back to READY
+bool reset_pipeline(Recording *recording);
+
+// finish_recording() followed by destroy_pipeline()
+bool finish_pipeline(Recording *recording, GstClockTime timeout);
+
+// Stops the pipeline without draining it and closes the output
+bool destroy_pipeline(Recording *recording);
+
+#endif
@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gstreamer-1.0/gst/gst.h>
+
+#include "pipeline_stats.h"
+
+// Bucket i counts latencies in [2^i, 2^(i+1)) microseconds, the last one everything above ~1s
+#define LATENCY_BUCKETS 21
+// Buffers an element can hold before its output is matched, encoders keep a few frames
+#define IN_FLIGHT_SLOTS 64
+#define MAX_PROBED_PADS 8
+
+typedef struct {
+    GstClockTime pts;
+    gint64 time;
+} InFlight;
+
+typedef struct {
+    GstElement *element;
+    char name[64];
+    GMutex lock;
+
+    GstPad *pads[MAX_PROBED_PADS];
+    gulong probes[MAX_PROBED_PADS];
+    int n_pads;
+
+    InFlight in_flight[IN_FLIGHT_SLOTS];
+    int next_slot;
+
+    guint64 buffers_in;
+    guint64 buffers_out;
+
+    guint64 histogram[LATENCY_BUCKETS];
+    guint64 latency_count;
+    gint64 latency_sum;
+    gint64 latency_max;
+
+    // From QoS messages posted by the element
+    guint64 late;
+    guint64 dropped;
+
+    bool is_queue;
+    guint queue_level;
+    guint queue_peak;
+    guint queue_limit;
+} ElementStats;
+
+struct PipelineStats {
+    GstBus *bus;
+    ElementStats *elements;
+    int n_elements;
+};
+
+static void add_latency(ElementStats *element, const gint64 latency)
+{
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && latency >= (gint64)2 << bucket) bucket++;
+
+    element->histogram[bucket]++;
+    element->latency_count++;
+    element->latency_sum += latency;
+    if (latency > element->latency_max) element->latency_max = latency;
+}
+
+// Upper bound of the bucket holding the given fraction of samples, in microseconds
+static gint64 latency_percentile(const ElementStats *element, const double fraction)
+{
+    const guint64 target = (guint64)((double)element->latency_count * fraction);
+    guint64 seen = 0;
+
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += element->histogram[i];
+        if (seen > target) return (gint64)2 << i;
+    }
+
+    return element->latency_max;
+}
+
+static GstPadProbeReturn cb_buffer_in(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    ElementStats *element = user_data;
+    const GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    g_mutex_lock(&element->lock);
+
+    element->buffers_in++;
+
+    if (GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer))) {
+        element->in_flight[element->next_slot] = (InFlight){ GST_BUFFER_PTS(buffer), g_get_monotonic_time() };
+        element->next_slot = (element->next_slot + 1) % IN_FLIGHT_SLOTS;
+    }
+
+    g_mutex_unlock(&element->lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn cb_buffer_out(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    ElementStats *element = user_data;
+    const GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    const GstClockTime pts = GST_BUFFER_PTS(buffer);
+
+    g_mutex_lock(&element->lock);
+
+    element->buffers_out++;
+
+    // Search from the oldest slot, muxers and encoders can emit several buffers per input
+    for (int i = 0; i < IN_FLIGHT_SLOTS && GST_CLOCK_TIME_IS_VALID(pts); i++) {
+        InFlight *slot = &element->in_flight[(element->next_slot + i) % IN_FLIGHT_SLOTS];
+
+        if (slot->pts == pts) {
+            add_latency(element, g_get_monotonic_time() - slot->time);
+            slot->pts = GST_CLOCK_TIME_NONE;
+            break;
+        }
+    }
+
+    g_mutex_unlock(&element->lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void add_pad_probes(GstElement *element, ElementStats *stats)
+{
+    GstIterator *it = gst_element_iterate_pads(element);
+    GValue item = G_VALUE_INIT;
+
+    while (stats->n_pads < MAX_PROBED_PADS && gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+        GstPad *pad = g_value_get_object(&item);
+        const bool is_sink = GST_PAD_DIRECTION(pad) == GST_PAD_SINK;
+
+        stats->pads[stats->n_pads] = gst_object_ref(pad);
+        stats->probes[stats->n_pads] = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, is_sink ? cb_buffer_in : cb_buffer_out, stats, nullptr);
+        stats->n_pads++;
+        g_value_reset(&item);
+    }
+
+    g_value_unset(&item);
+    gst_iterator_free(it);
+}
+
+static ElementStats *find_element(PipelineStats *stats, const GstObject *object)
+{
+    for (int i = 0; i < stats->n_elements; i++) {
+        if (GST_OBJECT(stats->elements[i].element) == object) return &stats->elements[i];
+    }
+
+    return nullptr;
+}
+
+static GstBusSyncReply cb_sync_message(GstBus *bus, GstMessage *msg, gpointer user_data)
+{
+    if (GST_MESSAGE_TYPE(msg) != GST_MESSAGE_QOS) return GST_BUS_PASS;
+
+    ElementStats *element = find_element(user_data, GST_MESSAGE_SRC(msg));
+    if (element == NULL) return GST_BUS_PASS;
+
+    GstFormat format;
+    guint64 processed;
+    guint64 dropped;
+    gst_message_parse_qos_stats(msg, &format, &processed, &dropped);
+
+    g_mutex_lock(&element->lock);
+
+    element->late++;
+    // The dropped count is a running total, (guint64)-1 when the element does not track it
+    if (dropped != (guint64)-1 && dropped > element->dropped) element->dropped = dropped;
+
+    g_mutex_unlock(&element->lock);
+
+    return GST_BUS_PASS;
+}
+
+PipelineStats *pipeline_stats_attach(GstElement *pipeline)
+{
+    PipelineStats *stats = calloc(1, sizeof(PipelineStats));
+    if (stats == NULL) return nullptr;
+
+    // Count first so the array never moves once the probes hold pointers into it
+    GstIterator *it = gst_bin_iterate_recurse(GST_BIN(pipeline));
+    GValue item = G_VALUE_INIT;
+    int capacity = 0;
+
+    while (gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+        capacity++;
+        g_value_reset(&item);
+    }
+
+    stats->elements = calloc(capacity > 0 ? (size_t)capacity : 1, sizeof(ElementStats));
+    if (stats->elements == NULL) {
+        g_value_unset(&item);
+        gst_iterator_free(it);
+        free(stats);
+        return nullptr;
+    }
+
+    gst_iterator_resync(it);
+
+    while (stats->n_elements < capacity && gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+        GstElement *element = g_value_get_object(&item);
+        ElementStats *element_stats = &stats->elements[stats->n_elements++];
+
+        element_stats->element = gst_object_ref(element);
+        snprintf(element_stats->name, sizeof(element_stats->name), "%s", GST_ELEMENT_NAME(element));
+        g_mutex_init(&element_stats->lock);
+
+        for (int i = 0; i < IN_FLIGHT_SLOTS; i++) element_stats->in_flight[i].pts = GST_CLOCK_TIME_NONE;
+
+        GstElementFactory *factory = gst_element_get_factory(element);
+        element_stats->is_queue = factory != NULL && strcmp(GST_OBJECT_NAME(factory), "queue") == 0;
+
+        add_pad_probes(element, element_stats);
+        g_value_reset(&item);
+    }
+
+    g_value_unset(&item);
+    gst_iterator_free(it);
+
+    stats->bus = gst_element_get_bus(pipeline);
+    gst_bus_set_sync_handler(stats->bus, cb_sync_message, stats, nullptr);
+
+    return stats;
+}
+
+void pipeline_stats_poll(PipelineStats *stats)
+{
+    for (int i = 0; i < stats->n_elements; i++) {
+        ElementStats *element = &stats->elements[i];
+        if (!element->is_queue) continue;
+
+        guint level = 0;
+        guint limit = 0;
+        g_object_get(element->element, "current-level-buffers", &level, "max-size-buffers", &limit, nullptr);
+
+        g_mutex_lock(&element->lock);
+
+        element->queue_level = level;
+        element->queue_limit = limit;
+        if (level > element->queue_peak) element->queue_peak = level;
+
+        g_mutex_unlock(&element->lock);
+    }
+}
+
+int pipeline_stats_count(const PipelineStats *stats)
+{
+    return stats->n_elements;
+}
+
+bool pipeline_stats_get(PipelineStats *stats, const char *name, ElementCounters *counters)
+{
+    for (int i = 0; i < stats->n_elements; i++) {
+        ElementStats *element = &stats->elements[i];
+        if (strcmp(element->name, name) != 0) continue;
+
+        g_mutex_lock(&element->lock);
+
+        *counters = (ElementCounters){
+            .buffers_in = element->buffers_in,
+            .buffers_out = element->buffers_out,
+            .latency_count = element->latency_count,
+            .latency_sum = element->latency_sum,
+            .dropped = element->dropped,
+            .queue_level = element->queue_level,
+            .queue_limit = element->queue_limit,
+        };
+
+        g_mutex_unlock(&element->lock);
+
+        return true;
+    }
+
+    return false;
+}
+
+void pipeline_stats_describe(PipelineStats *stats, const int index, char *line, const size_t size)
+{
+    ElementStats *element = &stats->elements[index];
+
+    g_mutex_lock(&element->lock);
+
+    int length = snprintf(line, size, "%-16s in %6" G_GUINT64_FORMAT " out %6" G_GUINT64_FORMAT,
+        element->name, element->buffers_in, element->buffers_out);
+
+    if (element->latency_count > 0 && length >= 0 && (size_t)length < size) {
+        length += snprintf(line + length, size - (size_t)length, "  p50 %.1fms p99 %.1fms max %.1fms",
+            (double)latency_percentile(element, 0.5) / 1000.0,
+            (double)latency_percentile(element, 0.99) / 1000.0,
+            (double)element->latency_max / 1000.0);
+    }
+
+    if (element->late > 0 && length >= 0 && (size_t)length < size) {
+        length += snprintf(line + length, size - (size_t)length, "  late %" G_GUINT64_FORMAT " dropped %" G_GUINT64_FORMAT,
+            element->late, element->dropped);
+    }
+
+    if (element->is_queue && length >= 0 && (size_t)length < size) {
+        snprintf(line + length, size - (size_t)length, "  fill %u/%u peak %u",
+            element->queue_level, element->queue_limit, element->queue_peak);
+    }
+
+    g_mutex_unlock(&element->lock);
+}
+
+bool pipeline_stats_write(PipelineStats *stats, FILE *f)
+{
+    char line[256];
+
+    pipeline_stats_poll(stats);
+
+    for (int i = 0; i < stats->n_elements; i++) {
+        pipeline_stats_describe(stats, i, line, sizeof(line));
+        fprintf(f, "%s\n", line);
+    }
+
+    fprintf(f, "\nLatency histograms (buffers per bucket, upper bound in us)\n");
+
+    for (int i = 0; i < stats->n_elements; i++) {
+        ElementStats *element = &stats->elements[i];
+
+        g_mutex_lock(&element->lock);
+
+        if (element->latency_count > 0) {
+            fprintf(f, "%s: mean %.1fus\n", element->name, (double)element->latency_sum / (double)element->latency_count);
+
+            for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+                if (element->histogram[bucket] == 0) continue;
+                fprintf(f, "  <%8ld %8" G_GUINT64_FORMAT "\n", (long)2 << bucket, element->histogram[bucket]);
+            }
+        }
+
+        g_mutex_unlock(&element->lock);
+    }
+
+    return !ferror(f);
+}
+
+bool pipeline_stats_has_data(PipelineStats *stats)
+{
+    bool has_data = false;
+
+    for (int i = 0; i < stats->n_elements && !has_data; i++) {
+        ElementStats *element = &stats->elements[i];
+
+        g_mutex_lock(&element->lock);
+        has_data = element->buffers_in > 0 || element->buffers_out > 0;
+        g_mutex_unlock(&element->lock);
+    }
+
+    return has_data;
+}
+
+void pipeline_stats_reset(PipelineStats *stats)
+{
+    for (int i = 0; i < stats->n_elements; i++) {
+        ElementStats *element = &stats->elements[i];
+
+        g_mutex_lock(&element->lock);
+
+        for (int slot = 0; slot < IN_FLIGHT_SLOTS; slot++) element->in_flight[slot].pts = GST_CLOCK_TIME_NONE;
+
+        element->buffers_in = 0;
+        element->buffers_out = 0;
+        memset(element->histogram, 0, sizeof(element->histogram));
+        element->latency_count = 0;
+        element->latency_sum = 0;
+        element->latency_max = 0;
+        element->late = 0;
+        element->dropped = 0;
+        element->queue_level = 0;
+        element->queue_peak = 0;
+
+        g_mutex_unlock(&element->lock);
+    }
+}
+
+void pipeline_stats_free(PipelineStats *stats)
+{
+    if (stats == NULL) return;
+
+    gst_bus_set_sync_handler(stats->bus, nullptr, nullptr, nullptr);
+    gst_object_unref(stats->bus);
+
+    for (int i = 0; i < stats->n_elements; i++) {
+        ElementStats *element = &stats->elements[i];
+
+        for (int pad = 0; pad < element->n_pads; pad++) {
+            gst_pad_remove_probe(element->pads[pad], element->probes[pad]);
+            gst_object_unref(element->pads[pad]);
+        }
+
+        g_mutex_clear(&element->lock);
+        gst_object_unref(element->element);
+    }
+
+    free(stats->elements);
+    free(stats);
+}
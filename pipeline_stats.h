@@ -0,0 +1,49 @@
+#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+
+#include <stdio.h>
+#include <gstreamer-1.0/gst/gst.h>
+
+typedef struct PipelineStats PipelineStats;
+
+// Running totals of one element since the last reset
+typedef struct {
+    guint64 buffers_in;
+    guint64 buffers_out;
+    guint64 latency_count;
+    gint64 latency_sum;
+    guint64 dropped;
+    // Only for queues, as of the last pipeline_stats_poll()
+    guint queue_level;
+    guint queue_limit;
+} ElementCounters;
+
+// Adds buffer probes to the pads of every element in `pipeline` and a bus sync handler for QoS
+// messages. The time between a buffer entering an element and a buffer with the same PTS
+// leaving it goes into a per-element latency histogram.
+PipelineStats *pipeline_stats_attach(GstElement *pipeline);
+
+// Samples the fill level of every queue, the probes do not see buffers sitting in a queue
+void pipeline_stats_poll(PipelineStats *stats);
+
+int pipeline_stats_count(const PipelineStats *stats);
+
+// Copies the totals of the element called `name`, false if the pipeline has no such element
+bool pipeline_stats_get(PipelineStats *stats, const char *name, ElementCounters *counters);
+
+// One line summary of element `index`: buffers in/out, latency percentiles, drops and queue fill
+void pipeline_stats_describe(PipelineStats *stats, int index, char *line, size_t size);
+
+// Writes the summaries followed by the full latency histograms
+bool pipeline_stats_write(PipelineStats *stats, FILE *f);
+
+// True once any buffer went through the probes since the last reset
+bool pipeline_stats_has_data(PipelineStats *stats);
+
+// Clears the counters and histograms, keeping the probes
+void pipeline_stats_reset(PipelineStats *stats);
+
+// Removes the probes, call it once no more buffers are flowing
+void pipeline_stats_free(PipelineStats *stats);
+
+#endif
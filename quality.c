@@ -0,0 +1,93 @@
+#include <math.h>
+
+#include "quality.h"
+
+#define SSIM_BLOCK 8
+// Stabilizers from the SSIM paper for 8 bit samples, (0.01 * 255)² and (0.03 * 255)²
+#define SSIM_C1 6.5025
+#define SSIM_C2 58.5225
+
+static inline int luma(const uint8_t *bgrx)
+{
+    return (29 * bgrx[0] + 150 * bgrx[1] + 77 * bgrx[2]) >> 8;
+}
+
+static double block_ssim(const uint8_t *reference, const int reference_stride, const uint8_t *decoded, const int decoded_stride)
+{
+    double sum_a = 0.0;
+    double sum_b = 0.0;
+    double sum_aa = 0.0;
+    double sum_bb = 0.0;
+    double sum_ab = 0.0;
+    const double n = SSIM_BLOCK * SSIM_BLOCK;
+
+    for (int y = 0; y < SSIM_BLOCK; y++) {
+        const uint8_t *a = reference + (size_t)y * reference_stride;
+        const uint8_t *b = decoded + (size_t)y * decoded_stride;
+
+        for (int x = 0; x < SSIM_BLOCK; x++) {
+            const double la = luma(a + x * 4);
+            const double lb = luma(b + x * 4);
+
+            sum_a += la;
+            sum_b += lb;
+            sum_aa += la * la;
+            sum_bb += lb * lb;
+            sum_ab += la * lb;
+        }
+    }
+
+    const double mean_a = sum_a / n;
+    const double mean_b = sum_b / n;
+    const double var_a = sum_aa / n - mean_a * mean_a;
+    const double var_b = sum_bb / n - mean_b * mean_b;
+    const double cov = sum_ab / n - mean_a * mean_b;
+
+    return (2.0 * mean_a * mean_b + SSIM_C1) * (2.0 * cov + SSIM_C2) /
+        ((mean_a * mean_a + mean_b * mean_b + SSIM_C1) * (var_a + var_b + SSIM_C2));
+}
+
+void quality_add_frame(QualityScore *score, const uint8_t *reference, const int reference_stride, const uint8_t *decoded, const int decoded_stride, const int width, const int height)
+{
+    double ssim = 0.0;
+    int blocks = 0;
+    double squared_error = 0.0;
+
+    for (int y = 0; y + SSIM_BLOCK <= height; y += SSIM_BLOCK) {
+        for (int x = 0; x + SSIM_BLOCK <= width; x += SSIM_BLOCK) {
+            ssim += block_ssim(reference + (size_t)y * reference_stride + (size_t)x * 4, reference_stride,
+                decoded + (size_t)y * decoded_stride + (size_t)x * 4, decoded_stride);
+            blocks++;
+        }
+    }
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t *a = reference + (size_t)y * reference_stride;
+        const uint8_t *b = decoded + (size_t)y * decoded_stride;
+
+        for (int x = 0; x < width; x++) {
+            const double d = luma(a + x * 4) - luma(b + x * 4);
+            squared_error += d * d;
+        }
+    }
+
+    const double mse = squared_error / ((double)width * height);
+    const double psnr = mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : QUALITY_MAX_PSNR;
+
+    ssim = blocks > 0 ? ssim / blocks : 1.0;
+
+    if (score->frames == 0 || ssim < score->min_ssim) score->min_ssim = ssim;
+    score->ssim_sum += ssim;
+    score->psnr_sum += psnr < QUALITY_MAX_PSNR ? psnr : QUALITY_MAX_PSNR;
+    score->frames++;
+}
+
+double quality_mean_ssim(const QualityScore *score)
+{
+    return score->frames > 0 ? score->ssim_sum / score->frames : 0.0;
+}
+
+double quality_mean_psnr(const QualityScore *score)
+{
+    return score->frames > 0 ? score->psnr_sum / score->frames : 0.0;
+}
@@ -0,0 +1,24 @@
+#ifndef QUALITY_H
+#define QUALITY_H
+
+#include <stdint.h>
+
+// PSNR of identical frames, which would otherwise be infinite
+#define QUALITY_MAX_PSNR 100.0
+
+// Running scores of a clip, one frame at a time
+typedef struct {
+    int frames;
+    double ssim_sum;
+    double min_ssim;
+    double psnr_sum;
+} QualityScore;
+
+// Compares two BGRx frames on their luma. SSIM is the mean over 8x8 blocks, PSNR comes from the
+// mean squared error of the whole frame. Both are added to `score`.
+void quality_add_frame(QualityScore *score, const uint8_t *reference, int reference_stride, const uint8_t *decoded, int decoded_stride, int width, int height);
+
+double quality_mean_ssim(const QualityScore *score);
+double quality_mean_psnr(const QualityScore *score);
+
+#endif
@@ -3,7 +3,9 @@
 #include <string.h>
 #include <math.h>
 #include <pwd.h>
+#include <signal.h>
 #include <sys/stat.h>
+#include <sys/eventfd.h>
 #include <dbus-1.0/dbus/dbus.h>
 #include <gstreamer-1.0/gst/gst.h>
 #include <gstreamer-1.0/gst/gstparse.h>
@@ -12,34 +14,31 @@
 #include <unistd.h>
 
 #include "raylib.h"
+#include "pipeline.h"
+#include "bench.h"
+#include "replay.h"
+#include "control.h"
+#include "event_waiter.h"
+#include "loop_bench.h"
+#include "handshake.h"
+#include "stop_test.h"
+#include "screencast.h"
+#include "overlay_meter.h"
+#include "av_drift.h"
 
 #define MOUSE_SCALE_MARK_SIZE  24
 
-#define SCREENCAST_SERVICE "org.gnome.Mutter.ScreenCast"
-#define SCREENCAST_OBJECT_PATH "/org/gnome/Mutter/ScreenCast"
-#define SCREENCAST_INTERFACE "org.gnome.Mutter.ScreenCast"
-#define SESSION_INTERFACE "org.gnome.Mutter.ScreenCast.Session"
-#define STREAM_INTERFACE "org.gnome.Mutter.ScreenCast.Stream"
-
-typedef struct {
-    DBusConnection *conn;
-    char *session_path;
-    char *stream_path;
-    unsigned int pipewire_node_id;
-} ScreenCastState;
+// How long an overlay with nothing to redraw sleeps between checks when the event waiter thread
+// could not be started, otherwise it sleeps until something happens
+#define OVERLAY_POLL_SECONDS 0.05
 
 typedef struct {
     gboolean is_live;
-    GstElement *pipeline;
+    // From malloc(), claim_pipeline() may put a new one in its place
+    Recording *recording;
     GMainLoop *loop;
 } CustomData;
 
-enum OutputEncoding {
-    WEBM_WITH_AUDIO,
-    WEBM_ONLY_VIDEO,
-    GIF
-};
-
 bool received_eos = false;
 
 typedef struct {
@@ -47,336 +46,82 @@ typedef struct {
 
     bool is_resizing_recording_area;
     bool is_recording;
+    bool is_paused;
+    // The pipeline is built, the PipeWire node has not arrived yet
+    bool is_waiting_for_stream;
 
     enum OutputEncoding output_encoding;
-} UISettings;
 
-const char * const  PIPELINES[] = {
-    "webmmux name=mux ! filesink location=%s "
-    "pipewiresrc path=%u \
-        do-timestamp=true \
-        keepalive-time=1000 \
-        resend-last=true ! "
-    "capsfilter caps=video/x-raw,max-framerate=30/1 ! "
-    "videoconvert matrix-mode=output-only n-threads=32 ! "
-    "queue ! "
-    "vp8enc cpu-used=16 max-quantizer=17 deadline=1 keyframe-mode=disabled threads=32 static-threshold=100 buffer-size=20000 ! "
-    "queue ! "
-    "mux.video_0 "
-    "pulsesrc ! audioconvert ! vorbisenc ! queue ! mux.audio_0",
-
-    "pipewiresrc path=%u \
-        do-timestamp=true \
-        keepalive-time=1000 \
-        resend-last=true ! "
-    "capsfilter caps=video/x-raw,max-framerate=30/1 ! "
-    "videoconvert chroma-mode=none dither=none matrix-mode=output-only n-threads=32 ! "
-    "queue ! "
-    "vp8enc cpu-used=16 max-quantizer=17 deadline=1 keyframe-mode=disabled threads=32 static-threshold=1000 buffer-size=20000 ! "
-    "queue ! "
-    "webmmux ! filesink location=%s",
-
-    "pipewiresrc path=%u \
-        do-timestamp=true \
-        keepalive-time=1000 \
-        resend-last=true ! "
-    "capsfilter caps=video/x-raw,max-framerate=60/1 ! "
-    "videoconvert chroma-mode=none dither=none matrix-mode=output-only n-threads=32 ! "
-    "queue ! "
-    "gifskienc quality=100 location=%s ! fakesink",
-};
+    // Instant replay keeps the last `replay_seconds` in memory instead of recording to a file
+    int replay_seconds;
+    int replay_memory_mb;
+
+    enum ThreadMode thread_mode;
+
+    // Adjust the encoder while recording to hold this frame rate, 0 keeps the preset settings
+    int target_fps;
+    // Frames that may wait for the GIF encoder, 0 for the default
+    int gif_max_frames;
+
+    // Capture raw frames now, encode them once the recording stops
+    bool spool;
+    // Convert only the damaged tiles and skip frames without damage
+    bool damage;
+    // Capture with the stock pipewiresrc, which has the pointer drawn into the frames and no damage
+    bool stock_source;
+    // Drop frames identical to the previous one, the output gets a variable frame rate
+    bool vfr;
+    // Cut the output into files this many seconds long, 0 for a single file
+    int segment_seconds;
+    // Join the segments into one file once the recording stops
+    bool concat_segments;
+    // Frames still queued this long after a stop are dropped, 0 to always encode all of them
+    int stop_deadline_seconds;
+    enum AudioCodec audio_codec;
+    // Audio capture buffer, 0 keeps the source's default
+    int audio_buffer_ms;
+    // A/V drift corrected by resampling the audio, 0 for the default
+    int drift_threshold_ms;
+} UISettings;
 
 #define INITIAL_RECORDING_AREA_X 300
 #define INITIAL_RECORDING_AREA_Y 100
 
-static CustomData data;
-static UISettings ui_settings;
-
-bool create_screen_cast_session(DBusConnection **conn, char **session_path)
-{
-    DBusError err;
-    DBusMessage *msg = dbus_message_new_method_call(
-        SCREENCAST_SERVICE,
-        SCREENCAST_OBJECT_PATH,
-        SCREENCAST_INTERFACE,
-        "CreateSession"
-    );
-
-    if (msg == NULL) {
-        fprintf(stderr, "ERROR: Message Null (CreateSession)\n");
-
-        return false;
-    }
-
-    // Add the 'properties' argument (empty dictionary for now)
-    DBusMessageIter arg;
-    dbus_message_iter_init_append(msg, &arg);
-    DBusMessageIter dict_iter;
-    dbus_message_iter_open_container(&arg, DBUS_TYPE_ARRAY, "{sv}", &dict_iter);
-    dbus_message_iter_close_container(&arg, &dict_iter);
-
-    // Send the message and get the reply
-    dbus_error_init(&err);
-    DBusMessage *reply = dbus_connection_send_with_reply_and_block(*conn, msg, -1, &err);
-    dbus_message_unref(msg);
-
-    if (dbus_error_is_set(&err)) {
-        fprintf(stderr, "ERROR: Error calling CreateSession: %s\n", err.message);
-
-        dbus_error_free(&err);
-        dbus_message_unref(reply);
-        return false;
-    }
-
-    // Get the session_path from the reply
-    if (reply) {
-        char *session_path_reply;
-
-        if (dbus_message_get_args(reply, &err, DBUS_TYPE_OBJECT_PATH, &session_path_reply, DBUS_TYPE_INVALID)) {
-            *session_path = strdup(session_path_reply);
-            printf("INFO: Created session at: %s\n", *session_path);
-
-            dbus_message_unref(reply);
-            return true;
-        }
-
-        fprintf(stderr, "ERROR: Error getting session_path: %s\n", err.message);
-        dbus_error_free(&err);
-        dbus_message_unref(reply);
-
-        return false;
-    }
-
-    fprintf(stderr, "ERROR: Reply for CreateSession is NULL\n");
-
-    dbus_error_free(&err);
-    return false;
-}
-bool start_screen_cast_session(DBusConnection **conn, char **session_path)
-{
-    DBusError err;
-    DBusMessage *msg = dbus_message_new_method_call(
-        SCREENCAST_SERVICE,
-        *session_path,
-        SESSION_INTERFACE,
-        "Start"
-    );
-
-    dbus_error_init(&err);
-    DBusMessage *reply = dbus_connection_send_with_reply_and_block(*conn, msg, -1, &err);
-    dbus_message_unref(msg);
-
-    if (dbus_error_is_set(&err)) {
-        fprintf(stderr, "ERROR: Error calling Session.Start: %s\n", err.message);
-        dbus_error_free(&err);
-
-        return false;
-    }
-
-    if (!reply) {
-        fprintf(stderr, "ERROR: Reply for Session.Start is NULL\n");
-
-        return false;
-    }
-
-    dbus_message_unref(reply);
-    printf("INFO: Session at [%s] started successfully.\n", *session_path);
-
-    return true;
-}
-void handle_pipewire_stream_added(unsigned int *pipewire_node_id, DBusMessage * signal) {
-    DBusError err;
-    dbus_error_init(&err);
-    unsigned int node_id;
-
-    if (!dbus_message_get_args(signal, &err, DBUS_TYPE_UINT32, &node_id, DBUS_TYPE_INVALID)) {
-        fprintf(stderr, "ERROR: Error getting PipeWireStreamAdded arguments: %s\n", err.message);
-        dbus_error_free(&err);
-
-        return;
-    }
-
-    *pipewire_node_id = node_id;
-    printf("INFO: PipeWire stream added with node ID: %u\n", node_id);
-}
-DBusHandlerResult filter_function(DBusConnection * conn, DBusMessage * msg, void *user_data) {
-    unsigned int *pipewire_node_id = user_data;
-
-    if (dbus_message_is_signal(msg, STREAM_INTERFACE, "PipeWireStreamAdded")) {
-        handle_pipewire_stream_added(pipewire_node_id, msg);
-        return DBUS_HANDLER_RESULT_HANDLED;
-    }
-
-    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
-}
-void subscribe_to_pipewire_added_event(DBusConnection **conn, unsigned int *pipewire_node_id)
-{
-    dbus_bus_add_match(*conn, "type='signal',interface='" STREAM_INTERFACE "',member='PipeWireStreamAdded'", nullptr);
-    dbus_connection_add_filter(*conn, filter_function, pipewire_node_id, nullptr);
-    dbus_connection_flush(*conn);
-}
-bool create_stream_cast_record_area_stream(DBusConnection **conn, char **session_path, char **stream_path, const int x, const int y, const int width, const int height)
-{
-    DBusError err;
-
-    DBusMessage *msg = dbus_message_new_method_call(
-        SCREENCAST_SERVICE,
-        *session_path,
-        SESSION_INTERFACE,
-        "RecordArea"
-    );
-
-    if (msg == NULL) {
-        fprintf(stderr, "ERROR: Message Null (RecordArea)\n");
-
-        return false;
-    }
-
-    const int cursor_mode_value = 2;
-    const char *cursor_mode_key = "cursor-mode";
-
-    DBusMessageIter arg;
-    DBusMessageIter dict_iter;
-    DBusMessageIter entry_iter;
-    DBusMessageIter variant_iter;
-    dbus_message_iter_init_append(msg, &arg);
-    dbus_message_iter_append_basic(&arg, DBUS_TYPE_INT32, &x);
-    dbus_message_iter_append_basic(&arg, DBUS_TYPE_INT32, &y);
-    dbus_message_iter_append_basic(&arg, DBUS_TYPE_INT32, &width);
-    dbus_message_iter_append_basic(&arg, DBUS_TYPE_INT32, &height);
-    // Add the 'properties' argument (dictionary)
-    dbus_message_iter_open_container(&arg, DBUS_TYPE_ARRAY, "{sv}", &dict_iter);
-        dbus_message_iter_open_container(&dict_iter, DBUS_TYPE_DICT_ENTRY, nullptr, &entry_iter);
-            dbus_message_iter_append_basic(&entry_iter, DBUS_TYPE_STRING, &cursor_mode_key);
-            dbus_message_iter_open_container(&entry_iter, DBUS_TYPE_VARIANT, "u", &variant_iter);
-                dbus_message_iter_append_basic(&variant_iter, DBUS_TYPE_UINT32, &cursor_mode_value);
-            dbus_message_iter_close_container(&entry_iter, &variant_iter);
-        dbus_message_iter_close_container(&dict_iter, &entry_iter);
-    dbus_message_iter_close_container(&arg, &dict_iter);
-
-    dbus_error_init(&err);
-    DBusMessage *reply = dbus_connection_send_with_reply_and_block(*conn, msg, -1, &err);
-    dbus_message_unref(msg);
-    if (dbus_error_is_set(&err)) {
-        fprintf(stderr, "Error calling RecordArea: %s\n", err.message);
-
-        dbus_error_free(&err);
-        return false;
-    }
-
-    if (!reply) {
-        fprintf(stderr, "ERROR: Reply for RecordArea is NULL\n");
-
-        return false;
-    }
-
-    char *stream_path_reply;
-    if (dbus_message_get_args(reply, &err, DBUS_TYPE_OBJECT_PATH, &stream_path_reply, DBUS_TYPE_INVALID)) {
-        *stream_path = strdup(stream_path_reply);
-        printf("INFO: Started recording area, stream at: %s\n", *stream_path);
-    } else {
-        fprintf(stderr, "ERROR: Error getting stream_path: %s\n", err.message);
-        dbus_error_free(&err);
+#define DEFAULT_REPLAY_MEMORY_MB 256
 
-        return false;
-    }
-
-    dbus_message_unref(reply);
-
-    return true;
-}
-bool start_screen_cast_record_area_stream(DBusConnection **conn, char **stream_path)
-{
-    DBusError err;
+// An area given with --area=, recorded next to the one selected on screen with a pipeline of its own
+typedef struct {
+    // Stage coordinates once the window is open, relative to `monitor` before that
+    int area[4];
+    // -1 for the monitor the overlay opens on
+    int monitor;
 
-    DBusMessage *msg = dbus_message_new_method_call(
-        SCREENCAST_SERVICE,
-        *stream_path,
-        STREAM_INTERFACE,
-        "Start"
-    );
+    CustomData data;
 
-    dbus_error_init(&err);
-    DBusMessage *reply = dbus_connection_send_with_reply_and_block(*conn, msg, -1, &err);
-    dbus_message_unref(msg);
+    // Index in `ScreenCastState.streams` while recording, -1 otherwise
+    int stream;
+    bool is_waiting_for_stream;
+    bool is_watching_bus;
+} ExtraArea;
 
-    if (dbus_error_is_set(&err)) {
-        fprintf(stderr, "ERROR: Error starting stream [%s]: %s\n", *stream_path, err.message);
-        dbus_error_free(&err);
+static CustomData data;
+static UISettings ui_settings;
+static OverlayMeter overlay_meter;
 
-        return false;
-    }
+// The screen cast session has one stream for the selected area and one for each of these
+static ExtraArea extra_areas[SCREEN_CAST_MAX_STREAMS - 1];
+static int n_extra_areas = 0;
 
-    if (!reply) {
-        fprintf(stderr, "ERROR: No reply when starting record area stream\n");
-    }
+static volatile sig_atomic_t replay_requested = 0;
 
-    dbus_message_unref(reply);
-    printf("INFO: Record area stream started successfully.\n");
+// Ends the wait of the render loop when the replay is asked for
+static int replay_wake_fd = -1;
 
-    return true;
-}
-bool stop_screen_cast_record_area_stream(DBusConnection **conn, char **stream_path)
+static void cb_replay_signal(int signal)
 {
-    DBusError err;
-
-    DBusMessage *msg = dbus_message_new_method_call(
-        SCREENCAST_SERVICE,
-        *stream_path,
-        STREAM_INTERFACE,
-        "Stop"
-    );
-
-    dbus_error_init(&err);
-    DBusMessage *reply = dbus_connection_send_with_reply_and_block(*conn, msg, -1, &err);
-    dbus_message_unref(msg);
+    replay_requested = 1;
 
-    if (dbus_error_is_set(&err)) {
-        fprintf(stderr, "ERROR: Error stopping stream [%s]: %s\n", *stream_path, err.message);
-        dbus_error_free(&err);
-
-        return false;
-    }
-
-    if (!reply) {
-        fprintf(stderr, "ERROR: No reply when stopping record area stream\n");
-    }
-
-    dbus_message_unref(reply);
-    printf("INFO: Record area stream stopped successfully.\n");
-
-    return true;
-}
-bool stop_screen_cast_session(DBusConnection **conn, char **session_path)
-{
-    DBusError err;
-
-    DBusMessage *msg = dbus_message_new_method_call(
-        SCREENCAST_SERVICE,
-        *session_path,
-        SESSION_INTERFACE,
-        "Stop"
-    );
-
-    dbus_error_init(&err);
-    DBusMessage *reply = dbus_connection_send_with_reply_and_block(*conn, msg, -1, &err);
-    dbus_message_unref(msg);
-
-    if (dbus_error_is_set(&err)) {
-        fprintf(stderr, "ERROR: Error stopping session [%s]: %s\n", *session_path, err.message);
-        dbus_error_free(&err);
-
-        return false;
-    }
-
-    if (!reply) {
-        fprintf(stderr, "ERROR: No reply when stopping session\n");
-    }
-
-    dbus_message_unref(reply);
-    printf("INFO: Session stopped successfully.\n");
-
-    return true;
+    if (replay_wake_fd >= 0) eventfd_write(replay_wake_fd, 1);
 }
 
 static void cb_message(GstBus *bus, GstMessage *msg, const CustomData *data) {
@@ -390,12 +135,12 @@ static void cb_message(GstBus *bus, GstMessage *msg, const CustomData *data) {
             g_error_free(err);
             g_free(debug);
 
-            gst_element_set_state(data->pipeline, GST_STATE_READY);
+            gst_element_set_state(data->recording->pipeline, GST_STATE_READY);
             break;
         }
         case GST_MESSAGE_EOS:
             received_eos = true;
-            gst_element_set_state(data->pipeline, GST_STATE_READY);
+            gst_element_set_state(data->recording->pipeline, GST_STATE_READY);
             break;
         case GST_MESSAGE_BUFFERING: {
             gint percent = 0;
@@ -406,15 +151,15 @@ static void cb_message(GstBus *bus, GstMessage *msg, const CustomData *data) {
             gst_message_parse_buffering(msg, &percent);
 
             if (percent < 100)
-                gst_element_set_state(data->pipeline, GST_STATE_PAUSED);
+                gst_element_set_state(data->recording->pipeline, GST_STATE_PAUSED);
             else
-                gst_element_set_state(data->pipeline, GST_STATE_PLAYING);
+                gst_element_set_state(data->recording->pipeline, GST_STATE_PLAYING);
             break;
         }
         case GST_MESSAGE_CLOCK_LOST:
             /* Get a new clock */
-            gst_element_set_state(data->pipeline, GST_STATE_PAUSED);
-            gst_element_set_state(data->pipeline, GST_STATE_PLAYING);
+            gst_element_set_state(data->recording->pipeline, GST_STATE_PAUSED);
+            gst_element_set_state(data->recording->pipeline, GST_STATE_PLAYING);
             break;
         default:
             printf("DEBUG: Message type: %s\n", gst_message_type_get_name(GST_MESSAGE_TYPE(msg)));
@@ -422,7 +167,7 @@ static void cb_message(GstBus *bus, GstMessage *msg, const CustomData *data) {
     }
 }
 
-static void get_pipeline_string(char *str, const unsigned int pipewire_node_id)
+static void get_output_location(char *location, const size_t size)
 {
     const char *homedir;
 
@@ -430,144 +175,259 @@ static void get_pipeline_string(char *str, const unsigned int pipewire_node_id)
         homedir = getpwuid(getuid())->pw_dir;
     }
 
-    char format_string[100];
-    char full_path[100];
+    char format_string[PATH_MAX];
 
     const time_t t = time(nullptr);
     const struct tm *tm = localtime(&t);
 
     snprintf(format_string, sizeof(format_string), "%s/Videos/Screencasts/screen_cast_%%d_%%m_%%Y_%%H_%%M_%%S", homedir);
 
-    strftime(full_path, sizeof(full_path), format_string, tm);
+    strftime(location, size, format_string, tm);
+    strncat(location, OUTPUT_ENCODING_EXTENSIONS[ui_settings.output_encoding], size - strlen(location) - 1);
+}
 
-    switch (ui_settings.output_encoding) {
-        case WEBM_WITH_AUDIO:
-            strcat(full_path, ".webm");
-            sprintf(str, PIPELINES[WEBM_WITH_AUDIO], full_path, pipewire_node_id);
-            break;
-        case WEBM_ONLY_VIDEO:
-            strcat(full_path, ".webm");
-            sprintf(str, PIPELINES[WEBM_ONLY_VIDEO], pipewire_node_id, full_path);
-            break;
-        case GIF:
-            strcat(full_path, ".gif");
-            sprintf(str, PIPELINES[GIF], pipewire_node_id, full_path);
-            break;
-    }
+// `location` of the primary recording with `_area<N>` in front of the extension
+static void get_area_location(char *location, const size_t size, const char *primary, const int index)
+{
+    const char *extension = OUTPUT_ENCODING_EXTENSIONS[ui_settings.output_encoding];
+    const int base_length = (int)(strlen(primary) - strlen(extension));
+
+    snprintf(location, size, "%.*s_area%d%s", base_length, primary, index + 1, extension);
 }
 
-GstElement* create_pipeline(const unsigned int pipewire_node_id)
+// Parses `X,Y,WIDTHxHEIGHT` with an optional `@MONITOR` for --area=
+static bool parse_area(const char *value, ExtraArea *extra)
 {
-    char fullPipeline[9999];
-    get_pipeline_string(fullPipeline, pipewire_node_id);
+    const int fields = sscanf(value, "%d,%d,%dx%d@%d", &extra->area[0], &extra->area[1], &extra->area[2], &extra->area[3], &extra->monitor);
+
+    if (fields < 4) return false;
+    if (fields == 4) extra->monitor = -1;
+
+    return extra->area[2] > 0 && extra->area[3] > 0;
+}
 
-    GError *error = nullptr;
-    GstElement *pipeline = gst_parse_launch(fullPipeline, &error);
+// Points the prewarmed pipeline of `data` at the node of `stream` and starts it
+static bool start_stream(CustomData *data, const ScreenCastStream *stream, bool *is_watching_bus)
+{
+    connect_pipewire_node(data->recording, stream->pipewire_node_id);
 
-    if (pipeline == NULL) {
-        fprintf(stderr, "ERROR: Failed to create pipeline\n");
-        return nullptr;
+    /* Start playing */
+    if (!start_pipeline(data->recording)) {
+        return false;
     }
 
-    if (error != NULL) {
-        fprintf(stderr, "ERROR: Error parsing full pipeline: %d, %s\n", error->code, error->message);
-        g_error_free(error);
-        return nullptr;
+    // The bus outlives each recording, so it is only watched once
+    if (!*is_watching_bus) {
+        GstBus *bus = gst_element_get_bus(data->recording->pipeline);
+        gst_bus_add_signal_watch(bus);
+        g_signal_connect(bus, "message", G_CALLBACK(cb_message), data);
+        gst_object_unref(bus);
+
+        *is_watching_bus = true;
     }
 
-    return pipeline;
+    return true;
+}
+
+static GstClockTime get_stop_deadline(void)
+{
+    return ui_settings.stop_deadline_seconds > 0 ? (GstClockTime)ui_settings.stop_deadline_seconds * GST_SECOND : GST_CLOCK_TIME_NONE;
 }
 
-bool is_gifskienc_plugin_loaded(void)
+// Finishes the recording of an extra area in the background, or only resets it when its stream
+// never started, and gives its stream back to the session
+static void stop_extra_area(ScreenCastState *state, ExtraArea *extra)
 {
-    GstRegistry *registry = gst_registry_get();
+    if (extra->is_waiting_for_stream) {
+        reset_pipeline(extra->data.recording);
+    } else {
+        finish_recording_async(extra->data.recording, get_stop_deadline());
+    }
 
-    const GstPlugin *plugin = gst_registry_find_plugin(registry, "gifskienc");
+    screen_cast_stop_stream(state, extra->stream);
 
-    return plugin != NULL;
+    extra->stream = -1;
+    extra->is_waiting_for_stream = false;
 }
 
-bool check_for_exit_flag(void) {
-    FILE *f = fopen("/tmp/recording-indicator/flag.txt", "r");
+static void publish_status(ControlServer *control, const int elapsed_seconds)
+{
+    static char last_status[256];
+    char status[256];
+
+    if (!ui_settings.is_recording) {
+        snprintf(status, sizeof(status), "idle %s", OUTPUT_ENCODING_NAMES[ui_settings.output_encoding]);
+    } else {
+        char overlay[64];
+        overlay_meter_describe(&overlay_meter, overlay, sizeof(overlay));
 
-    if (f != NULL) {
-        fclose(f);
-        return true;
+        snprintf(status, sizeof(status), "%s %ds %s %s %s",
+            ui_settings.is_waiting_for_stream ? "starting" : ui_settings.replay_seconds > 0 ? "replay" : ui_settings.is_paused ? "paused" : "recording",
+            elapsed_seconds, OUTPUT_ENCODING_NAMES[ui_settings.output_encoding], data.recording->location, overlay);
     }
 
-    return false;
+    if (strcmp(status, last_status) != 0) {
+        control_server_set_status(control, status);
+        snprintf(last_status, sizeof(last_status), "%s", status);
+    }
 }
 
 int main(int argc, char *argv[])
 {
+    // Talks to an instance that is already running
+    if (argc >= 2 && strcmp(argv[1], "ctl") == 0) {
+        return run_control_client(argc - 2, argv + 2);
+    }
+
+    // Headless mode, runs before anything touches D-Bus or the display
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        gst_init(nullptr, nullptr);
+        const int status = run_benchmark(argc - 2, argv + 2);
+        gst_deinit();
+
+        return status;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "loop-bench") == 0) {
+        return run_loop_benchmark(argc - 2, argv + 2);
+    }
+
+    // Against whatever owns the ScreenCast name, see mock_screencast.py
+    if (argc >= 2 && strcmp(argv[1], "handshake") == 0) {
+        gst_init(nullptr, nullptr);
+        const int status = run_handshake_test(argc - 2, argv + 2);
+        gst_deinit();
+
+        return status;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "stop-test") == 0) {
+        gst_init(nullptr, nullptr);
+        const int status = run_stop_test(argc - 2, argv + 2);
+        gst_deinit();
+
+        return status;
+    }
+
     struct stat st = {0};
 
     if (stat("/tmp/recording-indicator", &st) == -1) {
         mkdir("/tmp/recording-indicator", 0777);
     }
 
-    // Remove any existing indicator file
-    remove("/tmp/recording-indicator/flag.txt");
-
-    DBusError err;
-    dbus_error_init(&err);
-
     ScreenCastState state = {};
     memset(&state, 0, sizeof(ScreenCastState));
 
     gst_init(nullptr, nullptr);
 
     memset(&data, 0, sizeof(data));
+    data.recording = calloc(1, sizeof(Recording));
 
-    if (argc == 2) {
-        if (strcmp(argv[1], "GIF") == 0) {
-            if (!is_gifskienc_plugin_loaded()) {
-                fprintf(stderr, "ERROR: gifskienc plugin is needed to use GIF encoding.\n");
-                return 1;
-            }
+    if (data.recording == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate the recording\n");
+        return 1;
+    }
 
-            ui_settings.output_encoding = GIF;
-        } else if (strcmp(argv[1], "WEBM_WITH_AUDIO") == 0) {
-            ui_settings.output_encoding = WEBM_WITH_AUDIO;
-        } else {
+    ui_settings.output_encoding = WEBM_ONLY_VIDEO;
+    ui_settings.replay_seconds = 0;
+    ui_settings.replay_memory_mb = DEFAULT_REPLAY_MEMORY_MB;
+    ui_settings.thread_mode = THREADS_AUTO;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--replay=", 9) == 0) {
+            ui_settings.replay_seconds = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--replay-memory=", 16) == 0) {
+            ui_settings.replay_memory_mb = atoi(argv[i] + 16);
+        } else if (strncmp(argv[i], "--target-fps=", 13) == 0) {
+            ui_settings.target_fps = atoi(argv[i] + 13);
+        } else if (strncmp(argv[i], "--gif-frames=", 13) == 0) {
+            ui_settings.gif_max_frames = atoi(argv[i] + 13);
+        } else if (strcmp(argv[i], "--spool") == 0) {
+            ui_settings.spool = true;
+        } else if (strcmp(argv[i], "--damage") == 0) {
+            ui_settings.damage = true;
+        } else if (strcmp(argv[i], "--pipewiresrc") == 0) {
+            ui_settings.stock_source = true;
+        } else if (strncmp(argv[i], "--scale=", 8) == 0) {
+            if (!parse_output_scale(argv[i] + 8, data.recording)) {
+                fprintf(stderr, "ERROR: Unknown scale: %s\n", argv[i] + 8);
+                data.recording->output_scale = SCALE_NATIVE;
+            }
+        } else if (strncmp(argv[i], "--area=", 7) == 0) {
+            if (n_extra_areas == SCREEN_CAST_MAX_STREAMS - 1) {
+                fprintf(stderr, "ERROR: At most %d areas can be added, ignoring %s\n", SCREEN_CAST_MAX_STREAMS - 1, argv[i] + 7);
+            } else if (!parse_area(argv[i] + 7, &extra_areas[n_extra_areas])) {
+                fprintf(stderr, "ERROR: Invalid area, expected X,Y,WIDTHxHEIGHT[@MONITOR]: %s\n", argv[i] + 7);
+            } else {
+                n_extra_areas++;
+            }
+        } else if (strcmp(argv[i], "--vfr") == 0) {
+            ui_settings.vfr = true;
+        } else if (strncmp(argv[i], "--segment=", 10) == 0) {
+            ui_settings.segment_seconds = atoi(argv[i] + 10);
+        } else if (strcmp(argv[i], "--concat") == 0) {
+            ui_settings.concat_segments = true;
+        } else if (strncmp(argv[i], "--stop-deadline=", 16) == 0) {
+            ui_settings.stop_deadline_seconds = atoi(argv[i] + 16);
+        } else if (strncmp(argv[i], "--audio=", 8) == 0) {
+            if (!parse_audio_codec(argv[i] + 8, &ui_settings.audio_codec)) {
+                fprintf(stderr, "ERROR: Unknown audio codec: %s\n", argv[i] + 8);
+                ui_settings.audio_codec = AUDIO_VORBIS;
+            }
+        } else if (strncmp(argv[i], "--audio-buffer=", 15) == 0) {
+            ui_settings.audio_buffer_ms = atoi(argv[i] + 15);
+        } else if (strncmp(argv[i], "--drift-threshold=", 18) == 0) {
+            ui_settings.drift_threshold_ms = atoi(argv[i] + 18);
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            if (!parse_thread_mode(argv[i] + 10, &ui_settings.thread_mode)) {
+                fprintf(stderr, "ERROR: Unknown thread mode: %s\n", argv[i] + 10);
+                ui_settings.thread_mode = THREADS_AUTO;
+            }
+        } else if (!parse_output_encoding(argv[i], &ui_settings.output_encoding)) {
             ui_settings.output_encoding = WEBM_ONLY_VIDEO;
         }
     }
 
-    ui_settings.show_debug_info = false;
-    ui_settings.is_resizing_recording_area = true;
-    ui_settings.is_recording = false;
+    if (ui_settings.replay_seconds > 0) {
+        // `kill -USR1` saves the replay
+        replay_wake_fd = eventfd(0, EFD_NONBLOCK);
+        signal(SIGUSR1, cb_replay_signal);
+        printf("INFO: Instant replay of %d seconds, send SIGUSR1 to save it\n", ui_settings.replay_seconds);
 
-    // Connect to the session bus
-    state.conn = dbus_bus_get(DBUS_BUS_SESSION, &err);
-    if (dbus_error_is_set(&err)) {
-        fprintf(stderr, "ERROR: Connection Error (%s)\n", err.message);
-
-        dbus_error_free(&err);
-        return 1;
+        // The replay ring only holds the selected area
+        if (n_extra_areas > 0) {
+            printf("INFO: Instant replay records a single area, ignoring --area\n");
+            n_extra_areas = 0;
+        }
     }
 
-    if (state.conn == NULL) {
-        fprintf(stderr, "ERROR: Connection Null\n");
+    // Both already write the output only once the recording stops
+    if (ui_settings.segment_seconds > 0 && (ui_settings.replay_seconds > 0 || ui_settings.spool)) {
+        printf("INFO: Segments are not written with --replay or --spool, ignoring --segment\n");
+        ui_settings.segment_seconds = 0;
+    }
 
-        dbus_error_free(&err);
-        return 1;
+    if (ui_settings.damage && ui_settings.stock_source) {
+        printf("INFO: pipewiresrc drops the damage, ignoring --damage\n");
+        ui_settings.damage = false;
     }
 
-    if (! create_screen_cast_session(&state.conn, &state.session_path)) {
-      	dbus_connection_unref(state.conn);
+    // Only capturesrc reads the pointer and the damage from the metadata
+    state.cursor_mode = ui_settings.stock_source ? SCREEN_CAST_CURSOR_EMBEDDED : SCREEN_CAST_CURSOR_METADATA;
 
-    	return 1;
-    }
+    ui_settings.show_debug_info = false;
+    ui_settings.is_resizing_recording_area = true;
+    ui_settings.is_recording = false;
+    ui_settings.is_paused = false;
+    ui_settings.is_waiting_for_stream = false;
 
-    if (! start_screen_cast_session(&state.conn, &state.session_path)) {
-      	dbus_connection_unref(state.conn);
+    // The session is set up while the window opens and the area is selected
+    if (!screen_cast_connect(&state)) {
+        screen_cast_stop(&state);
 
-    	return 1;
+        return 1;
     }
 
-    subscribe_to_pipewire_added_event(&state.conn, &state.pipewire_node_id);
-
     SetConfigFlags(FLAG_VSYNC_HINT | FLAG_WINDOW_TRANSPARENT | FLAG_WINDOW_UNDECORATED | FLAG_WINDOW_TOPMOST);
     InitWindow(0, 0, "");
 
@@ -576,6 +436,27 @@ int main(int argc, char *argv[])
     float screenHeight = (float)GetScreenHeight() * GetWindowScaleDPI().y;
     const float monitorPositionX = GetMonitorPosition(monitor).x;
 
+    // Extra areas may be on any monitor, Mutter takes them all in stage coordinates
+    int n_valid_areas = 0;
+
+    for (int i = 0; i < n_extra_areas; i++) {
+        ExtraArea extra = extra_areas[i];
+        const int area_monitor = extra.monitor < 0 ? monitor : extra.monitor;
+
+        if (area_monitor >= GetMonitorCount()) {
+            fprintf(stderr, "ERROR: There is no monitor %d, ignoring area %d\n", area_monitor, i + 1);
+            continue;
+        }
+
+        extra.area[0] += (int)GetMonitorPosition(area_monitor).x;
+        extra.area[1] += (int)GetMonitorPosition(area_monitor).y;
+        extra.monitor = area_monitor;
+        extra.stream = -1;
+        extra_areas[n_valid_areas++] = extra;
+    }
+
+    n_extra_areas = n_valid_areas;
+
     SetWindowPosition((int)monitorPositionX, 0);
     SetWindowSize((int)screenWidth, (int)screenHeight);
     SetTargetFPS(60);
@@ -598,24 +479,246 @@ int main(int argc, char *argv[])
     Color activeScaleMarkColor = GRAY;
 
     double startTime = 0.0;
+    double pauseTime = 0.0;
     int elapsedSeconds = 0;
 
+    ControlServer *control = control_server_start(CONTROL_SOCKET_PATH);
+
+    // Commands, Mutter's replies and the replay signal end the wait of an overlay with nothing to
+    // redraw, as input does
+    EventWaiter *waiter = event_waiter_start(false);
+
+    if (waiter) {
+        if (control) event_waiter_watch(waiter, control_server_get_fd(control));
+        event_waiter_watch(waiter, screen_cast_get_fd(&state));
+        if (replay_wake_fd >= 0) event_waiter_watch(waiter, replay_wake_fd);
+    }
+
+    // Built and taken to READY while the area is selected, then reused for every recording
+    data.recording->output_encoding = ui_settings.output_encoding;
+    data.recording->use_spool = ui_settings.spool && ui_settings.replay_seconds == 0;
+    data.recording->use_damage = ui_settings.damage;
+    data.recording->use_vfr = ui_settings.vfr;
+    data.recording->dpi_scale = GetWindowScaleDPI().x;
+    data.recording->target_fps = ui_settings.target_fps;
+    data.recording->gif_max_frames = ui_settings.gif_max_frames;
+    data.recording->segment_seconds = ui_settings.segment_seconds;
+    data.recording->concat_segments = ui_settings.concat_segments;
+    data.recording->audio_codec = ui_settings.audio_codec;
+    data.recording->audio_buffer_ms = ui_settings.audio_buffer_ms;
+    data.recording->drift_threshold_ms = ui_settings.drift_threshold_ms;
+    snprintf(data.recording->stats_location, sizeof(data.recording->stats_location), "/tmp/recording-indicator/pipeline_stats.txt");
+    snprintf(data.recording->tuning_location, sizeof(data.recording->tuning_location), "/tmp/recording-indicator/encoder_tuning.log");
+
+    const char *video_source = ui_settings.stock_source ? PIPEWIRE_SOURCE : CAPTURE_SOURCE;
+
+    prewarm_pipeline(data.recording, video_source, PULSE_AUDIO_SOURCE,
+        (GstClockTime)ui_settings.replay_seconds * GST_SECOND,
+        (size_t)ui_settings.replay_memory_mb * 1024 * 1024);
+
+    // Extra areas are recorded the same way, only to files of their own
+    for (int i = 0; i < n_extra_areas; i++) {
+        Recording *recording = calloc(1, sizeof(Recording));
+
+        if (recording == NULL) {
+            fprintf(stderr, "ERROR: Unable to allocate the recording of area %d, continuing without it\n", i + 1);
+            n_extra_areas = i;
+            break;
+        }
+
+        extra_areas[i].data.recording = recording;
+        recording->output_encoding = data.recording->output_encoding;
+        recording->use_spool = data.recording->use_spool;
+        recording->use_damage = data.recording->use_damage;
+        recording->use_vfr = data.recording->use_vfr;
+        recording->output_scale = data.recording->output_scale;
+        recording->fit_width = data.recording->fit_width;
+        recording->dpi_scale = data.recording->dpi_scale;
+        recording->target_fps = data.recording->target_fps;
+        recording->gif_max_frames = data.recording->gif_max_frames;
+        recording->segment_seconds = data.recording->segment_seconds;
+        recording->concat_segments = data.recording->concat_segments;
+        recording->audio_codec = data.recording->audio_codec;
+        recording->audio_buffer_ms = data.recording->audio_buffer_ms;
+        recording->drift_threshold_ms = data.recording->drift_threshold_ms;
+        snprintf(recording->stats_location, sizeof(recording->stats_location), "/tmp/recording-indicator/pipeline_stats_area%d.txt", i + 1);
+        snprintf(recording->tuning_location, sizeof(recording->tuning_location), "/tmp/recording-indicator/encoder_tuning_area%d.log", i + 1);
+
+        printf("INFO: Also recording %dx%d at %d,%d on monitor %d\n",
+            extra_areas[i].area[2], extra_areas[i].area[3], extra_areas[i].area[0], extra_areas[i].area[1], extra_areas[i].monitor);
+
+        prewarm_pipeline(recording, video_source, PULSE_AUDIO_SOURCE, 0, 0);
+    }
+
+    bool is_watching_bus = false;
+
+    // Index of the selected area's stream in `state.streams` while recording
+    int primary_stream = -1;
+
+    // What the overlay showed last while recording, -1 forces a redraw
+    int drawn_seconds = -1;
+    bool drawn_paused = false;
+    bool drawn_waiting = false;
+
     while (!WindowShouldClose())
     {
-        if (ui_settings.is_recording) {
-            elapsedSeconds = (int)(GetTime() - startTime);
+        const enum ControlCommand command = control ? control_server_take(control) : CONTROL_NONE;
 
-            if (check_for_exit_flag()) {
-                printf("INFO: Finishing recording...\n");
-                remove("/tmp/recording-indicator/flag.txt");
+        if (command == CONTROL_QUIT) {
+            break;
+        }
+
+        // The flag stays set until a recording takes it, the eventfd only ends the wait
+        if (replay_requested && replay_wake_fd >= 0) {
+            eventfd_t value;
+            eventfd_read(replay_wake_fd, &value);
+        }
+
+        if (command == CONTROL_STOP && ui_settings.is_recording) {
+            char overlay[64];
+            overlay_meter_describe(&overlay_meter, overlay, sizeof(overlay));
+            printf("INFO: Finishing recording, %s...\n", overlay);
+
+            // A pipeline that never started has nothing to drain, otherwise the encoder works
+            // through its backlog in the background, see claim_pipeline() for the next recording
+            if (ui_settings.is_waiting_for_stream) {
+                reset_pipeline(data.recording);
+            } else {
+                finish_recording_async(data.recording, get_stop_deadline());
+            }
+
+            for (int i = 0; i < n_extra_areas; i++) {
+                if (extra_areas[i].stream >= 0) stop_extra_area(&state, &extra_areas[i]);
+            }
+
+            screen_cast_stop_stream(&state, primary_stream);
+            primary_stream = -1;
+
+            ClearWindowState(FLAG_WINDOW_MOUSE_PASSTHROUGH);
+            ui_settings.is_recording = false;
+            ui_settings.is_paused = false;
+            ui_settings.is_waiting_for_stream = false;
+            elapsedSeconds = 0;
+        }
+
+        if (screen_cast_poll(&state) == SCREEN_CAST_FAILED
+            || (primary_stream >= 0 && state.streams[primary_stream].phase == SCREEN_CAST_FAILED)) {
+            fprintf(stderr, "ERROR: Unable to set up the screen cast\n");
+            break;
+        }
+
+        if (ui_settings.is_waiting_for_stream && state.streams[primary_stream].phase == SCREEN_CAST_STREAMING) {
+            if (!start_stream(&data, &state.streams[primary_stream], &is_watching_bus)) {
                 break;
             }
+
+            ui_settings.is_waiting_for_stream = false;
+        }
+
+        // An extra area that fails is dropped, the others keep recording
+        for (int i = 0; i < n_extra_areas; i++) {
+            ExtraArea *extra = &extra_areas[i];
+
+            if (extra->stream < 0) continue;
+
+            const ScreenCastStream *stream = &state.streams[extra->stream];
+
+            if (stream->phase == SCREEN_CAST_FAILED) {
+                fprintf(stderr, "ERROR: Unable to record area %d, continuing without it\n", i + 1);
+                stop_extra_area(&state, extra);
+            } else if (extra->is_waiting_for_stream && stream->phase == SCREEN_CAST_STREAMING) {
+                if (!start_stream(&extra->data, stream, &extra->is_watching_bus)) {
+                    fprintf(stderr, "ERROR: Unable to start recording area %d, continuing without it\n", i + 1);
+                    stop_extra_area(&state, extra);
+                    continue;
+                }
+
+                extra->is_waiting_for_stream = false;
+
+                if (ui_settings.is_paused) gst_element_set_state(extra->data.recording->pipeline, GST_STATE_PAUSED);
+            }
+        }
+
+        if (ui_settings.is_recording && !ui_settings.is_waiting_for_stream) {
+            if (command == CONTROL_PAUSE && !ui_settings.is_paused) {
+                gst_element_set_state(data.recording->pipeline, GST_STATE_PAUSED);
+
+                for (int i = 0; i < n_extra_areas; i++) {
+                    if (extra_areas[i].stream >= 0 && !extra_areas[i].is_waiting_for_stream) {
+                        gst_element_set_state(extra_areas[i].data.recording->pipeline, GST_STATE_PAUSED);
+                    }
+                }
+
+                ui_settings.is_paused = true;
+                pauseTime = GetTime();
+            } else if (command == CONTROL_RESUME && ui_settings.is_paused) {
+                gst_element_set_state(data.recording->pipeline, GST_STATE_PLAYING);
+
+                for (int i = 0; i < n_extra_areas; i++) {
+                    if (extra_areas[i].stream >= 0 && !extra_areas[i].is_waiting_for_stream) {
+                        gst_element_set_state(extra_areas[i].data.recording->pipeline, GST_STATE_PLAYING);
+                    }
+                }
+
+                ui_settings.is_paused = false;
+                startTime += GetTime() - pauseTime;
+            }
+
+            if (!ui_settings.is_paused) {
+                elapsedSeconds = (int)(GetTime() - startTime);
+            }
+
+            if (replay_requested || command == CONTROL_REPLAY) {
+                replay_requested = 0;
+
+                if (data.recording->replay) {
+                    char location[PATH_MAX];
+                    get_output_location(location, sizeof(location));
+                    replay_buffer_save(data.recording->replay, ui_settings.output_encoding, location);
+                }
+            }
         }
 
+        if (control) publish_status(control, elapsedSeconds);
+
       	if (IsKeyPressed(KEY_D)) {
       	    ui_settings.show_debug_info = !ui_settings.show_debug_info;
         }
 
+        // While recording only the seconds counter changes, so instead of drawing the masks over
+        // the whole screen 60 times a second the loop sleeps until it changes, input or a command
+        // arrives, or Mutter answers
+        if (ui_settings.is_recording && !ui_settings.show_debug_info) {
+            const Vector2 mouse_delta = GetMouseDelta();
+            const bool has_input = command != CONTROL_NONE || GetKeyPressed() != 0 || mouse_delta.x != 0 || mouse_delta.y != 0;
+            const bool has_changed = elapsedSeconds != drawn_seconds
+                || ui_settings.is_paused != drawn_paused
+                || ui_settings.is_waiting_for_stream != drawn_waiting;
+
+            if (!has_input && !has_changed) {
+                // Paused, the counter stands still and only a deadline of the screen cast is left
+                double timeout = ui_settings.is_paused ? -1.0 : 1.0 - fmod(GetTime() - startTime, 1.0);
+                const long long deadline = screen_cast_next_deadline(&state);
+
+                if (deadline >= 0) {
+                    const double until_deadline = fmax(0.0, (double)(deadline - g_get_monotonic_time()) / 1e6) + 0.001;
+                    timeout = timeout < 0 ? until_deadline : fmin(timeout, until_deadline);
+                }
+
+                if (waiter) {
+                    event_waiter_wait(waiter, timeout);
+                } else {
+                    WaitTime(timeout < 0 ? OVERLAY_POLL_SECONDS : fmin(timeout, OVERLAY_POLL_SECONDS));
+                    PollInputEvents();
+                }
+                continue;
+            }
+
+            drawn_seconds = elapsedSeconds;
+            drawn_paused = ui_settings.is_paused;
+            drawn_waiting = ui_settings.is_waiting_for_stream;
+        }
+
         mousePosition = GetMousePosition();
 
         isInTopLeftCorner = CheckCollisionPointCircle(mousePosition, (Vector2){ rec.x, rec.y }, MOUSE_SCALE_MARK_SIZE);
@@ -713,6 +816,21 @@ int main(int argc, char *argv[])
             DrawText(TextFormat("Rectangle Height: %03f", rec.height), (int)screenWidth - 970, 400, 60, WHITE);
             DrawText(TextFormat("Mouse position x: %03f", mousePosition.x), (int)screenWidth - 970, 500, 60, WHITE);
             DrawText(TextFormat("Mouse position y: %03f", mousePosition.y), (int)screenWidth - 970, 600, 60, WHITE);
+
+            if (data.recording->stats) {
+                char line[256];
+                pipeline_stats_poll(data.recording->stats);
+
+                for (int i = 0; i < pipeline_stats_count(data.recording->stats); i++) {
+                    pipeline_stats_describe(data.recording->stats, i, line, sizeof(line));
+                    DrawText(line, 40, 100 + i * 40, 30, WHITE);
+                }
+
+                if (data.recording->drift) {
+                    av_drift_describe(data.recording->drift, line, sizeof(line));
+                    DrawText(line, 40, 100 + pipeline_stats_count(data.recording->stats) * 40, 30, WHITE);
+                }
+            }
         } else {
             DrawRectangle(0, 0, (int)screenWidth, (int)rec.y, backgroundColor);
             DrawRectangle(0, (int)rec.y + (int)rec.height, (int)screenWidth, (int)screenHeight - (int)(rec.y + rec.height), backgroundColor);
@@ -722,7 +840,11 @@ int main(int argc, char *argv[])
 
         if (ui_settings.is_recording) {
             DrawRectangle((int)(screenWidth / 2) - 50, 0, 100, 50, RED);
-            DrawText(TextFormat("%d", elapsedSeconds),(int)screenWidth / 2, 0,40,WHITE);
+            if (ui_settings.replay_seconds > 0) {
+                DrawText("REPLAY", (int)(screenWidth / 2) - 45, 5, 30, WHITE);
+            } else {
+                DrawText(TextFormat("%d", elapsedSeconds),(int)screenWidth / 2, 0,40,WHITE);
+            }
         }
 
         DrawRectangleRec(rec, BLANK);
@@ -754,7 +876,18 @@ int main(int argc, char *argv[])
                 DrawCircleLines((int)(screenWidth / 2), (int)screenHeight - 145, 45, BLACK);
             }
 
-            if (ui_settings.is_recording == false && IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && CheckCollisionPointCircle(mousePosition, (Vector2){ screenWidth / 2.f, (float)screenHeight - 145 }, 45)) {
+            const bool record_clicked = IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && CheckCollisionPointCircle(mousePosition, (Vector2){ screenWidth / 2.f, (float)screenHeight - 145 }, 45);
+
+            if (ui_settings.is_recording == false && (record_clicked || command == CONTROL_START)) {
+                const Recording *previous = data.recording;
+
+                if (!claim_pipeline(&data.recording)) {
+                    break;
+                }
+
+                // The last recording is still draining, a new pipeline has a bus of its own
+                if (data.recording != previous) is_watching_bus = false;
+
                 SetWindowState(FLAG_WINDOW_MOUSE_PASSTHROUGH);
 
                 startTime = GetTime();
@@ -765,67 +898,101 @@ int main(int argc, char *argv[])
                 y += GNOME_TOP_BAR;
 #endif
 
-                create_stream_cast_record_area_stream(
-                    &state.conn, &state.session_path, &state.stream_path,
-                    (int)roundf(rec.x+monitorPositionX), y,
-                    (int)rec.width, (int)rec.height
-                );
+                primary_stream = screen_cast_record_area(&state, (int)roundf(rec.x+monitorPositionX), y, (int)rec.width, (int)rec.height);
 
-                start_screen_cast_record_area_stream(&state.conn, &state.stream_path);
-
-                while (state.pipewire_node_id == 0) {
-                    dbus_connection_read_write_dispatch(state.conn, -1);
+                if (primary_stream < 0) {
+                    break;
                 }
 
-                data.pipeline = create_pipeline(state.pipewire_node_id);
-                if (data.pipeline == NULL) {
-                    break;
+                data.recording->request_time = g_get_monotonic_time();
+                get_output_location(data.recording->location, sizeof(data.recording->location));
+
+                // The cores are split between the areas by how many pixels each of them has
+                long long total_pixels = (long long)rec.width * (long long)rec.height;
+
+                for (int i = 0; i < n_extra_areas; i++) {
+                    total_pixels += (long long)extra_areas[i].area[2] * extra_areas[i].area[3];
                 }
 
-                GstBus *bus = gst_element_get_bus(data.pipeline);
+                configure_threads_share(data.recording, ui_settings.thread_mode, (int)rec.width, (int)rec.height, 0, total_pixels);
+
+                long long pixels_before = (long long)rec.width * (long long)rec.height;
+
+                for (int i = 0; i < n_extra_areas; i++) {
+                    ExtraArea *extra = &extra_areas[i];
+                    const Recording *previous = extra->data.recording;
+
+                    if (!claim_pipeline(&extra->data.recording)) {
+                        fprintf(stderr, "ERROR: Unable to build the pipeline of area %d\n", i + 1);
+                        continue;
+                    }
 
-                /* Start playing */
-                GstStateChangeReturn ret = gst_element_set_state(data.pipeline, GST_STATE_PLAYING);
-                if (ret == GST_STATE_CHANGE_FAILURE) {
-                    fprintf(stderr, "ERROR: Unable to set the pipeline to the playing state.\n");
-                    return 1;
+                    Recording *recording = extra->data.recording;
+                    if (recording != previous) extra->is_watching_bus = false;
+
+                    extra->stream = screen_cast_record_area(&state, extra->area[0], extra->area[1], extra->area[2], extra->area[3]);
+
+                    if (extra->stream < 0) continue;
+
+                    recording->request_time = g_get_monotonic_time();
+                    get_area_location(recording->location, sizeof(recording->location), data.recording->location, i);
+
+                    configure_threads_share(recording, ui_settings.thread_mode, extra->area[2], extra->area[3], pixels_before, total_pixels);
+                    pixels_before += (long long)extra->area[2] * extra->area[3];
+
+                    extra->is_waiting_for_stream = true;
                 }
 
+                // Streaming threads started from here inherit this, the busy ones are moved off again
+                thread_plan_pin(&data.recording->threads.ui_cpus);
+
                 ui_settings.is_recording = true;
-                gst_bus_add_signal_watch(bus);
-                g_signal_connect(bus, "message", G_CALLBACK(cb_message), &data);
+                ui_settings.is_waiting_for_stream = true;
+                drawn_seconds = -1;
+                overlay_meter_start(&overlay_meter);
             }
         }
 
         EndDrawing();
+
+        if (ui_settings.is_recording) overlay_meter_frame(&overlay_meter);
     }
 
-    if(data.pipeline) {
-        GstBus *bus = gst_element_get_bus(data.pipeline);
-        GstEvent *eos = gst_event_new_eos();
-        gst_element_send_event(data.pipeline, eos);
-        gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS);
-        gst_element_set_state(data.pipeline, GST_STATE_NULL);
-        gst_object_unref(data.pipeline);
-        gst_event_unref(eos);
+    event_waiter_stop(waiter);
+    control_server_stop(control);
+
+    // The window goes away at once, before waiting for anything, the outputs are completed behind it
+    CloseWindow();
+
+    wait_for_pipeline(data.recording);
+
+    // A pipeline that never started has nothing to drain
+    if (ui_settings.is_recording && !ui_settings.is_waiting_for_stream) {
+        finish_recording_async(data.recording, get_stop_deadline());
     }
 
-    if (state.stream_path) {
-        stop_screen_cast_record_area_stream(&state.conn, &state.stream_path);
+    for (int i = 0; i < n_extra_areas; i++) {
+        ExtraArea *extra = &extra_areas[i];
+
+        wait_for_pipeline(extra->data.recording);
 
-        free(state.stream_path);
+        if (extra->stream >= 0 && !extra->is_waiting_for_stream) {
+            finish_recording_async(extra->data.recording, get_stop_deadline());
+        }
     }
 
-    if (state.session_path) {
-        stop_screen_cast_session(&state.conn, &state.session_path);
+    screen_cast_stop(&state);
+
+    destroy_pipeline(data.recording);
+    free(data.recording);
 
-        free(state.session_path);
+    for (int i = 0; i < n_extra_areas; i++) {
+        destroy_pipeline(extra_areas[i].data.recording);
+        free(extra_areas[i].data.recording);
     }
 
-    if (state.conn) dbus_connection_unref(state.conn);
+    wait_for_detached();
     gst_deinit();
 
-    CloseWindow();
-
     return 0;
 }
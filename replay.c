@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gstreamer-1.0/gst/gst.h>
+#include <gstreamer-1.0/gst/app/gstappsrc.h>
+
+#include "replay.h"
+
+#define REPLAY_SOURCE "appsrc name=replaysrc format=time block=true"
+#define REPLAY_SAVE_TIMEOUT (60 * GST_SECOND)
+
+typedef struct {
+    GstBuffer *buffer;
+    GstClockTime pts;
+    bool keyframe;
+} ReplayPacket;
+
+typedef struct {
+    enum OutputEncoding output_encoding;
+    char location[PATH_MAX];
+
+    GstCaps *caps;
+    GstBuffer **buffers;
+    int n_buffers;
+
+    gint *saving;
+} ReplaySave;
+
+struct ReplayBuffer {
+    GMutex lock;
+    GstClockTime duration;
+    size_t max_bytes;
+
+    GstCaps *caps;
+
+    // Ring of `count` packets starting at `head`
+    ReplayPacket *packets;
+    int capacity;
+    int head;
+    int count;
+    size_t bytes;
+
+    GThread *save_thread;
+    gint saving;
+};
+
+static ReplayPacket *packet_at(const ReplayBuffer *replay, const int index)
+{
+    return &replay->packets[(replay->head + index) % replay->capacity];
+}
+
+static void drop_oldest_packet(ReplayBuffer *replay)
+{
+    ReplayPacket *packet = packet_at(replay, 0);
+
+    replay->bytes -= gst_buffer_get_size(packet->buffer);
+    gst_buffer_unref(packet->buffer);
+
+    replay->head = (replay->head + 1) % replay->capacity;
+    replay->count--;
+}
+
+// Drops packets up to the next keyframe, so the ring always starts on one
+static void drop_oldest_interval(ReplayBuffer *replay)
+{
+    do {
+        drop_oldest_packet(replay);
+    } while (replay->count > 0 && !packet_at(replay, 0)->keyframe);
+}
+
+static void drop_all(ReplayBuffer *replay)
+{
+    while (replay->count > 0) drop_oldest_packet(replay);
+}
+
+static int next_keyframe(const ReplayBuffer *replay, const int from)
+{
+    for (int i = from; i < replay->count; i++) {
+        if (packet_at(replay, i)->keyframe) return i;
+    }
+
+    return -1;
+}
+
+static bool grow(ReplayBuffer *replay)
+{
+    const int capacity = replay->capacity * 2;
+    ReplayPacket *packets = malloc((size_t)capacity * sizeof(ReplayPacket));
+
+    if (packets == NULL) return false;
+
+    for (int i = 0; i < replay->count; i++) packets[i] = *packet_at(replay, i);
+
+    free(replay->packets);
+    replay->packets = packets;
+    replay->capacity = capacity;
+    replay->head = 0;
+
+    return true;
+}
+
+ReplayBuffer *replay_buffer_new(const GstClockTime duration, const size_t max_bytes)
+{
+    ReplayBuffer *replay = calloc(1, sizeof(ReplayBuffer));
+    if (replay == NULL) return nullptr;
+
+    replay->capacity = 1024;
+    replay->packets = malloc((size_t)replay->capacity * sizeof(ReplayPacket));
+
+    if (replay->packets == NULL) {
+        free(replay);
+        return nullptr;
+    }
+
+    replay->duration = duration;
+    replay->max_bytes = max_bytes;
+    g_mutex_init(&replay->lock);
+
+    return replay;
+}
+
+void replay_buffer_push(ReplayBuffer *replay, GstSample *sample)
+{
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    GstCaps *caps = gst_sample_get_caps(sample);
+
+    if (buffer == NULL || !GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer))) return;
+
+    const GstClockTime pts = GST_BUFFER_PTS(buffer);
+    const bool keyframe = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+
+    g_mutex_lock(&replay->lock);
+
+    // Packets from before a renegotiation cannot go into the same file
+    if (caps != NULL && (replay->caps == NULL || !gst_caps_is_equal(caps, replay->caps))) {
+        drop_all(replay);
+        if (replay->caps) gst_caps_unref(replay->caps);
+        replay->caps = gst_caps_ref(caps);
+    }
+
+    // Nothing before the first keyframe can be decoded
+    if (replay->count == 0 && !keyframe) {
+        g_mutex_unlock(&replay->lock);
+        return;
+    }
+
+    if (replay->count == replay->capacity && !grow(replay)) {
+        drop_oldest_interval(replay);
+    }
+
+    *packet_at(replay, replay->count) = (ReplayPacket){ gst_buffer_ref(buffer), pts, keyframe };
+    replay->count++;
+    replay->bytes += gst_buffer_get_size(buffer);
+
+    while (replay->count > 0 && replay->bytes > replay->max_bytes) {
+        drop_oldest_interval(replay);
+    }
+
+    // The second interval alone still reaches back far enough
+    for (int second = next_keyframe(replay, 1); second > 0 && packet_at(replay, second)->pts + replay->duration <= pts; second = next_keyframe(replay, 1)) {
+        drop_oldest_interval(replay);
+    }
+
+    g_mutex_unlock(&replay->lock);
+}
+
+static void free_save(ReplaySave *save)
+{
+    for (int i = 0; i < save->n_buffers; i++) gst_buffer_unref(save->buffers[i]);
+
+    free(save->buffers);
+    if (save->caps) gst_caps_unref(save->caps);
+    free(save);
+}
+
+static bool push_packets(const ReplaySave *save, GstElement *src)
+{
+    const GstClockTime first_pts = GST_BUFFER_PTS(save->buffers[0]);
+
+    gst_app_src_set_caps(GST_APP_SRC(src), save->caps);
+
+    for (int i = 0; i < save->n_buffers; i++) {
+        // The packets are shared with the ring, only the metadata is copied
+        GstBuffer *buffer = gst_buffer_copy(save->buffers[i]);
+        GST_BUFFER_PTS(buffer) -= first_pts;
+        GST_BUFFER_DTS(buffer) = GST_BUFFER_PTS(buffer);
+
+        if (gst_app_src_push_buffer(GST_APP_SRC(src), buffer) != GST_FLOW_OK) return false;
+    }
+
+    return gst_app_src_end_of_stream(GST_APP_SRC(src)) == GST_FLOW_OK;
+}
+
+static gpointer save_thread(gpointer user_data)
+{
+    ReplaySave *save = user_data;
+    Recording recording = { .output_encoding = save->output_encoding };
+    bool ok = false;
+
+    snprintf(recording.location, sizeof(recording.location), "%s", save->location);
+
+    if (create_remux_pipeline(&recording, REPLAY_SOURCE)) {
+        GstElement *src = gst_bin_get_by_name(GST_BIN(recording.pipeline), "replaysrc");
+
+        ok = gst_element_set_state(recording.pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE
+            && push_packets(save, src);
+
+        gst_object_unref(src);
+
+        if (ok) {
+            ok = finish_pipeline(&recording, REPLAY_SAVE_TIMEOUT);
+        } else {
+            destroy_pipeline(&recording);
+        }
+    }
+
+    if (ok) {
+        printf("INFO: Replay of %d frames saved to %s\n", save->n_buffers, save->location);
+    } else {
+        fprintf(stderr, "ERROR: Unable to save replay to %s\n", save->location);
+    }
+
+    g_atomic_int_set(save->saving, 0);
+    free_save(save);
+
+    return nullptr;
+}
+
+bool replay_buffer_save(ReplayBuffer *replay, const enum OutputEncoding output_encoding, const char *location)
+{
+    if (g_atomic_int_get(&replay->saving)) {
+        fprintf(stderr, "ERROR: A replay is still being saved\n");
+        return false;
+    }
+
+    if (replay->save_thread) {
+        g_thread_join(replay->save_thread);
+        replay->save_thread = nullptr;
+    }
+
+    ReplaySave *save = calloc(1, sizeof(ReplaySave));
+    if (save == NULL) return false;
+
+    save->output_encoding = output_encoding;
+    save->saving = &replay->saving;
+    snprintf(save->location, sizeof(save->location), "%s", location);
+
+    g_mutex_lock(&replay->lock);
+
+    // Latest keyframe that is at least `duration` old, or the oldest one if the ring is shorter
+    int start = 0;
+
+    if (replay->count > 0) {
+        const GstClockTime newest = packet_at(replay, replay->count - 1)->pts;
+
+        for (int i = next_keyframe(replay, 1); i > 0 && packet_at(replay, i)->pts + replay->duration <= newest; i = next_keyframe(replay, i + 1)) {
+            start = i;
+        }
+    }
+
+    save->n_buffers = replay->count - start;
+    save->buffers = save->n_buffers > 0 ? malloc((size_t)save->n_buffers * sizeof(GstBuffer *)) : nullptr;
+
+    for (int i = 0; save->buffers && i < save->n_buffers; i++) {
+        save->buffers[i] = gst_buffer_ref(packet_at(replay, start + i)->buffer);
+    }
+
+    save->caps = replay->caps ? gst_caps_ref(replay->caps) : nullptr;
+
+    g_mutex_unlock(&replay->lock);
+
+    if (save->buffers == NULL || save->caps == NULL) {
+        fprintf(stderr, "ERROR: Nothing has been buffered for a replay yet\n");
+        save->n_buffers = 0;
+        free_save(save);
+        return false;
+    }
+
+    g_atomic_int_set(&replay->saving, 1);
+    replay->save_thread = g_thread_new("replay-save", save_thread, save);
+
+    return true;
+}
+
+void replay_buffer_reset(ReplayBuffer *replay)
+{
+    // A running save holds its own references
+    g_mutex_lock(&replay->lock);
+    drop_all(replay);
+    g_mutex_unlock(&replay->lock);
+}
+
+void replay_buffer_free(ReplayBuffer *replay)
+{
+    if (replay == NULL) return;
+
+    if (replay->save_thread) g_thread_join(replay->save_thread);
+
+    drop_all(replay);
+
+    if (replay->caps) gst_caps_unref(replay->caps);
+    g_mutex_clear(&replay->lock);
+    free(replay->packets);
+    free(replay);
+}
@@ -0,0 +1,28 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stddef.h>
+#include <gstreamer-1.0/gst/gst.h>
+
+#include "pipeline.h"
+
+// Keeps encoded VP8 packets in memory, starting on a keyframe. Whole keyframe intervals are
+// dropped from the front once the rest still covers `duration`, or whenever the packets take more
+// than `max_bytes`, so memory stays bounded however long the stream runs.
+ReplayBuffer *replay_buffer_new(GstClockTime duration, size_t max_bytes);
+
+// Called from the streaming thread for every encoded packet
+void replay_buffer_push(ReplayBuffer *replay, GstSample *sample);
+
+// Writes the last `duration` of packets to `location` from a background thread. WebM outputs are
+// only remuxed, GIF decodes the packets into the GIF encoder. Returns false when nothing is
+// buffered yet or the previous save is still running.
+bool replay_buffer_save(ReplayBuffer *replay, enum OutputEncoding output_encoding, const char *location);
+
+// Drops every packet, for a new stream with the same caps
+void replay_buffer_reset(ReplayBuffer *replay);
+
+// Waits for a running save before freeing the packets
+void replay_buffer_free(ReplayBuffer *replay);
+
+#endif
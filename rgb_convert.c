@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <gstreamer-1.0/gst/gst.h>
+#include <gstreamer-1.0/gst/video/video.h>
+#include <gstreamer-1.0/gst/video/gstvideofilter.h>
+
+#include "rgb_convert.h"
+#include "rgb_kernels.h"
+#include "thread_pool.h"
+
+#define RGB_CAPS GST_VIDEO_CAPS_MAKE("{ BGRx, BGRA, RGBx, RGBA }")
+#define I420_CAPS GST_VIDEO_CAPS_MAKE("I420")
+#define SINK_CAPS GST_VIDEO_CAPS_MAKE("{ BGRx, BGRA, RGBx, RGBA, I420 }")
+#define SRC_CAPS I420_CAPS
+
+// More stripes than threads, so a thread that got a cheap stripe picks up another one
+#define STRIPES_PER_THREAD 4
+
+enum {
+    PROP_0,
+    PROP_N_THREADS,
+    PROP_KERNEL,
+};
+
+typedef struct {
+    GstVideoFilter parent;
+
+    int n_threads;
+    char *kernel_name;
+
+    ThreadPool *pool;
+    const RgbKernel *kernel;
+    bool rgb_order;
+    int n_stripes;
+
+    // Luma of the row after the last one of an odd height
+    uint8_t *spare_row;
+
+    // Only set while a frame is being converted
+    const GstVideoFrame *input;
+    GstVideoFrame *output;
+} RgbConvert;
+
+typedef struct {
+    GstVideoFilterClass parent_class;
+} RgbConvertClass;
+
+G_DEFINE_TYPE(RgbConvert, rgb_convert, GST_TYPE_VIDEO_FILTER)
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE("sink", GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS(SINK_CAPS));
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE("src", GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS(SRC_CAPS));
+
+// Converts the row pairs of stripe `stripe`, writing straight into the output frame
+static void convert_task(void *context, const int stripe, const int worker_index)
+{
+    RgbConvert *self = context;
+    const GstVideoFrame *input = self->input;
+    GstVideoFrame *output = self->output;
+
+    const int width = GST_VIDEO_FRAME_WIDTH(input);
+    const int height = GST_VIDEO_FRAME_HEIGHT(input);
+    const int pairs = (height + 1) / 2;
+    const int first = (int)((int64_t)pairs * stripe / self->n_stripes);
+    const int last = (int)((int64_t)pairs * (stripe + 1) / self->n_stripes);
+
+    const uint8_t *pixels = GST_VIDEO_FRAME_PLANE_DATA(input, 0);
+    const int stride = GST_VIDEO_FRAME_PLANE_STRIDE(input, 0);
+    uint8_t *planes[3];
+    int strides[3];
+
+    for (int plane = 0; plane < 3; plane++) {
+        planes[plane] = GST_VIDEO_FRAME_PLANE_DATA(output, plane);
+        strides[plane] = GST_VIDEO_FRAME_PLANE_STRIDE(output, plane);
+    }
+
+    for (int pair = first; pair < last; pair++) {
+        const int y = pair * 2;
+        const bool has_second_row = y + 1 < height;
+        const uint8_t *row0 = pixels + (size_t)y * stride;
+        uint8_t *luma0 = planes[0] + (size_t)y * strides[0];
+
+        self->kernel->to_i420(row0, has_second_row ? row0 + stride : row0, width, self->rgb_order,
+            luma0, has_second_row ? luma0 + strides[0] : self->spare_row,
+            planes[1] + (size_t)pair * strides[1], planes[2] + (size_t)pair * strides[2]);
+    }
+}
+
+static GstFlowReturn rgb_convert_transform_frame(GstVideoFilter *filter, GstVideoFrame *input, GstVideoFrame *output)
+{
+    RgbConvert *self = (RgbConvert *)filter;
+
+    self->input = input;
+    self->output = output;
+    thread_pool_run(self->pool, self->n_stripes, convert_task, self);
+    self->input = nullptr;
+    self->output = nullptr;
+
+    return GST_FLOW_OK;
+}
+
+static gboolean rgb_convert_set_info(GstVideoFilter *filter, GstCaps *incaps, GstVideoInfo *in_info, GstCaps *outcaps, GstVideoInfo *out_info)
+{
+    RgbConvert *self = (RgbConvert *)filter;
+    const GstVideoFormat format = GST_VIDEO_INFO_FORMAT(in_info);
+    const int width = GST_VIDEO_INFO_WIDTH(in_info);
+    const int height = GST_VIDEO_INFO_HEIGHT(in_info);
+
+    // Already converted by damageconvert
+    if (format == GST_VIDEO_FORMAT_I420) {
+        gst_base_transform_set_passthrough(GST_BASE_TRANSFORM(filter), TRUE);
+        return TRUE;
+    }
+
+    gst_base_transform_set_passthrough(GST_BASE_TRANSFORM(filter), FALSE);
+
+    self->kernel = rgb_kernel_get(self->kernel_name);
+
+    if (self->kernel == NULL) {
+        fprintf(stderr, "ERROR: rgbconvert: Kernel %s is not available on this machine\n", self->kernel_name);
+        return FALSE;
+    }
+
+    self->rgb_order = format == GST_VIDEO_FORMAT_RGBx || format == GST_VIDEO_FORMAT_RGBA;
+    self->n_stripes = (height + 1) / 2 < self->n_threads * STRIPES_PER_THREAD ? (height + 1) / 2 : self->n_threads * STRIPES_PER_THREAD;
+
+    free(self->spare_row);
+    self->spare_row = malloc((size_t)width);
+
+    if (self->spare_row == NULL) return FALSE;
+
+    if (self->pool == NULL || thread_pool_size(self->pool) != self->n_threads) {
+        if (self->pool) thread_pool_free(self->pool);
+        self->pool = thread_pool_new(self->n_threads);
+    }
+
+    printf("INFO: rgbconvert: %dx%d %s to I420 with the %s kernel on %d threads\n",
+        width, height, gst_video_format_to_string(format), self->kernel->name, self->n_threads);
+
+    return self->pool != NULL;
+}
+
+// Size and frame rate carry over; I420 passes through as it is, RGB becomes BT.709 I420
+static GstCaps *rgb_convert_transform_caps(GstBaseTransform *trans, const GstPadDirection direction, GstCaps *caps, GstCaps *filter)
+{
+    GstCaps *i420 = gst_caps_from_string(I420_CAPS);
+    GstCaps *result = gst_caps_intersect(caps, i420);
+    GstCaps *stripped = gst_caps_copy(caps);
+
+    for (guint i = 0; i < gst_caps_get_size(stripped); i++) {
+        gst_structure_remove_fields(gst_caps_get_structure(stripped, i), "format", "colorimetry", "chroma-site", nullptr);
+    }
+
+    GstCaps *other = gst_caps_from_string(direction == GST_PAD_SINK ? SRC_CAPS ", colorimetry=(string)bt709" : RGB_CAPS);
+    result = gst_caps_merge(result, gst_caps_intersect(stripped, other));
+
+    gst_caps_unref(i420);
+    gst_caps_unref(stripped);
+    gst_caps_unref(other);
+
+    if (filter) {
+        GstCaps *filtered = gst_caps_intersect_full(filter, result, GST_CAPS_INTERSECT_FIRST);
+        gst_caps_unref(result);
+        result = filtered;
+    }
+
+    return result;
+}
+
+static gboolean rgb_convert_stop(GstBaseTransform *trans)
+{
+    RgbConvert *self = (RgbConvert *)trans;
+
+    free(self->spare_row);
+    self->spare_row = nullptr;
+
+    return TRUE;
+}
+
+static void rgb_convert_set_property(GObject *object, const guint property_id, const GValue *value, GParamSpec *pspec)
+{
+    RgbConvert *self = (RgbConvert *)object;
+
+    switch (property_id) {
+        case PROP_N_THREADS:
+            self->n_threads = g_value_get_int(value);
+            break;
+        case PROP_KERNEL:
+            g_free(self->kernel_name);
+            self->kernel_name = g_value_dup_string(value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
+static void rgb_convert_get_property(GObject *object, const guint property_id, GValue *value, GParamSpec *pspec)
+{
+    const RgbConvert *self = (const RgbConvert *)object;
+
+    switch (property_id) {
+        case PROP_N_THREADS:
+            g_value_set_int(value, self->n_threads);
+            break;
+        case PROP_KERNEL:
+            g_value_set_string(value, self->kernel_name);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+            break;
+    }
+}
+
+static void rgb_convert_finalize(GObject *object)
+{
+    RgbConvert *self = (RgbConvert *)object;
+
+    if (self->pool) thread_pool_free(self->pool);
+    free(self->spare_row);
+    g_free(self->kernel_name);
+
+    G_OBJECT_CLASS(rgb_convert_parent_class)->finalize(object);
+}
+
+static void rgb_convert_class_init(RgbConvertClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+    GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+    GstBaseTransformClass *trans_class = GST_BASE_TRANSFORM_CLASS(klass);
+    GstVideoFilterClass *filter_class = GST_VIDEO_FILTER_CLASS(klass);
+
+    gobject_class->set_property = rgb_convert_set_property;
+    gobject_class->get_property = rgb_convert_get_property;
+    gobject_class->finalize = rgb_convert_finalize;
+
+    g_object_class_install_property(gobject_class, PROP_N_THREADS,
+        g_param_spec_int("n-threads", "Threads", "Threads the stripes of a frame are converted on", 1, 256, 1, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property(gobject_class, PROP_KERNEL,
+        g_param_spec_string("kernel", "Kernel", "Conversion kernel: auto, scalar, sse4.1, avx2 or neon", "auto", G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    gst_element_class_add_static_pad_template(element_class, &sink_template);
+    gst_element_class_add_static_pad_template(element_class, &src_template);
+    gst_element_class_set_static_metadata(element_class, "RGB to I420 converter", "Filter/Converter/Video",
+        "Converts RGB screen captures to I420 with SIMD kernels", "record_area");
+
+    trans_class->transform_caps = rgb_convert_transform_caps;
+    trans_class->stop = rgb_convert_stop;
+
+    filter_class->set_info = rgb_convert_set_info;
+    filter_class->transform_frame = rgb_convert_transform_frame;
+}
+
+static void rgb_convert_init(RgbConvert *self)
+{
+    self->n_threads = 1;
+    self->kernel_name = g_strdup("auto");
+}
+
+bool rgb_convert_register(void)
+{
+    return gst_element_register(nullptr, "rgbconvert", GST_RANK_NONE, rgb_convert_get_type());
+}
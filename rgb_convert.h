@@ -0,0 +1,12 @@
+#ifndef RGB_CONVERT_H
+#define RGB_CONVERT_H
+
+// Registers the `rgbconvert` element for this process. It converts RGB screen captures (BGRx,
+// BGRA, RGBx or RGBA) to BT.709 I420 for the encoders with the SIMD kernels of rgb_kernels.h, in
+// horizontal stripes. I420 from damageconvert goes through untouched.
+//
+// Properties: `n-threads` (default 1) sets the number of stripes converted at once, `kernel`
+// (default "auto") forces one of the kernels, for benchmarks.
+bool rgb_convert_register(void);
+
+#endif
@@ -0,0 +1,308 @@
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_NEON_KERNEL
+#endif
+
+#include "rgb_kernels.h"
+
+// BT.709 limited range, 8 bit fixed point. The chroma offset is added before the shift so it never
+// shifts a negative value. The SIMD kernels use the same integer math, so their output is identical.
+static inline uint8_t luma(const int r, const int g, const int b)
+{
+    return (uint8_t)(((47 * r + 157 * g + 16 * b + 128) >> 8) + 16);
+}
+
+static inline uint8_t chroma_u(const int r, const int g, const int b)
+{
+    return (uint8_t)((-26 * r - 86 * g + 112 * b + (128 << 8) + 128) >> 8);
+}
+
+static inline uint8_t chroma_v(const int r, const int g, const int b)
+{
+    return (uint8_t)((112 * r - 102 * g - 10 * b + (128 << 8) + 128) >> 8);
+}
+
+// Columns [x, width), `x` even. Also the tail of the SIMD kernels.
+static void rows_to_i420_from(const uint8_t *row0, const uint8_t *row1, const int x_start, const int width, const bool rgb_order,
+                              uint8_t *luma0, uint8_t *luma1, uint8_t *u, uint8_t *v)
+{
+    const int r = rgb_order ? 0 : 2;
+    const int b = 2 - r;
+    const uint8_t *rows[2] = { row0, row1 };
+    uint8_t *luma_rows[2] = { luma0, luma1 };
+
+    for (int x = x_start; x < width; x += 2) {
+        const int columns[2] = { x, x + 1 < width ? x + 1 : x };
+        int sum_r = 0;
+        int sum_g = 0;
+        int sum_b = 0;
+
+        for (int row = 0; row < 2; row++) {
+            for (int column = 0; column < 2; column++) {
+                const uint8_t *pixel = rows[row] + columns[column] * 4;
+                sum_r += pixel[r];
+                sum_g += pixel[1];
+                sum_b += pixel[b];
+            }
+
+            luma_rows[row][x] = luma(rows[row][x * 4 + r], rows[row][x * 4 + 1], rows[row][x * 4 + b]);
+            if (x + 1 < width) {
+                luma_rows[row][x + 1] = luma(rows[row][x * 4 + 4 + r], rows[row][x * 4 + 5], rows[row][x * 4 + 4 + b]);
+            }
+        }
+
+        u[x / 2] = chroma_u((sum_r + 2) >> 2, (sum_g + 2) >> 2, (sum_b + 2) >> 2);
+        v[x / 2] = chroma_v((sum_r + 2) >> 2, (sum_g + 2) >> 2, (sum_b + 2) >> 2);
+    }
+}
+
+static void rows_to_i420_scalar(const uint8_t *row0, const uint8_t *row1, const int width, const bool rgb_order,
+                                uint8_t *luma0, uint8_t *luma1, uint8_t *u, uint8_t *v)
+{
+    rows_to_i420_from(row0, row1, 0, width, rgb_order, luma0, luma1, u, v);
+}
+
+#ifdef HAVE_X86_KERNELS
+
+// Pixels are widened to 16 bit B, G, R, x lanes, madd leaves two partial sums per pixel and hadd
+// adds them up. Everything stays in 32 bit integers like the scalar code.
+__attribute__((target("sse4.1")))
+static inline __m128i luma_4_sse41(const __m128i pixels01, const __m128i pixels23, const __m128i coefficients)
+{
+    const __m128i sum = _mm_hadd_epi32(_mm_madd_epi16(pixels01, coefficients), _mm_madd_epi16(pixels23, coefficients));
+
+    return _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(128)), 8), _mm_set1_epi32(16));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i chroma_4_sse41(const __m128i average01, const __m128i average23, const __m128i coefficients)
+{
+    const __m128i sum = _mm_hadd_epi32(_mm_madd_epi16(average01, coefficients), _mm_madd_epi16(average23, coefficients));
+
+    return _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32((128 << 8) + 128)), 8);
+}
+
+__attribute__((target("sse4.1")))
+static void rows_to_i420_sse41(const uint8_t *row0, const uint8_t *row1, const int width, const bool rgb_order,
+                               uint8_t *luma0, uint8_t *luma1, uint8_t *u, uint8_t *v)
+{
+    const __m128i coefficients_y = rgb_order ? _mm_setr_epi16(47, 157, 16, 0, 47, 157, 16, 0) : _mm_setr_epi16(16, 157, 47, 0, 16, 157, 47, 0);
+    const __m128i coefficients_u = rgb_order ? _mm_setr_epi16(-26, -86, 112, 0, -26, -86, 112, 0) : _mm_setr_epi16(112, -86, -26, 0, 112, -86, -26, 0);
+    const __m128i coefficients_v = rgb_order ? _mm_setr_epi16(112, -102, -10, 0, 112, -102, -10, 0) : _mm_setr_epi16(-10, -102, 112, 0, -10, -102, 112, 0);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+        const __m128i a0 = _mm_loadu_si128((const __m128i *)(row0 + x * 4));
+        const __m128i b0 = _mm_loadu_si128((const __m128i *)(row0 + x * 4 + 16));
+        const __m128i a1 = _mm_loadu_si128((const __m128i *)(row1 + x * 4));
+        const __m128i b1 = _mm_loadu_si128((const __m128i *)(row1 + x * 4 + 16));
+
+        // Two pixels per register: 0-1, 2-3, 4-5 and 6-7
+        const __m128i top[4] = { _mm_unpacklo_epi8(a0, zero), _mm_unpackhi_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero), _mm_unpackhi_epi8(b0, zero) };
+        const __m128i bottom[4] = { _mm_unpacklo_epi8(a1, zero), _mm_unpackhi_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero), _mm_unpackhi_epi8(b1, zero) };
+
+        const __m128i y_top = _mm_packs_epi32(luma_4_sse41(top[0], top[1], coefficients_y), luma_4_sse41(top[2], top[3], coefficients_y));
+        const __m128i y_bottom = _mm_packs_epi32(luma_4_sse41(bottom[0], bottom[1], coefficients_y), luma_4_sse41(bottom[2], bottom[3], coefficients_y));
+
+        _mm_storel_epi64((__m128i *)(luma0 + x), _mm_packus_epi16(y_top, y_top));
+        _mm_storel_epi64((__m128i *)(luma1 + x), _mm_packus_epi16(y_bottom, y_bottom));
+
+        // Vertical sums, then the two pixels of each register are added for the 2x2 blocks
+        __m128i sums[4];
+        for (int i = 0; i < 4; i++) sums[i] = _mm_add_epi16(top[i], bottom[i]);
+
+        const __m128i blocks01 = _mm_add_epi16(_mm_unpacklo_epi64(sums[0], sums[1]), _mm_unpackhi_epi64(sums[0], sums[1]));
+        const __m128i blocks23 = _mm_add_epi16(_mm_unpacklo_epi64(sums[2], sums[3]), _mm_unpackhi_epi64(sums[2], sums[3]));
+        const __m128i average01 = _mm_srli_epi16(_mm_add_epi16(blocks01, two), 2);
+        const __m128i average23 = _mm_srli_epi16(_mm_add_epi16(blocks23, two), 2);
+
+        const __m128i u_words = _mm_packs_epi32(chroma_4_sse41(average01, average23, coefficients_u), zero);
+        const __m128i v_words = _mm_packs_epi32(chroma_4_sse41(average01, average23, coefficients_v), zero);
+        const int u_bytes = _mm_cvtsi128_si32(_mm_packus_epi16(u_words, u_words));
+        const int v_bytes = _mm_cvtsi128_si32(_mm_packus_epi16(v_words, v_words));
+
+        memcpy(u + x / 2, &u_bytes, sizeof(u_bytes));
+        memcpy(v + x / 2, &v_bytes, sizeof(v_bytes));
+    }
+
+    rows_to_i420_from(row0, row1, x, width, rgb_order, luma0, luma1, u, v);
+}
+
+// Same as the SSE4.1 kernel on twice the pixels. The in-lane hadd and pack leave the results out of
+// order, permutes put them back.
+__attribute__((target("avx2")))
+static inline __m256i luma_8_avx2(const __m256i low, const __m256i high, const __m256i coefficients)
+{
+    const __m256i sum = _mm256_hadd_epi32(_mm256_madd_epi16(low, coefficients), _mm256_madd_epi16(high, coefficients));
+
+    return _mm256_add_epi32(_mm256_srai_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32(128)), 8), _mm256_set1_epi32(16));
+}
+
+__attribute__((target("avx2")))
+static inline __m128i pack_16_avx2(const __m256i first, const __m256i second)
+{
+    const __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(first, second), 0xD8);
+
+    return _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+}
+
+__attribute__((target("avx2")))
+static inline __m128i chroma_8_avx2(const __m256i blocks_a, const __m256i blocks_b, const __m256i coefficients)
+{
+    const __m256i sum = _mm256_hadd_epi32(_mm256_madd_epi16(blocks_a, coefficients), _mm256_madd_epi16(blocks_b, coefficients));
+    const __m256i shifted = _mm256_srai_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32((128 << 8) + 128)), 8);
+    const __m256i ordered = _mm256_permutevar8x32_epi32(shifted, _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7));
+    const __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(ordered), _mm256_extracti128_si256(ordered, 1));
+
+    return _mm_packus_epi16(words, words);
+}
+
+__attribute__((target("avx2")))
+static void rows_to_i420_avx2(const uint8_t *row0, const uint8_t *row1, const int width, const bool rgb_order,
+                              uint8_t *luma0, uint8_t *luma1, uint8_t *u, uint8_t *v)
+{
+    const __m256i coefficients_y = rgb_order
+        ? _mm256_setr_epi16(47, 157, 16, 0, 47, 157, 16, 0, 47, 157, 16, 0, 47, 157, 16, 0)
+        : _mm256_setr_epi16(16, 157, 47, 0, 16, 157, 47, 0, 16, 157, 47, 0, 16, 157, 47, 0);
+    const __m256i coefficients_u = rgb_order
+        ? _mm256_setr_epi16(-26, -86, 112, 0, -26, -86, 112, 0, -26, -86, 112, 0, -26, -86, 112, 0)
+        : _mm256_setr_epi16(112, -86, -26, 0, 112, -86, -26, 0, 112, -86, -26, 0, 112, -86, -26, 0);
+    const __m256i coefficients_v = rgb_order
+        ? _mm256_setr_epi16(112, -102, -10, 0, 112, -102, -10, 0, 112, -102, -10, 0, 112, -102, -10, 0)
+        : _mm256_setr_epi16(-10, -102, 112, 0, -10, -102, 112, 0, -10, -102, 112, 0, -10, -102, 112, 0);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i two = _mm256_set1_epi16(2);
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        const __m256i a0 = _mm256_loadu_si256((const __m256i *)(row0 + x * 4));
+        const __m256i b0 = _mm256_loadu_si256((const __m256i *)(row0 + x * 4 + 32));
+        const __m256i a1 = _mm256_loadu_si256((const __m256i *)(row1 + x * 4));
+        const __m256i b1 = _mm256_loadu_si256((const __m256i *)(row1 + x * 4 + 32));
+
+        // Pixels 0-1 | 4-5, 2-3 | 6-7, 8-9 | 12-13 and 10-11 | 14-15
+        const __m256i top[4] = { _mm256_unpacklo_epi8(a0, zero), _mm256_unpackhi_epi8(a0, zero), _mm256_unpacklo_epi8(b0, zero), _mm256_unpackhi_epi8(b0, zero) };
+        const __m256i bottom[4] = { _mm256_unpacklo_epi8(a1, zero), _mm256_unpackhi_epi8(a1, zero), _mm256_unpacklo_epi8(b1, zero), _mm256_unpackhi_epi8(b1, zero) };
+
+        _mm_storeu_si128((__m128i *)(luma0 + x), pack_16_avx2(luma_8_avx2(top[0], top[1], coefficients_y), luma_8_avx2(top[2], top[3], coefficients_y)));
+        _mm_storeu_si128((__m128i *)(luma1 + x), pack_16_avx2(luma_8_avx2(bottom[0], bottom[1], coefficients_y), luma_8_avx2(bottom[2], bottom[3], coefficients_y)));
+
+        __m256i sums[4];
+        for (int i = 0; i < 4; i++) sums[i] = _mm256_add_epi16(top[i], bottom[i]);
+
+        // Blocks 0-1 | 2-3 and 4-5 | 6-7
+        const __m256i blocks_a = _mm256_add_epi16(_mm256_unpacklo_epi64(sums[0], sums[1]), _mm256_unpackhi_epi64(sums[0], sums[1]));
+        const __m256i blocks_b = _mm256_add_epi16(_mm256_unpacklo_epi64(sums[2], sums[3]), _mm256_unpackhi_epi64(sums[2], sums[3]));
+        const __m256i average_a = _mm256_srli_epi16(_mm256_add_epi16(blocks_a, two), 2);
+        const __m256i average_b = _mm256_srli_epi16(_mm256_add_epi16(blocks_b, two), 2);
+
+        _mm_storel_epi64((__m128i *)(u + x / 2), chroma_8_avx2(average_a, average_b, coefficients_u));
+        _mm_storel_epi64((__m128i *)(v + x / 2), chroma_8_avx2(average_a, average_b, coefficients_v));
+    }
+
+    rows_to_i420_from(row0, row1, x, width, rgb_order, luma0, luma1, u, v);
+}
+
+#endif
+
+#ifdef HAVE_NEON_KERNEL
+
+// The sums fit in 16 bits, so NEON works on whole channels from vld4 with unsigned multiplies. The
+// chroma offset is added first, which keeps every intermediate value positive.
+static void rows_to_i420_neon(const uint8_t *row0, const uint8_t *row1, const int width, const bool rgb_order,
+                              uint8_t *luma0, uint8_t *luma1, uint8_t *u, uint8_t *v)
+{
+    const int r = rgb_order ? 0 : 2;
+    const int b = 2 - r;
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        const uint8x16x4_t top = vld4q_u8(row0 + x * 4);
+        const uint8x16x4_t bottom = vld4q_u8(row1 + x * 4);
+        const uint8x16x4_t *rows[2] = { &top, &bottom };
+        uint8_t *luma_rows[2] = { luma0, luma1 };
+
+        for (int row = 0; row < 2; row++) {
+            const uint8x16_t red = rows[row]->val[r];
+            const uint8x16_t green = rows[row]->val[1];
+            const uint8x16_t blue = rows[row]->val[b];
+
+            uint16x8_t low = vmull_u8(vget_low_u8(red), vdup_n_u8(47));
+            low = vmlal_u8(low, vget_low_u8(green), vdup_n_u8(157));
+            low = vmlal_u8(low, vget_low_u8(blue), vdup_n_u8(16));
+
+            uint16x8_t high = vmull_u8(vget_high_u8(red), vdup_n_u8(47));
+            high = vmlal_u8(high, vget_high_u8(green), vdup_n_u8(157));
+            high = vmlal_u8(high, vget_high_u8(blue), vdup_n_u8(16));
+
+            const uint8x16_t y = vcombine_u8(vrshrn_n_u16(low, 8), vrshrn_n_u16(high, 8));
+            vst1q_u8(luma_rows[row] + x, vaddq_u8(y, vdupq_n_u8(16)));
+        }
+
+        const uint16x8_t red = vrshrq_n_u16(vaddq_u16(vpaddlq_u8(top.val[r]), vpaddlq_u8(bottom.val[r])), 2);
+        const uint16x8_t green = vrshrq_n_u16(vaddq_u16(vpaddlq_u8(top.val[1]), vpaddlq_u8(bottom.val[1])), 2);
+        const uint16x8_t blue = vrshrq_n_u16(vaddq_u16(vpaddlq_u8(top.val[b]), vpaddlq_u8(bottom.val[b])), 2);
+        const uint16x8_t offset = vdupq_n_u16((128 << 8) + 128);
+
+        uint16x8_t u_sum = vmlaq_n_u16(offset, blue, 112);
+        u_sum = vmlsq_n_u16(u_sum, red, 26);
+        u_sum = vmlsq_n_u16(u_sum, green, 86);
+
+        uint16x8_t v_sum = vmlaq_n_u16(offset, red, 112);
+        v_sum = vmlsq_n_u16(v_sum, green, 102);
+        v_sum = vmlsq_n_u16(v_sum, blue, 10);
+
+        vst1_u8(u + x / 2, vshrn_n_u16(u_sum, 8));
+        vst1_u8(v + x / 2, vshrn_n_u16(v_sum, 8));
+    }
+
+    rows_to_i420_from(row0, row1, x, width, rgb_order, luma0, luma1, u, v);
+}
+
+#endif
+
+static const RgbKernel KERNELS[] = {
+#ifdef HAVE_NEON_KERNEL
+    { "neon", rows_to_i420_neon },
+#endif
+#ifdef HAVE_X86_KERNELS
+    { "avx2", rows_to_i420_avx2 },
+    { "sse4.1", rows_to_i420_sse41 },
+#endif
+    { "scalar", rows_to_i420_scalar },
+};
+
+static bool is_supported(const RgbKernel *kernel)
+{
+#ifdef HAVE_X86_KERNELS
+    if (strcmp(kernel->name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (strcmp(kernel->name, "sse4.1") == 0) return __builtin_cpu_supports("sse4.1");
+#endif
+
+    return true;
+}
+
+const RgbKernel *rgb_kernel_get(const char *name)
+{
+    const bool pick_fastest = name == NULL || strcmp(name, "auto") == 0;
+
+    // Fastest first, down to scalar which runs everywhere
+    for (size_t i = 0; i < sizeof(KERNELS) / sizeof(KERNELS[0]); i++) {
+        if (!pick_fastest && strcmp(KERNELS[i].name, name) != 0) continue;
+
+        if (is_supported(&KERNELS[i])) return &KERNELS[i];
+        if (!pick_fastest) return nullptr;
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,22 @@
+#ifndef RGB_KERNELS_H
+#define RGB_KERNELS_H
+
+#include <stdint.h>
+
+// Converts `width` pixels of two rows of 4 byte RGB, BGRx/BGRA or RGBx/RGBA when `rgb_order` is
+// set, to two rows of luma and one row of chroma averaged over 2x2 blocks. BT.709 limited range.
+// An odd width repeats the last column for chroma, an odd height passes the same row twice.
+typedef void (*RgbToI420Rows)(const uint8_t *row0, const uint8_t *row1, int width, bool rgb_order,
+                              uint8_t *luma0, uint8_t *luma1, uint8_t *u, uint8_t *v);
+
+typedef struct {
+    const char *name;
+    RgbToI420Rows to_i420;
+} RgbKernel;
+
+// The kernel called `name` (scalar, sse4.1, avx2 or neon), or the fastest one this CPU runs for
+// nullptr or "auto". Returns nullptr when the requested one is not available here. Every kernel
+// produces exactly the same output as the scalar one.
+const RgbKernel *rgb_kernel_get(const char *name);
+
+#endif
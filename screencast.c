@@ -0,0 +1,521 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dbus-1.0/dbus/dbus.h>
+#include <gstreamer-1.0/gst/gst.h>
+
+#include "screencast.h"
+
+#define SCREENCAST_SERVICE "org.gnome.Mutter.ScreenCast"
+#define SCREENCAST_OBJECT_PATH "/org/gnome/Mutter/ScreenCast"
+#define SCREENCAST_INTERFACE "org.gnome.Mutter.ScreenCast"
+#define SESSION_INTERFACE "org.gnome.Mutter.ScreenCast.Session"
+#define STREAM_INTERFACE "org.gnome.Mutter.ScreenCast.Stream"
+
+static const char * const PHASE_NAMES[] = {
+    [SCREEN_CAST_CREATING_SESSION] = "CreateSession",
+    [SCREEN_CAST_STARTING_SESSION] = "Session.Start",
+    [SCREEN_CAST_SESSION_READY] = "session ready",
+    [SCREEN_CAST_RECORDING_AREA] = "RecordArea",
+    [SCREEN_CAST_STARTING_STREAM] = "Stream.Start",
+    [SCREEN_CAST_STREAMING] = "streaming",
+    [SCREEN_CAST_FAILED] = "failed",
+};
+
+// Ends the call in flight of the session, or of `stream` when it is set, and marks it failed.
+// A failed stream leaves the session and the other streams alone.
+static void fail(ScreenCastState *state, ScreenCastStream *stream)
+{
+    DBusPendingCall **pending = stream ? &stream->pending : &state->pending;
+
+    if (*pending) {
+        dbus_pending_call_cancel(*pending);
+        dbus_pending_call_unref(*pending);
+        *pending = nullptr;
+    }
+
+    if (stream) {
+        stream->phase = SCREEN_CAST_FAILED;
+    } else {
+        state->phase = SCREEN_CAST_FAILED;
+    }
+}
+
+static bool send_call(ScreenCastState *state, ScreenCastStream *stream, DBusMessage *msg, const enum ScreenCastPhase phase, const DBusPendingCallNotifyFunction notify)
+{
+    DBusPendingCall *pending = nullptr;
+
+    if (!dbus_connection_send_with_reply(state->conn, msg, &pending, SCREEN_CAST_TIMEOUT_MS) || pending == NULL) {
+        fprintf(stderr, "ERROR: Unable to send %s\n", PHASE_NAMES[phase]);
+        dbus_message_unref(msg);
+        fail(state, stream);
+        return false;
+    }
+
+    dbus_message_unref(msg);
+
+    const long long deadline = g_get_monotonic_time() + (long long)SCREEN_CAST_TIMEOUT_MS * 1000;
+
+    if (stream) {
+        dbus_pending_call_set_notify(pending, notify, stream, nullptr);
+        stream->pending = pending;
+        stream->phase = phase;
+        stream->deadline = deadline;
+    } else {
+        dbus_pending_call_set_notify(pending, notify, state, nullptr);
+        state->pending = pending;
+        state->phase = phase;
+        state->deadline = deadline;
+    }
+
+    return true;
+}
+
+// Takes the reply of the call in flight, NULL and SCREEN_CAST_FAILED if Mutter returned an error
+static DBusMessage *take_reply(ScreenCastState *state, ScreenCastStream *stream, DBusPendingCall *pending)
+{
+    DBusMessage *reply = dbus_pending_call_steal_reply(pending);
+    const char *phase_name = PHASE_NAMES[stream ? stream->phase : state->phase];
+
+    dbus_pending_call_unref(pending);
+    if (stream) {
+        stream->pending = nullptr;
+    } else {
+        state->pending = nullptr;
+    }
+
+    if (reply == NULL) {
+        fprintf(stderr, "ERROR: Reply for %s is NULL\n", phase_name);
+        fail(state, stream);
+        return nullptr;
+    }
+
+    DBusError err;
+    dbus_error_init(&err);
+
+    if (dbus_set_error_from_message(&err, reply)) {
+        fprintf(stderr, "ERROR: Error calling %s: %s\n", phase_name, err.message);
+        dbus_error_free(&err);
+        dbus_message_unref(reply);
+        fail(state, stream);
+        return nullptr;
+    }
+
+    return reply;
+}
+
+static char *take_object_path(ScreenCastState *state, ScreenCastStream *stream, DBusPendingCall *pending)
+{
+    DBusMessage *reply = take_reply(state, stream, pending);
+    if (reply == NULL) return nullptr;
+
+    DBusError err;
+    dbus_error_init(&err);
+    char *path_reply;
+    char *path = nullptr;
+
+    if (dbus_message_get_args(reply, &err, DBUS_TYPE_OBJECT_PATH, &path_reply, DBUS_TYPE_INVALID)) {
+        path = strdup(path_reply);
+    } else {
+        fprintf(stderr, "ERROR: Error getting the object path from %s: %s\n", PHASE_NAMES[stream ? stream->phase : state->phase], err.message);
+        dbus_error_free(&err);
+        fail(state, stream);
+    }
+
+    dbus_message_unref(reply);
+
+    return path;
+}
+
+static void cb_stream_started(DBusPendingCall *pending, void *user_data)
+{
+    ScreenCastStream *stream = user_data;
+    DBusMessage *reply = take_reply(stream->session, stream, pending);
+
+    if (reply == NULL) return;
+
+    dbus_message_unref(reply);
+    printf("INFO: Record area stream %s started successfully.\n", stream->stream_path);
+
+    // PipeWireStreamAdded has its own deadline
+    stream->deadline = g_get_monotonic_time() + (long long)SCREEN_CAST_TIMEOUT_MS * 1000;
+}
+
+static void cb_area_recorded(DBusPendingCall *pending, void *user_data)
+{
+    ScreenCastStream *stream = user_data;
+
+    stream->stream_path = take_object_path(stream->session, stream, pending);
+    if (stream->stream_path == NULL) return;
+
+    printf("INFO: Started recording area %dx%d at %d,%d, stream at: %s\n",
+        stream->area[2], stream->area[3], stream->area[0], stream->area[1], stream->stream_path);
+
+    DBusMessage *msg = dbus_message_new_method_call(SCREENCAST_SERVICE, stream->stream_path, STREAM_INTERFACE, "Start");
+    if (msg) send_call(stream->session, stream, msg, SCREEN_CAST_STARTING_STREAM, cb_stream_started);
+}
+
+static void send_record_area(ScreenCastState *state, ScreenCastStream *stream)
+{
+    DBusMessage *msg = dbus_message_new_method_call(
+        SCREENCAST_SERVICE,
+        state->session_path,
+        SESSION_INTERFACE,
+        "RecordArea"
+    );
+
+    if (msg == NULL) {
+        fprintf(stderr, "ERROR: Message Null (RecordArea)\n");
+        fail(state, stream);
+        return;
+    }
+
+    const dbus_uint32_t cursor_mode_value = state->cursor_mode;
+    const char *cursor_mode_key = "cursor-mode";
+
+    DBusMessageIter arg;
+    DBusMessageIter dict_iter;
+    DBusMessageIter entry_iter;
+    DBusMessageIter variant_iter;
+    dbus_message_iter_init_append(msg, &arg);
+    dbus_message_iter_append_basic(&arg, DBUS_TYPE_INT32, &stream->area[0]);
+    dbus_message_iter_append_basic(&arg, DBUS_TYPE_INT32, &stream->area[1]);
+    dbus_message_iter_append_basic(&arg, DBUS_TYPE_INT32, &stream->area[2]);
+    dbus_message_iter_append_basic(&arg, DBUS_TYPE_INT32, &stream->area[3]);
+    // Add the 'properties' argument (dictionary)
+    dbus_message_iter_open_container(&arg, DBUS_TYPE_ARRAY, "{sv}", &dict_iter);
+        dbus_message_iter_open_container(&dict_iter, DBUS_TYPE_DICT_ENTRY, nullptr, &entry_iter);
+            dbus_message_iter_append_basic(&entry_iter, DBUS_TYPE_STRING, &cursor_mode_key);
+            dbus_message_iter_open_container(&entry_iter, DBUS_TYPE_VARIANT, "u", &variant_iter);
+                dbus_message_iter_append_basic(&variant_iter, DBUS_TYPE_UINT32, &cursor_mode_value);
+            dbus_message_iter_close_container(&entry_iter, &variant_iter);
+        dbus_message_iter_close_container(&dict_iter, &entry_iter);
+    dbus_message_iter_close_container(&arg, &dict_iter);
+
+    send_call(state, stream, msg, SCREEN_CAST_RECORDING_AREA, cb_area_recorded);
+}
+
+static void cb_session_started(DBusPendingCall *pending, void *user_data)
+{
+    ScreenCastState *state = user_data;
+    DBusMessage *reply = take_reply(state, nullptr, pending);
+
+    if (reply == NULL) return;
+
+    dbus_message_unref(reply);
+    printf("INFO: Session at [%s] started successfully.\n", state->session_path);
+
+    state->phase = SCREEN_CAST_SESSION_READY;
+
+    // Areas asked for while the session was being set up
+    for (int i = 0; i < SCREEN_CAST_MAX_STREAMS; i++) {
+        ScreenCastStream *stream = &state->streams[i];
+        if (stream->in_use && stream->phase == SCREEN_CAST_SESSION_READY) send_record_area(state, stream);
+    }
+}
+
+static void cb_session_created(DBusPendingCall *pending, void *user_data)
+{
+    ScreenCastState *state = user_data;
+
+    state->session_path = take_object_path(state, nullptr, pending);
+    if (state->session_path == NULL) return;
+
+    printf("INFO: Created session at: %s\n", state->session_path);
+
+    DBusMessage *msg = dbus_message_new_method_call(SCREENCAST_SERVICE, state->session_path, SESSION_INTERFACE, "Start");
+    if (msg) send_call(state, nullptr, msg, SCREEN_CAST_STARTING_SESSION, cb_session_started);
+}
+
+static DBusHandlerResult filter_function(DBusConnection *conn, DBusMessage *msg, void *user_data)
+{
+    ScreenCastState *state = user_data;
+
+    if (!dbus_message_is_signal(msg, STREAM_INTERFACE, "PipeWireStreamAdded")) {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+
+    const char *path = dbus_message_get_path(msg);
+    ScreenCastStream *stream = nullptr;
+
+    for (int i = 0; i < SCREEN_CAST_MAX_STREAMS && path != NULL; i++) {
+        const char *stream_path = state->streams[i].stream_path;
+        if (state->streams[i].in_use && stream_path != NULL && strcmp(path, stream_path) == 0) stream = &state->streams[i];
+    }
+
+    if (stream == NULL) {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+
+    DBusError err;
+    dbus_error_init(&err);
+    unsigned int node_id;
+
+    if (!dbus_message_get_args(msg, &err, DBUS_TYPE_UINT32, &node_id, DBUS_TYPE_INVALID)) {
+        fprintf(stderr, "ERROR: Error getting PipeWireStreamAdded arguments: %s\n", err.message);
+        dbus_error_free(&err);
+
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+
+    stream->pipewire_node_id = node_id;
+    printf("INFO: PipeWire stream %s added with node ID: %u, %.1f ms after the area was requested\n",
+        path, node_id, (double)(g_get_monotonic_time() - stream->area_requested_time) / 1000.0);
+
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+bool screen_cast_connect(ScreenCastState *state)
+{
+    DBusError err;
+    dbus_error_init(&err);
+
+    state->conn = dbus_bus_get(DBUS_BUS_SESSION, &err);
+    if (dbus_error_is_set(&err)) {
+        fprintf(stderr, "ERROR: Connection Error (%s)\n", err.message);
+
+        dbus_error_free(&err);
+        return false;
+    }
+
+    if (state->conn == NULL) {
+        fprintf(stderr, "ERROR: Connection Null\n");
+
+        return false;
+    }
+
+    dbus_bus_add_match(state->conn, "type='signal',interface='" STREAM_INTERFACE "',member='PipeWireStreamAdded'", nullptr);
+    dbus_connection_add_filter(state->conn, filter_function, state, nullptr);
+
+    DBusMessage *msg = dbus_message_new_method_call(
+        SCREENCAST_SERVICE,
+        SCREENCAST_OBJECT_PATH,
+        SCREENCAST_INTERFACE,
+        "CreateSession"
+    );
+
+    if (msg == NULL) {
+        fprintf(stderr, "ERROR: Message Null (CreateSession)\n");
+
+        return false;
+    }
+
+    // Add the 'properties' argument (empty dictionary for now)
+    DBusMessageIter arg;
+    dbus_message_iter_init_append(msg, &arg);
+    DBusMessageIter dict_iter;
+    dbus_message_iter_open_container(&arg, DBUS_TYPE_ARRAY, "{sv}", &dict_iter);
+    dbus_message_iter_close_container(&arg, &dict_iter);
+
+    if (!send_call(state, nullptr, msg, SCREEN_CAST_CREATING_SESSION, cb_session_created)) return false;
+
+    dbus_connection_flush(state->conn);
+
+    return true;
+}
+
+int screen_cast_record_area(ScreenCastState *state, const int x, const int y, const int width, const int height)
+{
+    int index = 0;
+
+    while (index < SCREEN_CAST_MAX_STREAMS && state->streams[index].in_use) index++;
+
+    if (index == SCREEN_CAST_MAX_STREAMS) {
+        fprintf(stderr, "ERROR: Already recording %d areas\n", SCREEN_CAST_MAX_STREAMS);
+        return -1;
+    }
+
+    ScreenCastStream *stream = &state->streams[index];
+
+    *stream = (ScreenCastStream){
+        .session = state,
+        .in_use = true,
+        .phase = SCREEN_CAST_SESSION_READY,
+        .area = { x, y, width, height },
+        .area_requested_time = g_get_monotonic_time(),
+    };
+
+    if (state->phase == SCREEN_CAST_SESSION_READY) {
+        send_record_area(state, stream);
+        dbus_connection_flush(state->conn);
+    }
+
+    return index;
+}
+
+// Whether a reply, a signal or a deadline can change anything
+static bool is_waiting(const ScreenCastState *state)
+{
+    if (state->pending) return true;
+
+    for (int i = 0; i < SCREEN_CAST_MAX_STREAMS; i++) {
+        const ScreenCastStream *stream = &state->streams[i];
+        if (stream->in_use && (stream->pending || stream->phase == SCREEN_CAST_STARTING_STREAM)) return true;
+    }
+
+    return false;
+}
+
+enum ScreenCastPhase screen_cast_poll(ScreenCastState *state)
+{
+    if (state->phase == SCREEN_CAST_FAILED || state->conn == NULL) {
+        return state->phase;
+    }
+
+    // Reads and writes whatever is ready, the pending-call callbacks run from dispatch. Messages
+    // nobody waits for are read too, the render loop sleeps until the socket is readable.
+    dbus_connection_read_write(state->conn, 0);
+    while (dbus_connection_dispatch(state->conn) == DBUS_DISPATCH_DATA_REMAINS) {}
+
+    // Calls sent from the callbacks go out before the loop sleeps on their replies
+    dbus_connection_flush(state->conn);
+
+    if (!is_waiting(state)) return state->phase;
+
+    const long long now = g_get_monotonic_time();
+
+    if (state->pending && now > state->deadline) {
+        fprintf(stderr, "ERROR: Timed out after %d ms waiting for %s\n", SCREEN_CAST_TIMEOUT_MS, PHASE_NAMES[state->phase]);
+        fail(state, nullptr);
+    }
+
+    for (int i = 0; i < SCREEN_CAST_MAX_STREAMS; i++) {
+        ScreenCastStream *stream = &state->streams[i];
+
+        if (!stream->in_use) continue;
+
+        if (stream->phase == SCREEN_CAST_STARTING_STREAM && stream->pending == NULL && stream->pipewire_node_id != 0) {
+            stream->phase = SCREEN_CAST_STREAMING;
+            continue;
+        }
+
+        const bool waiting = stream->pending != NULL || stream->phase == SCREEN_CAST_STARTING_STREAM;
+
+        if (waiting && now > stream->deadline) {
+            fprintf(stderr, "ERROR: Timed out after %d ms waiting for %s of stream %d\n", SCREEN_CAST_TIMEOUT_MS,
+                stream->pending ? PHASE_NAMES[stream->phase] : "PipeWireStreamAdded", i);
+            fail(state, stream);
+        }
+    }
+
+    return state->phase;
+}
+
+int screen_cast_get_fd(const ScreenCastState *state)
+{
+    int fd = -1;
+
+    if (state->conn == NULL || !dbus_connection_get_unix_fd(state->conn, &fd)) return -1;
+
+    return fd;
+}
+
+long long screen_cast_next_deadline(const ScreenCastState *state)
+{
+    long long deadline = -1;
+
+    if (state->phase == SCREEN_CAST_FAILED) return deadline;
+
+    if (state->pending) deadline = state->deadline;
+
+    for (int i = 0; i < SCREEN_CAST_MAX_STREAMS; i++) {
+        const ScreenCastStream *stream = &state->streams[i];
+        const bool waiting = stream->in_use && (stream->pending || stream->phase == SCREEN_CAST_STARTING_STREAM);
+
+        if (waiting && (deadline < 0 || stream->deadline < deadline)) deadline = stream->deadline;
+    }
+
+    return deadline;
+}
+
+static void cb_stopped(DBusPendingCall *pending, void *user_data)
+{
+    const char *what = user_data;
+    DBusMessage *reply = dbus_pending_call_steal_reply(pending);
+
+    if (reply == NULL) return;
+
+    DBusError err;
+    dbus_error_init(&err);
+
+    if (dbus_set_error_from_message(&err, reply)) {
+        fprintf(stderr, "ERROR: Error stopping %s: %s\n", what, err.message);
+        dbus_error_free(&err);
+    } else {
+        printf("INFO: %s stopped successfully.\n", what);
+    }
+
+    dbus_message_unref(reply);
+}
+
+// Nothing waits for the reply, it is reported from screen_cast_poll() whenever it arrives
+static void send_stop(ScreenCastState *state, const char *path, const char *interface, const char *what)
+{
+    DBusPendingCall *pending = nullptr;
+    DBusMessage *msg = dbus_message_new_method_call(SCREENCAST_SERVICE, path, interface, "Stop");
+
+    if (msg == NULL) return;
+
+    if (!dbus_connection_send_with_reply(state->conn, msg, &pending, SCREEN_CAST_TIMEOUT_MS) || pending == NULL) {
+        fprintf(stderr, "ERROR: Unable to send Stop for %s [%s]\n", what, path);
+        dbus_message_unref(msg);
+        return;
+    }
+
+    dbus_message_unref(msg);
+
+    // The connection keeps the call until it completes
+    dbus_pending_call_set_notify(pending, cb_stopped, (void *)what, nullptr);
+    dbus_pending_call_unref(pending);
+
+    dbus_connection_flush(state->conn);
+}
+
+void screen_cast_stop_stream(ScreenCastState *state, const int index)
+{
+    if (index < 0 || index >= SCREEN_CAST_MAX_STREAMS) return;
+
+    ScreenCastStream *stream = &state->streams[index];
+
+    if (stream->pending) {
+        dbus_pending_call_cancel(stream->pending);
+        dbus_pending_call_unref(stream->pending);
+        stream->pending = nullptr;
+    }
+
+    // Before the session is ready there is no stream yet, only the queued area to forget
+    if (stream->stream_path) {
+        send_stop(state, stream->stream_path, STREAM_INTERFACE, "Record area stream");
+
+        free(stream->stream_path);
+    }
+
+    // The session outlives the stream, so the next area skips CreateSession and Start
+    *stream = (ScreenCastStream){ 0 };
+}
+
+void screen_cast_stop(ScreenCastState *state)
+{
+    if (state->pending) {
+        dbus_pending_call_cancel(state->pending);
+        dbus_pending_call_unref(state->pending);
+        state->pending = nullptr;
+    }
+
+    for (int i = 0; i < SCREEN_CAST_MAX_STREAMS; i++) {
+        if (state->streams[i].in_use) screen_cast_stop_stream(state, i);
+    }
+
+    if (state->session_path) {
+        send_stop(state, state->session_path, SESSION_INTERFACE, "Session");
+
+        free(state->session_path);
+        state->session_path = nullptr;
+    }
+
+    if (state->conn) {
+        dbus_connection_remove_filter(state->conn, filter_function, state);
+        dbus_connection_unref(state->conn);
+        state->conn = nullptr;
+    }
+}
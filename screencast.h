@@ -0,0 +1,94 @@
+#ifndef SCREENCAST_H
+#define SCREENCAST_H
+
+#include <dbus-1.0/dbus/dbus.h>
+
+// Mutter calls that take longer than this fail the handshake instead of hanging the UI
+#define SCREEN_CAST_TIMEOUT_MS 5000
+
+// Areas recorded at the same time under one session
+#define SCREEN_CAST_MAX_STREAMS 4
+
+enum ScreenCastPhase {
+    SCREEN_CAST_CREATING_SESSION,
+    SCREEN_CAST_STARTING_SESSION,
+    SCREEN_CAST_SESSION_READY,
+    SCREEN_CAST_RECORDING_AREA,
+    SCREEN_CAST_STARTING_STREAM,
+    SCREEN_CAST_STREAMING,
+    SCREEN_CAST_FAILED,
+};
+
+// How RecordArea streams carry the pointer, the values of its cursor-mode property
+enum ScreenCastCursorMode {
+    SCREEN_CAST_CURSOR_HIDDEN = 0,
+    SCREEN_CAST_CURSOR_EMBEDDED = 1,
+    // As SPA_META_Cursor, which only capturesrc reads
+    SCREEN_CAST_CURSOR_METADATA = 2,
+};
+
+typedef struct ScreenCastState ScreenCastState;
+
+// One RecordArea stream of the session. A stream asked for before the session is ready waits in
+// SCREEN_CAST_SESSION_READY, a failed stream does not take the session or the others down.
+typedef struct {
+    ScreenCastState *session;
+    bool in_use;
+
+    char *stream_path;
+    unsigned int pipewire_node_id;
+
+    enum ScreenCastPhase phase;
+    DBusPendingCall *pending;
+    long long deadline;
+
+    int area[4];
+    long long area_requested_time;
+} ScreenCastStream;
+
+struct ScreenCastState {
+    DBusConnection *conn;
+    char *session_path;
+
+    // Of the session itself, streams can be added once it is SCREEN_CAST_SESSION_READY
+    enum ScreenCastPhase phase;
+    DBusPendingCall *pending;
+    long long deadline;
+
+    // Used by the streams asked for from then on
+    enum ScreenCastCursorMode cursor_mode;
+
+    // PipeWireStreamAdded signals are routed to these by object path
+    ScreenCastStream streams[SCREEN_CAST_MAX_STREAMS];
+};
+
+// Connects to the session bus and starts creating a session without waiting for Mutter.
+// DBUS_SESSION_BUS_ADDRESS is honoured, so a private dbus-daemon can stand in for GNOME.
+bool screen_cast_connect(ScreenCastState *state);
+
+// Asks for a stream of the given area in stage coordinates, so any monitor, sent as soon as the
+// session is ready. Returns the index in `state->streams`, -1 when all of them are in use.
+int screen_cast_record_area(ScreenCastState *state, int x, int y, int width, int height);
+
+// Handles whatever replies and signals have arrived without blocking, and fails the steps whose
+// deadline has passed. Returns the phase of the session; each stream has its own, with
+// `pipewire_node_id` set once it is SCREEN_CAST_STREAMING.
+enum ScreenCastPhase screen_cast_poll(ScreenCastState *state);
+
+// Socket of the session bus, readable when screen_cast_poll() has something to handle, -1 before
+// screen_cast_connect()
+int screen_cast_get_fd(const ScreenCastState *state);
+
+// Monotonic time in microseconds at which screen_cast_poll() fails the earliest step still
+// waiting for Mutter, -1 when nothing is waited for
+long long screen_cast_next_deadline(const ScreenCastState *state);
+
+// Stops only stream `index`, the session stays ready for the next screen_cast_record_area(). Stop
+// is sent without waiting for Mutter, screen_cast_poll() reports the reply.
+void screen_cast_stop_stream(ScreenCastState *state, int index);
+
+// Stops every stream and the session and lets go of the bus once the calls are written, without
+// waiting for the replies
+void screen_cast_stop(ScreenCastState *state);
+
+#endif
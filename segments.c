@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <gstreamer-1.0/gst/gst.h>
+
+#include "segments.h"
+
+struct SegmentSet {
+    char location[PATH_MAX];
+    // `location` without its extension
+    char base[PATH_MAX];
+    enum OutputEncoding output_encoding;
+    bool concatenate;
+
+    // Segments splitmuxsink has opened so far
+    unsigned int n_segments;
+
+    // GIF only, turns finished VP8 segments into GIFs
+    GThreadPool *converters;
+    int encoder_threads;
+    gint failed;
+
+    GThread *thread;
+    bool ok;
+};
+
+// Extension of the files splitmuxsink writes
+static const char *capture_extension(const SegmentSet *segments)
+{
+    return OUTPUT_ENCODING_EXTENSIONS[segments->output_encoding == GIF ? WEBM_ONLY_VIDEO : segments->output_encoding];
+}
+
+static void segment_path(const SegmentSet *segments, const unsigned int index, const char *extension, char *path, const size_t size)
+{
+    snprintf(path, size, "%s_%04u%s", segments->base, index, extension);
+}
+
+static void convert_segment(gpointer data, gpointer user_data)
+{
+    SegmentSet *segments = user_data;
+    const unsigned int index = GPOINTER_TO_UINT(data) - 1;
+    const gint64 start = g_get_monotonic_time();
+
+    char capture[PATH_MAX];
+    char source[PATH_MAX + 64];
+    segment_path(segments, index, capture_extension(segments), capture, sizeof(capture));
+    snprintf(source, sizeof(source), "filesrc location=\"%s\" ! matroskademux", capture);
+
+    Recording recording = { .output_encoding = GIF };
+    recording.threads.encoder_threads = segments->encoder_threads;
+    segment_path(segments, index, ".gif", recording.location, sizeof(recording.location));
+
+    if (create_remux_pipeline(&recording, source) && run_pipeline(&recording)) {
+        unlink(capture);
+        printf("INFO: Segment %s converted in %.1f s\n", recording.location, (double)(g_get_monotonic_time() - start) / 1e6);
+    } else {
+        g_atomic_int_set(&segments->failed, 1);
+        fprintf(stderr, "ERROR: Unable to convert segment %s, it is kept\n", capture);
+    }
+}
+
+SegmentSet *segment_set_new(const char *location, const enum OutputEncoding output_encoding, const bool concatenate)
+{
+    SegmentSet *segments = calloc(1, sizeof(SegmentSet));
+    if (segments == NULL) return nullptr;
+
+    const char *extension = OUTPUT_ENCODING_EXTENSIONS[output_encoding];
+    const size_t length = strlen(location);
+    const size_t extension_length = strlen(extension);
+    const bool has_extension = length > extension_length && strcmp(location + length - extension_length, extension) == 0;
+
+    segments->output_encoding = output_encoding;
+    segments->concatenate = concatenate;
+    snprintf(segments->location, sizeof(segments->location), "%s", location);
+    snprintf(segments->base, sizeof(segments->base), "%.*s", (int)(has_extension ? length - extension_length : length), location);
+
+    if (output_encoding == GIF) {
+        // Half of the cores stay with the capture, the rest is split between the conversions
+        const int n_cores = (int)sysconf(_SC_NPROCESSORS_ONLN) > 0 ? (int)sysconf(_SC_NPROCESSORS_ONLN) : 1;
+        const int n_converters = n_cores / 4 > 1 ? n_cores / 4 : 1;
+        GError *error = nullptr;
+
+        segments->encoder_threads = n_cores / (2 * n_converters) > 1 ? n_cores / (2 * n_converters) : 1;
+        segments->converters = g_thread_pool_new(convert_segment, segments, n_converters, TRUE, &error);
+
+        if (segments->converters == NULL) {
+            fprintf(stderr, "ERROR: Unable to start the segment converters: %s\n", error ? error->message : "unknown error");
+            if (error) g_error_free(error);
+            free(segments);
+            return nullptr;
+        }
+    }
+
+    return segments;
+}
+
+static void segment_complete(SegmentSet *segments, const unsigned int index)
+{
+    if (segments->converters) {
+        g_thread_pool_push(segments->converters, GUINT_TO_POINTER(index + 1), nullptr);
+    }
+}
+
+gchar *segment_set_next_location(SegmentSet *segments, const unsigned int index)
+{
+    char path[PATH_MAX];
+    segment_path(segments, index, capture_extension(segments), path, sizeof(path));
+
+    if (index > 0) segment_complete(segments, index - 1);
+    segments->n_segments = index + 1;
+
+    printf("INFO: Writing segment %s\n", path);
+
+    return g_strdup(path);
+}
+
+static gchar **cb_concat_location(GstElement *splitmux, gpointer user_data)
+{
+    return g_strdupv(user_data);
+}
+
+static bool concat_video(SegmentSet *segments)
+{
+    gchar **files = g_new0(gchar *, segments->n_segments + 1);
+
+    for (unsigned int i = 0; i < segments->n_segments; i++) {
+        char path[PATH_MAX];
+        segment_path(segments, i, capture_extension(segments), path, sizeof(path));
+        files[i] = g_strdup(path);
+    }
+
+    Recording recording = { .output_encoding = segments->output_encoding };
+    snprintf(recording.location, sizeof(recording.location), "%s", segments->location);
+
+    bool ok = create_concat_pipeline(&recording);
+
+    if (ok) {
+        GstElement *src = gst_bin_get_by_name(GST_BIN(recording.pipeline), "src");
+        g_signal_connect(src, "format-location", G_CALLBACK(cb_concat_location), files);
+        gst_object_unref(src);
+
+        ok = run_pipeline(&recording);
+    }
+
+    g_strfreev(files);
+
+    return ok;
+}
+
+// Every segment is a complete GIF of the same size with only local color tables, see
+// gif_encoder_new(), so the images of the later ones are appended to the first as they are
+static bool append_gif(FILE *out, const char *path, const bool is_first)
+{
+    gchar *data;
+    gsize size;
+
+    // A segment without frames has no GIF
+    if (!g_file_get_contents(path, &data, &size, nullptr)) return true;
+
+    const uint8_t *bytes = (const uint8_t *)data;
+    size_t start = 0;
+    size_t end = size > 0 && bytes[size - 1] == 0x3B ? size - 1 : size;
+    bool ok = size >= 13 && memcmp(bytes, "GIF8", 4) == 0;
+
+    if (ok && !is_first) {
+        // Screen descriptor, global color table and the looping extension are already there
+        start = 13 + ((bytes[10] & 0x80) ? 3u << ((bytes[10] & 0x07) + 1) : 0);
+
+        while (start + 2 <= end && bytes[start] == 0x21 && bytes[start + 1] == 0xFF) {
+            size_t pos = start + 2;
+            while (pos < end && bytes[pos] != 0) pos += (size_t)bytes[pos] + 1;
+            start = pos + 1;
+        }
+
+        ok = start <= end;
+    }
+
+    if (ok) {
+        ok = fwrite(bytes + start, 1, end - start, out) == end - start;
+    } else {
+        fprintf(stderr, "ERROR: %s is not a GIF\n", path);
+    }
+
+    g_free(data);
+
+    return ok;
+}
+
+static bool concat_gif(SegmentSet *segments)
+{
+    FILE *out = fopen(segments->location, "wb");
+
+    if (out == NULL) {
+        fprintf(stderr, "ERROR: Unable to create %s\n", segments->location);
+        return false;
+    }
+
+    bool ok = true;
+    bool is_first = true;
+
+    for (unsigned int i = 0; ok && i < segments->n_segments; i++) {
+        char path[PATH_MAX];
+        segment_path(segments, i, ".gif", path, sizeof(path));
+
+        const long before = ftell(out);
+        ok = append_gif(out, path, is_first);
+        if (ftell(out) > before) is_first = false;
+    }
+
+    ok = fputc(0x3B, out) != EOF && ok;
+    ok = fclose(out) == 0 && ok;
+
+    return ok;
+}
+
+static gpointer finish_thread(gpointer user_data)
+{
+    SegmentSet *segments = user_data;
+    const gint64 start = g_get_monotonic_time();
+
+    // Waits for every queued conversion
+    if (segments->converters) {
+        g_thread_pool_free(segments->converters, FALSE, TRUE);
+        segments->converters = nullptr;
+    }
+
+    segments->ok = !g_atomic_int_get(&segments->failed);
+
+    if (!segments->concatenate || segments->n_segments == 0) return nullptr;
+
+    if (!segments->ok) {
+        fprintf(stderr, "ERROR: Not joining the segments of %s, a segment is missing\n", segments->location);
+        return nullptr;
+    }
+
+    segments->ok = segments->output_encoding == GIF ? concat_gif(segments) : concat_video(segments);
+
+    if (!segments->ok) {
+        fprintf(stderr, "ERROR: Unable to join the segments into %s, they are kept\n", segments->location);
+        unlink(segments->location);
+        return nullptr;
+    }
+
+    const char *extension = segments->output_encoding == GIF ? ".gif" : capture_extension(segments);
+
+    for (unsigned int i = 0; i < segments->n_segments; i++) {
+        char path[PATH_MAX];
+        segment_path(segments, i, extension, path, sizeof(path));
+        unlink(path);
+    }
+
+    printf("INFO: Joined %u segments into %s in %.1f s\n", segments->n_segments, segments->location, (double)(g_get_monotonic_time() - start) / 1e6);
+
+    return nullptr;
+}
+
+void segment_set_close(SegmentSet *segments)
+{
+    if (segments->n_segments > 0) segment_complete(segments, segments->n_segments - 1);
+
+    segments->thread = g_thread_new("segments", finish_thread, segments);
+}
+
+bool segment_set_wait(SegmentSet *segments)
+{
+    if (segments == NULL) return true;
+
+    if (segments->thread) {
+        g_thread_join(segments->thread);
+    } else if (segments->converters) {
+        g_thread_pool_free(segments->converters, FALSE, TRUE);
+        segments->ok = !g_atomic_int_get(&segments->failed);
+    }
+
+    const bool ok = segments->ok;
+    free(segments);
+
+    return ok;
+}
@@ -0,0 +1,26 @@
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+
+#include <gstreamer-1.0/gst/gst.h>
+
+#include "pipeline.h"
+
+// Tracks the segments of one recording to `location`, written as `<base>_0000<ext>` and up. A
+// GIF recording is captured as VP8 segments which are turned into GIFs in the background as soon
+// as each one is complete, while capture goes on. With `concatenate` the finished segments are
+// joined into `location` once the recording stops, without re-encoding anything.
+SegmentSet *segment_set_new(const char *location, enum OutputEncoding output_encoding, bool concatenate);
+
+// Location of segment `index`, for the format-location signal of splitmuxsink. Every segment
+// before it is complete by then. The result is freed by the caller with g_free().
+gchar *segment_set_next_location(SegmentSet *segments, unsigned int index);
+
+// The last segment is complete, finishes the conversions and joins the segments from a
+// background thread
+void segment_set_close(SegmentSet *segments);
+
+// Waits for segment_set_close() and frees the set, false if a segment or the joined output
+// could not be written
+bool segment_set_wait(SegmentSet *segments);
+
+#endif
@@ -0,0 +1,401 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gstreamer-1.0/gst/gst.h>
+#include <gstreamer-1.0/gst/app/gstappsrc.h>
+#include <gstreamer-1.0/gst/video/video.h>
+
+#include "spool.h"
+
+#define SPOOL_MAGIC "RASPOOL1"
+#define SPOOL_CAPS_SIZE 2048
+
+// Frames start on page boundaries, the header takes the first page
+#define SPOOL_ALIGNMENT 4096
+#define SPOOL_GROW_BYTES ((size_t)256 * 1024 * 1024)
+
+// Writeback is started every so often so dirty pages do not pile up until the end
+#define SPOOL_FLUSH_BYTES ((size_t)64 * 1024 * 1024)
+
+#define SPOOL_SOURCE "appsrc name=spoolsrc format=time block=true"
+
+typedef struct {
+    char magic[8];
+    uint64_t n_frames;
+    uint64_t index_offset;
+    char caps[SPOOL_CAPS_SIZE];
+} SpoolHeader;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t pts;
+    uint64_t duration;
+    uint64_t size;
+} SpoolFrame;
+
+static_assert(sizeof(SpoolHeader) <= SPOOL_ALIGNMENT, "the header must fit in the first page");
+
+struct SpoolWriter {
+    char path[PATH_MAX];
+    int fd;
+
+    uint8_t *map;
+    size_t mapped;
+    size_t used;
+    size_t flushed;
+
+    GstCaps *caps;
+    GstVideoInfo info;
+
+    SpoolFrame *frames;
+    size_t n_frames;
+    size_t capacity;
+
+    bool failed;
+};
+
+struct SpoolEncoder {
+    char spool_path[PATH_MAX];
+    char location[PATH_MAX];
+    enum OutputEncoding output_encoding;
+
+    GThread *thread;
+    bool ok;
+};
+
+static size_t align_up(const size_t value)
+{
+    return (value + SPOOL_ALIGNMENT - 1) & ~(size_t)(SPOOL_ALIGNMENT - 1);
+}
+
+// Space is allocated up front so a full disk fails here instead of with SIGBUS on a write
+static bool reserve(SpoolWriter *spool, const size_t size)
+{
+    if (size <= spool->mapped) return true;
+
+    size_t mapped = spool->mapped;
+    while (mapped < size) mapped += SPOOL_GROW_BYTES;
+
+    const int error = posix_fallocate(spool->fd, (off_t)spool->mapped, (off_t)(mapped - spool->mapped));
+
+    if (error != 0) {
+        fprintf(stderr, "ERROR: Unable to grow the spool %s: %s\n", spool->path, strerror(error));
+        return false;
+    }
+
+    uint8_t *map = spool->map == NULL
+        ? mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, spool->fd, 0)
+        : mremap(spool->map, spool->mapped, mapped, MREMAP_MAYMOVE);
+
+    if (map == MAP_FAILED) {
+        perror("ERROR: Unable to map the spool");
+        return false;
+    }
+
+    spool->map = map;
+    spool->mapped = mapped;
+
+    return true;
+}
+
+SpoolWriter *spool_writer_new(const char *path)
+{
+    SpoolWriter *spool = calloc(1, sizeof(SpoolWriter));
+    if (spool == NULL) return nullptr;
+
+    snprintf(spool->path, sizeof(spool->path), "%s", path);
+    spool->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+    if (spool->fd < 0) {
+        fprintf(stderr, "ERROR: Unable to create the spool %s: %s\n", path, strerror(errno));
+        free(spool);
+        return nullptr;
+    }
+
+    spool->used = SPOOL_ALIGNMENT;
+    spool->flushed = SPOOL_ALIGNMENT;
+
+    if (!reserve(spool, SPOOL_GROW_BYTES)) {
+        close(spool->fd);
+        unlink(path);
+        free(spool);
+        return nullptr;
+    }
+
+    printf("INFO: Spooling raw frames to %s\n", path);
+
+    return spool;
+}
+
+static bool store_frame(SpoolWriter *spool, GstBuffer *buffer)
+{
+    const size_t offset = align_up(spool->used);
+    const size_t size = GST_VIDEO_INFO_SIZE(&spool->info);
+
+    if (spool->n_frames == spool->capacity) {
+        const size_t capacity = spool->capacity ? spool->capacity * 2 : 4096;
+        SpoolFrame *frames = realloc(spool->frames, capacity * sizeof(SpoolFrame));
+
+        if (frames == NULL) return false;
+
+        spool->frames = frames;
+        spool->capacity = capacity;
+    }
+
+    if (!reserve(spool, offset + size)) return false;
+
+    GstVideoFrame src;
+    GstVideoFrame dest;
+    GstBuffer *target = gst_buffer_new_wrapped_full(0, spool->map + offset, size, 0, size, nullptr, nullptr);
+
+    if (!gst_video_frame_map(&src, &spool->info, buffer, GST_MAP_READ)) {
+        gst_buffer_unref(target);
+        return false;
+    }
+
+    // The only copy on the capture side, also drops any stride padding of the source
+    const bool ok = gst_video_frame_map(&dest, &spool->info, target, GST_MAP_WRITE);
+
+    if (ok) {
+        gst_video_frame_copy(&dest, &src);
+        gst_video_frame_unmap(&dest);
+    }
+
+    gst_video_frame_unmap(&src);
+    gst_buffer_unref(target);
+
+    if (!ok) return false;
+
+    spool->frames[spool->n_frames++] = (SpoolFrame){
+        .offset = offset,
+        .pts = GST_BUFFER_PTS(buffer),
+        .duration = GST_BUFFER_DURATION(buffer),
+        .size = size,
+    };
+    spool->used = offset + size;
+
+    if (spool->used - spool->flushed >= SPOOL_FLUSH_BYTES) {
+        sync_file_range(spool->fd, (off_t)spool->flushed, (off_t)(spool->used - spool->flushed), SYNC_FILE_RANGE_WRITE);
+        spool->flushed = spool->used;
+    }
+
+    return true;
+}
+
+void spool_writer_push(SpoolWriter *spool, GstSample *sample)
+{
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    GstCaps *caps = gst_sample_get_caps(sample);
+
+    if (spool->failed || buffer == NULL || !GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer))) return;
+
+    // Every frame in a spool has the same layout, a renegotiation ends it
+    if (spool->caps == NULL) {
+        if (caps == NULL || !gst_video_info_from_caps(&spool->info, caps)) return;
+        spool->caps = gst_caps_ref(caps);
+    } else if (caps != NULL && !gst_caps_is_equal(caps, spool->caps)) {
+        fprintf(stderr, "ERROR: Capture caps changed, the spool stops at %zu frames\n", spool->n_frames);
+        spool->failed = true;
+        return;
+    }
+
+    if (!store_frame(spool, buffer)) {
+        fprintf(stderr, "ERROR: Unable to spool frame %zu, the spool stops here\n", spool->n_frames);
+        spool->failed = true;
+    }
+}
+
+long spool_writer_close(SpoolWriter *spool)
+{
+    bool ok = spool->n_frames > 0;
+    SpoolHeader header = { .n_frames = spool->n_frames };
+
+    memcpy(header.magic, SPOOL_MAGIC, sizeof(header.magic));
+
+    if (ok) {
+        char *caps = gst_caps_to_string(spool->caps);
+
+        header.index_offset = align_up(spool->used);
+        snprintf(header.caps, sizeof(header.caps), "%s", caps);
+        g_free(caps);
+
+        memcpy(spool->map, &header, sizeof(header));
+    }
+
+    if (spool->map) munmap(spool->map, spool->mapped);
+
+    const size_t index_size = spool->n_frames * sizeof(SpoolFrame);
+
+    if (ok) {
+        ok = pwrite(spool->fd, spool->frames, index_size, (off_t)header.index_offset) == (ssize_t)index_size
+            && ftruncate(spool->fd, (off_t)(header.index_offset + index_size)) == 0;
+
+        if (!ok) fprintf(stderr, "ERROR: Unable to write the spool index: %s\n", strerror(errno));
+    }
+
+    close(spool->fd);
+
+    if (!ok) unlink(spool->path);
+
+    const long n_frames = ok ? (long)spool->n_frames : 0;
+
+    if (ok) {
+        printf("INFO: Spooled %ld frames, %.1f MB\n", n_frames, (double)(header.index_offset + index_size) / (1024.0 * 1024.0));
+    }
+
+    if (spool->caps) gst_caps_unref(spool->caps);
+    free(spool->frames);
+    free(spool);
+
+    return n_frames;
+}
+
+static bool push_frames(GstElement *src, GstCaps *caps, const uint8_t *map, const SpoolFrame *frames, const uint64_t n_frames)
+{
+    gst_app_src_set_caps(GST_APP_SRC(src), caps);
+
+    for (uint64_t i = 0; i < n_frames; i++) {
+        // Wraps the mapped spool, the frame is only read from the page cache
+        GstBuffer *buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, (gpointer)(map + frames[i].offset), frames[i].size, 0, frames[i].size, nullptr, nullptr);
+
+        GST_BUFFER_PTS(buffer) = frames[i].pts - frames[0].pts;
+        GST_BUFFER_DURATION(buffer) = frames[i].duration;
+
+        if (gst_app_src_push_buffer(GST_APP_SRC(src), buffer) != GST_FLOW_OK) return false;
+    }
+
+    return gst_app_src_end_of_stream(GST_APP_SRC(src)) == GST_FLOW_OK;
+}
+
+static bool encode(const SpoolEncoder *encoder, const uint8_t *map, const size_t size)
+{
+    SpoolHeader header;
+    GstVideoInfo info;
+
+    memcpy(&header, map, sizeof(header));
+    header.caps[sizeof(header.caps) - 1] = '\0';
+
+    if (memcmp(header.magic, SPOOL_MAGIC, sizeof(header.magic)) != 0 || header.n_frames == 0
+        || header.index_offset > size || header.n_frames > (size - header.index_offset) / sizeof(SpoolFrame)) {
+        fprintf(stderr, "ERROR: %s is not a complete spool\n", encoder->spool_path);
+        return false;
+    }
+
+    const SpoolFrame *frames = (const SpoolFrame *)(map + header.index_offset);
+
+    for (uint64_t i = 0; i < header.n_frames; i++) {
+        if (frames[i].offset > header.index_offset || frames[i].size > header.index_offset - frames[i].offset) {
+            fprintf(stderr, "ERROR: Frame %" G_GUINT64_FORMAT " of %s is out of bounds\n", (guint64)i, encoder->spool_path);
+            return false;
+        }
+    }
+
+    GstCaps *caps = gst_caps_from_string(header.caps);
+
+    if (caps == NULL || !gst_video_info_from_caps(&info, caps)) {
+        fprintf(stderr, "ERROR: Invalid caps in %s: %s\n", encoder->spool_path, header.caps);
+        if (caps) gst_caps_unref(caps);
+        return false;
+    }
+
+    Recording recording = { .output_encoding = encoder->output_encoding };
+    snprintf(recording.location, sizeof(recording.location), "%s", encoder->location);
+
+    bool ok = false;
+
+    if (create_offline_pipeline(&recording, SPOOL_SOURCE)) {
+        configure_threads(&recording, THREADS_AUTO, GST_VIDEO_INFO_WIDTH(&info), GST_VIDEO_INFO_HEIGHT(&info));
+
+        GstElement *src = gst_bin_get_by_name(GST_BIN(recording.pipeline), "spoolsrc");
+
+        ok = gst_element_set_state(recording.pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE
+            && push_frames(src, caps, map, frames, header.n_frames);
+
+        gst_object_unref(src);
+
+        // Nothing may still point into the mapping once this returns
+        if (ok) {
+            ok = finish_pipeline(&recording, GST_CLOCK_TIME_NONE);
+        } else {
+            destroy_pipeline(&recording);
+        }
+    }
+
+    gst_caps_unref(caps);
+
+    return ok;
+}
+
+static gpointer encoder_thread(gpointer user_data)
+{
+    SpoolEncoder *encoder = user_data;
+    const gint64 start = g_get_monotonic_time();
+    struct stat st;
+
+    const int fd = open(encoder->spool_path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < SPOOL_ALIGNMENT) {
+        fprintf(stderr, "ERROR: Unable to open the spool %s\n", encoder->spool_path);
+        if (fd >= 0) close(fd);
+        return nullptr;
+    }
+
+    const size_t size = (size_t)st.st_size;
+    uint8_t *map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        perror("ERROR: Unable to map the spool");
+        return nullptr;
+    }
+
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    encoder->ok = encode(encoder, map, size);
+    munmap(map, size);
+
+    if (encoder->ok) {
+        unlink(encoder->spool_path);
+        printf("INFO: Spool encoded to %s in %.1f s\n", encoder->location, (double)(g_get_monotonic_time() - start) / 1e6);
+    } else {
+        fprintf(stderr, "ERROR: Unable to encode the spool, it is kept at %s\n", encoder->spool_path);
+    }
+
+    return nullptr;
+}
+
+SpoolEncoder *spool_encoder_start(const char *spool_path, const enum OutputEncoding output_encoding, const char *location)
+{
+    SpoolEncoder *encoder = calloc(1, sizeof(SpoolEncoder));
+    if (encoder == NULL) return nullptr;
+
+    encoder->output_encoding = output_encoding;
+    snprintf(encoder->spool_path, sizeof(encoder->spool_path), "%s", spool_path);
+    snprintf(encoder->location, sizeof(encoder->location), "%s", location);
+
+    printf("INFO: Encoding %s to %s\n", spool_path, location);
+    encoder->thread = g_thread_new("spool-encode", encoder_thread, encoder);
+
+    return encoder;
+}
+
+bool spool_encoder_wait(SpoolEncoder *encoder)
+{
+    if (encoder == NULL) return true;
+
+    g_thread_join(encoder->thread);
+
+    const bool ok = encoder->ok;
+    free(encoder);
+
+    return ok;
+}
@@ -0,0 +1,27 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <gstreamer-1.0/gst/gst.h>
+
+#include "pipeline.h"
+
+// Creates a spool file at `path` for raw frames. The file is memory-mapped and grown in large
+// preallocated steps, so storing a frame is one copy into the page cache.
+SpoolWriter *spool_writer_new(const char *path);
+
+// Called from the streaming thread for every captured frame. Frames are stored tightly packed in
+// the default layout for their caps, whatever strides the source used.
+void spool_writer_push(SpoolWriter *spool, GstSample *sample);
+
+// Appends the frame index, trims the preallocated tail and closes the file. Returns the number of
+// frames in the spool, 0 when nothing usable was written.
+long spool_writer_close(SpoolWriter *spool);
+
+// Encodes the spool at `spool_path` to `location` from a background thread with settings that
+// would not keep up in real time. The spool is deleted once the output is complete.
+SpoolEncoder *spool_encoder_start(const char *spool_path, enum OutputEncoding output_encoding, const char *location);
+
+// Waits for the encoder to finish and frees it, false if the output could not be written
+bool spool_encoder_wait(SpoolEncoder *encoder);
+
+#endif
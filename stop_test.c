@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gstreamer-1.0/gst/gst.h>
+
+#include "stop_test.h"
+#include "pipeline.h"
+#include "gif_decoder.h"
+
+// How long the frames get to pile up in front of the encoder, and the next recording to run
+#define STOP_TEST_TIMEOUT_MS 5000
+#define STOP_TEST_NEXT_RECORDING_MS 500
+
+typedef struct {
+    int width;
+    int height;
+    const char *output_dir;
+} StopTestOptions;
+
+// Keeps the GIF encoder of a pipeline from taking frames until released, so they are still queued
+// when the recording stops
+typedef struct {
+    GMutex lock;
+    GCond changed;
+    bool is_held;
+    // Frames that went into the queue in front of the encoder
+    int queued;
+} EncoderHold;
+
+static void print_usage(void)
+{
+    fprintf(stderr,
+        "Usage: record_area stop-test [options]\n"
+        "  --size=WxH          size of the synthetic frames (default: 640x360)\n"
+        "  --output-dir=DIR    where the recordings go (default: /tmp)\n");
+}
+
+static bool parse_options(const int argc, char *argv[], StopTestOptions *options)
+{
+    for (int i = 0; i < argc; i++) {
+        char *arg = argv[i];
+        char *value = strchr(arg, '=');
+
+        if (value == NULL) {
+            fprintf(stderr, "ERROR: Unknown stop test argument: %s\n", arg);
+            return false;
+        }
+
+        *value++ = '\0';
+
+        if (strcmp(arg, "--size") == 0) {
+            if (sscanf(value, "%dx%d", &options->width, &options->height) != 2 || options->width <= 0 || options->height <= 0) {
+                fprintf(stderr, "ERROR: Invalid size: %s\n", value);
+                return false;
+            }
+        } else if (strcmp(arg, "--output-dir") == 0) {
+            options->output_dir = value;
+        } else {
+            fprintf(stderr, "ERROR: Unknown stop test argument: %s\n", arg);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static GstPadProbeReturn cb_count_queued(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    EncoderHold *hold = user_data;
+
+    g_mutex_lock(&hold->lock);
+    hold->queued++;
+    g_cond_broadcast(&hold->changed);
+    g_mutex_unlock(&hold->lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn cb_hold_encoder(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    EncoderHold *hold = user_data;
+
+    g_mutex_lock(&hold->lock);
+    while (hold->is_held) g_cond_wait(&hold->changed, &hold->lock);
+    g_mutex_unlock(&hold->lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static bool add_probe(GstElement *pipeline, const char *name, const GstPadProbeCallback callback, EncoderHold *hold)
+{
+    GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), name);
+
+    if (element == NULL) {
+        fprintf(stderr, "ERROR: Pipeline has no %s\n", name);
+        return false;
+    }
+
+    GstPad *pad = gst_element_get_static_pad(element, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, callback, hold, nullptr);
+
+    gst_object_unref(pad);
+    gst_object_unref(element);
+
+    return true;
+}
+
+static void release_encoder(EncoderHold *hold)
+{
+    g_mutex_lock(&hold->lock);
+    hold->is_held = false;
+    g_cond_broadcast(&hold->changed);
+    g_mutex_unlock(&hold->lock);
+}
+
+// Waits until the queue is full and one more frame is held at the encoder, the count at that point
+static int wait_for_backlog(EncoderHold *hold, const int frames)
+{
+    const gint64 deadline = g_get_monotonic_time() + (gint64)STOP_TEST_TIMEOUT_MS * 1000;
+
+    g_mutex_lock(&hold->lock);
+    while (hold->queued < frames && g_cond_wait_until(&hold->changed, &hold->lock, deadline)) {}
+    const int queued = hold->queued;
+    g_mutex_unlock(&hold->lock);
+
+    return queued;
+}
+
+// Decodes every image of `path`, false when it is broken or has fewer than `min_images`
+static bool check_output(const char *path, const int width, const int height, const int min_images)
+{
+    int gif_width;
+    int gif_height;
+    GifDecoder *decoder = gif_decoder_open(path, &gif_width, &gif_height);
+
+    if (decoder == NULL) {
+        fprintf(stderr, "ERROR: Unable to open %s\n", path);
+        return false;
+    }
+
+    const uint8_t *pixels;
+    int delay_cs;
+    int images = 0;
+    bool ok;
+
+    while ((ok = gif_decoder_next_frame(decoder, &pixels, &delay_cs)) && pixels != NULL) {
+        images++;
+    }
+
+    gif_decoder_close(decoder);
+
+    if (!ok) {
+        fprintf(stderr, "ERROR: %s is broken after %d images\n", path, images);
+        return false;
+    }
+
+    if (gif_width != width || gif_height != height) {
+        fprintf(stderr, "ERROR: %s is %dx%d, the source was %dx%d\n", path, gif_width, gif_height, width, height);
+        return false;
+    }
+
+    if (images < min_images) {
+        fprintf(stderr, "ERROR: %s has %d images, %d frames were queued\n", path, images, min_images);
+        return false;
+    }
+
+    printf("INFO: %s decodes to %d images\n", path, images);
+
+    return true;
+}
+
+int run_stop_test(const int argc, char *argv[])
+{
+    StopTestOptions options = {
+        .width = 640,
+        .height = 360,
+        .output_dir = "/tmp",
+    };
+
+    if (argc == 1 && strcmp(argv[0], "--help") == 0) {
+        print_usage();
+        return 0;
+    }
+
+    if (!parse_options(argc, argv, &options)) {
+        print_usage();
+        return 1;
+    }
+
+    // Both recordings are checked from their files, claim_pipeline() may free the first one
+    char locations[2][PATH_MAX];
+    snprintf(locations[0], sizeof(locations[0]), "%s/stop-test-1.gif", options.output_dir);
+    snprintf(locations[1], sizeof(locations[1]), "%s/stop-test-2.gif", options.output_dir);
+    remove(locations[0]);
+    remove(locations[1]);
+
+    Recording *recording = calloc(1, sizeof(Recording));
+    if (recording == NULL) return 1;
+
+    recording->output_encoding = GIF;
+    snprintf(recording->location, sizeof(recording->location), "%s", locations[0]);
+
+    // The ball moves on every frame, so none of them is merged into the one before
+    char video_source[256];
+    snprintf(video_source, sizeof(video_source),
+        "videotestsrc is-live=true pattern=ball ! video/x-raw,format=BGRx,width=%d,height=%d,framerate=30/1",
+        options.width, options.height);
+
+    prewarm_pipeline(recording, video_source, "", 0, 0);
+
+    if (!wait_for_pipeline(recording)) {
+        fprintf(stderr, "ERROR: Unable to build the pipeline\n");
+        free(recording);
+        return 1;
+    }
+
+    EncoderHold hold = { .is_held = true };
+    g_mutex_init(&hold.lock);
+    g_cond_init(&hold.changed);
+
+    bool ok = add_probe(recording->pipeline, "gifqueue", cb_count_queued, &hold)
+        && add_probe(recording->pipeline, "gifsink", cb_hold_encoder, &hold)
+        && start_pipeline(recording);
+
+    const int backlog = GIF_DEFAULT_IN_FLIGHT + 1;
+    int queued = ok ? wait_for_backlog(&hold, backlog) : 0;
+
+    if (ok && queued < backlog) {
+        fprintf(stderr, "ERROR: Only %d frames reached the encoder queue in %d ms\n", queued, STOP_TEST_TIMEOUT_MS);
+        ok = false;
+    }
+
+    // Every frame is drained, however long it takes
+    if (ok) finish_recording_async(recording, GST_CLOCK_TIME_NONE);
+
+    const Recording *stopped = recording;
+
+    if (ok && !claim_pipeline(&recording)) {
+        fprintf(stderr, "ERROR: Unable to build the pipeline for the next recording\n");
+        ok = false;
+    }
+
+    // The drain cannot end while the encoder is held, so this has to be a new pipeline
+    if (ok && recording == stopped) {
+        fprintf(stderr, "ERROR: The drain was waited for instead of handed off\n");
+        ok = false;
+    }
+
+    if (ok) {
+        printf("INFO: Stopped with %d frames queued, recording the next one while they are drained\n", queued);
+
+        snprintf(recording->location, sizeof(recording->location), "%s", locations[1]);
+        ok = start_pipeline(recording);
+    }
+
+    // The frames queued at the stop go to the first output from here on
+    release_encoder(&hold);
+
+    if (ok) {
+        g_usleep(STOP_TEST_NEXT_RECORDING_MS * 1000);
+        ok = finish_recording(recording, 5 * GST_SECOND);
+    }
+
+    if (!wait_for_detached()) ok = false;
+    destroy_pipeline(recording);
+    free(recording);
+
+    g_mutex_lock(&hold.lock);
+    queued = hold.queued;
+    g_mutex_unlock(&hold.lock);
+
+    g_cond_clear(&hold.changed);
+    g_mutex_clear(&hold.lock);
+
+    // Everything that went into the queue before the EOS has to be in the first output
+    ok = ok && check_output(locations[0], options.width, options.height, queued) && check_output(locations[1], options.width, options.height, 1);
+
+    if (ok) {
+        printf("INFO: Stop test passed\n");
+    } else {
+        fprintf(stderr, "ERROR: Stop test failed\n");
+    }
+
+    return ok ? 0 : 1;
+}
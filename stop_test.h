@@ -0,0 +1,10 @@
+#ifndef STOP_TEST_H
+#define STOP_TEST_H
+
+// Stops a GIF recording from a synthetic source while frames still wait in front of the encoder,
+// and starts the next recording before they are drained, as a record click during the drain does,
+// see claim_pipeline(). Both outputs have to decode, the first one with every frame that was queued
+// at the stop. `argv` holds the arguments that follow "stop-test" on the command line.
+int run_stop_test(int argc, char *argv[]);
+
+#endif
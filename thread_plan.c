@@ -0,0 +1,295 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <linux/limits.h>
+
+#include "thread_plan.h"
+
+// Roughly what one libvpx realtime thread keeps up with at 30 fps
+#define ENCODER_PIXELS_PER_THREAD (512 * 512)
+#define CONVERT_PIXELS_PER_THREAD (1024 * 1024)
+
+// libvpx does not use more threads than this for VP8
+#define ENCODER_MAX_THREADS 64
+
+#define FIXED_THREADS 32
+
+const char * const THREAD_MODE_NAMES[] = {
+    [THREADS_FIXED] = "fixed",
+    [THREADS_AUTO] = "auto",
+    [THREADS_PINNED] = "pinned",
+};
+
+typedef struct {
+    int cpu;
+    int package;
+    int core;
+} Cpu;
+
+bool parse_thread_mode(const char *name, enum ThreadMode *mode)
+{
+    for (int i = 0; i < THREAD_MODE_COUNT; i++) {
+        if (strcmp(name, THREAD_MODE_NAMES[i]) == 0) {
+            *mode = (enum ThreadMode)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int read_topology(const int cpu, const char *name)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+
+    FILE *f = fopen(path, "r");
+    int value = -1;
+
+    if (f == NULL) return -1;
+
+    if (fscanf(f, "%d", &value) != 1) value = -1;
+    fclose(f);
+
+    return value;
+}
+
+// CPUs worth of time the cgroup v2 quota of this process allows, rounded up, 0 when unlimited.
+// Unlike a cpuset it leaves the affinity alone, so threads past it would only wait their turn.
+static int read_cpu_quota(void)
+{
+    char line[PATH_MAX];
+    char path[PATH_MAX + 32];
+    FILE *f = fopen("/proc/self/cgroup", "r");
+
+    if (f == NULL) return 0;
+
+    // The unified hierarchy is the "0::" entry, the path is relative to the mount
+    path[0] = '\0';
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "0::", 3) != 0) continue;
+
+        line[strcspn(line, "\n")] = '\0';
+        snprintf(path, sizeof(path), "/sys/fs/cgroup%s/cpu.max", line + 3);
+        break;
+    }
+    fclose(f);
+
+    if (path[0] == '\0' || (f = fopen(path, "r")) == NULL) return 0;
+
+    long long quota = 0;
+    long long period = 0;
+
+    // "max 100000" when there is no limit
+    if (fscanf(f, "%lld %lld", &quota, &period) != 2 || quota <= 0 || period <= 0) {
+        quota = 0;
+        period = 1;
+    }
+    fclose(f);
+
+    return (int)((quota + period - 1) / period);
+}
+
+static int compare_cpus(const void *a, const void *b)
+{
+    const Cpu *x = a;
+    const Cpu *y = b;
+
+    if (x->package != y->package) return x->package - y->package;
+    if (x->core != y->core) return x->core - y->core;
+
+    return x->cpu - y->cpu;
+}
+
+// Usable CPUs ordered so that hyperthread siblings are next to each other
+static int get_cpus(Cpu *cpus)
+{
+    cpu_set_t affinity;
+    int n_cpus = 0;
+
+    CPU_ZERO(&affinity);
+
+    if (sched_getaffinity(0, sizeof(affinity), &affinity) != 0) {
+        perror("ERROR: Unable to read the CPU affinity");
+        return 0;
+    }
+
+    for (int cpu = 0; cpu < CPU_SETSIZE && cpu < THREAD_PLAN_MAX_CPUS; cpu++) {
+        if (!CPU_ISSET(cpu, &affinity)) continue;
+
+        // Without topology every CPU counts as its own core
+        const int core = read_topology(cpu, "core_id");
+
+        cpus[n_cpus++] = (Cpu){
+            .cpu = cpu,
+            .package = read_topology(cpu, "physical_package_id"),
+            .core = core < 0 ? cpu : core,
+        };
+    }
+
+    qsort(cpus, (size_t)n_cpus, sizeof(Cpu), compare_cpus);
+
+    return n_cpus;
+}
+
+static bool same_core(const Cpu *a, const Cpu *b)
+{
+    return a->package == b->package && a->core == b->core;
+}
+
+static void add_cpu(CpuSet *set, const int cpu)
+{
+    set->bits[cpu / 64] |= UINT64_C(1) << (cpu % 64);
+    set->count++;
+}
+
+static int clamp(const int value, const int min, const int max)
+{
+    if (value < min) return min;
+    if (value > max) return max;
+
+    return value;
+}
+
+static int threads_for(const long long pixels, const long long pixels_per_thread)
+{
+    return (int)((pixels + pixels_per_thread - 1) / pixels_per_thread);
+}
+
+// Gives the first core to the UI, about a quarter of the rest to the converter and the remaining
+// cores to the encoder. Returns false when there are not enough cores for three sets.
+static bool split_cores(ThreadPlan *plan, const Cpu *cpus, const int n_cpus)
+{
+    int n_cores = 0;
+
+    for (int i = 0; i < n_cpus; i++) {
+        if (i == 0 || !same_core(&cpus[i], &cpus[i - 1])) n_cores++;
+    }
+
+    if (n_cores < 3) return false;
+
+    const int convert_cores = clamp((n_cores - 1) / 4, 1, n_cores - 2);
+    int core = -1;
+
+    for (int i = 0; i < n_cpus; i++) {
+        if (i == 0 || !same_core(&cpus[i], &cpus[i - 1])) core++;
+
+        if (core == 0) {
+            add_cpu(&plan->ui_cpus, cpus[i].cpu);
+        } else if (core <= convert_cores) {
+            add_cpu(&plan->convert_cpus, cpus[i].cpu);
+        } else {
+            add_cpu(&plan->encoder_cpus, cpus[i].cpu);
+        }
+    }
+
+    return true;
+}
+
+// Moves the first core, which the UI keeps, and this recording's part of the other cores to the
+// front of `cpus` and returns how many CPUs that is. The parts follow each other in the order of
+// `pixels_before` and are sized by pixel count, every recording gets at least one core.
+static int take_share(Cpu *cpus, const int n_cpus, const long long pixels_before, const long long pixels, const long long total_pixels)
+{
+    int n_cores = 0;
+
+    for (int i = 0; i < n_cpus; i++) {
+        if (i == 0 || !same_core(&cpus[i], &cpus[i - 1])) n_cores++;
+    }
+
+    if (pixels >= total_pixels || n_cores < 2) return n_cpus;
+
+    const int shared_cores = n_cores - 1;
+    const int first = clamp(1 + (int)(shared_cores * pixels_before / total_pixels), 1, n_cores - 1);
+    const int last = clamp(1 + (int)(shared_cores * (pixels_before + pixels) / total_pixels), first + 1, n_cores);
+    int core = -1;
+    int n_share = 0;
+
+    for (int i = 0; i < n_cpus; i++) {
+        if (i == 0 || !same_core(&cpus[i], &cpus[i - 1])) core++;
+        if (core == 0 || (core >= first && core < last)) cpus[n_share++] = cpus[i];
+    }
+
+    return n_share;
+}
+
+void thread_plan_compute(ThreadPlan *plan, const enum ThreadMode mode, const int width, const int height)
+{
+    thread_plan_compute_share(plan, mode, width, height, 0, (long long)width * height);
+}
+
+void thread_plan_compute_share(ThreadPlan *plan, const enum ThreadMode mode, const int width, const int height, const long long pixels_before, const long long total_pixels)
+{
+    memset(plan, 0, sizeof(ThreadPlan));
+    plan->mode = mode;
+
+    Cpu *cpus = calloc(THREAD_PLAN_MAX_CPUS, sizeof(Cpu));
+    int n_cpus = cpus ? get_cpus(cpus) : 0;
+
+    // Threads that are not pinned may still run anywhere, only their number follows the share
+    for (int i = 0; i < n_cpus; i++) add_cpu(&plan->all_cpus, cpus[i].cpu);
+
+    const int quota = read_cpu_quota();
+
+    if (quota > 0 && quota < n_cpus) {
+        printf("INFO: CPU quota of the cgroup allows %d of %d CPUs\n", quota, n_cpus);
+        n_cpus = quota;
+    }
+
+    n_cpus = take_share(cpus, n_cpus, pixels_before, (long long)width * height, total_pixels);
+
+    if (mode == THREADS_FIXED) {
+        plan->encoder_threads = FIXED_THREADS;
+        plan->convert_threads = FIXED_THREADS;
+        free(cpus);
+        return;
+    }
+
+    // One CPU is left for the render loop whenever there is more than one
+    const int budget = n_cpus > 1 ? n_cpus - 1 : 1;
+    const long long pixels = (long long)width * height;
+
+    plan->encoder_threads = clamp(threads_for(pixels, ENCODER_PIXELS_PER_THREAD), 1, budget < ENCODER_MAX_THREADS ? budget : ENCODER_MAX_THREADS);
+    plan->convert_threads = clamp(threads_for(pixels, CONVERT_PIXELS_PER_THREAD), 1, budget / 2 > 1 ? budget / 2 : 1);
+
+    if (mode == THREADS_PINNED) {
+        if (split_cores(plan, cpus, n_cpus)) {
+            plan->encoder_threads = clamp(plan->encoder_threads, 1, plan->encoder_cpus.count);
+            plan->convert_threads = clamp(plan->convert_threads, 1, plan->convert_cpus.count);
+        } else {
+            printf("INFO: Not enough cores to pin threads, using %s\n", THREAD_MODE_NAMES[THREADS_AUTO]);
+            plan->mode = THREADS_AUTO;
+        }
+    }
+
+    free(cpus);
+
+    printf("INFO: %dx%d on %d CPUs: %d encoder threads, %d converter threads%s\n",
+        width, height, n_cpus, plan->encoder_threads, plan->convert_threads,
+        plan->mode == THREADS_PINNED ? ", pinned" : "");
+}
+
+bool thread_plan_pin(const CpuSet *cpus)
+{
+    if (cpus->count == 0) return true;
+
+    cpu_set_t affinity;
+    CPU_ZERO(&affinity);
+
+    for (int cpu = 0; cpu < CPU_SETSIZE && cpu < THREAD_PLAN_MAX_CPUS; cpu++) {
+        if (cpus->bits[cpu / 64] & (UINT64_C(1) << (cpu % 64))) CPU_SET(cpu, &affinity);
+    }
+
+    const int error = pthread_setaffinity_np(pthread_self(), sizeof(affinity), &affinity);
+
+    if (error != 0) {
+        fprintf(stderr, "ERROR: Unable to set the thread affinity: %s\n", strerror(error));
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,59 @@
+#ifndef THREAD_PLAN_H
+#define THREAD_PLAN_H
+
+#include <stdint.h>
+
+#define THREAD_PLAN_MAX_CPUS 1024
+
+enum ThreadMode {
+    // The old n-threads=32 / threads=32, kept to compare against
+    THREADS_FIXED,
+    // Sized from the usable cores and the capture resolution
+    THREADS_AUTO,
+    // Like THREADS_AUTO, with the UI, converter and encoder on separate cores
+    THREADS_PINNED,
+
+    THREAD_MODE_COUNT
+};
+
+extern const char * const THREAD_MODE_NAMES[];
+
+typedef struct {
+    uint64_t bits[THREAD_PLAN_MAX_CPUS / 64];
+    int count;
+} CpuSet;
+
+typedef struct {
+    enum ThreadMode mode;
+    int encoder_threads;
+    int convert_threads;
+
+    // Every CPU the process may use
+    CpuSet all_cpus;
+
+    // Only filled in for THREADS_PINNED
+    CpuSet ui_cpus;
+    CpuSet convert_cpus;
+    CpuSet encoder_cpus;
+} ThreadPlan;
+
+// Looks up a mode by its name in THREAD_MODE_NAMES
+bool parse_thread_mode(const char *name, enum ThreadMode *mode);
+
+// Counts the CPUs this process may run on, so taskset and cpuset limits are respected, capped by
+// the cgroup v2 cpu.max quota. Hyperthread siblings are kept in the same set when pinning, and the
+// UI always keeps a core to itself. Falls back to THREADS_AUTO when there are fewer than three
+// cores to split.
+void thread_plan_compute(ThreadPlan *plan, enum ThreadMode mode, int width, int height);
+
+// Like thread_plan_compute() for one of several recordings running at once, which split the cores
+// after the UI one by pixel count: this one gets its `width` x `height` share of `total_pixels`,
+// after the cores of the recordings that add up to `pixels_before`. Pinned sets do not overlap as
+// long as there are cores enough.
+void thread_plan_compute_share(ThreadPlan *plan, enum ThreadMode mode, int width, int height, long long pixels_before, long long total_pixels);
+
+// Restricts the calling thread, and every thread it starts from now on, to `cpus`. An empty set
+// leaves the affinity alone.
+bool thread_plan_pin(const CpuSet *cpus);
+
+#endif
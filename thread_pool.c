@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "thread_pool.h"
+
+typedef struct {
+    ThreadPool *pool;
+    int index;
+} ThreadPoolWorker;
+
+struct ThreadPool {
+    int n_threads;
+    pthread_t *threads;
+    ThreadPoolWorker *workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+
+    ThreadPoolTask task;
+    void *context;
+    int n_tasks;
+    atomic_int next_task;
+
+    uint64_t generation;
+    int busy_workers;
+    bool shutting_down;
+};
+
+static void run_tasks(ThreadPool *pool, const int worker_index)
+{
+    int task_index;
+
+    while ((task_index = atomic_fetch_add(&pool->next_task, 1)) < pool->n_tasks) {
+        pool->task(pool->context, task_index, worker_index);
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    const ThreadPoolWorker *worker = arg;
+    ThreadPool *pool = worker->pool;
+    uint64_t seen_generation = 0;
+
+    while (true) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->shutting_down && pool->generation == seen_generation) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+
+        if (pool->shutting_down) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+
+        seen_generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_tasks(pool, worker->index);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy_workers == 0) {
+            pthread_cond_signal(&pool->work_done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return nullptr;
+}
+
+ThreadPool *thread_pool_new(int n_threads)
+{
+    if (n_threads < 1) n_threads = 1;
+
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    if (pool == NULL) {
+        return nullptr;
+    }
+
+    pool->n_threads = n_threads;
+    pool->threads = calloc((size_t)n_threads, sizeof(pthread_t));
+    pool->workers = calloc((size_t)n_threads, sizeof(ThreadPoolWorker));
+
+    if (pool->threads == NULL || pool->workers == NULL) {
+        free(pool->threads);
+        free(pool->workers);
+        free(pool);
+        return nullptr;
+    }
+
+    pthread_mutex_init(&pool->lock, nullptr);
+    pthread_cond_init(&pool->work_ready, nullptr);
+    pthread_cond_init(&pool->work_done, nullptr);
+
+    // Worker 0 is the caller of thread_pool_run(), only spawn the rest
+    for (int i = 1; i < n_threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+
+        if (pthread_create(&pool->threads[i], nullptr, worker_main, &pool->workers[i]) != 0) {
+            fprintf(stderr, "ERROR: Unable to start thread pool worker %d\n", i);
+            pool->n_threads = i;
+            break;
+        }
+    }
+
+    return pool;
+}
+
+void thread_pool_run(ThreadPool *pool, const int n_tasks, const ThreadPoolTask task, void *context)
+{
+    if (n_tasks <= 0) return;
+
+    pool->task = task;
+    pool->context = context;
+    pool->n_tasks = n_tasks;
+    atomic_store(&pool->next_task, 0);
+
+    // Not worth waking anyone up for a single task
+    if (n_tasks == 1 || pool->n_threads == 1) {
+        run_tasks(pool, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->busy_workers = pool->n_threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_tasks(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy_workers > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int thread_pool_size(const ThreadPool *pool)
+{
+    return pool->n_threads;
+}
+
+void thread_pool_free(ThreadPool *pool)
+{
+    if (pool == NULL) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutting_down = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 1; i < pool->n_threads; i++) {
+        pthread_join(pool->threads[i], nullptr);
+    }
+
+    pthread_cond_destroy(&pool->work_done);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_mutex_destroy(&pool->lock);
+
+    free(pool->workers);
+    free(pool->threads);
+    free(pool);
+}
@@ -0,0 +1,20 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// Task callback. `task_index` is in [0, n_tasks), `worker_index` in [0, thread_pool_size()).
+// Worker 0 is always the thread that called thread_pool_run().
+typedef void (*ThreadPoolTask)(void *context, int task_index, int worker_index);
+
+typedef struct ThreadPool ThreadPool;
+
+// Creates a pool of `n_threads` workers, including the calling thread.
+ThreadPool *thread_pool_new(int n_threads);
+
+// Runs `task` for every index in [0, n_tasks) and returns when all of them are done.
+void thread_pool_run(ThreadPool *pool, int n_tasks, ThreadPoolTask task, void *context);
+
+int thread_pool_size(const ThreadPool *pool);
+
+void thread_pool_free(ThreadPool *pool);
+
+#endif